@@ -0,0 +1,1106 @@
+//
+//  btree.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_btree_h
+#define AlgoAndData_data_btree_h
+
+#include "pool_allocator.h"
+
+#include <utility>
+#include <memory>
+#include <tuple>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <type_traits>
+#include <stdexcept>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // B+ Tree
+    //
+    // Generalization of the 2-3 tree (lab::twothree_tree) to wide nodes of NodeSize bytes (256 by default):
+    // dozens of values per node make the tree a few levels high, and every level is a single cache miss.
+    // Values live in the leaves only, the internal nodes hold separator keys; leaves are linked,
+    // so iteration and range scans walk the leaf level without going back up.
+    //
+    // Search: O(log N)
+    // Insert: O(log N)
+    // Delete: O(log N)
+    // Space: O(n)
+    //
+    
+    // Items fitting into 'available' bytes, one of them is the temporary overflow slot (split pending)
+    constexpr int btree_node_capacity(std::size_t available, std::size_t itemSize) {
+        return available / itemSize > 4 ? static_cast<int>(available / itemSize) - 1 : 3;
+    }
+    
+    /// Leaf and internal nodes
+    template<typename Key, typename Value, std::size_t NodeSize>
+    struct Btree_node_types {
+        struct Internal_node;
+        
+        struct Node_base {
+            Internal_node* parent;
+            int count; // values of a leaf, keys of an internal node
+            bool leaf;
+        };
+        
+        using Value_slot = typename std::aligned_storage<sizeof(Value), alignof(Value)>::type;
+        using Key_slot = typename std::aligned_storage<sizeof(Key), alignof(Key)>::type;
+        
+        static const std::size_t LeafHeaderSize = sizeof(Node_base) + sizeof(void*);
+        static const std::size_t InternalHeaderSize = sizeof(Node_base) + sizeof(void*);
+        
+        static_assert(NodeSize >= 64, "Node size is too small");
+        
+        static const int LeafCapacity = btree_node_capacity(NodeSize - LeafHeaderSize, sizeof(Value_slot));
+        static const int InternalCapacity = btree_node_capacity(NodeSize - InternalHeaderSize, sizeof(Key_slot) + sizeof(void*));
+        
+        struct Leaf_node : Node_base {
+            Leaf_node* next;
+            Value_slot values[LeafCapacity + 1];
+            
+            Value& value(int valueIdx) noexcept {
+                return *reinterpret_cast<Value*>(values + valueIdx);
+            }
+            const Value& value(int valueIdx) const noexcept {
+                return *reinterpret_cast<const Value*>(values + valueIdx);
+            }
+        };
+        
+        struct Internal_node : Node_base {
+            Key_slot keys[InternalCapacity + 1];
+            Node_base* children[InternalCapacity + 2];
+            
+            Key& key(int keyIdx) noexcept {
+                return *reinterpret_cast<Key*>(keys + keyIdx);
+            }
+            const Key& key(int keyIdx) const noexcept {
+                return *reinterpret_cast<const Key*>(keys + keyIdx);
+            }
+        };
+    };
+    
+    ///// Iterators
+    /// Base class for leaf iterators.
+    template<typename Value, typename leaf_type>
+    struct Btree_iterator_base
+    {
+        Value& operator*() const {
+            return *reinterpret_cast<Value*>(current->values + valueIdx);
+        }
+        
+        Value* operator->() const {
+            return reinterpret_cast<Value*>(current->values + valueIdx);
+        }
+        
+        leaf_type* current;
+        int valueIdx;
+    
+    protected:
+        Btree_iterator_base(leaf_type* curLeaf, int valueIdx)
+        : current(curLeaf), valueIdx(valueIdx) {}
+        
+        void incr() noexcept {
+            if (current == nullptr)
+                return;
+            
+            if (++valueIdx == current->count) {
+                // Linked leaves, no way up is needed
+                current = current->next;
+                valueIdx = 0;
+            }
+        }
+    };
+    
+    // Iterators and const_iterators are comparable
+    template<typename Value1, typename Value2, typename leaf_type>
+    inline bool
+    operator==(const Btree_iterator_base<Value1, leaf_type>& x,
+               const Btree_iterator_base<Value2, leaf_type>& y)
+    { return x.current == y.current && x.valueIdx == y.valueIdx; }
+    
+    template<typename Value1, typename Value2, typename leaf_type>
+    inline bool
+    operator!=(const Btree_iterator_base<Value1, leaf_type>& x,
+               const Btree_iterator_base<Value2, leaf_type>& y)
+    { return x.current != y.current || x.valueIdx != y.valueIdx; }
+    
+    /// Leaf iterators, used to iterate through all the tree.
+    template<typename Value, typename leaf_type>
+    struct Btree_iterator : public Btree_iterator_base<Value, leaf_type>
+    {
+    private:
+        using base_type = Btree_iterator_base<Value, leaf_type>;
+    
+    public:
+        using value_type = typename std::remove_const<Value>::type;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+        
+        using pointer = Value*;
+        using reference = Value&;
+        
+        Btree_iterator(leaf_type* curLeaf, int valueIdx) :
+            base_type(curLeaf, valueIdx) {}
+        
+        Btree_iterator&
+        operator++() {
+            this->incr();
+            return *this;
+        }
+        
+        Btree_iterator
+        operator++(int) {
+            Btree_iterator tmp(*this);
+            this->incr();
+            return tmp;
+        }
+    };
+    
+    template<typename Value, typename leaf_type>
+    struct Btree_const_iterator : public Btree_iterator_base<const Value, leaf_type>
+    {
+    private:
+        using base_type = Btree_iterator_base<const Value, leaf_type>;
+    
+    public:
+        using value_type = Value;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+        
+        using pointer = const Value*;
+        using reference = const Value&;
+        
+        Btree_const_iterator(leaf_type* curLeaf, int valueIdx) :
+            base_type(curLeaf, valueIdx) {}
+        
+        template<typename Other_value>
+        Btree_const_iterator(const Btree_iterator<Other_value, leaf_type>& other) :
+            base_type(other.current, other.valueIdx)
+        {}
+        
+        Btree_const_iterator&
+        operator++() {
+            this->incr();
+            return *this;
+        }
+        
+        Btree_const_iterator
+        operator++(int) {
+            Btree_const_iterator tmp(*this);
+            this->incr();
+            return tmp;
+        }
+    };
+    ///// Iterators
+    
+    //
+    // The tree itself, shared by btree_set and btree_map
+    // Params: key_type, value_type, stored_type (value_type without const key), iterator_value,
+    // key_compare, allocator_type, node_size and get_key(stored_type / value_type)
+    //
+    template<typename Params>
+    class btree {
+    protected:
+        using stored_type = typename Params::stored_type;
+        using Node_types = Btree_node_types<typename Params::key_type, stored_type, Params::node_size>;
+        using Node_base = typename Node_types::Node_base;
+        using Leaf_node = typename Node_types::Leaf_node;
+        using Internal_node = typename Node_types::Internal_node;
+        
+        using Leaf_allocator_type = typename Params::allocator_type::template rebind<Leaf_node>::other;
+        using Internal_allocator_type = typename Params::allocator_type::template rebind<Internal_node>::other;
+        
+        static const int LeafCapacity = Node_types::LeafCapacity;
+        static const int InternalCapacity = Node_types::InternalCapacity;
+        static const int MinLeafCount = LeafCapacity / 2;
+        static const int MinInternalCount = InternalCapacity / 2;
+    
+    public:
+        using key_type = typename Params::key_type;
+        using value_type = typename Params::value_type;
+        using key_compare = typename Params::key_compare;
+        using allocator_type = typename Params::allocator_type;
+        using size_type = std::size_t;
+        
+        using iterator = Btree_iterator<typename Params::iterator_value, Leaf_node>;
+        using const_iterator = Btree_const_iterator<value_type, Leaf_node>;
+        
+        // Values per leaf and keys per internal node
+        static const int leaf_capacity = LeafCapacity;
+        static const int internal_capacity = InternalCapacity;
+        
+        // .ctors
+        
+        explicit btree(const key_compare& compare = key_compare(), const allocator_type& alloc = allocator_type())
+            : rootNode(nullptr), elementsCount(0), compare(compare),
+              leafAllocator(alloc), internalAllocator(alloc) {}
+        
+        btree(const btree& other)
+            : rootNode(nullptr), elementsCount(0), compare(other.compare),
+              leafAllocator(std::allocator_traits<Leaf_allocator_type>::select_on_container_copy_construction(other.leafAllocator)),
+              internalAllocator(leafAllocator)
+        {
+            try {
+                for (const auto& value : other) {
+                    emplaceUnique(Params::get_key(value), value);
+                }
+            } catch(...) {
+                clear();
+                throw;
+            }
+        }
+        
+        // The allocators are moved: the moved-from tree doesn't share the pool, a pool_allocator gets a new one
+        // on its first allocation (see allocateInternal)
+        btree(btree&& other) noexcept
+            : rootNode(other.rootNode), elementsCount(other.elementsCount), compare(std::move(other.compare)),
+              leafAllocator(std::move(other.leafAllocator)), internalAllocator(std::move(other.internalAllocator))
+        {
+            other.rootNode = nullptr;
+            other.elementsCount = 0;
+        }
+        
+        btree& operator=(btree other) noexcept {
+            swap(other);
+            return *this;
+        }
+        
+        ~btree() {
+            clear();
+        }
+        
+        void swap(btree& other) noexcept {
+            using std::swap;
+            swap(rootNode, other.rootNode);
+            swap(elementsCount, other.elementsCount);
+            swap(compare, other.compare);
+            swap(leafAllocator, other.leafAllocator);
+            swap(internalAllocator, other.internalAllocator);
+        }
+        
+        // Lookup
+        
+        iterator find(const key_type& key) {
+            Leaf_node* leaf = nullptr;
+            int valueIdx = findValue(key, leaf);
+            return valueIdx == -1 ? end() : iterator(leaf, valueIdx);
+        }
+        const_iterator find(const key_type& key) const {
+            Leaf_node* leaf = nullptr;
+            int valueIdx = findValue(key, leaf);
+            return valueIdx == -1 ? end() : const_iterator(leaf, valueIdx);
+        }
+        
+        size_type count(const key_type& key) const {
+            Leaf_node* leaf = nullptr;
+            return findValue(key, leaf) == -1 ? 0 : 1;
+        }
+        
+        bool contains(const key_type& key) const {
+            return count(key) == 1;
+        }
+        
+        // First element not less than the key
+        iterator lower_bound(const key_type& key) {
+            return makeIterator<iterator>(lowerBound(key));
+        }
+        const_iterator lower_bound(const key_type& key) const {
+            return makeIterator<const_iterator>(lowerBound(key));
+        }
+        
+        // First element greater than the key
+        iterator upper_bound(const key_type& key) {
+            return makeIterator<iterator>(upperBound(key));
+        }
+        const_iterator upper_bound(const key_type& key) const {
+            return makeIterator<const_iterator>(upperBound(key));
+        }
+        
+        // Modifiers
+        
+        void erase(const_iterator pos) {
+            if (pos.current != nullptr)
+                eraseImpl(pos.current, pos.valueIdx);
+        }
+        
+        // Returns: Number of elements removed.
+        size_type erase(const key_type& key) {
+            Leaf_node* leaf = nullptr;
+            int valueIdx = findValue(key, leaf);
+            
+            if (valueIdx == -1) {
+                // An element with provided key isn't found to erase
+                return 0;
+            }
+            
+            eraseImpl(leaf, valueIdx);
+            return 1;
+        }
+        
+        void clear() noexcept {
+            if (rootNode != nullptr)
+                disposeSubtree(rootNode, true);
+            
+            rootNode = nullptr;
+            elementsCount = 0;
+        }
+        
+        //
+        // Fast clear: with a releasable allocator (pool_allocator) the nodes aren't freed one by one,
+        // the allocator drops all of them at once. Nodes aren't even visited if the values are trivially destructible.
+        // Falls back to clear() if the pool is shared with other containers or the nodes are too large for its slabs.
+        //
+        void release_all() noexcept {
+            releaseAllImpl(is_releasable_allocator<Leaf_allocator_type>{});
+        }
+        
+        // Capacity
+        
+        bool empty() const noexcept {
+            return rootNode == nullptr;
+        }
+        
+        size_type size() const noexcept {
+            return elementsCount;
+        }
+        
+        // Iterators
+        
+        iterator begin() noexcept {
+            return iterator(getFirstLeaf(), 0);
+        }
+        
+        const_iterator begin() const noexcept {
+            return const_iterator(getFirstLeaf(), 0);
+        }
+        
+        iterator end() noexcept {
+            return iterator(nullptr, 0);
+        }
+        
+        const_iterator end() const noexcept {
+            return const_iterator(nullptr, 0);
+        }
+        
+        const_iterator cbegin() const noexcept {
+            return begin();
+        }
+        
+        const_iterator cend() const noexcept {
+            return end();
+        }
+    
+    protected:
+        Node_base* rootNode;
+        size_type elementsCount;
+        key_compare compare;
+        Leaf_allocator_type leafAllocator;
+        Internal_allocator_type internalAllocator;
+        
+        static const key_type& getKey(const Leaf_node* leaf, int valueIdx) noexcept {
+            return Params::get_key(leaf->value(valueIdx));
+        }
+        
+        //
+        // Inserts a value constructed from 'args' if there's no element with the key
+        // Returns a pair consisting of an iterator to the inserted element (or to the element that prevented the insertion) and a bool denoting whether the insertion took place.
+        //
+        template<typename... Args>
+        std::pair<iterator, bool> emplaceUnique(const key_type& key, Args&&... args) {
+            if (rootNode == nullptr) {
+                Leaf_node* leaf = allocateLeaf();
+                try {
+                    constructValue(leaf, 0, std::forward<Args>(args)...);
+                } catch(...) {
+                    deallocateLeaf(leaf);
+                    throw;
+                }
+                leaf->count = 1;
+                rootNode = leaf;
+                elementsCount = 1;
+                return std::make_pair(iterator(leaf, 0), true);
+            }
+            
+            Leaf_node* leaf = findLeaf(key);
+            int valueIdx = leafLowerBound(leaf, key);
+            
+            if (valueIdx < leaf->count && !compare(key, getKey(leaf, valueIdx)))
+                return std::make_pair(iterator(leaf, valueIdx), false);
+            
+            return std::make_pair(insertIntoLeaf(leaf, valueIdx, std::forward<Args>(args)...), true);
+        }
+    
+    private:
+        /// Nodes allocation
+        
+        Leaf_node* allocateLeaf() {
+            Leaf_node* leaf = leafAllocator.allocate(1);
+            leaf->parent = nullptr;
+            leaf->count = 0;
+            leaf->leaf = true;
+            leaf->next = nullptr;
+            return leaf;
+        }
+        
+        // A leaf is always allocated first: after a move the internal allocator takes the pool the leaf one has created
+        Internal_node* allocateInternal() {
+            if (internalAllocator != leafAllocator)
+                internalAllocator = Internal_allocator_type(leafAllocator);
+            Internal_node* node = internalAllocator.allocate(1);
+            node->parent = nullptr;
+            node->count = 0;
+            node->leaf = false;
+            return node;
+        }
+        
+        // The node's values or keys must have been destroyed already
+        void deallocateLeaf(Leaf_node* leaf) noexcept {
+            leafAllocator.deallocate(leaf, 1);
+        }
+        
+        void deallocateInternal(Internal_node* node) noexcept {
+            internalAllocator.deallocate(node, 1);
+        }
+        
+        static Leaf_node* asLeaf(Node_base* node) noexcept {
+            assert(node->leaf);
+            return static_cast<Leaf_node*>(node);
+        }
+        
+        static Internal_node* asInternal(Node_base* node) noexcept {
+            assert(!node->leaf);
+            return static_cast<Internal_node*>(node);
+        }
+        
+        /// Values and keys in the raw node slots
+        
+        template<typename... Args>
+        static void constructValue(Leaf_node* leaf, int valueIdx, Args&&... args) {
+            ::new (static_cast<void*>(leaf->values + valueIdx)) stored_type(std::forward<Args>(args)...);
+        }
+        
+        // Moves the value to the empty slot 'to', the slot 'from' becomes empty
+        static void relocateValue(Leaf_node* to, int toIdx, Leaf_node* from, int fromIdx) {
+            constructValue(to, toIdx, std::move(from->value(fromIdx)));
+            from->value(fromIdx).~stored_type();
+        }
+        
+        template<typename... Args>
+        static void constructKey(Internal_node* node, int keyIdx, Args&&... args) {
+            ::new (static_cast<void*>(node->keys + keyIdx)) key_type(std::forward<Args>(args)...);
+        }
+        
+        static void relocateKey(Internal_node* to, int toIdx, Internal_node* from, int fromIdx) {
+            constructKey(to, toIdx, std::move(from->key(fromIdx)));
+            from->key(fromIdx).~key_type();
+        }
+        
+        static void setChild(Internal_node* node, int childIdx, Node_base* child) noexcept {
+            node->children[childIdx] = child;
+            child->parent = node;
+        }
+        
+        static int getChildIdx(const Internal_node* node, const Node_base* child) noexcept {
+            for (int i = 0; i <= node->count; ++i) {
+                if (node->children[i] == child)
+                    return i;
+            }
+            assert(false);
+            return -1;
+        }
+        
+        /// Search
+        
+        // Index of the first value not less than the key, or the values count
+        int leafLowerBound(const Leaf_node* leaf, const key_type& key) const {
+            int first = 0;
+            int count = leaf->count;
+            
+            while (count > 0) {
+                int half = count / 2;
+                if (compare(getKey(leaf, first + half), key)) {
+                    first += half + 1;
+                    count -= half + 1;
+                } else {
+                    count = half;
+                }
+            }
+            return first;
+        }
+        
+        // Index of the first value greater than the key, or the values count
+        int leafUpperBound(const Leaf_node* leaf, const key_type& key) const {
+            int first = 0;
+            int count = leaf->count;
+            
+            while (count > 0) {
+                int half = count / 2;
+                if (!compare(key, getKey(leaf, first + half))) {
+                    first += half + 1;
+                    count -= half + 1;
+                } else {
+                    count = half;
+                }
+            }
+            return first;
+        }
+        
+        // Child subtree of the key: children[i] < keys[i] <= children[i+1]
+        int chooseChildIdx(const Internal_node* node, const key_type& key) const {
+            const key_type* keys = &node->key(0);
+            return static_cast<int>(std::upper_bound(keys, keys + node->count, key, compare) - keys);
+        }
+        
+        Leaf_node* findLeaf(const key_type& key) const {
+            Node_base* node = rootNode;
+            
+            while (!node->leaf) {
+                Internal_node* internal = asInternal(node);
+                node = internal->children[chooseChildIdx(internal, key)];
+            }
+            return asLeaf(node);
+        }
+        
+        // Returns the value index (and its leaf) or -1
+        int findValue(const key_type& key, Leaf_node*& leaf) const {
+            if (rootNode == nullptr)
+                return -1;
+            
+            leaf = findLeaf(key);
+            int valueIdx = leafLowerBound(leaf, key);
+            
+            if (valueIdx < leaf->count && !compare(key, getKey(leaf, valueIdx)))
+                return valueIdx;
+            return -1;
+        }
+        
+        std::pair<Leaf_node*, int> lowerBound(const key_type& key) const {
+            if (rootNode == nullptr)
+                return std::make_pair(nullptr, 0);
+            
+            Leaf_node* leaf = findLeaf(key);
+            return std::make_pair(leaf, leafLowerBound(leaf, key));
+        }
+        
+        std::pair<Leaf_node*, int> upperBound(const key_type& key) const {
+            if (rootNode == nullptr)
+                return std::make_pair(nullptr, 0);
+            
+            Leaf_node* leaf = findLeaf(key);
+            return std::make_pair(leaf, leafUpperBound(leaf, key));
+        }
+        
+        // A position past the last value of a leaf is the first value of the next one
+        template<typename Iterator>
+        static Iterator makeIterator(std::pair<Leaf_node*, int> position) noexcept {
+            if (position.first != nullptr && position.second == position.first->count)
+                return Iterator(position.first->next, 0);
+            return Iterator(position.first, position.second);
+        }
+        
+        Leaf_node* getFirstLeaf() const noexcept {
+            Node_base* node = rootNode;
+            if (node == nullptr)
+                return nullptr;
+            
+            while (!node->leaf) {
+                node = asInternal(node)->children[0];
+            }
+            return asLeaf(node);
+        }
+        
+        /// Insertion
+        
+        template<typename... Args>
+        iterator insertIntoLeaf(Leaf_node* leaf, int valueIdx, Args&&... args) {
+            // The split's new leaf is allocated upfront: nothing to undo if it throws
+            Leaf_node* newLeaf = leaf->count == LeafCapacity ? allocateLeaf() : nullptr;
+            
+            // Shifting values to insert the new value
+            for (int i = leaf->count; i > valueIdx; --i) {
+                relocateValue(leaf, i, leaf, i - 1);
+            }
+            
+            try {
+                constructValue(leaf, valueIdx, std::forward<Args>(args)...);
+            } catch(...) {
+                for (int i = valueIdx; i < leaf->count; ++i) {
+                    relocateValue(leaf, i, leaf, i + 1);
+                }
+                if (newLeaf)
+                    deallocateLeaf(newLeaf);
+                throw;
+            }
+            
+            ++leaf->count;
+            ++elementsCount;
+            
+            if (newLeaf == nullptr)
+                return iterator(leaf, valueIdx);
+            
+            // Overflow: the upper half goes to the new right sibling
+            int leftCount = leaf->count / 2;
+            for (int i = leftCount; i < leaf->count; ++i) {
+                relocateValue(newLeaf, i - leftCount, leaf, i);
+            }
+            newLeaf->count = leaf->count - leftCount;
+            leaf->count = leftCount;
+            
+            newLeaf->next = leaf->next;
+            leaf->next = newLeaf;
+            
+            insertIntoParent(leaf, getKey(newLeaf, 0), newLeaf);
+            
+            if (valueIdx < leftCount)
+                return iterator(leaf, valueIdx);
+            return iterator(newLeaf, valueIdx - leftCount);
+        }
+        
+        // Adds the separator and the new right sibling of 'left' to the parent, splitting overflowed parents up to the root
+        void insertIntoParent(Node_base* left, const key_type& separator, Node_base* right) {
+            key_type upKey = separator;
+            
+            while (true) {
+                Internal_node* parent = left->parent;
+                
+                if (parent == nullptr) {
+                    // Tree height increment
+                    Internal_node* newRoot = allocateInternal();
+                    constructKey(newRoot, 0, std::move(upKey));
+                    setChild(newRoot, 0, left);
+                    setChild(newRoot, 1, right);
+                    newRoot->count = 1;
+                    rootNode = newRoot;
+                    return;
+                }
+                
+                int childIdx = getChildIdx(parent, left);
+                for (int i = parent->count; i > childIdx; --i) {
+                    relocateKey(parent, i, parent, i - 1);
+                    parent->children[i + 1] = parent->children[i];
+                }
+                constructKey(parent, childIdx, std::move(upKey));
+                setChild(parent, childIdx + 1, right);
+                ++parent->count;
+                
+                if (parent->count <= InternalCapacity)
+                    return;
+                
+                // Overflow: the middle key goes up, the keys after it go to the new right sibling
+                Internal_node* newNode = allocateInternal();
+                int middleIdx = parent->count / 2;
+                
+                for (int i = middleIdx + 1; i < parent->count; ++i) {
+                    relocateKey(newNode, i - middleIdx - 1, parent, i);
+                }
+                for (int i = middleIdx + 1; i <= parent->count; ++i) {
+                    setChild(newNode, i - middleIdx - 1, parent->children[i]);
+                }
+                newNode->count = parent->count - middleIdx - 1;
+                
+                upKey = std::move(parent->key(middleIdx));
+                parent->key(middleIdx).~key_type();
+                parent->count = middleIdx;
+                
+                left = parent;
+                right = newNode;
+            }
+        }
+        
+        /// Removal
+        
+        void eraseImpl(Leaf_node* leaf, int valueIdx) {
+            leaf->value(valueIdx).~stored_type();
+            for (int i = valueIdx + 1; i < leaf->count; ++i) {
+                relocateValue(leaf, i - 1, leaf, i);
+            }
+            --leaf->count;
+            --elementsCount;
+            
+            if (leaf == rootNode) {
+                if (leaf->count == 0) {
+                    // root node removed
+                    deallocateLeaf(leaf);
+                    rootNode = nullptr;
+                }
+                return;
+            }
+            
+            // Separators stay valid after a removal, only the underflow is fixed
+            if (leaf->count < MinLeafCount)
+                fixLeafUnderflow(leaf);
+        }
+        
+        // Borrows a value from a sibling or merges with it
+        void fixLeafUnderflow(Leaf_node* leaf) {
+            Internal_node* parent = leaf->parent;
+            int idxInParent = getChildIdx(parent, leaf);
+            Leaf_node* left = idxInParent > 0 ? asLeaf(parent->children[idxInParent - 1]) : nullptr;
+            Leaf_node* right = idxInParent < parent->count ? asLeaf(parent->children[idxInParent + 1]) : nullptr;
+            
+            if (left && left->count > MinLeafCount) {
+                for (int i = leaf->count; i > 0; --i) {
+                    relocateValue(leaf, i, leaf, i - 1);
+                }
+                relocateValue(leaf, 0, left, left->count - 1);
+                --left->count;
+                ++leaf->count;
+                
+                parent->key(idxInParent - 1) = getKey(leaf, 0);
+            } else if (right && right->count > MinLeafCount) {
+                relocateValue(leaf, leaf->count, right, 0);
+                for (int i = 1; i < right->count; ++i) {
+                    relocateValue(right, i - 1, right, i);
+                }
+                --right->count;
+                ++leaf->count;
+                
+                parent->key(idxInParent) = getKey(right, 0);
+            } else if (left) {
+                mergeLeaves(left, leaf, idxInParent - 1);
+            } else {
+                mergeLeaves(leaf, right, idxInParent);
+            }
+        }
+        
+        // Moves all the values of 'right' to 'left', removes 'right' and the separator between them
+        void mergeLeaves(Leaf_node* left, Leaf_node* right, int separatorIdx) {
+            for (int i = 0; i < right->count; ++i) {
+                relocateValue(left, left->count + i, right, i);
+            }
+            left->count += right->count;
+            left->next = right->next;
+            
+            Internal_node* parent = left->parent;
+            removeFromInternal(parent, separatorIdx);
+            deallocateLeaf(right);
+            
+            fixInternalUnderflow(parent);
+        }
+        
+        // Removes the key and the child on its right
+        static void removeFromInternal(Internal_node* node, int keyIdx) {
+            node->key(keyIdx).~key_type();
+            for (int i = keyIdx + 1; i < node->count; ++i) {
+                relocateKey(node, i - 1, node, i);
+            }
+            for (int i = keyIdx + 2; i <= node->count; ++i) {
+                node->children[i - 1] = node->children[i];
+            }
+            --node->count;
+        }
+        
+        void fixInternalUnderflow(Internal_node* node) {
+            while (true) {
+                if (node == rootNode) {
+                    if (node->count == 0) {
+                        // eliminate the empty root (tree height decrement)
+                        rootNode = node->children[0];
+                        rootNode->parent = nullptr;
+                        deallocateInternal(node);
+                    }
+                    return;
+                }
+                
+                if (node->count >= MinInternalCount)
+                    return;
+                
+                Internal_node* parent = node->parent;
+                int idxInParent = getChildIdx(parent, node);
+                Internal_node* left = idxInParent > 0 ? asInternal(parent->children[idxInParent - 1]) : nullptr;
+                Internal_node* right = idxInParent < parent->count ? asInternal(parent->children[idxInParent + 1]) : nullptr;
+                
+                if (left && left->count > MinInternalCount) {
+                    // Rotation right through the parent's separator
+                    for (int i = node->count; i > 0; --i) {
+                        relocateKey(node, i, node, i - 1);
+                    }
+                    for (int i = node->count + 1; i > 0; --i) {
+                        node->children[i] = node->children[i - 1];
+                    }
+                    relocateKey(node, 0, parent, idxInParent - 1);
+                    setChild(node, 0, left->children[left->count]);
+                    relocateKey(parent, idxInParent - 1, left, left->count - 1);
+                    --left->count;
+                    ++node->count;
+                    return;
+                }
+                
+                if (right && right->count > MinInternalCount) {
+                    // Rotation left through the parent's separator
+                    relocateKey(node, node->count, parent, idxInParent);
+                    setChild(node, node->count + 1, right->children[0]);
+                    relocateKey(parent, idxInParent, right, 0);
+                    for (int i = 1; i < right->count; ++i) {
+                        relocateKey(right, i - 1, right, i);
+                    }
+                    for (int i = 1; i <= right->count; ++i) {
+                        right->children[i - 1] = right->children[i];
+                    }
+                    --right->count;
+                    ++node->count;
+                    return;
+                }
+                
+                if (left)
+                    mergeInternals(left, node, idxInParent - 1);
+                else
+                    mergeInternals(node, right, idxInParent);
+                
+                node = parent;
+            }
+        }
+        
+        // The separator goes down between the keys of 'left' and 'right', 'right' is removed
+        void mergeInternals(Internal_node* left, Internal_node* right, int separatorIdx) {
+            Internal_node* parent = left->parent;
+            
+            constructKey(left, left->count, std::move(parent->key(separatorIdx)));
+            for (int i = 0; i < right->count; ++i) {
+                relocateKey(left, left->count + 1 + i, right, i);
+            }
+            for (int i = 0; i <= right->count; ++i) {
+                setChild(left, left->count + 1 + i, right->children[i]);
+            }
+            left->count += right->count + 1;
+            
+            removeFromInternal(parent, separatorIdx);
+            deallocateInternal(right);
+        }
+        
+        /// Disposal
+        
+        // Destroys the values and keys of the subtree, frees its nodes too if 'deallocate' is set
+        void disposeSubtree(Node_base* node, bool deallocate) noexcept {
+            if (node->leaf) {
+                Leaf_node* leaf = asLeaf(node);
+                for (int i = 0; i < leaf->count; ++i) {
+                    leaf->value(i).~stored_type();
+                }
+                if (deallocate)
+                    deallocateLeaf(leaf);
+                return;
+            }
+            
+            // The height is logarithmic with a large base, recursion is shallow
+            Internal_node* internal = asInternal(node);
+            for (int i = 0; i <= internal->count; ++i) {
+                disposeSubtree(internal->children[i], deallocate);
+            }
+            for (int i = 0; i < internal->count; ++i) {
+                internal->key(i).~key_type();
+            }
+            if (deallocate)
+                deallocateInternal(internal);
+        }
+        
+        // The leaf and internal allocators share one pool (the internal one may have none yet after a move):
+        // it's the tree's own if no other allocator uses it.
+        // Nodes larger than memory_pool::MaxBlockSize aren't in the slabs, release() would leak them.
+        void releaseAllImpl(std::true_type) noexcept {
+            if (leafAllocator.pool_use_count() > (leafAllocator == internalAllocator ? 2 : 1) ||
+                sizeof(Leaf_node) > memory_pool::MaxBlockSize || sizeof(Internal_node) > memory_pool::MaxBlockSize) {
+                clear(); // other containers' blocks are in the pool too, or the nodes are freed one by one anyway
+                return;
+            }
+            
+            if (rootNode != nullptr &&
+                !(std::is_trivially_destructible<stored_type>::value && std::is_trivially_destructible<key_type>::value))
+                disposeSubtree(rootNode, false);
+            
+            rootNode = nullptr;
+            elementsCount = 0;
+            leafAllocator.release();
+            internalAllocator.release(); // no-op: the pool is already released, or there's none
+        }
+        
+        void releaseAllImpl(std::false_type) noexcept {
+            clear();
+        }
+    };
+    
+    template<typename Key, typename Compare, typename Allocator, std::size_t NodeSize>
+    struct btree_set_params {
+        using key_type = Key;
+        using value_type = Key;
+        using stored_type = Key;
+        using iterator_value = const Key; // keys of a set aren't modifiable
+        using key_compare = Compare;
+        using allocator_type = Allocator;
+        static const std::size_t node_size = NodeSize;
+        
+        static const Key& get_key(const Key& value) noexcept {
+            return value;
+        }
+    };
+    
+    template<typename Key, typename T, typename Compare, typename Allocator, std::size_t NodeSize>
+    struct btree_map_params {
+        using key_type = Key;
+        using value_type = std::pair<const Key, T>;
+        using stored_type = std::pair<Key, T>; // keys are moved between the nodes
+        using iterator_value = value_type;
+        using key_compare = Compare;
+        using allocator_type = Allocator;
+        static const std::size_t node_size = NodeSize;
+        
+        static const Key& get_key(const stored_type& value) noexcept {
+            return value.first;
+        }
+        static const Key& get_key(const value_type& value) noexcept {
+            return value.first;
+        }
+    };
+    
+    //
+    // Ordered set of unique keys, same API as lab::twothree_tree
+    //
+    template<
+        typename Key,
+        typename Compare = std::less<Key>,
+        typename Allocator = pool_allocator< Key >,
+        std::size_t NodeSize = 256
+    >
+    class btree_set : public btree< btree_set_params<Key, Compare, Allocator, NodeSize> > {
+    private:
+        using base_type = btree< btree_set_params<Key, Compare, Allocator, NodeSize> >;
+    
+    public:
+        using typename base_type::value_type;
+        using typename base_type::iterator;
+        using typename base_type::key_compare;
+        using typename base_type::allocator_type;
+        
+        explicit btree_set(const key_compare& compare = key_compare(), const allocator_type& alloc = allocator_type())
+            : base_type(compare, alloc) {}
+        
+        btree_set(std::initializer_list<value_type> ilist) {
+            insert(ilist);
+        }
+        
+        std::pair<iterator,bool> insert(const value_type& value) {
+            return this->emplaceUnique(value, value);
+        }
+        
+        std::pair<iterator,bool> insert(value_type&& value) {
+            return this->emplaceUnique(value, std::move(value));
+        }
+        
+        template< class InputIt >
+        void insert(InputIt first, InputIt last) {
+            for (; first != last; ++first) {
+                insert(*first);
+            }
+        }
+        
+        void insert(std::initializer_list<value_type> ilist) {
+            insert(ilist.begin(), ilist.end());
+        }
+    };
+    
+    //
+    // Ordered map of unique keys
+    //
+    template<
+        typename Key,
+        typename T,
+        typename Compare = std::less<Key>,
+        typename Allocator = pool_allocator< std::pair<const Key, T> >,
+        std::size_t NodeSize = 256
+    >
+    class btree_map : public btree< btree_map_params<Key, T, Compare, Allocator, NodeSize> > {
+    private:
+        using base_type = btree< btree_map_params<Key, T, Compare, Allocator, NodeSize> >;
+    
+    public:
+        using typename base_type::key_type;
+        using typename base_type::value_type;
+        using typename base_type::iterator;
+        using typename base_type::key_compare;
+        using typename base_type::allocator_type;
+        using mapped_type = T;
+        
+        explicit btree_map(const key_compare& compare = key_compare(), const allocator_type& alloc = allocator_type())
+            : base_type(compare, alloc) {}
+        
+        btree_map(std::initializer_list<value_type> ilist) {
+            insert(ilist);
+        }
+        
+        // Lookup
+        
+        T& operator[](const key_type& key) {
+            return try_emplace(key).first->second;
+        }
+        
+        T& operator[](key_type&& key) {
+            return try_emplace(std::move(key)).first->second;
+        }
+        
+        // Throws std::out_of_range if the key isn't found
+        T& at(const key_type& key) {
+            iterator pos = this->find(key);
+            if (pos == this->end())
+                throw std::out_of_range("btree_map::at: key not found");
+            return pos->second;
+        }
+        const T& at(const key_type& key) const {
+            auto pos = this->find(key);
+            if (pos == this->end())
+                throw std::out_of_range("btree_map::at: key not found");
+            return pos->second;
+        }
+        
+        // Modifiers
+        
+        std::pair<iterator,bool> insert(const value_type& value) {
+            return this->emplaceUnique(value.first, value);
+        }
+        
+        template< class InputIt >
+        void insert(InputIt first, InputIt last) {
+            for (; first != last; ++first) {
+                insert(*first);
+            }
+        }
+        
+        void insert(std::initializer_list<value_type> ilist) {
+            insert(ilist.begin(), ilist.end());
+        }
+        
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args) {
+            return this->emplaceUnique(key, std::piecewise_construct,
+                                       std::forward_as_tuple(key),
+                                       std::forward_as_tuple(std::forward<Args>(args)...));
+        }
+        
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args) {
+            return this->emplaceUnique(key, std::piecewise_construct,
+                                       std::forward_as_tuple(std::move(key)),
+                                       std::forward_as_tuple(std::forward<Args>(args)...));
+        }
+        
+        template<typename M>
+        std::pair<iterator, bool> insert_or_assign(const key_type& key, M&& obj) {
+            std::pair<iterator, bool> result = try_emplace(key, std::forward<M>(obj));
+            if (!result.second)
+                result.first->second = std::forward<M>(obj);
+            return result;
+        }
+    };
+
+} // namespace lab
+
+#endif // AlgoAndData_data_btree_h
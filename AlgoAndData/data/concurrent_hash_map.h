@@ -0,0 +1,377 @@
+//
+//  concurrent_hash_map.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_concurrent_hash_map_h
+#define AlgoAndData_data_concurrent_hash_map_h
+
+#include "hash_map.h"
+
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <utility>
+#include <functional>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // Reader-writer spin lock, writers have a priority
+    //
+    // Writer sets WriterBit first (no new readers pass after that), then waits for active readers to leave.
+    // Critical sections of the concurrent map are a single hash_map operation, so spinning is cheaper
+    // than parking the thread.
+    //
+    class shared_spin_lock {
+    public:
+        shared_spin_lock() noexcept : state(0) {}
+        
+        shared_spin_lock(const shared_spin_lock&) = delete;
+        shared_spin_lock& operator=(const shared_spin_lock&) = delete;
+        
+        void lock() noexcept {
+            unsigned int curState = state.load(std::memory_order_relaxed);
+            
+            while (true) {
+                if ((curState & WriterBit) == 0 &&
+                    state.compare_exchange_weak(curState, curState | WriterBit, std::memory_order_acquire))
+                    break;
+                
+                pause(curState);
+            }
+            
+            // Waiting for readers
+            while (state.load(std::memory_order_acquire) != WriterBit) {
+                std::this_thread::yield();
+            }
+        }
+        
+        void unlock() noexcept {
+            state.store(0, std::memory_order_release);
+        }
+        
+        void lock_shared() noexcept {
+            unsigned int curState = state.load(std::memory_order_relaxed);
+            
+            while (true) {
+                if ((curState & WriterBit) == 0 &&
+                    state.compare_exchange_weak(curState, curState + ReaderInc, std::memory_order_acquire))
+                    break;
+                
+                pause(curState);
+            }
+        }
+        
+        void unlock_shared() noexcept {
+            state.fetch_sub(ReaderInc, std::memory_order_release);
+        }
+    
+    private:
+        static const unsigned int WriterBit = 1;
+        static const unsigned int ReaderInc = 2;
+        
+        std::atomic<unsigned int> state;
+        
+        void pause(unsigned int& curState) noexcept {
+            std::this_thread::yield();
+            curState = state.load(std::memory_order_relaxed);
+        }
+    };
+    
+    //
+    // Thread-safe hash map: N independently locked shards, each shard is a lab::hash_map
+    //
+    // A key is routed to a shard by the high bits of its (mixed) hash code, the shard's table
+    // uses the whole hash code, so shard and bucket indices aren't correlated.
+    // Readers of a shard share its lock and use the non-mutating hash_map lookup path,
+    // so they never wait for each other, only for a writer of the same shard.
+    //
+    // References into the map are never handed out: lookups copy the mapped value out
+    // or run a visitor under the shard lock.
+    //
+    template<
+        typename Key,
+        typename T,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>,
+        typename Allocator = pool_allocator< std::pair<const Key, T> >
+    >
+    class concurrent_hash_map {
+    private:
+        using Map_type = hash_map<Key, T, Hash, KeyEqual, Allocator>;
+        
+        // Every shard starts a cache line: no false sharing between a shard's lock and the neighbour shard's map
+        struct alignas(64) Shard {
+            mutable shared_spin_lock lock;
+            Map_type map;
+            
+            Shard(typename Map_type::size_type bucketCount, const Hash& hash, const KeyEqual& equal, const Allocator& alloc)
+                : map(bucketCount, hash, equal, alloc) {}
+        };
+        
+        template<typename K>
+        using transparent_key = typename std::enable_if<is_transparent<Hash>::value && is_transparent<KeyEqual>::value, K>::type;
+    
+    public:
+        using key_type = Key;
+        using mapped_type = T;
+        using value_type = std::pair<const Key, T>;
+        using size_type = std::size_t;
+        
+        explicit concurrent_hash_map(size_type shards_count = defaultShardsCount(),
+                                     size_type shard_bucket_count = 10,
+                                     const Hash& hash = Hash(),
+                                     const KeyEqual& equal = KeyEqual(),
+                                     const Allocator& alloc = Allocator())
+            : hash(hash)
+        {
+            // Shards count is a power of two, shard index is taken from the top bits of the hash code
+            shardsShift = 64;
+            shardsCount = 1;
+            while (shardsCount < shards_count) {
+                shardsCount <<= 1;
+                --shardsShift;
+            }
+            
+            shards = allocateShards(shard_bucket_count, hash, equal, alloc);
+        }
+        
+        concurrent_hash_map(const concurrent_hash_map&) = delete;
+        concurrent_hash_map& operator=(const concurrent_hash_map&) = delete;
+        
+        ~concurrent_hash_map() {
+            for (size_type i = 0; i < shardsCount; ++i) {
+                shards[i].~Shard();
+            }
+            ::operator delete(shardsStorage);
+        }
+        
+        // Lookup
+        
+        // Copies the mapped value to 'value' if the key is found
+        bool find(const key_type& key, mapped_type& value) const {
+            return findImpl(key, value);
+        }
+        
+        template<typename K, typename = transparent_key<K>>
+        bool find(const K& key, mapped_type& value) const {
+            return findImpl(key, value);
+        }
+        
+        bool contains(const key_type& key) const {
+            return countImpl(key) == 1;
+        }
+        
+        template<typename K, typename = transparent_key<K>>
+        bool contains(const K& key) const {
+            return countImpl(key) == 1;
+        }
+        
+        size_type count(const key_type& key) const {
+            return countImpl(key);
+        }
+        
+        //
+        // Calls visitor(const value_type&) under the shared lock of the key's shard
+        // Returns false if the key isn't found
+        //
+        template<typename Visitor>
+        bool visit(const key_type& key, Visitor visitor) const {
+            const Shard& shard = getShard(key);
+            shared_lock_guard guard(shard.lock);
+            
+            auto iter = shard.map.find(key);
+            if (iter == shard.map.end())
+                return false;
+            
+            visitor(*iter);
+            return true;
+        }
+        
+        // Modifiers
+        
+        bool insert(const value_type& value) {
+            return try_emplace(value.first, value.second);
+        }
+        
+        // Returns true if the key was absent and the value has been inserted
+        template<typename... Args>
+        bool try_emplace(const key_type& key, Args&&... args) {
+            Shard& shard = getShard(key);
+            lock_guard guard(shard.lock);
+            
+            return shard.map.try_emplace(key, std::forward<Args>(args)...).second;
+        }
+        
+        template<typename... Args>
+        bool try_emplace(key_type&& key, Args&&... args) {
+            Shard& shard = getShard(key);
+            lock_guard guard(shard.lock);
+            
+            return shard.map.try_emplace(std::move(key), std::forward<Args>(args)...).second;
+        }
+        
+        // Returns true if the value has been inserted, false if assigned
+        template<typename M>
+        bool insert_or_assign(const key_type& key, M&& obj) {
+            Shard& shard = getShard(key);
+            lock_guard guard(shard.lock);
+            
+            return shard.map.insert_or_assign(key, std::forward<M>(obj)).second;
+        }
+        
+        //
+        // Calls updater(mapped_type&) under the exclusive lock of the key's shard,
+        // the mapped value is default constructed first if the key is absent
+        //
+        template<typename Updater>
+        void update(const key_type& key, Updater updater) {
+            Shard& shard = getShard(key);
+            lock_guard guard(shard.lock);
+            
+            updater(shard.map[key]);
+        }
+        
+        size_type erase(const key_type& key) {
+            return eraseImpl(key);
+        }
+        
+        template<typename K, typename = transparent_key<K>>
+        size_type erase(const K& key) {
+            return eraseImpl(key);
+        }
+        
+        void clear() {
+            for (size_type i = 0; i < shardsCount; ++i) {
+                lock_guard guard(shards[i].lock);
+                shards[i].map.clear();
+            }
+        }
+        
+        // Capacity
+        
+        // Shards are counted one by one, the result is exact only without concurrent writers
+        size_type size() const {
+            size_type elementsCount = 0;
+            
+            for (size_type i = 0; i < shardsCount; ++i) {
+                shared_lock_guard guard(shards[i].lock);
+                elementsCount += shards[i].map.size();
+            }
+            return elementsCount;
+        }
+        
+        bool empty() const {
+            return size() == 0;
+        }
+        
+        size_type shards_count() const noexcept {
+            return shardsCount;
+        }
+    
+    private:
+        struct lock_guard {
+            explicit lock_guard(shared_spin_lock& lock) : lock(lock) { lock.lock(); }
+            ~lock_guard() { lock.unlock(); }
+            shared_spin_lock& lock;
+        };
+        
+        struct shared_lock_guard {
+            explicit shared_lock_guard(shared_spin_lock& lock) : lock(lock) { lock.lock_shared(); }
+            ~shared_lock_guard() { lock.unlock_shared(); }
+            shared_spin_lock& lock;
+        };
+        
+        Shard* shards;
+        void* shardsStorage; // the allocated block, shards start at its first 64-byte boundary
+        size_type shardsCount;
+        int shardsShift;
+        Hash hash;
+        
+        static size_type defaultShardsCount() {
+            size_type threadsCount = std::thread::hardware_concurrency();
+            return threadsCount > 0 ? threadsCount * 4 : 16;
+        }
+        
+        Shard* allocateShards(size_type bucketCount, const Hash& hash, const KeyEqual& equal, const Allocator& alloc) {
+            // operator new doesn't align past max_align_t: the block is over-allocated and aligned here
+            size_type space = shardsCount * sizeof(Shard) + alignof(Shard);
+            void* storage = ::operator new(space);
+            void* alignedStorage = storage;
+            std::align(alignof(Shard), shardsCount * sizeof(Shard), alignedStorage, space);
+            Shard* newShards = static_cast<Shard*>(alignedStorage);
+            size_type constructed = 0;
+            
+            try {
+                // Every shard gets its own allocator copy: a pool isn't shared between shards' locks
+                for (; constructed < shardsCount; ++constructed) {
+                    Allocator shardAlloc = std::allocator_traits<Allocator>::select_on_container_copy_construction(alloc);
+                    ::new (static_cast<void*>(newShards + constructed)) Shard(bucketCount, hash, equal, shardAlloc);
+                }
+            } catch(...) {
+                for (size_type i = 0; i < constructed; ++i) {
+                    newShards[i].~Shard();
+                }
+                ::operator delete(storage);
+                throw;
+            }
+            shardsStorage = storage;
+            return newShards;
+        }
+        
+        template<typename K>
+        size_type getShardIdx(const K& key) const {
+            if (shardsCount == 1)
+                return 0;
+            
+            // Fibonacci hashing: spreads poor hash codes (e.g. identity for integers) over the top bits
+            std::uint64_t mixed = static_cast<std::uint64_t>(hash(key)) * 11400714819323198485ULL;
+            return static_cast<size_type>(mixed >> shardsShift);
+        }
+        
+        template<typename K>
+        Shard& getShard(const K& key) {
+            return shards[getShardIdx(key)];
+        }
+        template<typename K>
+        const Shard& getShard(const K& key) const {
+            return shards[getShardIdx(key)];
+        }
+        
+        template<typename K>
+        bool findImpl(const K& key, mapped_type& value) const {
+            const Shard& shard = getShard(key);
+            shared_lock_guard guard(shard.lock);
+            
+            auto iter = shard.map.find(key);
+            if (iter == shard.map.end())
+                return false;
+            
+            value = iter->second;
+            return true;
+        }
+        
+        template<typename K>
+        size_type countImpl(const K& key) const {
+            const Shard& shard = getShard(key);
+            shared_lock_guard guard(shard.lock);
+            
+            return shard.map.count(key);
+        }
+        
+        template<typename K>
+        size_type eraseImpl(const K& key) {
+            Shard& shard = getShard(key);
+            lock_guard guard(shard.lock);
+            
+            return shard.map.erase(key);
+        }
+    };
+
+} // namespace lab
+
+#endif // AlgoAndData_data_concurrent_hash_map_h
@@ -0,0 +1,848 @@
+//
+//  concurrent_twothree_tree.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_concurrent_twothree_tree_h
+#define AlgoAndData_data_concurrent_twothree_tree_h
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <type_traits>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // Epoch based memory reclamation
+    //
+    // An operation pins the global epoch in a slot while it runs. A retired object is freed once every pinned
+    // epoch is newer than the one it was retired at: the operations that could have reached it before it was
+    // unlinked are all over. Retired objects are checked in batches, under a mutex (writers only).
+    //
+    class epoch_reclaimer {
+    public:
+        using deleter_type = void (*)(void*);
+        
+        // Pins the epoch for the guard's scope
+        class guard {
+        public:
+            explicit guard(epoch_reclaimer& reclaimer) : reclaimer(reclaimer), slotIdx(reclaimer.pin()) {}
+            
+            guard(const guard&) = delete;
+            guard& operator=(const guard&) = delete;
+            
+            ~guard() {
+                reclaimer.unpin(slotIdx);
+            }
+        
+        private:
+            epoch_reclaimer& reclaimer;
+            std::size_t slotIdx;
+        };
+        
+        epoch_reclaimer() : globalEpoch(1) {
+            for (Slot& slot : slots) {
+                slot.epoch.store(0, std::memory_order_relaxed);
+            }
+        }
+        
+        epoch_reclaimer(const epoch_reclaimer&) = delete;
+        epoch_reclaimer& operator=(const epoch_reclaimer&) = delete;
+        
+        // Nothing is pinned anymore
+        ~epoch_reclaimer() {
+            for (Retired& retired : retiredList) {
+                retired.deleter(retired.object);
+            }
+        }
+        
+        // 'object' is unlinked already: operations starting from now on can't reach it
+        void retire(void* object, deleter_type deleter) {
+            std::lock_guard<std::mutex> lock(retiredLock);
+            retiredList.push_back(Retired { object, deleter, globalEpoch.load() });
+            
+            if (retiredList.size() >= ReclaimThreshold)
+                reclaim();
+        }
+    
+    private:
+        static const std::size_t SlotsCount = 128;
+        static const std::size_t ReclaimThreshold = 64;
+        
+        struct Slot {
+            std::atomic<std::uint64_t> epoch; // 0 if the slot is free
+            char padding[64]; // no false sharing between threads' slots
+        };
+        
+        struct Retired {
+            void* object;
+            deleter_type deleter;
+            std::uint64_t epoch;
+        };
+        
+        std::atomic<std::uint64_t> globalEpoch;
+        Slot slots[SlotsCount];
+        
+        std::mutex retiredLock;
+        std::vector<Retired> retiredList;
+        
+        // A thread starts from its own slot, so slots are rarely contended
+        std::size_t pin() noexcept {
+            std::size_t slotIdx = std::hash<std::thread::id>()(std::this_thread::get_id()) % SlotsCount;
+            
+            while (true) {
+                std::uint64_t freeSlot = 0;
+                if (slots[slotIdx].epoch.load(std::memory_order_relaxed) == 0 &&
+                    slots[slotIdx].epoch.compare_exchange_strong(freeSlot, globalEpoch.load()))
+                    break;
+                
+                slotIdx = (slotIdx + 1) % SlotsCount;
+            }
+            
+            // The pin is visible to reclaim() before the operation reads anything
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return slotIdx;
+        }
+        
+        void unpin(std::size_t slotIdx) noexcept {
+            slots[slotIdx].epoch.store(0, std::memory_order_release);
+        }
+        
+        // Under retiredLock
+        void reclaim() {
+            globalEpoch.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            
+            std::uint64_t minPinned = std::numeric_limits<std::uint64_t>::max();
+            for (Slot& slot : slots) {
+                std::uint64_t epoch = slot.epoch.load();
+                if (epoch != 0 && epoch < minPinned)
+                    minPinned = epoch;
+            }
+            
+            std::size_t keptCount = 0;
+            for (Retired& retired : retiredList) {
+                if (retired.epoch < minPinned)
+                    retired.deleter(retired.object);
+                else
+                    retiredList[keptCount++] = retired;
+            }
+            retiredList.resize(keptCount);
+        }
+    };
+    
+    //
+    // Concurrent 2-3 tree (ordered set), optimistic lock coupling
+    //
+    // Every node has a version word. Readers never lock: they read the nodes optimistically and check
+    // that the versions didn't change, otherwise the operation restarts. Writers descend the same way,
+    // then lock only the nodes the operation changes: the path from the lowest ancestor a split (or a merge)
+    // stops at down to the leaf, and the siblings of the merged nodes. Writers on disjoint subtrees don't
+    // wait for each other; a lock is taken only if the node is unchanged since it was read, otherwise
+    // the writer drops its locks and restarts, so there are no deadlocks.
+    //
+    // Nodes have no parent links, the path is remembered on the way down.
+    // Removed nodes are freed through epoch_reclaimer: an optimistic reader may still be reading them.
+    // Keys are copied out (no references or iterators are handed out) and read concurrently with writes,
+    // so they must be trivially copyable.
+    //
+    // Search: O(log N), Insert: O(log N), Delete: O(log N), plus the restarts under contention
+    //
+    template<typename Key, typename Compare = std::less<Key>>
+    class concurrent_twothree_tree {
+    private:
+        static_assert(std::is_trivially_copyable<Key>::value, "Key type must be trivially copyable");
+        
+        static const std::uint64_t ObsoleteBit = 1;
+        static const std::uint64_t LockedBit = 2;
+        static const int MaxHeight = 64;
+        
+        struct Node {
+            std::atomic<std::uint64_t> version; // obsolete bit, locked bit, then the changes counter
+            std::atomic<int> valuesCount;
+            std::atomic<Key> values[2];
+            std::atomic<Node*> childs[3];
+            bool leaf; // set before the node is published
+            
+            Node() : version(0), valuesCount(0), leaf(true) {
+                for (std::atomic<Node*>& child : childs) {
+                    child.store(nullptr, std::memory_order_relaxed);
+                }
+            }
+        };
+        
+        // A node on the way down: its version when it was read, the child (or value) index taken, values count
+        struct Path_entry {
+            Node* node;
+            std::uint64_t version;
+            int childIdx;
+            int valuesCount;
+        };
+        
+        // Locks taken by a writer: released all at once, or restored untouched if the operation restarts
+        class Lock_set {
+        public:
+            Lock_set() : count(0), rootVersion(nullptr) {}
+            
+            bool lockRoot(std::atomic<std::uint64_t>& version, std::uint64_t expected) {
+                if (!upgradeLock(version, expected))
+                    return false;
+                rootVersion = &version;
+                rootExpected = expected;
+                return true;
+            }
+            
+            bool lock(Node* node, std::uint64_t expected) {
+                if (!upgradeLock(node->version, expected))
+                    return false;
+                assert(count < MaxLocks);
+                nodes[count] = node;
+                versions[count] = expected;
+                obsolete[count] = false;
+                ++count;
+                return true;
+            }
+            
+            // The node is unlinked by the operation
+            void markObsolete(Node* node) {
+                for (int i = 0; i < count; ++i) {
+                    if (nodes[i] == node)
+                        obsolete[i] = true;
+                }
+            }
+            
+            // Nothing was changed: the versions are restored, optimistic readers don't restart
+            void abort() {
+                for (int i = 0; i < count; ++i) {
+                    nodes[i]->version.store(versions[i], std::memory_order_release);
+                }
+                if (rootVersion)
+                    rootVersion->store(rootExpected, std::memory_order_release);
+                count = 0;
+                rootVersion = nullptr;
+            }
+            
+            void unlock(epoch_reclaimer& reclaimer) {
+                for (int i = 0; i < count; ++i) {
+                    if (obsolete[i]) {
+                        nodes[i]->version.fetch_add(LockedBit + ObsoleteBit, std::memory_order_release);
+                        reclaimer.retire(nodes[i], &deleteNode);
+                    } else {
+                        nodes[i]->version.fetch_add(LockedBit, std::memory_order_release);
+                    }
+                }
+                if (rootVersion)
+                    rootVersion->fetch_add(LockedBit, std::memory_order_release);
+                count = 0;
+                rootVersion = nullptr;
+            }
+        
+        private:
+            static const int MaxLocks = 2 * MaxHeight + 1; // path, siblings and the node of the erased value
+            
+            Node* nodes[MaxLocks];
+            std::uint64_t versions[MaxLocks];
+            bool obsolete[MaxLocks];
+            int count;
+            
+            std::atomic<std::uint64_t>* rootVersion;
+            std::uint64_t rootExpected;
+        };
+    
+    public:
+        using key_type = Key;
+        using value_type = Key;
+        using size_type = std::size_t;
+        
+        concurrent_twothree_tree() : root(nullptr), rootVersion(0), elementsCount(0) {}
+        
+        concurrent_twothree_tree(const concurrent_twothree_tree&) = delete;
+        concurrent_twothree_tree& operator=(const concurrent_twothree_tree&) = delete;
+        
+        // No operations are running anymore
+        ~concurrent_twothree_tree() {
+            std::vector<Node*> nodes;
+            if (Node* rootNode = root.load())
+                nodes.push_back(rootNode);
+            
+            while (!nodes.empty()) {
+                Node* node = nodes.back();
+                nodes.pop_back();
+                
+                if (!node->leaf) {
+                    for (int i = 0; i <= node->valuesCount.load(std::memory_order_relaxed); ++i) {
+                        nodes.push_back(node->childs[i].load(std::memory_order_relaxed));
+                    }
+                }
+                delete node;
+            }
+        }
+        
+        // Lookup
+        
+        bool contains(const key_type& key) const {
+            epoch_reclaimer::guard guard(reclaimer);
+            Path_entry path[MaxHeight];
+            
+            while (true) {
+                int depth = 0;
+                std::uint64_t rootV = 0;
+                bool found = false;
+                if (descend(key, false, path, depth, rootV, found))
+                    return found;
+                
+                std::this_thread::yield();
+            }
+        }
+        
+        // First key not less than the key, the bool is false if there is no such key
+        std::pair<key_type, bool> lower_bound(const key_type& key) const {
+            return boundImpl(key, false);
+        }
+        
+        // First key greater than the key, the bool is false if there is no such key
+        std::pair<key_type, bool> upper_bound(const key_type& key) const {
+            return boundImpl(key, true);
+        }
+        
+        //
+        // Calls 'visit' for the keys in [low, high), in order
+        // Every key is a separate lookup (O(K log N)), the keys changed during the scan may be seen or not
+        //
+        template<typename Visitor>
+        void range(const key_type& low, const key_type& high, Visitor visit) const {
+            for (std::pair<key_type, bool> next = lower_bound(low); next.second && compare(next.first, high); next = upper_bound(next.first)) {
+                visit(next.first);
+            }
+        }
+        
+        // Modifiers
+        
+        // Returns true if the key was absent and has been inserted by this call
+        bool insert(const key_type& key) {
+            epoch_reclaimer::guard guard(reclaimer);
+            Path_entry path[MaxHeight];
+            Node* spareNodes[MaxHeight + 1];
+            int spareCount = 0;
+            Lock_set locks;
+            bool inserted = false;
+            
+            try {
+                while (true) {
+                    int depth = 0;
+                    std::uint64_t rootV = 0;
+                    bool found = false;
+                    if (!descend(key, false, path, depth, rootV, found)) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    if (found)
+                        break;
+                    
+                    // Splits stop at the lowest node with a free slot, or split the root too
+                    int top = depth;
+                    if (root.load(std::memory_order_relaxed) != nullptr) {
+                        while (top >= 0 && path[top].valuesCount == 2) {
+                            --top;
+                        }
+                    }
+                    
+                    // Nodes are allocated before anything is locked: one per split, one more for a new root
+                    // (the empty tree's leaf: depth and top are -1 then)
+                    int neededNodes = depth - top + (top < 0 ? 1 : 0);
+                    for (; spareCount < neededNodes; ++spareCount) {
+                        spareNodes[spareCount] = new Node();
+                    }
+                    
+                    if (!lockInsertion(locks, path, depth, top, rootV)) {
+                        locks.abort();
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    
+                    applyInsertion(key, path, depth, top, spareNodes, spareCount);
+                    locks.unlock(reclaimer);
+                    elementsCount.fetch_add(1, std::memory_order_relaxed);
+                    inserted = true;
+                    break;
+                }
+            } catch(...) {
+                for (int i = 0; i < spareCount; ++i) {
+                    delete spareNodes[i];
+                }
+                throw;
+            }
+            
+            for (int i = 0; i < spareCount; ++i) {
+                delete spareNodes[i];
+            }
+            return inserted;
+        }
+        
+        // Returns: Number of elements removed.
+        size_type erase(const key_type& key) {
+            epoch_reclaimer::guard guard(reclaimer);
+            Path_entry path[MaxHeight];
+            Node* siblings[MaxHeight];
+            std::uint64_t siblingVersions[MaxHeight];
+            Lock_set locks;
+            
+            while (true) {
+                int depth = 0;
+                std::uint64_t rootV = 0;
+                bool found = false;
+                if (!descend(key, false, path, depth, rootV, found)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                if (!found)
+                    return 0;
+                
+                // An internal value is replaced with its in-order successor, the leftmost value of the right subtree
+                int keyLevel = depth;
+                int keyIdx = path[depth].childIdx;
+                if (!path[depth].node->leaf) {
+                    path[depth].childIdx = keyIdx + 1;
+                    if (!descendLeftmost(path, depth)) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                }
+                
+                int top = depth;
+                bool rootChange = false;
+                if (path[depth].valuesCount == 1 &&
+                    !planHoleFix(path, depth, siblings, siblingVersions, top, rootChange)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                
+                if (!lockErasure(locks, path, depth, keyLevel, top, rootChange, rootV, siblings, siblingVersions)) {
+                    locks.abort();
+                    std::this_thread::yield();
+                    continue;
+                }
+                
+                applyErasure(locks, path, depth, keyLevel, keyIdx, top, rootChange, siblings);
+                locks.unlock(reclaimer);
+                elementsCount.fetch_sub(1, std::memory_order_relaxed);
+                return 1;
+            }
+        }
+        
+        // Capacity
+        
+        bool empty() const noexcept {
+            return size() == 0;
+        }
+        
+        size_type size() const noexcept {
+            return elementsCount.load(std::memory_order_relaxed);
+        }
+    
+    private:
+        std::atomic<Node*> root;
+        std::atomic<std::uint64_t> rootVersion; // guards the root pointer
+        std::atomic<size_type> elementsCount;
+        Compare compare;
+        mutable epoch_reclaimer reclaimer;
+        
+        static void deleteNode(void* node) {
+            delete static_cast<Node*>(node);
+        }
+        
+        /// Versions
+        
+        // Optimistic read: false if the node is being changed or is removed
+        static bool readLock(const std::atomic<std::uint64_t>& version, std::uint64_t& readVersion) noexcept {
+            readVersion = version.load(std::memory_order_acquire);
+            return (readVersion & (LockedBit | ObsoleteBit)) == 0;
+        }
+        
+        // Nothing was changed since readLock: the values read in between are consistent
+        static bool validate(const std::atomic<std::uint64_t>& version, std::uint64_t readVersion) noexcept {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return version.load(std::memory_order_relaxed) == readVersion;
+        }
+        
+        // Locks the node only if it is unchanged since readLock
+        static bool upgradeLock(std::atomic<std::uint64_t>& version, std::uint64_t readVersion) noexcept {
+            if (!version.compare_exchange_strong(readVersion, readVersion + LockedBit, std::memory_order_acquire))
+                return false;
+            
+            // Readers seeing any of the following writes see the lock too
+            std::atomic_thread_fence(std::memory_order_release);
+            return true;
+        }
+        
+        /// Optimistic reads
+        
+        static int readValuesCount(const Node* node) noexcept {
+            int valuesCount = node->valuesCount.load(std::memory_order_relaxed);
+            return std::min(std::max(valuesCount, 0), 2); // torn reads are validated later
+        }
+        
+        static Key readValue(const Node* node, int valueIdx) noexcept {
+            return node->values[valueIdx].load(std::memory_order_relaxed);
+        }
+        
+        // Index of the child to descend to: the number of values less than (not greater than, if 'upper') the key
+        int getChildIdx(const Node* node, int valuesCount, const key_type& key, bool upper) const {
+            int idx = 0;
+            for (int i = 0; i < valuesCount; ++i) {
+                Key value = readValue(node, i);
+                idx += (upper ? !compare(key, value) : compare(value, key)) ? 1 : 0;
+            }
+            return idx;
+        }
+        
+        //
+        // Optimistic descent from the root to the node holding the key or to the leaf it belongs to ('upper' goes
+        // to the leaf always), the path is filled from the root, path[depth] is the last node.
+        // Returns false if the operation has to restart
+        //
+        bool descend(const key_type& key, bool upper, Path_entry* path, int& depth, std::uint64_t& rootV, bool& found) const {
+            found = false;
+            depth = -1;
+            if (!readLock(rootVersion, rootV))
+                return false;
+            
+            Node* node = root.load(std::memory_order_acquire);
+            if (node == nullptr)
+                return validate(rootVersion, rootV);
+            
+            std::uint64_t nodeVersion = 0;
+            if (!readLock(node->version, nodeVersion) || !validate(rootVersion, rootV))
+                return false;
+            
+            while (true) {
+                int valuesCount = readValuesCount(node);
+                int idx = getChildIdx(node, valuesCount, key, upper);
+                found = !upper && idx < valuesCount && !compare(key, readValue(node, idx));
+                
+                path[++depth] = Path_entry { node, nodeVersion, idx, valuesCount };
+                if (found || node->leaf)
+                    return validate(node->version, nodeVersion);
+                
+                if (!stepDown(node, nodeVersion, idx) || depth + 1 == MaxHeight)
+                    return false;
+            }
+        }
+        
+        // Continues the descent from path[depth] to the leftmost leaf under its child 'childIdx'
+        bool descendLeftmost(Path_entry* path, int& depth) const {
+            Node* node = path[depth].node;
+            std::uint64_t nodeVersion = path[depth].version;
+            int idx = path[depth].childIdx;
+            
+            while (true) {
+                if (!stepDown(node, nodeVersion, idx) || depth + 1 == MaxHeight)
+                    return false;
+                
+                path[++depth] = Path_entry { node, nodeVersion, 0, readValuesCount(node) };
+                idx = 0;
+                if (node->leaf)
+                    return validate(node->version, nodeVersion);
+            }
+        }
+        
+        // Lock coupling: the child is taken only if the parent is unchanged before and after the child is read
+        bool stepDown(Node*& node, std::uint64_t& nodeVersion, int childIdx) const {
+            Node* child = node->childs[childIdx].load(std::memory_order_acquire);
+            if (!validate(node->version, nodeVersion) || child == nullptr)
+                return false;
+            
+            std::uint64_t childVersion = 0;
+            if (!readLock(child->version, childVersion) || !validate(node->version, nodeVersion))
+                return false;
+            
+            node = child;
+            nodeVersion = childVersion;
+            return true;
+        }
+        
+        // The answer is the value right after the deepest child taken on the way down
+        std::pair<key_type, bool> boundImpl(const key_type& key, bool upper) const {
+            epoch_reclaimer::guard guard(reclaimer);
+            Path_entry path[MaxHeight];
+            
+            while (true) {
+                int depth = 0;
+                std::uint64_t rootV = 0;
+                bool found = false;
+                if (!descend(key, upper, path, depth, rootV, found)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                
+                int level = depth;
+                while (level >= 0 && path[level].childIdx >= path[level].valuesCount) {
+                    --level;
+                }
+                if (level < 0)
+                    return std::make_pair(key_type(), false);
+                
+                Key value = readValue(path[level].node, path[level].childIdx);
+                if (validate(path[level].node->version, path[level].version))
+                    return std::make_pair(value, true);
+                
+                std::this_thread::yield();
+            }
+        }
+        
+        /// Insertion
+        
+        // Levels [top, depth] of the path, the root pointer too if the root is split (top < 0) or the tree is empty
+        bool lockInsertion(Lock_set& locks, Path_entry* path, int depth, int top, std::uint64_t rootV) {
+            if (top < 0 && !locks.lockRoot(rootVersion, rootV))
+                return false;
+            
+            for (int level = std::max(top, 0); level <= depth; ++level) {
+                if (!locks.lock(path[level].node, path[level].version))
+                    return false;
+            }
+            return true;
+        }
+        
+        void applyInsertion(const key_type& key, Path_entry* path, int depth, int top, Node** spareNodes, int& spareCount) {
+            if (depth < 0) {
+                // Empty tree
+                Node* leaf = spareNodes[--spareCount];
+                leaf->values[0].store(key, std::memory_order_relaxed);
+                leaf->valuesCount.store(1, std::memory_order_relaxed);
+                root.store(leaf, std::memory_order_release);
+                return;
+            }
+            
+            Key carryValue = key;
+            Node* carryChild = nullptr; // right neighbour of the carried value, for the internal nodes
+            
+            for (int level = depth; level >= std::max(top, 0); --level) {
+                Node* node = path[level].node;
+                int valuesCount = path[level].valuesCount;
+                int pos = path[level].childIdx;
+                
+                // In-order values and children with the carried ones inserted
+                Key values[3];
+                Node* childs[4];
+                for (int i = 0, j = 0; i <= valuesCount; ++i) {
+                    if (i == pos)
+                        values[j++] = carryValue;
+                    if (i < valuesCount)
+                        values[j++] = readValue(node, i);
+                }
+                for (int i = 0, j = 0; i <= valuesCount; ++i) {
+                    childs[j++] = node->childs[i].load(std::memory_order_relaxed);
+                    if (i == pos)
+                        childs[j++] = carryChild;
+                }
+                
+                if (valuesCount < 2) {
+                    storeNode(node, values, childs, valuesCount + 1);
+                    return;
+                }
+                
+                // 4-node: the node keeps the left part, the right part goes to a new node, the middle value goes up
+                Node* right = spareNodes[--spareCount];
+                right->leaf = node->leaf;
+                storeNode(right, values + 2, childs + 2, 1);
+                storeNode(node, values, childs, 1);
+                
+                carryValue = values[1];
+                carryChild = right;
+            }
+            
+            // The root is split
+            Node* newRoot = spareNodes[--spareCount];
+            Key values[1] = { carryValue };
+            Node* childs[2] = { path[0].node, carryChild };
+            newRoot->leaf = false;
+            storeNode(newRoot, values, childs, 1);
+            root.store(newRoot, std::memory_order_release);
+        }
+        
+        // Children pointers are published with release: a reader taking a new node sees it initialized
+        static void storeNode(Node* node, const Key* values, Node* const* childs, int valuesCount) {
+            for (int i = 0; i < valuesCount; ++i) {
+                node->values[i].store(values[i], std::memory_order_relaxed);
+            }
+            for (int i = 0; i < 3; ++i) {
+                node->childs[i].store(!node->leaf && i <= valuesCount ? childs[i] : nullptr, std::memory_order_release);
+            }
+            node->valuesCount.store(valuesCount, std::memory_order_relaxed);
+        }
+        
+        /// Erasure
+        
+        static int getSiblingIdx(int holeIdx) noexcept {
+            return holeIdx == 0 ? 1 : holeIdx - 1;
+        }
+        
+        //
+        // The leaf loses its only value: finds where the hole stops going up (see twothree_tree::fixNodeRemove)
+        //  - a sibling with two values lends one: the parent is the top changed node
+        //  - a sibling with one value is merged with the hole: the parent loses a value, it becomes the hole
+        //    if it has no values left, or the root is replaced with the merged node
+        // 'top' is the highest changed level, the siblings are read for the levels below it
+        //
+        bool planHoleFix(Path_entry* path, int depth, Node** siblings, std::uint64_t* siblingVersions, int& top, bool& rootChange) const {
+            for (int level = depth; ; --level) {
+                if (level == 0) {
+                    // The only value of the tree
+                    top = 0;
+                    rootChange = true;
+                    return true;
+                }
+                
+                const Path_entry& parent = path[level - 1];
+                Node* sibling = parent.node->childs[getSiblingIdx(parent.childIdx)].load(std::memory_order_acquire);
+                if (!validate(parent.node->version, parent.version) || sibling == nullptr)
+                    return false;
+                
+                std::uint64_t siblingVersion = 0;
+                if (!readLock(sibling->version, siblingVersion) || !validate(parent.node->version, parent.version))
+                    return false;
+                int siblingValuesCount = readValuesCount(sibling);
+                if (!validate(sibling->version, siblingVersion))
+                    return false;
+                
+                siblings[level] = sibling;
+                siblingVersions[level] = siblingVersion;
+                top = level - 1;
+                
+                if (siblingValuesCount == 2 || parent.valuesCount == 2)
+                    return true;
+                if (level - 1 == 0) {
+                    rootChange = true;
+                    return true;
+                }
+            }
+        }
+        
+        // Top-down: the root pointer, the node of the erased value, then the path from 'top' with the siblings
+        bool lockErasure(Lock_set& locks, Path_entry* path, int depth, int keyLevel, int top, bool rootChange, std::uint64_t rootV,
+                         Node** siblings, std::uint64_t* siblingVersions) {
+            if (rootChange && !locks.lockRoot(rootVersion, rootV))
+                return false;
+            if (keyLevel < top && !locks.lock(path[keyLevel].node, path[keyLevel].version))
+                return false;
+            
+            bool holeFix = path[depth].valuesCount == 1;
+            for (int level = top; level <= depth; ++level) {
+                if (!locks.lock(path[level].node, path[level].version))
+                    return false;
+                if (holeFix && level > top && !locks.lock(siblings[level], siblingVersions[level]))
+                    return false;
+            }
+            return true;
+        }
+        
+        void applyErasure(Lock_set& locks, Path_entry* path, int depth, int keyLevel, int keyIdx, int top, bool rootChange, Node** siblings) {
+            Node* leaf = path[depth].node;
+            int removedIdx = 0;
+            if (keyLevel != depth)
+                path[keyLevel].node->values[keyIdx].store(readValue(leaf, 0), std::memory_order_relaxed);
+            else
+                removedIdx = keyIdx;
+            
+            // Removing the value from the leaf
+            int leafValuesCount = path[depth].valuesCount;
+            if (leafValuesCount == 2) {
+                leaf->values[0].store(readValue(leaf, 1 - removedIdx), std::memory_order_relaxed);
+                leaf->valuesCount.store(1, std::memory_order_relaxed);
+                return;
+            }
+            
+            if (depth == 0) {
+                root.store(nullptr, std::memory_order_release);
+                locks.markObsolete(leaf);
+                return;
+            }
+            
+            Node* hole = leaf;
+            Node* holeChild = nullptr;
+            for (int level = depth; level > top; --level) {
+                Node* parent = path[level - 1].node;
+                Node* sibling = siblings[level];
+                int parentValuesCount = path[level - 1].valuesCount;
+                int holeIdx = path[level - 1].childIdx;
+                int siblingIdx = getSiblingIdx(holeIdx);
+                int separatorIdx = std::min(holeIdx, siblingIdx);
+                
+                // In-order values and children of the sibling and the hole, with the separator between them
+                int siblingValuesCount = sibling->valuesCount.load(std::memory_order_relaxed);
+                Key values[3];
+                Node* childs[4];
+                int valuesCount = 0, childsCount = 0;
+                if (holeIdx < siblingIdx) {
+                    values[valuesCount++] = readValue(parent, separatorIdx);
+                    childs[childsCount++] = holeChild;
+                }
+                for (int i = 0; i < siblingValuesCount; ++i) {
+                    values[valuesCount++] = readValue(sibling, i);
+                }
+                for (int i = 0; i <= siblingValuesCount; ++i) {
+                    childs[childsCount++] = sibling->childs[i].load(std::memory_order_relaxed);
+                }
+                if (holeIdx > siblingIdx) {
+                    values[valuesCount++] = readValue(parent, separatorIdx);
+                    childs[childsCount++] = holeChild;
+                }
+                
+                if (valuesCount == 3) {
+                    // The sibling lends a value through the parent
+                    Node* left = holeIdx < siblingIdx ? hole : sibling;
+                    Node* right = holeIdx < siblingIdx ? sibling : hole;
+                    storeNode(left, values, childs, 1);
+                    storeNode(right, values + 2, childs + 2, 1);
+                    parent->values[separatorIdx].store(values[1], std::memory_order_relaxed);
+                    return;
+                }
+                
+                // Merged into the sibling, the hole is removed from the parent
+                storeNode(sibling, values, childs, 2);
+                locks.markObsolete(hole);
+                
+                Key parentValues[2];
+                Node* parentChilds[3];
+                for (int i = 0, j = 0; i < parentValuesCount; ++i) {
+                    if (i != separatorIdx)
+                        parentValues[j++] = readValue(parent, i);
+                }
+                for (int i = 0, j = 0; i <= parentValuesCount; ++i) {
+                    if (i != holeIdx)
+                        parentChilds[j++] = parent->childs[i].load(std::memory_order_relaxed);
+                }
+                
+                if (parentValuesCount == 2) {
+                    storeNode(parent, parentValues, parentChilds, 1);
+                    return;
+                }
+                
+                // The parent is left with the merged node only
+                if (level - 1 == 0) {
+                    assert(rootChange);
+                    root.store(sibling, std::memory_order_release);
+                    locks.markObsolete(parent);
+                    return;
+                }
+                parent->valuesCount.store(0, std::memory_order_relaxed);
+                hole = parent;
+                holeChild = sibling;
+            }
+        }
+    };
+
+} // namespace lab
+
+#endif // AlgoAndData_data_concurrent_twothree_tree_h
@@ -0,0 +1,538 @@
+//
+//  cuckoo_hash_map.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_cuckoo_hash_map_h
+#define AlgoAndData_data_cuckoo_hash_map_h
+
+#include "hash_map.h"
+
+#include <utility>
+#include <memory>
+#include <functional>
+#include <tuple>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // Bucketized cuckoo hash table
+    //
+    // Every key has two candidate buckets of SlotsPerBucket slots each (two hash functions
+    // derived from one Hash code), so a lookup checks at most 2 * SlotsPerBucket slots:
+    // Search: O(1) worst case
+    // Insert: O(1) amortized; when both buckets are full, a breadth-first search finds the shortest
+    //         chain of keys to move to their alternative buckets (at most MaxBfsNodes buckets visited)
+    // Delete: O(1), no tombstones
+    //
+    // Storage and iterators are the ones of lab::hash_map: control bytes apart from the value slots.
+    //
+    template<
+        typename Key,
+        typename T,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>,
+        typename Allocator = pool_allocator< std::pair<const Key, T> >
+    >
+    class cuckoo_hash_map {
+    private:
+        using internal_value_type = std::pair<Key, T>;
+        using Bucket_table_type = Bucket_table<internal_value_type>;
+        using Slot_type = typename Bucket_table_type::Slot_type;
+        using Bucket_allocator_type = typename Allocator::template rebind<Slot_type>::other;
+    
+    public:
+        using key_type = Key;
+        using mapped_type = T;
+        using value_type = std::pair<const Key, T>;
+        using size_type = std::size_t;
+        
+        using iterator = Bucket_iterator<value_type, Slot_type*>;
+        using const_iterator = Bucket_const_iterator<value_type, const Slot_type*>;
+        
+        static const size_type SlotsPerBucket = 4;
+        
+        cuckoo_hash_map() : cuckoo_hash_map(DefaultBucketCount) {}
+        
+        // 'bucket_count' is rounded up to a power of two
+        explicit cuckoo_hash_map( size_type bucket_count,
+                                 const Hash& hash = Hash(),
+                                 const KeyEqual& equal = KeyEqual(),
+                                 const Allocator& alloc = Allocator() )
+            : bucketsCount(0), bucketsShift(64), elementsCount(0),
+              hash(hash), keyEqual(equal), bucketAllocator(alloc)
+        {
+            allocateTable(bucket_count);
+        }
+        
+        cuckoo_hash_map(const cuckoo_hash_map& other)
+            : bucketsCount(0), bucketsShift(64), elementsCount(0),
+              hash(other.hash), keyEqual(other.keyEqual),
+              bucketAllocator(std::allocator_traits<Bucket_allocator_type>::select_on_container_copy_construction(other.bucketAllocator))
+        {
+            allocateTable(other.bucketsCount);
+            
+            // Same layout as 'other', both hash functions depend on the buckets count only
+            try {
+                for (size_type i = 0; i < getSlotsCount(); ++i) {
+                    if (other.buckets.isActive(i)) {
+                        buckets.makeActive(i, other.buckets.contents(i));
+                        ++elementsCount;
+                    }
+                }
+            } catch(...) {
+                releaseTable();
+                throw;
+            }
+        }
+        
+        cuckoo_hash_map(cuckoo_hash_map&& other) noexcept
+            : buckets(other.buckets), bucketsCount(other.bucketsCount), bucketsShift(other.bucketsShift),
+              elementsCount(other.elementsCount),
+              hash(std::move(other.hash)), keyEqual(std::move(other.keyEqual)), bucketAllocator(other.bucketAllocator)
+        {
+            other.buckets = Bucket_table_type();
+            other.bucketsCount = 0;
+            other.bucketsShift = 64;
+            other.elementsCount = 0;
+        }
+        
+        cuckoo_hash_map& operator=(cuckoo_hash_map other) noexcept {
+            swap(other);
+            return *this;
+        }
+        
+        ~cuckoo_hash_map() {
+            releaseTable();
+        }
+        
+        void swap(cuckoo_hash_map& other) noexcept {
+            using std::swap;
+            swap(buckets, other.buckets);
+            swap(bucketsCount, other.bucketsCount);
+            swap(bucketsShift, other.bucketsShift);
+            swap(elementsCount, other.elementsCount);
+            swap(hash, other.hash);
+            swap(keyEqual, other.keyEqual);
+            swap(bucketAllocator, other.bucketAllocator);
+        }
+        
+        // Lookup
+        
+        T& operator[](const key_type& key) {
+            return try_emplace(key).first->second;
+        }
+        
+        T& operator[](key_type&& key) {
+            return try_emplace(std::move(key)).first->second;
+        }
+        
+        iterator find(const key_type& key) {
+            size_type index = findIndex(key);
+            return index == NotFound ? end() : iteratorAt(index);
+        }
+        
+        const_iterator find(const key_type& key) const {
+            size_type index = findIndex(key);
+            return index == NotFound ? end() : iteratorAt(index);
+        }
+        
+        size_type count(const key_type& key) const {
+            return findIndex(key) == NotFound ? 0 : 1;
+        }
+        
+        bool contains(const key_type& key) const {
+            return findIndex(key) != NotFound;
+        }
+        
+        // Modifiers
+        
+        std::pair<iterator, bool> insert(const value_type& value) {
+            return try_emplace(value.first, value.second);
+        }
+        
+        std::pair<iterator, bool> insert(value_type&& value) {
+            return try_emplace(value.first, std::move(value.second));
+        }
+        
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args) {
+            return tryEmplaceImpl(key, std::forward<Args>(args)...);
+        }
+        
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args) {
+            return tryEmplaceImpl(std::move(key), std::forward<Args>(args)...);
+        }
+        
+        template<typename M>
+        std::pair<iterator, bool> insert_or_assign(const key_type& key, M&& obj) {
+            return insertOrAssignImpl(key, std::forward<M>(obj));
+        }
+        
+        template<typename M>
+        std::pair<iterator, bool> insert_or_assign(key_type&& key, M&& obj) {
+            return insertOrAssignImpl(std::move(key), std::forward<M>(obj));
+        }
+        
+        iterator erase(const_iterator pos) {
+            size_type index = static_cast<size_type>(pos.current - buckets.controls);
+            assert(buckets.isActive(index));
+            
+            buckets.makeEmpty(index);
+            --elementsCount;
+            
+            iterator nextIter = iteratorAt(index);
+            ++nextIter;
+            return nextIter;
+        }
+        
+        size_type erase(const key_type& key) {
+            size_type index = findIndex(key);
+            if (index == NotFound)
+                return 0;
+            
+            buckets.makeEmpty(index);
+            --elementsCount;
+            return 1;
+        }
+        
+        // Capacity is kept
+        void clear() noexcept {
+            for (size_type i = 0; i < getSlotsCount(); ++i) {
+                if (buckets.isActive(i))
+                    buckets.makeEmpty(i);
+            }
+            elementsCount = 0;
+        }
+        
+        // Makes room for 'count' elements without growing
+        void reserve(size_type count) {
+            size_type newBucketsCount = bucketsCount == 0 ? 2 : bucketsCount;
+            while (count > max_load_factor() * newBucketsCount * SlotsPerBucket) {
+                newBucketsCount *= 2;
+            }
+            
+            if (newBucketsCount > bucketsCount)
+                rehashImpl(newBucketsCount);
+        }
+        
+        // Capacity
+        
+        bool empty() const noexcept {
+            return elementsCount == 0;
+        }
+        
+        size_type size() const noexcept {
+            return elementsCount;
+        }
+        
+        // Slots count
+        size_type bucket_count() const noexcept {
+            return getSlotsCount();
+        }
+        
+        float load_factor() const noexcept {
+            return bucketsCount == 0 ? 0.0f : static_cast<float>(elementsCount) / getSlotsCount();
+        }
+        
+        // The table also grows earlier if the displacement search fails
+        float max_load_factor() const noexcept {
+            return 0.95f;
+        }
+        
+        // Iterators
+        
+        iterator begin() noexcept {
+            return iteratorAt(getFirstSlot());
+        }
+        
+        const_iterator begin() const noexcept {
+            return iteratorAt(getFirstSlot());
+        }
+        
+        iterator end() noexcept {
+            return iteratorAt(getSlotsCount());
+        }
+        
+        const_iterator end() const noexcept {
+            return iteratorAt(getSlotsCount());
+        }
+        
+        const_iterator cbegin() const noexcept {
+            return begin();
+        }
+        
+        const_iterator cend() const noexcept {
+            return end();
+        }
+    
+    private:
+        static const size_type NotFound = static_cast<size_type>(-1);
+        static const size_type DefaultBucketCount = 4;
+        static const int MaxBfsNodes = 512;
+        
+        // Both candidate buckets of a key
+        struct Candidates {
+            size_type first;
+            size_type second;
+        };
+        
+        // Displacement search node: a full bucket, reached by moving the key at 'parentSlot' of the parent bucket
+        struct BfsNode {
+            size_type bucket;
+            int parent;
+            int parentSlot;
+        };
+        
+        Bucket_table_type buckets;
+        size_type bucketsCount; // power of two
+        int bucketsShift;       // 64 - log2(bucketsCount)
+        size_type elementsCount;
+        
+        Hash hash;
+        KeyEqual keyEqual;
+        Bucket_allocator_type bucketAllocator;
+        
+        size_type getSlotsCount() const noexcept {
+            return bucketsCount * SlotsPerBucket;
+        }
+        
+        //
+        // Two bucket indices from one hash code: top bits of two different multiplicative mixes
+        // The buckets are always different (there are at least two of them)
+        //
+        Candidates getCandidates(std::size_t hashCode) const noexcept {
+            std::uint64_t code = static_cast<std::uint64_t>(hashCode);
+            std::uint64_t firstMix = code * 11400714819323198485ULL;
+            std::uint64_t secondMix = ((code << 32) | (code >> 32)) * 14029467366897019727ULL;
+            
+            Candidates candidates;
+            candidates.first = static_cast<size_type>(firstMix >> bucketsShift);
+            candidates.second = static_cast<size_type>(secondMix >> bucketsShift);
+            if (candidates.second == candidates.first)
+                candidates.second ^= 1;
+            return candidates;
+        }
+        
+        size_type getAlternativeBucket(size_type slotIdx) const {
+            Candidates candidates = getCandidates(hash(buckets.contents(slotIdx).first));
+            size_type bucket = slotIdx / SlotsPerBucket;
+            return bucket == candidates.first ? candidates.second : candidates.first;
+        }
+        
+        size_type findInBucket(size_type bucket, const key_type& key) const {
+            size_type firstSlot = bucket * SlotsPerBucket;
+            for (size_type i = firstSlot; i < firstSlot + SlotsPerBucket; ++i) {
+                if (buckets.isActive(i) && keyEqual(buckets.contents(i).first, key))
+                    return i;
+            }
+            return NotFound;
+        }
+        
+        size_type findFreeInBucket(size_type bucket) const noexcept {
+            size_type firstSlot = bucket * SlotsPerBucket;
+            for (size_type i = firstSlot; i < firstSlot + SlotsPerBucket; ++i) {
+                if (!buckets.isActive(i))
+                    return i;
+            }
+            return NotFound;
+        }
+        
+        size_type findIndex(const key_type& key, const Candidates& candidates) const {
+            size_type index = findInBucket(candidates.first, key);
+            if (index == NotFound)
+                index = findInBucket(candidates.second, key);
+            return index;
+        }
+        
+        size_type findIndex(const key_type& key) const {
+            if (bucketsCount == 0)
+                return NotFound;
+            
+            Candidates candidates = getCandidates(hash(key));
+            
+            // Both buckets are fetched at once
+            prefetch_read(buckets.slots + candidates.second * SlotsPerBucket);
+            prefetch_read(buckets.controls + candidates.second * SlotsPerBucket);
+            
+            return findIndex(key, candidates);
+        }
+        
+        template<typename K, typename... Args>
+        std::pair<iterator, bool> tryEmplaceImpl(K&& key, Args&&... args) {
+            if (bucketsCount == 0)
+                allocateTable(DefaultBucketCount); // moved-from map
+            
+            std::size_t hashCode = hash(key);
+            size_type index = findIndex(key, getCandidates(hashCode));
+            
+            if (index != NotFound) {
+                // Insertion prevented by the existing element
+                return std::make_pair(iteratorAt(index), false);
+            }
+            
+            index = makeFreeSlot(hashCode);
+            buckets.makeActive(index, std::piecewise_construct,
+                               std::forward_as_tuple(std::forward<K>(key)),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+            ++elementsCount;
+            
+            return std::make_pair(iteratorAt(index), true);
+        }
+        
+        template<typename K, typename M>
+        std::pair<iterator, bool> insertOrAssignImpl(K&& key, M&& obj) {
+            std::pair<iterator, bool> result = tryEmplaceImpl(std::forward<K>(key), std::forward<M>(obj));
+            if (!result.second)
+                result.first->second = std::forward<M>(obj);
+            return result;
+        }
+        
+        //
+        // Returns an empty slot in one of the buckets of the key with 'hashCode',
+        // grows the table when it's too loaded or no displacement chain is found
+        //
+        size_type makeFreeSlot(std::size_t hashCode) {
+            if (elementsCount + 1 > max_load_factor() * getSlotsCount())
+                rehashImpl(bucketsCount * 2);
+            
+            while (true) {
+                Candidates candidates = getCandidates(hashCode);
+                
+                size_type index = findFreeInBucket(candidates.first);
+                if (index == NotFound)
+                    index = findFreeInBucket(candidates.second);
+                if (index == NotFound)
+                    index = displace(candidates);
+                
+                if (index != NotFound)
+                    return index;
+                
+                rehashImpl(bucketsCount * 2);
+            }
+        }
+        
+        //
+        // Breadth-first search from both (full) candidate buckets for a bucket with an empty slot,
+        // then keys along the found path are moved to their alternative buckets, from the end of the path.
+        // Returns the freed slot in a candidate bucket or NotFound.
+        //
+        size_type displace(const Candidates& candidates) {
+            BfsNode nodes[MaxBfsNodes];
+            int nodesCount = 0;
+            
+            nodes[nodesCount++] = BfsNode { candidates.first, -1, -1 };
+            nodes[nodesCount++] = BfsNode { candidates.second, -1, -1 };
+            
+            for (int nodeIdx = 0; nodeIdx < nodesCount; ++nodeIdx) {
+                size_type bucket = nodes[nodeIdx].bucket;
+                size_type freeSlot = findFreeInBucket(bucket);
+                
+                if (freeSlot != NotFound)
+                    return movePath(nodes, nodeIdx, freeSlot);
+                
+                for (size_type i = 0; i < SlotsPerBucket && nodesCount < MaxBfsNodes; ++i) {
+                    size_type slotIdx = bucket * SlotsPerBucket + i;
+                    nodes[nodesCount++] = BfsNode { getAlternativeBucket(slotIdx), nodeIdx, static_cast<int>(i) };
+                }
+            }
+            
+            return NotFound;
+        }
+        
+        size_type movePath(const BfsNode* nodes, int nodeIdx, size_type freeSlot) {
+            while (nodes[nodeIdx].parent != -1) {
+                const BfsNode& node = nodes[nodeIdx];
+                size_type fromSlot = nodes[node.parent].bucket * SlotsPerBucket + node.parentSlot;
+                
+                // A bucket may occur twice on the path, then the slot may be empty or hold another key by now
+                if (!buckets.isActive(fromSlot) || getAlternativeBucket(fromSlot) != node.bucket)
+                    return NotFound;
+                
+                buckets.makeActive(freeSlot, std::move(buckets.contents(fromSlot)));
+                buckets.makeEmpty(fromSlot);
+                
+                freeSlot = fromSlot;
+                nodeIdx = node.parent;
+            }
+            
+            return freeSlot;
+        }
+        
+        // Moves all the elements to a table of 'newBucketsCount' buckets (which may grow further itself)
+        void rehashImpl(size_type newBucketsCount) {
+            cuckoo_hash_map newMap(newBucketsCount, hash, keyEqual, bucketAllocator);
+            
+            for (size_type i = 0; i < getSlotsCount(); ++i) {
+                if (!buckets.isActive(i))
+                    continue;
+                
+                internal_value_type& value = buckets.contents(i);
+                size_type index = newMap.makeFreeSlot(hash(value.first));
+                newMap.buckets.makeActive(index, std::move(value));
+                ++newMap.elementsCount;
+            }
+            
+            swap(newMap);
+        }
+        
+        iterator iteratorAt(size_type index) noexcept {
+            return iterator(buckets.controls + index, buckets.controls + getSlotsCount(), buckets.slots + index);
+        }
+        const_iterator iteratorAt(size_type index) const noexcept {
+            return const_iterator(buckets.controls + index, buckets.controls + getSlotsCount(), buckets.slots + index);
+        }
+        
+        size_type getFirstSlot() const noexcept {
+            if (bucketsCount == 0)
+                return 0;
+            
+            size_type index = static_cast<size_type>(find_full_control(buckets.controls) - buckets.controls);
+            return std::min(index, getSlotsCount());
+        }
+        
+        //
+        // Same allocation as hash_map's: slots, then the control bytes with the Full sentinel padding
+        //
+        static size_type getAllocationSize(size_type slotsCount) noexcept {
+            return slotsCount + (slotsCount + ControlsPadding + sizeof(Slot_type) - 1) / sizeof(Slot_type);
+        }
+        
+        void allocateTable(size_type minBucketsCount) {
+            size_type newBucketsCount = 2;
+            int newShift = 63;
+            while (newBucketsCount < minBucketsCount) {
+                newBucketsCount *= 2;
+                --newShift;
+            }
+            
+            size_type slotsCount = newBucketsCount * SlotsPerBucket;
+            buckets.slots = bucketAllocator.allocate(getAllocationSize(slotsCount));
+            buckets.controls = reinterpret_cast<bucket_control*>(buckets.slots + slotsCount);
+            std::memset(buckets.controls, static_cast<int>(bucket_control::Empty), slotsCount * sizeof(bucket_control));
+            std::memset(buckets.controls + slotsCount, static_cast<int>(bucket_control::Full), ControlsPadding * sizeof(bucket_control));
+            
+            bucketsCount = newBucketsCount;
+            bucketsShift = newShift;
+        }
+        
+        void releaseTable() noexcept {
+            if (bucketsCount == 0)
+                return;
+            
+            clear();
+            bucketAllocator.deallocate(buckets.slots, getAllocationSize(getSlotsCount()));
+            buckets = Bucket_table_type();
+            bucketsCount = 0;
+        }
+    };
+
+} // namespace lab
+
+#endif // AlgoAndData_data_cuckoo_hash_map_h
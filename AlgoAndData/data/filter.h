@@ -0,0 +1,387 @@
+//
+//  filter.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_filter_h
+#define AlgoAndData_data_filter_h
+
+#include "hash_map.h"
+
+#include <vector>
+#include <iterator>
+#include <initializer_list>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // Approximate membership filters: contains() may return a false positive, never a false negative.
+    // Meant as a cheap negative check before a lookup in a bigger (or remote) table.
+    //
+    
+    // Finalizer of MurmurHash3: spreads the bits of a (possibly identity) Hash result, salted with 'seed'
+    inline std::uint64_t filter_mix(std::uint64_t code, std::uint64_t seed = 0) noexcept {
+        code += seed;
+        code ^= code >> 33;
+        code *= 0xff51afd7ed558ccdULL;
+        code ^= code >> 33;
+        code *= 0xc4ceb9fe1a85ec53ULL;
+        code ^= code >> 33;
+        return code;
+    }
+    
+    // Maps a 32-bit value to [0, range) without division
+    inline std::uint32_t filter_reduce(std::uint32_t value, std::uint32_t range) noexcept {
+        return static_cast<std::uint32_t>((static_cast<std::uint64_t>(value) * range) >> 32);
+    }
+    
+    //
+    // Blocked Bloom filter
+    //
+    // Every key sets one bit in each of the BlockWords 64-bit words of a single cache-line-sized block.
+    // A lookup costs one cache miss; the word tests are independent, so the compiler turns the test loop
+    // into SIMD compares.
+    // Insert: O(1)
+    // Search: O(1)
+    //
+    template<typename Key, typename Hash = std::hash<Key>>
+    class blocked_bloom_filter {
+    public:
+        using key_type = Key;
+        using size_type = std::size_t;
+        
+        static const size_type BlockWords = 8;
+        static const size_type BlockBytes = BlockWords * sizeof(std::uint64_t);
+        
+        // Sized for 'expected_count' keys with 'bits_per_key' bits each
+        explicit blocked_bloom_filter(size_type expected_count, double bits_per_key = 10.0, const Hash& hash = Hash())
+            : blocksCount(0), firstBlockIdx(0), elementsCount(0), hash(hash)
+        {
+            double bitsCount = static_cast<double>(expected_count) * bits_per_key;
+            blocksCount = static_cast<size_type>(bitsCount / (BlockBytes * 8)) + 1;
+            
+            // Extra words to align the first block to the cache line
+            words.assign(blocksCount * BlockWords + BlockWords - 1, 0);
+            firstBlockIdx = getAlignedIdx(words.data());
+        }
+        
+        // Copies lay the blocks out again: the new buffer's offset to the cache line is usually different
+        blocked_bloom_filter(const blocked_bloom_filter& other)
+            : words(other.words.size(), 0), blocksCount(other.blocksCount), firstBlockIdx(0),
+              elementsCount(other.elementsCount), hash(other.hash)
+        {
+            firstBlockIdx = getAlignedIdx(words.data());
+            std::copy(other.getFirstBlock(), other.getFirstBlock() + blocksCount * BlockWords, words.begin() + firstBlockIdx);
+        }
+        
+        // Moves keep the buffer, so the blocks stay where they are
+        blocked_bloom_filter(blocked_bloom_filter&& other) = default;
+        
+        blocked_bloom_filter& operator=(const blocked_bloom_filter& other) {
+            if (this != &other) {
+                blocked_bloom_filter copy(other);
+                *this = std::move(copy);
+            }
+            return *this;
+        }
+        
+        blocked_bloom_filter& operator=(blocked_bloom_filter&& other) = default;
+        
+        void insert(const key_type& key) {
+            std::uint64_t code = filter_mix(hash(key));
+            std::uint64_t* block = getBlock(code);
+            
+            for (size_type i = 0; i < BlockWords; ++i) {
+                block[i] |= getBitMask(code, i);
+            }
+            ++elementsCount;
+        }
+        
+        template<typename InputIt>
+        void insert(InputIt first, InputIt last) {
+            for (; first != last; ++first) {
+                insert(*first);
+            }
+        }
+        
+        bool contains(const key_type& key) const {
+            std::uint64_t code = filter_mix(hash(key));
+            return testBlock(getBlock(code), code);
+        }
+        
+        //
+        // Batched lookup: hashes and prefetches the blocks of BatchGroupSize keys, then tests them
+        // Writes 'true' for every key of [first, last) which may be in the filter and 'false' otherwise
+        //
+        template<typename ForwardIt, typename OutputIt>
+        OutputIt contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+            std::uint64_t groupCodes[BatchGroupSize];
+            
+            while (first != last) {
+                int groupSize = 0;
+                for (; first != last && groupSize < BatchGroupSize; ++first, ++groupSize) {
+                    groupCodes[groupSize] = filter_mix(hash(*first));
+                    prefetch_read(getBlock(groupCodes[groupSize]));
+                }
+                
+                for (int i = 0; i < groupSize; ++i) {
+                    *out++ = testBlock(getBlock(groupCodes[i]), groupCodes[i]);
+                }
+            }
+            
+            return out;
+        }
+        
+        void clear() noexcept {
+            std::fill(words.begin(), words.end(), 0);
+            elementsCount = 0;
+        }
+        
+        // Insertions count (duplicates included)
+        size_type size() const noexcept {
+            return elementsCount;
+        }
+        
+        size_type memory_usage() const noexcept {
+            return blocksCount * BlockBytes;
+        }
+        
+        double bits_per_key() const noexcept {
+            return elementsCount == 0 ? 0.0 : 8.0 * memory_usage() / elementsCount;
+        }
+    
+    private:
+        static const int BatchGroupSize = 16;
+        
+        std::vector<std::uint64_t> words;
+        size_type blocksCount;
+        size_type firstBlockIdx; // words before the first cache line aligned block
+        size_type elementsCount;
+        Hash hash;
+        
+        // High half of the code selects the block, low half the bits
+        const std::uint64_t* getBlock(std::uint64_t code) const noexcept {
+            return getFirstBlock() + filter_reduce(static_cast<std::uint32_t>(code >> 32), static_cast<std::uint32_t>(blocksCount)) * BlockWords;
+        }
+        std::uint64_t* getBlock(std::uint64_t code) noexcept {
+            return const_cast<std::uint64_t*>(static_cast<const blocked_bloom_filter*>(this)->getBlock(code));
+        }
+        
+        const std::uint64_t* getFirstBlock() const noexcept {
+            return words.data() + firstBlockIdx;
+        }
+        
+        static size_type getAlignedIdx(const std::uint64_t* data) noexcept {
+            std::uintptr_t address = reinterpret_cast<std::uintptr_t>(data);
+            std::uintptr_t aligned = (address + BlockBytes - 1) / BlockBytes * BlockBytes;
+            return (aligned - address) / sizeof(std::uint64_t);
+        }
+        
+        // Bit of the i-th word: top 6 bits of the low code half multiplied by an odd salt
+        static std::uint64_t getBitMask(std::uint64_t code, size_type i) noexcept {
+            static const std::uint32_t Salts[BlockWords] = {
+                0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+            };
+            std::uint32_t bitIdx = (static_cast<std::uint32_t>(code) * Salts[i]) >> 26;
+            return std::uint64_t(1) << bitIdx;
+        }
+        
+        static bool testBlock(const std::uint64_t* block, std::uint64_t code) noexcept {
+            // No early exit: a branch-free loop of independent tests
+            std::uint64_t missing = 0;
+            for (size_type i = 0; i < BlockWords; ++i) {
+                std::uint64_t mask = getBitMask(code, i);
+                missing |= (block[i] & mask) ^ mask;
+            }
+            return missing == 0;
+        }
+    };
+    
+    //
+    // Xor filter (static): built once from a key set, ~1.23 * sizeof(Fingerprint) bytes per key
+    //
+    // Every key maps to three slots (one in each third of the table), the xor of the three slot
+    // fingerprints equals the key's fingerprint. Construction peels the keys off the 3-hypergraph
+    // and assigns the slots in the reverse order; it's retried with a new seed if the graph has a cycle.
+    // False-positive rate is 2^-(8 * sizeof(Fingerprint)).
+    // Build: O(n) expected
+    // Search: O(1), three memory accesses
+    //
+    template<typename Key, typename Hash = std::hash<Key>, typename Fingerprint = std::uint8_t>
+    class xor_filter {
+    public:
+        using key_type = Key;
+        using size_type = std::size_t;
+        
+        // Duplicate keys are allowed
+        template<typename InputIt>
+        xor_filter(InputIt first, InputIt last, const Hash& hash = Hash())
+            : seed(0), blockLength(0), elementsCount(0), hash(hash)
+        {
+            std::vector<std::uint64_t> codes;
+            for (; first != last; ++first) {
+                codes.push_back(this->hash(*first));
+            }
+            build(codes);
+        }
+        
+        xor_filter(std::initializer_list<Key> keys, const Hash& hash = Hash())
+            : xor_filter(keys.begin(), keys.end(), hash) {}
+        
+        bool contains(const key_type& key) const {
+            return testCode(filter_mix(hash(key), seed));
+        }
+        
+        //
+        // Batched lookup: hashes and prefetches the three slots of BatchGroupSize keys, then tests them
+        // Writes 'true' for every key of [first, last) which may be in the filter and 'false' otherwise
+        //
+        template<typename ForwardIt, typename OutputIt>
+        OutputIt contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+            std::uint64_t groupCodes[BatchGroupSize];
+            
+            while (first != last) {
+                int groupSize = 0;
+                for (; first != last && groupSize < BatchGroupSize; ++first, ++groupSize) {
+                    std::uint64_t code = filter_mix(hash(*first), seed);
+                    for (int i = 0; i < 3; ++i) {
+                        prefetch_read(fingerprints.data() + getSlot(code, i));
+                    }
+                    groupCodes[groupSize] = code;
+                }
+                
+                for (int i = 0; i < groupSize; ++i) {
+                    *out++ = testCode(groupCodes[i]);
+                }
+            }
+            
+            return out;
+        }
+        
+        // Distinct keys count
+        size_type size() const noexcept {
+            return elementsCount;
+        }
+        
+        size_type memory_usage() const noexcept {
+            return fingerprints.size() * sizeof(Fingerprint);
+        }
+        
+        double bits_per_key() const noexcept {
+            return elementsCount == 0 ? 0.0 : 8.0 * memory_usage() / elementsCount;
+        }
+    
+    private:
+        static const int BatchGroupSize = 16;
+        static const int MaxBuildAttempts = 64;
+        
+        std::vector<Fingerprint> fingerprints;
+        std::uint64_t seed;
+        std::uint32_t blockLength;
+        size_type elementsCount;
+        Hash hash;
+        
+        // Slot in the 'third'-th block: a different 32-bit window of the code for every block
+        size_type getSlot(std::uint64_t code, int third) const noexcept {
+            int rotation = 21 * third;
+            std::uint64_t rotated = rotation == 0 ? code : (code << rotation) | (code >> (64 - rotation));
+            return filter_reduce(static_cast<std::uint32_t>(rotated), blockLength) + static_cast<size_type>(third) * blockLength;
+        }
+        
+        static Fingerprint getFingerprint(std::uint64_t code) noexcept {
+            return static_cast<Fingerprint>(code ^ (code >> 32));
+        }
+        
+        bool testCode(std::uint64_t code) const noexcept {
+            Fingerprint expected = static_cast<Fingerprint>(fingerprints[getSlot(code, 0)] ^ fingerprints[getSlot(code, 1)] ^ fingerprints[getSlot(code, 2)]);
+            return getFingerprint(code) == expected;
+        }
+        
+        void build(std::vector<std::uint64_t>& hashCodes) {
+            // Equal codes would never peel off
+            std::sort(hashCodes.begin(), hashCodes.end());
+            hashCodes.erase(std::unique(hashCodes.begin(), hashCodes.end()), hashCodes.end());
+            elementsCount = hashCodes.size();
+            
+            size_type capacity = 32 + static_cast<size_type>(1.23 * elementsCount);
+            blockLength = static_cast<std::uint32_t>(capacity / 3);
+            capacity = 3 * static_cast<size_type>(blockLength);
+            
+            // Per slot: xor of the codes mapped to it and their count; a slot with one code reveals it
+            std::vector<std::uint64_t> slotCodes(capacity);
+            std::vector<std::uint32_t> slotCounts(capacity);
+            std::vector<size_type> queue;
+            std::vector<std::pair<std::uint64_t, size_type>> peeled; // code, its own slot
+            queue.reserve(capacity);
+            peeled.reserve(elementsCount);
+            
+            for (int attempt = 0; attempt < MaxBuildAttempts; ++attempt, ++seed) {
+                std::fill(slotCodes.begin(), slotCodes.end(), 0);
+                std::fill(slotCounts.begin(), slotCounts.end(), 0);
+                queue.clear();
+                peeled.clear();
+                
+                for (std::uint64_t hashCode : hashCodes) {
+                    std::uint64_t code = filter_mix(hashCode, seed);
+                    for (int i = 0; i < 3; ++i) {
+                        size_type slot = getSlot(code, i);
+                        slotCodes[slot] ^= code;
+                        ++slotCounts[slot];
+                    }
+                }
+                
+                for (size_type slot = 0; slot < capacity; ++slot) {
+                    if (slotCounts[slot] == 1)
+                        queue.push_back(slot);
+                }
+                
+                for (size_type queueIdx = 0; queueIdx < queue.size(); ++queueIdx) {
+                    size_type slot = queue[queueIdx];
+                    if (slotCounts[slot] != 1)
+                        continue; // already peeled via another slot
+                    
+                    std::uint64_t code = slotCodes[slot];
+                    peeled.push_back(std::make_pair(code, slot));
+                    
+                    for (int i = 0; i < 3; ++i) {
+                        size_type otherSlot = getSlot(code, i);
+                        slotCodes[otherSlot] ^= code;
+                        if (--slotCounts[otherSlot] == 1)
+                            queue.push_back(otherSlot);
+                    }
+                }
+                
+                if (peeled.size() == elementsCount) {
+                    assign(peeled, capacity);
+                    return;
+                }
+            }
+            
+            throw std::runtime_error("xor_filter: construction failed, hash function is too weak");
+        }
+        
+        // Reverse peeling order: the own slot of every key is the last of its three to be assigned
+        void assign(const std::vector<std::pair<std::uint64_t, size_type>>& peeled, size_type capacity) {
+            fingerprints.assign(capacity, 0);
+            
+            for (auto iter = peeled.rbegin(); iter != peeled.rend(); ++iter) {
+                std::uint64_t code = iter->first;
+                size_type slot = iter->second;
+                
+                fingerprints[slot] = static_cast<Fingerprint>(getFingerprint(code) ^ fingerprints[getSlot(code, 0)]
+                                                              ^ fingerprints[getSlot(code, 1)] ^ fingerprints[getSlot(code, 2)]);
+            }
+        }
+    };
+
+} // namespace lab
+
+#endif // AlgoAndData_data_filter_h
@@ -9,88 +9,328 @@
 #ifndef AlgoAndData_data_hash_map_h
 #define AlgoAndData_data_hash_map_h
 
+#include "pool_allocator.h"
+
 #include <iterator>
 #include <utility>
 #include <memory>
-#include <vector>
 #include <limits>
 #include <algorithm>
+#include <functional>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <cassert>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
 //#include <cstdio>
 
 namespace lab {
 	
+    //
+    // Transparent (heterogeneous lookup) helpers
+    //
+    // Hash and KeyEqual are considered transparent when both declare 'is_transparent',
+    // then find/count/erase accept any key type they can handle without building a key_type.
+    //
+    
+    template<typename T>
+    struct hash_map_void { using type = void; };
+    
+    template<typename T, typename = void>
+    struct is_transparent : std::false_type {};
+    
+    template<typename T>
+    struct is_transparent<T, typename hash_map_void<typename T::is_transparent>::type> : std::true_type {};
+    
+    // FNV-1a, same hash for std::string and C strings
+    struct string_hash {
+        using is_transparent = void;
+        
+        std::size_t operator()(const char* str) const noexcept {
+            return hashBytes(str, std::strlen(str));
+        }
+        std::size_t operator()(const std::string& str) const noexcept {
+            return hashBytes(str.data(), str.size());
+        }
+    
+    private:
+        static std::size_t hashBytes(const char* data, std::size_t length) noexcept {
+            std::uint64_t hashCode = 14695981039346656037ULL;
+            
+            for (std::size_t i = 0; i < length; ++i) {
+                hashCode ^= static_cast<unsigned char>(data[i]);
+                hashCode *= 1099511628211ULL;
+            }
+            return static_cast<std::size_t>(hashCode);
+        }
+    };
+    
+    struct string_equal {
+        using is_transparent = void;
+        
+        bool operator()(const std::string& left, const std::string& right) const noexcept {
+            return left == right;
+        }
+        bool operator()(const std::string& left, const char* right) const noexcept {
+            return left.compare(right) == 0;
+        }
+        bool operator()(const char* left, const std::string& right) const noexcept {
+            return right.compare(left) == 0;
+        }
+        bool operator()(const char* left, const char* right) const noexcept {
+            return std::strcmp(left, right) == 0;
+        }
+    };
+    
+    inline void prefetch_read(const void* address) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(address, 0, 3);
+#else
+        (void)address;
+#endif
+    }
+    
+    //
+    // Probing and growth policy of the open addressing tables
+    //
+    struct probing_policy {
+        static float max_load_factor() noexcept {
+            return 0.75f;
+        }
+        
+        // New table size = old size * growth_factor
+        static float growth_factor() noexcept {
+            return 2.25f;
+        }
+        
+        static std::size_t home_index(std::size_t hashCode, std::size_t tableSize) noexcept {
+            return hashCode % tableSize;
+        }
+        
+        // Linear probing
+        static std::size_t next_index(std::size_t index, std::size_t tableSize) noexcept {
+            return ++index == tableSize ? 0 : index;
+        }
+        
+        // Steps from the home bucket to the 'index' one
+        static std::size_t probe_length(std::size_t homeIndex, std::size_t index, std::size_t tableSize) noexcept {
+            return index >= homeIndex ? index - homeIndex : index + tableSize - homeIndex;
+        }
+    };
+    
+    //
+    // Probe lengths of the elements: counts[0] is the elements in their home buckets,
+    // counts[i] the ones with lengths in [2^(i-1), 2^i), the last bucket is open ended
+    //
+    struct probe_length_histogram {
+        static const int BucketsCount = 8;
+        
+        std::size_t counts[BucketsCount];
+        
+        probe_length_histogram() noexcept {
+            clear();
+        }
+        
+        void add(std::size_t length) noexcept {
+            ++counts[getBucket(length)];
+        }
+        
+        void remove(std::size_t length) noexcept {
+            assert(counts[getBucket(length)] > 0);
+            --counts[getBucket(length)];
+        }
+        
+        void clear() noexcept {
+            std::fill(counts, counts + BucketsCount, 0);
+        }
+        
+        static int getBucket(std::size_t length) noexcept {
+            int bucket = 0;
+            for (; length > 0 && bucket < BucketsCount - 1; length >>= 1) {
+                ++bucket;
+            }
+            return bucket;
+        }
+    };
+    
+    //
+    // Table occupancy, every field is maintained on insertions and erasures: taking stats is O(1)
+    //
+    struct hash_map_stats {
+        std::size_t size;
+        std::size_t capacity;       // buckets
+        std::size_t tombstones;
+        float load_factor;          // size / capacity
+        std::size_t memory_usage;   // bytes, see hash_map::memory_usage
+        probe_length_histogram probe_lengths;
+    };
+    
     //
     // Open addressing (closed hashing) hash table, linear probing
     //
     
+    //
+    // Bucket state, one byte per bucket
+    //
+    enum class bucket_control : std::uint8_t {
+        Empty = 0,
+        Full = 1,
+        Deleted = 2  // tombstone: probe chains continue over it
+    };
+    
+    //
+    // Buckets are kept as a structure of arrays: control bytes apart from the raw value slots.
+    // Occupancy scans (iteration, probing over tombstones) stream the control bytes only,
+    // and slots carry no per-bucket flags with their padding.
+    // A value exists only while its bucket is Full: Empty and Deleted slots hold nothing,
+    // so Value doesn't have to be default constructible and empty capacity costs no Value constructions.
+    //
     template<typename Value>
-    struct Bucket {
-        bool is_busy;
-        bool is_deleted;
-        Value contents;
+    struct Bucket_table {
+        using Slot_type = typename std::aligned_storage<sizeof(Value), alignof(Value)>::type;
+        
+        Slot_type* slots;
+        bucket_control* controls;
+        
+        Bucket_table() noexcept : slots(nullptr), controls(nullptr) {}
+        
+        // Holds a value or a tombstone
+        bool isBusy(std::size_t index) const noexcept {
+            return controls[index] != bucket_control::Empty;
+        }
+        
+        bool isDeleted(std::size_t index) const noexcept {
+            return controls[index] == bucket_control::Deleted;
+        }
+        
+        bool isActive(std::size_t index) const noexcept {
+            return controls[index] == bucket_control::Full;
+        }
+        
+        Value& contents(std::size_t index) noexcept {
+            return *reinterpret_cast<Value*>(slots + index);
+        }
+        const Value& contents(std::size_t index) const noexcept {
+            return *reinterpret_cast<const Value*>(slots + index);
+        }
         
-        void makeActive(const Value& value) {
-            assert(!isActive());
+        template<typename... Args>
+        void makeActive(std::size_t index, Args&&... args) {
+            assert(!isActive(index));
             
-            is_busy = true;
-            is_deleted = false;
-            contents = value;
+            ::new (static_cast<void*>(slots + index)) Value(std::forward<Args>(args)...);
+            controls[index] = bucket_control::Full;
         }
         
-        bool isActive() const noexcept {
-            return is_busy && !is_deleted;
+        // Destroys the value, the bucket becomes a tombstone
+        void markAsDeleted(std::size_t index) noexcept {
+            assert(isActive(index));
+            
+            contents(index).~Value();
+            controls[index] = bucket_control::Deleted;
+        }
+        
+        // Destroys the value, the bucket becomes empty (for tables without tombstones)
+        void makeEmpty(std::size_t index) noexcept {
+            assert(isActive(index));
+            
+            contents(index).~Value();
+            controls[index] = bucket_control::Empty;
         }
         
-        void markAsDeleted() noexcept {
-            is_deleted = true;
+        // Moves the value to the 'target' bucket (empty or deleted one), this bucket becomes a tombstone
+        void moveTo(std::size_t index, Bucket_table& target, std::size_t targetIndex) {
+            assert(isActive(index) && !target.isActive(targetIndex));
+            
+            target.makeActive(targetIndex, std::move(contents(index)));
+            markAsDeleted(index);
         }
     };
     
+    //
+    // Returns the first Full control byte at or after 'first'
+    // Control arrays end with ControlsPadding Full sentinel bytes, so the scan needs no bounds:
+    // a result past the last bucket means there are no more active ones.
+    //
+    static const std::size_t ControlsPadding = sizeof(std::uint64_t);
+    
+    inline const bucket_control* find_full_control(const bucket_control* first) noexcept {
+        // Dense tables: the next bucket is the usual answer
+        if (*first == bucket_control::Full)
+            return first;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && (defined(__GNUC__) || defined(__clang__))
+        // Word at a time: bytes equal to Full become zero bytes, then the lowest zero byte is found
+        const std::uint64_t Ones = 0x0101010101010101ULL;
+        const std::uint64_t Highs = 0x8080808080808080ULL;
+        const std::uint64_t FullBytes = Ones * static_cast<std::uint8_t>(bucket_control::Full);
+        
+        while (true) {
+            std::uint64_t word;
+            std::memcpy(&word, first, sizeof(word));
+            
+            std::uint64_t diff = word ^ FullBytes;
+            std::uint64_t zeroBytes = (diff - Ones) & ~diff & Highs;
+            if (zeroBytes != 0)
+                return first + (__builtin_ctzll(zeroBytes) >> 3);
+            
+            first += sizeof(word);
+        }
+#else
+        while (*first != bucket_control::Full)
+            ++first;
+        return first;
+#endif
+    }
+    
     ///// Iterators
     /// Base class for node iterators.
-    template<typename Value, typename node_type>
+    /// 'current' and 'end' point to the control bytes, 'slot' is the value slot of 'current'
+    template<typename Value, typename slot_pointer>
     struct Bucket_iterator_base
     {
-        using bucket_type = Bucket<Value>;
-        node_type current;
-        node_type end;
+        const bucket_control* current;
+        const bucket_control* end;
+        slot_pointer slot;
         
-        Bucket_iterator_base(node_type curNode, node_type endNode)
-            : current(curNode), end(endNode) {}
+        Bucket_iterator_base(const bucket_control* curControl, const bucket_control* endControl, slot_pointer curSlot)
+            : current(curControl), end(endControl), slot(curSlot) {}
         
         void incr() {
             if (current == end)
                 return;
-
-            while (current != end) {
-                ++current;
-                
-                if (current->is_deleted)
-                    continue;
-                if (current->is_busy)
-                    break;
-            }
+            
+            const bucket_control* next = find_full_control(current + 1);
+            if (next > end)
+                next = end;
+            
+            slot += next - current;
+            current = next;
         }
     };
     
-    template<typename Value, typename node_type>
+    template<typename Value, typename slot_pointer>
     inline bool
-    operator==(const Bucket_iterator_base<Value, node_type>& x,
-               const Bucket_iterator_base<Value, node_type>& y)
+    operator==(const Bucket_iterator_base<Value, slot_pointer>& x,
+               const Bucket_iterator_base<Value, slot_pointer>& y)
     { return x.current == y.current && x.end == y.end; }
     
-    template<typename Value, typename node_type>
+    template<typename Value, typename slot_pointer>
     inline bool
-    operator!=(const Bucket_iterator_base<Value, node_type>& x,
-               const Bucket_iterator_base<Value, node_type>& y)
+    operator!=(const Bucket_iterator_base<Value, slot_pointer>& x,
+               const Bucket_iterator_base<Value, slot_pointer>& y)
     { return x.current != y.current || x.end != y.end; }
     
     /// Node iterators, used to iterate through all the hashtable.
-    template<typename Value, typename node_type>
-    struct Bucket_iterator : public Bucket_iterator_base<Value, node_type>
+    template<typename Value, typename slot_pointer>
+    struct Bucket_iterator : public Bucket_iterator_base<Value, slot_pointer>
     {
     private:
-        using base_type = Bucket_iterator_base<Value, node_type>;
+        using base_type = Bucket_iterator_base<Value, slot_pointer>;
         
     public:
         using value_type = Value;
@@ -100,18 +340,19 @@ namespace lab {
         using pointer = Value*;
         using reference = Value&;
         
-        Bucket_iterator(node_type curNode, node_type endNode) : base_type(curNode, endNode) {}
+        Bucket_iterator(const bucket_control* curControl, const bucket_control* endControl, slot_pointer curSlot)
+            : base_type(curControl, endControl, curSlot) {}
         
         reference
         operator*() const
         {
-            return reinterpret_cast<reference>(this->current->contents);
+            return *reinterpret_cast<pointer>(this->slot);
         }
         
         pointer
         operator->() const
         {
-            return reinterpret_cast<pointer>(std::addressof(this->current->contents));
+            return reinterpret_cast<pointer>(this->slot);
         }
         
         Bucket_iterator&
@@ -130,11 +371,11 @@ namespace lab {
         }
     };
     
-    template<typename Value, typename node_type>
-    struct Bucket_const_iterator : public Bucket_iterator_base<Value, node_type>
+    template<typename Value, typename slot_pointer>
+    struct Bucket_const_iterator : public Bucket_iterator_base<Value, slot_pointer>
     {
     private:
-        using base_type = Bucket_iterator_base<Value, node_type>;
+        using base_type = Bucket_iterator_base<Value, slot_pointer>;
         
     public:
         using value_type = Value;
@@ -144,21 +385,23 @@ namespace lab {
         using pointer = const Value*;
         using reference = const Value&;
         
-        Bucket_const_iterator(node_type curNode, node_type endNode) : base_type(curNode, endNode) {}
+        Bucket_const_iterator(const bucket_control* curControl, const bucket_control* endControl, slot_pointer curSlot)
+            : base_type(curControl, endControl, curSlot) {}
         
-        Bucket_const_iterator(const Bucket_iterator<Value, node_type>& other) :
-            base_type(other.current, other.end) {}
+        template<typename Other_slot_pointer>
+        Bucket_const_iterator(const Bucket_iterator<Value, Other_slot_pointer>& other) :
+            base_type(other.current, other.end, other.slot) {}
         
         reference
         operator*() const
         {
-            return reinterpret_cast<reference>(this->current->contents);
+            return *reinterpret_cast<pointer>(this->slot);
         }
         
         pointer
         operator->() const
         {
-            return reinterpret_cast<pointer>(std::addressof(this->current->contents));
+            return reinterpret_cast<pointer>(this->slot);
         }
         
         Bucket_const_iterator&
@@ -178,20 +421,58 @@ namespace lab {
     };
     ///// Iterators
     
+    //
+    // Flat snapshot format (hash_map::save, mapped_hash_map::open)
+    //
+    // | header | control bytes (bucket_control) | padding up to SnapshotAlignment | slot array |
+    //
+    // The table layout is kept as is (tombstones included), so probe chains of the snapshot
+    // are the ones of the saved map and lookups need the same Hash: it must give the same codes
+    // in every process (std::hash of integers does, pointers or seeded hashes don't).
+    //
+    
+    struct hash_map_snapshot_header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t slotSize;
+        std::uint32_t keySize;
+        std::uint32_t mappedSize;
+        std::uint64_t capacity;
+        std::uint64_t elementsCount;
+        std::uint64_t slotsOffset;
+        
+        static const char* signature() noexcept {
+            return "LABHMAP";
+        }
+        
+        static const std::uint32_t CurrentVersion = 1;
+        static const std::uint64_t SnapshotAlignment = 64;
+    };
+    
+    // Keys and values are stored by their bytes, hence trivially copyable types only
+    template<typename Key, typename T>
+    struct hash_map_snapshot_slot {
+        Key first;
+        T second;
+    };
+    
     
     template<
         typename Key,
         typename T,
         typename Hash = std::hash<Key>,
         typename KeyEqual = std::equal_to<Key>,
-        typename Allocator = std::allocator< std::pair<const Key, T> >
+        typename Allocator = pool_allocator< std::pair<const Key, T> >
     >
     class hash_map {
     private:
         using internal_value_type = std::pair<Key, T>;
-        using Bucket_type = Bucket<internal_value_type>;
-        using Bucket_allocator_type = typename Allocator::template rebind<Bucket_type>::other;
-        using BucketArray = std::vector<Bucket_type, Bucket_allocator_type>;
+        using Bucket_table_type = Bucket_table<internal_value_type>;
+        using Slot_type = typename Bucket_table_type::Slot_type;
+        using Bucket_allocator_type = typename Allocator::template rebind<Slot_type>::other;
+        
+        template<typename K>
+        using transparent_key = typename std::enable_if<is_transparent<Hash>::value && is_transparent<KeyEqual>::value, K>::type;
         
     public:
         using key_type = Key;
@@ -199,22 +480,84 @@ namespace lab {
         using value_type = std::pair<const Key, T>;
         using size_type = std::size_t;
         
-        using iterator = Bucket_iterator<value_type, typename BucketArray::iterator>;
-        using const_iterator = Bucket_const_iterator<value_type, typename BucketArray::const_iterator>;
+        using iterator = Bucket_iterator<value_type, Slot_type*>;
+        using const_iterator = Bucket_const_iterator<value_type, const Slot_type*>;
         
-        hash_map() : hash_map(10) {}
+        hash_map() : hash_map(DefaultBucketCount) {}
         
         explicit hash_map( size_type bucket_count,
                           const Hash& hash = Hash(),
                           const KeyEqual& equal = KeyEqual(),
                           const Allocator& alloc = Allocator() )
+            : array_size(0), elementsCount(0), tombstonesCount(0), firstActiveHint(0),
+              hash(hash), keyEqual(equal), bucketAllocator(alloc)
         {
-            this->array_size = bucket_count;
-            this->elementsCount = 0;
-            this->hash = hash;
-            this->keyEqual = keyEqual;
+            buckets = allocateBuckets(bucket_count);
+            array_size = bucket_count;
+            firstActiveHint = array_size;
+        }
+        
+        hash_map(const hash_map& other)
+            : array_size(0), elementsCount(0), tombstonesCount(other.tombstonesCount),
+              probeLengths(other.probeLengths), firstActiveHint(other.firstActiveHint),
+              hash(other.hash), keyEqual(other.keyEqual),
+              bucketAllocator(std::allocator_traits<Bucket_allocator_type>::select_on_container_copy_construction(other.bucketAllocator))
+        {
+            buckets = allocateBuckets(other.array_size);
+            array_size = other.array_size;
             
-            bucket_array.resize(array_size);
+            // Same layout as 'other': active buckets are copied, tombstones are kept as is
+            try {
+                for (size_type i = 0; i < array_size; ++i) {
+                    if (other.buckets.isActive(i)) {
+                        buckets.makeActive(i, other.buckets.contents(i));
+                        ++elementsCount;
+                    } else {
+                        buckets.controls[i] = other.buckets.controls[i];
+                    }
+                }
+            } catch(...) {
+                releaseBuckets();
+                throw;
+            }
+        }
+        
+        // The allocator is moved too: the moved-from map doesn't share the pool (that would keep release_all
+        // from dropping it), a pool_allocator gets a new one on its first allocation
+        hash_map(hash_map&& other) noexcept
+            : buckets(other.buckets), array_size(other.array_size), elementsCount(other.elementsCount),
+              tombstonesCount(other.tombstonesCount), probeLengths(other.probeLengths),
+              firstActiveHint(other.firstActiveHint),
+              hash(std::move(other.hash)), keyEqual(std::move(other.keyEqual)), bucketAllocator(std::move(other.bucketAllocator))
+        {
+            other.buckets = Bucket_table_type();
+            other.array_size = 0;
+            other.elementsCount = 0;
+            other.tombstonesCount = 0;
+            other.probeLengths.clear();
+            other.firstActiveHint = 0;
+        }
+        
+        hash_map& operator=(hash_map other) noexcept {
+            swap(other);
+            return *this;
+        }
+        
+        ~hash_map() {
+            releaseBuckets();
+        }
+        
+        void swap(hash_map& other) noexcept {
+            using std::swap;
+            swap(buckets, other.buckets);
+            swap(array_size, other.array_size);
+            swap(elementsCount, other.elementsCount);
+            swap(tombstonesCount, other.tombstonesCount);
+            swap(probeLengths, other.probeLengths);
+            swap(firstActiveHint, other.firstActiveHint);
+            swap(hash, other.hash);
+            swap(keyEqual, other.keyEqual);
+            swap(bucketAllocator, other.bucketAllocator);
         }
         
         // Lookup
@@ -222,99 +565,184 @@ namespace lab {
         // TODO implement 'at'
         
         T& operator[](const key_type& key) {
-            std::size_t index = getIndex(key);
-            
-            if (bucket_array[index].isActive()) {
-                // Found existing entry
-                return bucket_array[index].contents.second;
-            }
-            
-            // Entry with provided key not found, creating one
-            iterator iter = insertImpl(index, std::make_pair(key, T{}));
-            return iter->second;
+            return try_emplace(key).first->second;
+        }
+        
+        T& operator[](key_type&& key) {
+            return try_emplace(std::move(key)).first->second;
         }
         
         iterator find(const Key& key) {
-            std::size_t index = getIndex(key);
-            
-            if (!bucket_array[index].isActive()) {
-                // Element not found
-                return end();
-            }
-            
-            return iterator { bucket_array.begin() + index, bucket_array.end() };
+            return findImpl(key);
         }
         
         const_iterator find(const Key& key) const {
-            std::size_t index = getIndexLookup(key);
-            
-            if (!bucket_array[index].isActive()) {
-                // Element not found
-                return end();
-            }
-            
-            return const_iterator { bucket_array.begin() + index, bucket_array.end() };
+            return findImpl(key);
+        }
+        
+        template<typename K, typename = transparent_key<K>>
+        iterator find(const K& key) {
+            return findImpl(key);
+        }
+        
+        template<typename K, typename = transparent_key<K>>
+        const_iterator find(const K& key) const {
+            return findImpl(key);
         }
         
         size_type count(const Key& key) const {
-            std::size_t index = getIndexLookup(key);
-            
-            if (!bucket_array[index].isActive()) {
-                // Element not found
-                return 0;
-            }
-            return 1;
+            return countImpl(key);
+        }
+        
+        template<typename K, typename = transparent_key<K>>
+        size_type count(const K& key) const {
+            return countImpl(key);
+        }
+        
+        //
+        // Batched lookup (group prefetching)
+        //
+        // Keys are processed in groups of BatchGroupSize: the first pass hashes every key of the group
+        // and prefetches its home bucket, the second pass probes. Cache misses of the whole group
+        // overlap instead of being paid one after another, which pays off for tables larger than the LLC.
+        // Writes a const_iterator (end() if not found) for every key of [first, last) to 'out'.
+        //
+        template<typename ForwardIt, typename OutputIt>
+        OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+            return lookupBatch(first, last, out, [this](std::size_t index) -> const_iterator {
+                if (index == array_size || !buckets.isActive(index))
+                    return end();
+                return iteratorAt(index);
+            });
+        }
+        
+        // Same as find_batch, writes 'true' for every found key and 'false' otherwise
+        template<typename ForwardIt, typename OutputIt>
+        OutputIt contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+            return lookupBatch(first, last, out, [this](std::size_t index) -> bool {
+                return index != array_size && buckets.isActive(index);
+            });
         }
         
         // Modifiers
         
         std::pair<iterator, bool> insert(const value_type& value) {
-            std::size_t index = getIndex(value.first);
-            
-            if (bucket_array[index].isActive()) {
-                // Insertion prevented by the existing element
-                iterator iter { bucket_array.begin() + index, bucket_array.end() };
-                return std::make_pair(iter, false);
-            }
-            
-            iterator iter = insertImpl(index, value);
-            return std::make_pair(iter, true);
+            return try_emplace(value.first, value.second);
+        }
+        
+        std::pair<iterator, bool> insert(value_type&& value) {
+            // 'first' is const in value_type, so the key is copied while the mapped value is moved
+            return try_emplace(value.first, std::move(value.second));
+        }
+        
+        template<typename P, typename = typename std::enable_if<std::is_constructible<value_type, P&&>::value>::type>
+        std::pair<iterator, bool> insert(P&& value) {
+            return emplace(std::forward<P>(value));
+        }
+        
+        //
+        // The key is unknown until the value is constructed, so it's built aside once
+        // and moved into the bucket if the key is absent. Prefer try_emplace when the key is at hand.
+        //
+        template<typename... Args>
+        std::pair<iterator, bool> emplace(Args&&... args) {
+            internal_value_type value(std::forward<Args>(args)...);
+            return try_emplace(std::move(value.first), std::move(value.second));
+        }
+        
+        //
+        // Mapped value is constructed from 'args' only if the key is absent,
+        // otherwise 'args' are left untouched
+        //
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args) {
+            return tryEmplaceImpl(key, std::forward<Args>(args)...);
+        }
+        
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args) {
+            return tryEmplaceImpl(std::move(key), std::forward<Args>(args)...);
+        }
+        
+        template<typename M>
+        std::pair<iterator, bool> insert_or_assign(const key_type& key, M&& obj) {
+            return insertOrAssignImpl(key, std::forward<M>(obj));
+        }
+        
+        template<typename M>
+        std::pair<iterator, bool> insert_or_assign(key_type&& key, M&& obj) {
+            return insertOrAssignImpl(std::move(key), std::forward<M>(obj));
         }
         
         iterator erase(const_iterator pos) {
-            typename BucketArray::iterator bucketArrIter = bucket_array.begin();
-            std::advance(bucketArrIter, std::distance(bucket_array.cbegin(), pos.current));
-            
-            iterator iter { bucketArrIter , bucket_array.end() };
-            return eraseImpl(iter);
+            return eraseImpl(static_cast<size_type>(pos.current - buckets.controls));
         }
         
         size_type erase(const key_type& key) {
-            iterator iter = find(key);
-            
-            if (iter == end()) {
-                // An element with provided key isn't found to erase
-                return 0;
-            }
-            
-            eraseImpl(iter);
-            return 1;
+            return eraseKeyImpl(key);
+        }
+        
+        template<typename K, typename = transparent_key<K>>
+        size_type erase(const K& key) {
+            return eraseKeyImpl(key);
         }
         
         void rehash(size_type newSize) {
             rehashImpl(newSize);
         }
         
+        // Rebuilds the table with the smallest size for the current elements, dropping the tombstones
+        void shrink_to_fit() {
+            rehashImpl(0);
+        }
+        
+        // Capacity is kept
         void clear() noexcept {
+            for (size_type i = 0; i < array_size; ++i) {
+                if (buckets.isActive(i))
+                    buckets.markAsDeleted(i);
+            }
+            
+            if (array_size > 0)
+                std::memset(buckets.controls, 0, array_size * sizeof(bucket_control));
+            elementsCount = 0;
+            tombstonesCount = 0;
+            probeLengths.clear();
+            firstActiveHint = array_size;
+        }
+        
+        //
+        // Fast clear: values are destroyed only if their destructors aren't trivial,
+        // then the bucket array is freed and a releasable allocator (pool_allocator)
+        // drops everything it holds at once, unless its pool is shared with other containers.
+        // The map gets a default sized bucket array.
+        //
+        void release_all() {
+            if (!std::is_trivially_destructible<internal_value_type>::value) {
+                for (size_type i = 0; i < array_size; ++i) {
+                    if (buckets.isActive(i))
+                        buckets.markAsDeleted(i);
+                }
+            }
+            
+            deallocateBuckets(buckets, array_size);
+            buckets = Bucket_table_type();
             array_size = 0;
-            bucket_array.clear(); // still keeps memory busy
             elementsCount = 0;
+            tombstonesCount = 0;
+            probeLengths.clear();
+            
+            releaseAllocator(is_releasable_allocator<Bucket_allocator_type>{});
+            
+            buckets = allocateBuckets(DefaultBucketCount);
+            array_size = DefaultBucketCount;
+            firstActiveHint = array_size;
         }
         
         // Capacity
         
         bool empty() const noexcept {
-            return elementsCount > 0;
+            return elementsCount == 0;
         }
         
         size_type size() const noexcept {
@@ -326,48 +754,260 @@ namespace lab {
         }
         
         float max_load_factor() const {
-            return 0.75f;
+            return probing_policy::max_load_factor();
+        }
+        
+        size_type bucket_count() const noexcept {
+            return array_size;
+        }
+        
+        // Bytes taken by the bucket array: a slot and a control byte per bucket
+        size_type memory_usage() const noexcept {
+            return getAllocationSize(array_size) * sizeof(Slot_type);
+        }
+        
+        // O(1): the counters are kept up to date by the modifiers, no table scans
+        hash_map_stats stats() const noexcept {
+            hash_map_stats result;
+            result.size = elementsCount;
+            result.capacity = array_size;
+            result.tombstones = tombstonesCount;
+            result.load_factor = array_size > 0 ? static_cast<float>(elementsCount) / array_size : 0.0f;
+            result.memory_usage = memory_usage();
+            result.probe_lengths = probeLengths;
+            return result;
         }
         
         // Iterators
         
         iterator begin() noexcept {
-            return iterator(getFirstBucket(), bucket_array.end());
+            return iteratorAt(getFirstBucket());
         }
         
         const_iterator begin() const noexcept {
-            return const_iterator(getFirstBucket(), bucket_array.end());
+            return iteratorAt(getFirstBucket());
         }
         
         iterator end() noexcept {
-            return iterator(bucket_array.end(), bucket_array.end());
+            return iteratorAt(array_size);
         }
         
         const_iterator end() const noexcept {
-            return const_iterator(bucket_array.end(), bucket_array.end());
+            return iteratorAt(array_size);
         }
         
         const_iterator cbegin() const noexcept {
-            return const_iterator(getFirstBucket(), bucket_array.end());
+            return iteratorAt(getFirstBucket());
         }
         
         const_iterator cend() const noexcept {
-            return const_iterator(bucket_array.end(), bucket_array.end());
+            return iteratorAt(array_size);
+        }
+        
+        // Snapshot
+        
+        //
+        // Writes the table to 'path' in the flat snapshot format (see hash_map_snapshot_header),
+        // the file is served by mapped_hash_map without any deserialization.
+        // Throws std::runtime_error if the file can't be written.
+        //
+        void save(const std::string& path) const {
+            static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<T>::value,
+                          "Key and T must be trivially copyable to be saved");
+            
+            using Snapshot_slot_type = hash_map_snapshot_slot<Key, T>;
+            
+            hash_map_snapshot_header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, hash_map_snapshot_header::signature(), sizeof(header.magic));
+            header.version = hash_map_snapshot_header::CurrentVersion;
+            header.slotSize = sizeof(Snapshot_slot_type);
+            header.keySize = sizeof(Key);
+            header.mappedSize = sizeof(T);
+            header.capacity = array_size;
+            header.elementsCount = elementsCount;
+            
+            const std::uint64_t alignment = hash_map_snapshot_header::SnapshotAlignment;
+            header.slotsOffset = (sizeof(header) + array_size + alignment - 1) / alignment * alignment;
+            
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if (!file)
+                throw std::runtime_error("hash_map::save: can't open " + path);
+            
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            
+            // Control bytes are written as they are, then padding and slots (through a chunk buffer)
+            if (array_size > 0)
+                file.write(reinterpret_cast<const char*>(buckets.controls), array_size);
+            
+            const size_type ChunkSize = 4096;
+            std::vector<char> buffer(ChunkSize * sizeof(Snapshot_slot_type), 0);
+            file.write(buffer.data(), header.slotsOffset - sizeof(header) - array_size);
+            
+            for (size_type chunkStart = 0; chunkStart < array_size; chunkStart += ChunkSize) {
+                size_type chunkEnd = std::min(chunkStart + ChunkSize, array_size);
+                Snapshot_slot_type* slots = reinterpret_cast<Snapshot_slot_type*>(buffer.data());
+                
+                for (size_type i = chunkStart; i < chunkEnd; ++i) {
+                    Snapshot_slot_type& slot = slots[i - chunkStart];
+                    
+                    if (buckets.isActive(i)) {
+                        std::memcpy(&slot.first, &buckets.contents(i).first, sizeof(Key));
+                        std::memcpy(&slot.second, &buckets.contents(i).second, sizeof(T));
+                    } else {
+                        std::memset(&slot, 0, sizeof(Snapshot_slot_type));
+                    }
+                }
+                file.write(buffer.data(), (chunkEnd - chunkStart) * sizeof(Snapshot_slot_type));
+            }
+            
+            file.flush();
+            if (!file)
+                throw std::runtime_error("hash_map::save: can't write " + path);
         }
         
     private:
         
-        std::size_t getHashCode(const Key& key) const {
+        template<typename K>
+        std::size_t getHashCode(const K& key) const {
             return hash(key);
         }
         
         std::size_t getBucketIndex(size_t hashCode) const {
-            return hashCode % array_size;
+            return probing_policy::home_index(hashCode, array_size);
         }
-        std::size_t getBucketIndex(const key_type& key) const {
+        template<typename K>
+        std::size_t getBucketIndex(const K& key) const {
             return getBucketIndex(getHashCode(key));
         }
         
+        template<typename K>
+        iterator findImpl(const K& key) {
+            if (array_size == 0)
+                return end();
+            
+            std::size_t index = getIndex(key);
+            
+            if (!buckets.isActive(index)) {
+                // Element not found
+                return end();
+            }
+            
+            return iteratorAt(index);
+        }
+        
+        template<typename K>
+        const_iterator findImpl(const K& key) const {
+            if (array_size == 0)
+                return end();
+            
+            std::size_t index = getIndexLookup(key);
+            
+            if (!buckets.isActive(index)) {
+                // Element not found
+                return end();
+            }
+            
+            return iteratorAt(index);
+        }
+        
+        template<typename K>
+        size_type countImpl(const K& key) const {
+            if (array_size == 0)
+                return 0;
+            
+            std::size_t index = getIndexLookup(key);
+            
+            if (!buckets.isActive(index)) {
+                // Element not found
+                return 0;
+            }
+            return 1;
+        }
+        
+        template<typename ForwardIt, typename OutputIt, typename ResultFunc>
+        OutputIt lookupBatch(ForwardIt first, ForwardIt last, OutputIt out, ResultFunc result) const {
+            ForwardIt groupKeys[BatchGroupSize];
+            std::size_t groupIndices[BatchGroupSize];
+            
+            if (array_size == 0) {
+                for (; first != last; ++first)
+                    *out++ = result(array_size); // not found
+                return out;
+            }
+            
+            while (first != last) {
+                // Hash & prefetch pass
+                int groupSize = 0;
+                for (; first != last && groupSize < BatchGroupSize; ++first, ++groupSize) {
+                    std::size_t bucketIdx = getBucketIndex(*first);
+                    prefetch_read(buckets.controls + bucketIdx);
+                    prefetch_read(buckets.slots + bucketIdx);
+                    
+                    groupKeys[groupSize] = first;
+                    groupIndices[groupSize] = bucketIdx;
+                }
+                
+                // Probe pass, home buckets are (hopefully) in cache already
+                for (int i = 0; i < groupSize; ++i) {
+                    *out++ = result(getIndexLookup(*groupKeys[i], groupIndices[i]));
+                }
+            }
+            
+            return out;
+        }
+        
+        template<typename K>
+        size_type eraseKeyImpl(const K& key) {
+            if (array_size == 0)
+                return 0;
+            
+            std::size_t bucketIdx = getBucketIndex(key);
+            std::size_t index = getIndexLookup(key, bucketIdx);
+            
+            if (!buckets.isActive(index)) {
+                // An element with provided key isn't found to erase
+                return 0;
+            }
+            
+            eraseImpl(index, bucketIdx);
+            return 1;
+        }
+        
+        template<typename K, typename... Args>
+        std::pair<iterator, bool> tryEmplaceImpl(K&& key, Args&&... args) {
+            if (array_size == 0)
+                rehashImpl(DefaultBucketCount); // moved-from or zero sized map
+            
+            std::size_t hashCode = getHashCode(key);
+            std::size_t index = getIndex(key, getBucketIndex(hashCode));
+            
+            if (buckets.isActive(index)) {
+                // Insertion prevented by the existing element
+                return std::make_pair(iteratorAt(index), false);
+            }
+            
+            iterator iter = insertImpl(index, hashCode, std::forward<K>(key), std::forward<Args>(args)...);
+            return std::make_pair(iter, true);
+        }
+        
+        template<typename K, typename M>
+        std::pair<iterator, bool> insertOrAssignImpl(K&& key, M&& obj) {
+            if (array_size == 0)
+                rehashImpl(DefaultBucketCount); // moved-from or zero sized map
+            
+            std::size_t hashCode = getHashCode(key);
+            std::size_t index = getIndex(key, getBucketIndex(hashCode));
+            
+            if (buckets.isActive(index)) {
+                buckets.contents(index).second = std::forward<M>(obj);
+                return std::make_pair(iteratorAt(index), false);
+            }
+            
+            iterator iter = insertImpl(index, hashCode, std::forward<K>(key), std::forward<M>(obj));
+            return std::make_pair(iter, true);
+        }
+        
         //
         // Returns:
         //  - If node found:
@@ -380,26 +1020,31 @@ namespace lab {
         //      - !is_busy || (is_busy && is_deleted)
         //  - Found existing:
         //      - is_busy && !is_deleted
-        std::size_t getIndex(const key_type& key) {
-            std::size_t bucketIdx = getBucketIndex(key);
+        template<typename K>
+        std::size_t getIndex(const K& key) {
+            return getIndex(key, getBucketIndex(key));
+        }
+        
+        // Probing from the precomputed home bucket 'bucketIdx'
+        template<typename K>
+        std::size_t getIndex(const K& key, std::size_t bucketIdx) {
             size_t index = bucketIdx;
             bool circle_run = false;
             bool foundDeletedNode = false;
             size_t deletedNodeIndex = 0;
             
-            while (bucket_array[index].is_busy && !circle_run) {
-                if (!foundDeletedNode && bucket_array[index].is_deleted) {
-                    foundDeletedNode = true;
-                    deletedNodeIndex = index;
-                }
-                
-                if (keyEqual(key, bucket_array[index].contents.first))
+            while (buckets.isBusy(index) && !circle_run) {
+                if (buckets.isDeleted(index)) {
+                    // Tombstone doesn't hold a value, remember the first one as an insertion proposal
+                    if (!foundDeletedNode) {
+                        foundDeletedNode = true;
+                        deletedNodeIndex = index;
+                    }
+                } else if (keyEqual(key, buckets.contents(index).first)) {
                     break;
-                ++index;
-                
-                if (index == array_size) {
-                    index = 0;
                 }
+                index = probing_policy::next_index(index, array_size);
+                
                 if (index == bucketIdx) {
                     circle_run = true;
                 }
@@ -414,18 +1059,18 @@ namespace lab {
                 return deletedNodeIndex;
             }
             
-            if (bucket_array[index].is_busy) {
-                // Found something...
-                if (bucket_array[index].is_deleted) {
-                    // Entry is deleted already
-                    // Swap with first found 'is_deleted' and return as an insertion proposal
-                } else {
-                    // Found existing entry
-                    // Swap with first found 'is_deleted' and return
-                }
+            if (buckets.isBusy(index)) {
+                // Found existing entry
+                // Move it to the first found 'is_deleted' and return
+                assert(!buckets.isDeleted(index));
                 
-                if (foundDeletedNode && deletedNodeIndex != index) {
-                    std::swap(bucket_array[deletedNodeIndex], bucket_array[index]);
+                if (foundDeletedNode) {
+                    // One tombstone is taken, another one is left: the count stays the same
+                    buckets.moveTo(index, buckets, deletedNodeIndex);
+                    probeLengths.remove(probing_policy::probe_length(bucketIdx, index, array_size));
+                    probeLengths.add(probing_policy::probe_length(bucketIdx, deletedNodeIndex, array_size));
+                    updateFirstActive(deletedNodeIndex);
+                    index = deletedNodeIndex;
                 }
             } else {
                 // Didn't find nor active required entry nor it's is_deleted node
@@ -440,26 +1085,31 @@ namespace lab {
         
         //
         // getIndex version without swaps
-        std::size_t getIndexLookup(const key_type& key) const {
-            std::size_t bucketIdx = getBucketIndex(key);
+        template<typename K>
+        std::size_t getIndexLookup(const K& key) const {
+            return getIndexLookup(key, getBucketIndex(key));
+        }
+        
+        // Probing from the precomputed home bucket 'bucketIdx'
+        template<typename K>
+        std::size_t getIndexLookup(const K& key, std::size_t bucketIdx) const {
             size_t index = bucketIdx;
             bool circle_run = false;
             bool foundDeletedNode = false;
             size_t deletedNodeIndex = 0;
             
-            while (bucket_array[index].is_busy && !circle_run) {
-                if (!foundDeletedNode && bucket_array[index].is_deleted) {
-                    foundDeletedNode = true;
-                    deletedNodeIndex = index;
-                }
-                
-                if (keyEqual(key, bucket_array[index].contents.first))
+            while (buckets.isBusy(index) && !circle_run) {
+                if (buckets.isDeleted(index)) {
+                    // Tombstone doesn't hold a value, remember the first one as an insertion proposal
+                    if (!foundDeletedNode) {
+                        foundDeletedNode = true;
+                        deletedNodeIndex = index;
+                    }
+                } else if (keyEqual(key, buckets.contents(index).first)) {
                     break;
-                ++index;
-                
-                if (index == array_size) {
-                    index = 0;
                 }
+                index = probing_policy::next_index(index, array_size);
+                
                 if (index == bucketIdx) {
                     circle_run = true;
                 }
@@ -474,14 +1124,9 @@ namespace lab {
                 return deletedNodeIndex;
             }
             
-            if (bucket_array[index].is_busy) {
-                // Found something...
-                if (bucket_array[index].is_deleted) {
-                    // Entry is deleted already
-                    // Return as an insertion proposal
-                } else {
-                    // Found existing entry
-                }
+            if (buckets.isBusy(index)) {
+                // Found existing entry
+                assert(!buckets.isDeleted(index));
             } else {
                 // Didn't find nor active required entry nor it's is_deleted node
                 // Return first found 'is_deleted' node or this
@@ -493,100 +1138,183 @@ namespace lab {
             return index;
         }
         
-        typename BucketArray::iterator
-        getFirstBucket() noexcept
-        {
-            auto iter = bucket_array.begin();
-            auto endIter = bucket_array.end();
-            
-            while (iter != endIter) {
-                if (iter->isActive())
-                    return iter;
-                
-                ++iter;
-            }
-            
-            return endIter;
+        iterator iteratorAt(size_type index) noexcept {
+            return iterator(buckets.controls + index, buckets.controls + array_size, buckets.slots + index);
+        }
+        const_iterator iteratorAt(size_type index) const noexcept {
+            return const_iterator(buckets.controls + index, buckets.controls + array_size, buckets.slots + index);
         }
         
-        typename BucketArray::const_iterator
-        getFirstBucket() const noexcept
-        {
-            auto iter = bucket_array.begin();
-            auto endIter = bucket_array.end();
-            
-            while (iter != endIter) {
-                if (iter->isActive())
-                    return iter;
-                
-                ++iter;
-            }
+        //
+        // Index of the first active bucket, array_size if there's none
+        // Scans from the hint (no active buckets below it). The hint is kept by the modifiers only: inserts lower it,
+        // erasing the first element moves it to the next one. begin() doesn't write, concurrent readers are safe.
+        //
+        size_type getFirstBucket() const noexcept {
+            if (firstActiveHint >= array_size)
+                return array_size;
             
-            return endIter;
+            const bucket_control* first = find_full_control(buckets.controls + firstActiveHint);
+            return std::min(static_cast<size_type>(first - buckets.controls), array_size);
+        }
+        
+        void updateFirstActive(size_type activatedIndex) noexcept {
+            if (activatedIndex < firstActiveHint)
+                firstActiveHint = activatedIndex;
         }
         
         std::pair<bool, size_type> isRehashNeeded(size_type elemsCount) const {
             if (elemsCount >= max_load_factor() * array_size) {
-                return std::make_pair(true, array_size * 2.25);
+                return std::make_pair(true, array_size * probing_policy::growth_factor());
             }
             
             return std::make_pair(false, 0);
         }
         
+        // Table of 'newSize' buckets, but not less than the elements need (and never empty)
         void rehashImpl(size_type newSize) {
-            if (elementsCount > max_load_factor() * newSize) {
-                newSize = elementsCount / max_load_factor();
+            if (elementsCount >= max_load_factor() * newSize) {
+                newSize = static_cast<size_type>(elementsCount / max_load_factor()) + 1;
+            }
+            if (newSize < MinBucketCount) {
+                newSize = MinBucketCount;
             }
             
-            BucketArray oldBuckets { bucket_array };
+            Bucket_table_type oldBuckets = buckets;
+            size_type oldSize = array_size;
             
-            clear();
+            buckets = allocateBuckets(newSize);
             array_size = newSize;
-            bucket_array.resize(array_size);
-            
-            auto iter = oldBuckets.begin();
-            auto endIter = oldBuckets.end();
+            tombstonesCount = 0;
+            probeLengths.clear();
+            firstActiveHint = array_size;
             
-            while (iter != endIter) {
-                if (iter->isActive())
-                    operator[](iter->contents.first) = iter->contents.second;
+            // Keys are unique and there are no tombstones in the new array,
+            // so the first free bucket of the probe sequence is the place
+            for (size_type i = 0; i < oldSize; ++i) {
+                if (!oldBuckets.isActive(i))
+                    continue;
+                
+                std::size_t bucketIdx = getBucketIndex(oldBuckets.contents(i).first);
+                std::size_t index = bucketIdx;
+                while (buckets.isBusy(index)) {
+                    index = probing_policy::next_index(index, array_size);
+                }
                 
-                ++iter;
+                oldBuckets.moveTo(i, buckets, index);
+                probeLengths.add(probing_policy::probe_length(bucketIdx, index, array_size));
+                updateFirstActive(index);
             }
+            
+            deallocateBuckets(oldBuckets, oldSize);
         }
         
-        iterator insertImpl(size_type index, const value_type& value) {
+        //
+        // 'key' must be absent in the table, 'index' is the insertion proposal from getIndex, 'hashCode' is the key's one
+        // Mapped value is constructed from 'args' directly in the bucket
+        //
+        template<typename K, typename... Args>
+        iterator insertImpl(size_type index, std::size_t hashCode, K&& key, Args&&... args) {
             std::pair<bool, size_type> rehashNeededPair = isRehashNeeded(elementsCount+1);
             
             if (rehashNeededPair.first) {
                 rehash(rehashNeededPair.second);
-                index = getIndex(value.first);
+                index = getIndex(key, getBucketIndex(hashCode));
             }
             
-            bucket_array[index].makeActive(value);
+            bool reusesTombstone = buckets.isDeleted(index);
+            buckets.makeActive(index, std::piecewise_construct,
+                               std::forward_as_tuple(std::forward<K>(key)),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
             ++elementsCount;
+            if (reusesTombstone)
+                --tombstonesCount;
+            probeLengths.add(probing_policy::probe_length(getBucketIndex(hashCode), index, array_size));
+            updateFirstActive(index);
             
-            return iterator(bucket_array.begin() + index, bucket_array.end());
+            return iteratorAt(index);
         }
 
-        iterator eraseImpl(iterator pos) {
-            iterator nextIter = pos;
-            ++nextIter;
+        // The key is hashed again to find the element's home bucket
+        iterator eraseImpl(size_type index) {
+            assert(buckets.isActive(index));
+            return eraseImpl(index, getBucketIndex(buckets.contents(index).first));
+        }
+        iterator eraseImpl(size_type index, std::size_t bucketIdx) {
+            assert(buckets.isActive(index));
             
-            assert(pos.current->is_busy);
-
-            pos.current->markAsDeleted();
+            buckets.markAsDeleted(index);
             --elementsCount;
+            ++tombstonesCount;
+            probeLengths.remove(probing_policy::probe_length(bucketIdx, index, array_size));
             
+            iterator nextIter = iteratorAt(index);
+            ++nextIter;
+            if (index == firstActiveHint)
+                firstActiveHint = static_cast<size_type>(nextIter.current - buckets.controls);
             return nextIter;
         }
+        
+        //
+        // Slots and control bytes share one allocation: 'count' slots, then the control bytes
+        // with the Full sentinel padding (in slot units, rounded up).
+        // Only the control bytes are initialized, values are constructed on insertion
+        //
+        static size_type getAllocationSize(size_type count) noexcept {
+            return count + (count + ControlsPadding + sizeof(Slot_type) - 1) / sizeof(Slot_type);
+        }
+        
+        Bucket_table_type allocateBuckets(size_type count) {
+            Bucket_table_type table;
+            if (count == 0)
+                return table;
+            
+            table.slots = bucketAllocator.allocate(getAllocationSize(count));
+            table.controls = reinterpret_cast<bucket_control*>(table.slots + count);
+            std::memset(table.controls, static_cast<int>(bucket_control::Empty), count * sizeof(bucket_control));
+            std::memset(table.controls + count, static_cast<int>(bucket_control::Full), ControlsPadding * sizeof(bucket_control));
+            return table;
+        }
+        
+        void deallocateBuckets(Bucket_table_type table, size_type count) noexcept {
+            if (table.slots == nullptr)
+                return;
+            
+            bucketAllocator.deallocate(table.slots, getAllocationSize(count));
+        }
+        
+        void releaseAllocator(std::true_type) noexcept {
+            // Other containers' blocks are in a shared pool: the bucket array has been freed by itself already
+            if (!bucketAllocator.is_pool_shared())
+                bucketAllocator.release();
+        }
+        void releaseAllocator(std::false_type) noexcept {}
+        
+        // Destroys active values and frees the bucket array
+        void releaseBuckets() noexcept {
+            for (size_type i = 0; i < array_size; ++i) {
+                if (buckets.isActive(i))
+                    buckets.markAsDeleted(i);
+            }
+            
+            deallocateBuckets(buckets, array_size);
+            buckets = Bucket_table_type();
+        }
 
-        BucketArray bucket_array;
+        Bucket_table_type buckets;
         size_type array_size;
         size_type elementsCount;
+        size_type tombstonesCount;
+        probe_length_histogram probeLengths;
+        size_type firstActiveHint; // no active buckets below
         
         Hash hash;
         KeyEqual keyEqual;
+        Bucket_allocator_type bucketAllocator;
+        
+        static const int BatchGroupSize = 16;
+        static const size_type DefaultBucketCount = 10;
+        static const size_type MinBucketCount = 2;
     };
     
 } // namespace lab
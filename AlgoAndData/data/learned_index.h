@@ -0,0 +1,486 @@
+//
+//  learned_index.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_learned_index_h
+#define AlgoAndData_data_learned_index_h
+
+#include "../sort/heap_sort.h"
+#include "../sort/intro_sort.h"
+
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <fstream>
+#include <stdexcept>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // File format (learned_index::save, learned_index::load)
+    //
+    // | header | level offsets (uint64) | segments (key, slope, intercept) | keys |
+    //
+    // Values are stored by their bytes: the file is read back on a machine of the same endianness.
+    //
+    
+    struct learned_index_header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t keySize;
+        std::uint64_t epsilon;
+        std::uint64_t keysCount;
+        std::uint64_t segmentsCount;
+        std::uint64_t levelsCount;
+        
+        static const char* signature() noexcept {
+            return "LABLIDX";
+        }
+        
+        static const std::uint32_t CurrentVersion = 1;
+    };
+    
+    //
+    // Learned index over a sorted array of integer keys (PGM-index style)
+    //
+    // The position of a key is predicted by a piecewise linear function of the key: every segment predicts
+    // the positions of its keys within Epsilon. The segments are found in one pass by a greedy shrinking cone:
+    // a segment grows while some slope through its first point keeps all of its points within the error.
+    // The first keys of the segments are indexed the same way, with RecursiveEpsilon, up to a single segment.
+    // A lookup descends the levels: a prediction, then a branch-free binary search in the window around it.
+    //
+    // The index holds a few segments per thousand keys for smooth data: it is far smaller than a tree.
+    // Equal keys are kept, lower_bound finds the first one. A run of more than Epsilon equal keys
+    // (or floating point rounding of huge keys) widens the window by an exponential search.
+    //
+    // Build: O(n) for sorted input, O(n log n) otherwise
+    // Search: O(log_{RecursiveEpsilon} S + log Epsilon) for S segments
+    // Space: O(n) for the keys, O(S) for the index
+    //
+    template<typename Key, std::size_t Epsilon = 64>
+    class learned_index {
+        static_assert(std::is_integral<Key>::value, "Key type must be an integral type");
+        static_assert(Epsilon > 0, "Epsilon must be positive");
+    
+    public:
+        using key_type = Key;
+        using value_type = Key;
+        using size_type = std::size_t;
+        using const_iterator = typename std::vector<Key>::const_iterator;
+        using iterator = const_iterator;
+        
+        static const size_type RecursiveEpsilon = 4;
+        
+        learned_index() : levelOffsets(1, 0) {}
+        
+        // Unsorted input is sorted with lab::intro_sort first
+        template< class InputIt >
+        learned_index(InputIt first, InputIt last) : keys(first, last) {
+            if (!std::is_sorted(keys.begin(), keys.end()))
+                intro_sort(keys.begin(), keys.end(), std::less<Key>());
+            keys.shrink_to_fit();
+            
+            build();
+        }
+        
+        // Lookup
+        
+        // First element not less than the key
+        const_iterator lower_bound(const Key& key) const {
+            return keys.begin() + getPosition(key, [&key](const Key& element) { return element < key; });
+        }
+        
+        // First element greater than the key
+        const_iterator upper_bound(const Key& key) const {
+            return keys.begin() + getPosition(key, [&key](const Key& element) { return !(key < element); });
+        }
+        
+        std::pair<const_iterator, const_iterator> equal_range(const Key& key) const {
+            return std::make_pair(lower_bound(key), upper_bound(key));
+        }
+        
+        const_iterator find(const Key& key) const {
+            const_iterator pos = lower_bound(key);
+            if (pos != end() && key < *pos)
+                return end();
+            return pos;
+        }
+        
+        size_type count(const Key& key) const {
+            return static_cast<size_type>(upper_bound(key) - lower_bound(key));
+        }
+        
+        // Number of elements less than the key
+        size_type rank(const Key& key) const {
+            return static_cast<size_type>(lower_bound(key) - begin());
+        }
+        
+        // Iterators, in the key order
+        
+        const_iterator begin() const noexcept {
+            return keys.begin();
+        }
+        const_iterator end() const noexcept {
+            return keys.end();
+        }
+        
+        // Capacity
+        
+        bool empty() const noexcept {
+            return keys.empty();
+        }
+        
+        size_type size() const noexcept {
+            return keys.size();
+        }
+        
+        size_type segments_count() const noexcept {
+            return segments.size();
+        }
+        
+        // Bytes of the segments, the index without the keys
+        size_type index_memory_usage() const noexcept {
+            return segments.capacity() * sizeof(Segment) + levelOffsets.capacity() * sizeof(size_type);
+        }
+        
+        // Bytes of the keys and of the index
+        size_type memory_usage() const noexcept {
+            return keys.capacity() * sizeof(Key) + index_memory_usage();
+        }
+        
+        // Serialization
+        
+        //
+        // Writes the keys and the segments to 'path' (see learned_index_header), load reads them back
+        // without fitting the segments again.
+        // Throws std::runtime_error if the file can't be written.
+        //
+        void save(const std::string& path) const {
+            learned_index_header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, learned_index_header::signature(), sizeof(header.magic));
+            header.version = learned_index_header::CurrentVersion;
+            header.keySize = sizeof(Key);
+            header.epsilon = Epsilon;
+            header.keysCount = keys.size();
+            header.segmentsCount = segments.size();
+            header.levelsCount = getLevelsCount();
+            
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if (!file)
+                throw std::runtime_error("learned_index::save: can't open " + path);
+            
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            for (size_type offset : levelOffsets) {
+                writeValue(file, static_cast<std::uint64_t>(offset));
+            }
+            for (const Segment& segment : segments) {
+                writeValue(file, segment.key);
+                writeValue(file, segment.slope);
+                writeValue(file, segment.intercept);
+            }
+            if (!keys.empty())
+                file.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(Key));
+            
+            file.flush();
+            if (!file)
+                throw std::runtime_error("learned_index::save: can't write " + path);
+        }
+        
+        //
+        // Reads an index written by save with the same Key and Epsilon
+        // Throws std::runtime_error if the file can't be read or holds something else.
+        //
+        static learned_index load(const std::string& path) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+                throw std::runtime_error("learned_index::load: can't open " + path);
+            
+            learned_index_header header;
+            if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+                std::memcmp(header.magic, learned_index_header::signature(), sizeof(header.magic)) != 0)
+                throw std::runtime_error("learned_index::load: not a learned_index file " + path);
+            
+            if (header.version != learned_index_header::CurrentVersion || header.keySize != sizeof(Key) ||
+                header.epsilon != Epsilon)
+                throw std::runtime_error("learned_index::load: index of another type " + path);
+            
+            // The sizes are checked against the file before anything is allocated
+            std::streamoff headerEnd = file.tellg();
+            file.seekg(0, std::ios::end);
+            std::uint64_t payloadSize = static_cast<std::uint64_t>(static_cast<std::streamoff>(file.tellg()) - headerEnd);
+            file.seekg(headerEnd);
+            
+            const std::uint64_t segmentSize = sizeof(Key) + 2 * sizeof(double);
+            if (header.levelsCount > payloadSize || header.segmentsCount > payloadSize / segmentSize ||
+                header.keysCount > payloadSize / sizeof(Key) ||
+                (header.levelsCount + 1) * sizeof(std::uint64_t) + header.segmentsCount * segmentSize
+                    + header.keysCount * sizeof(Key) != payloadSize)
+                throw std::runtime_error("learned_index::load: truncated file " + path);
+            
+            learned_index index;
+            index.levelOffsets.resize(header.levelsCount + 1);
+            for (size_type& offset : index.levelOffsets) {
+                std::uint64_t value = 0;
+                readValue(file, value);
+                offset = static_cast<size_type>(value);
+            }
+            index.segments.resize(header.segmentsCount);
+            for (Segment& segment : index.segments) {
+                readValue(file, segment.key);
+                readValue(file, segment.slope);
+                readValue(file, segment.intercept);
+            }
+            index.keys.resize(header.keysCount);
+            if (!index.keys.empty())
+                file.read(reinterpret_cast<char*>(index.keys.data()), index.keys.size() * sizeof(Key));
+            
+            if (!file || !index.isConsistent())
+                throw std::runtime_error("learned_index::load: corrupted file " + path);
+            return index;
+        }
+    
+    private:
+        using Unsigned_key = typename std::make_unsigned<Key>::type;
+        
+        // Predicts intercept + slope * (key - first key) for the keys from the first one up to the next segment's
+        struct Segment {
+            Key key;
+            double slope;
+            double intercept;
+        };
+        
+        //
+        // Greedy shrinking cone: the segment starts at its first point, every next point narrows the range
+        // of the slopes keeping all the points within the error. The segment ends when the range gets empty.
+        //
+        class Segments_fitter {
+        public:
+            Segments_fitter(std::vector<Segment>& segments, double epsilon) :
+                segments(segments), epsilon(epsilon), hasSegment(false), first(), minSlope(0), maxSlope(0) {}
+            
+            // The points come in the increasing order of their distinct keys
+            void add(Key key, size_type position) {
+                double y = static_cast<double>(position);
+                
+                if (hasSegment) {
+                    double dx = static_cast<double>(static_cast<Unsigned_key>(key) - static_cast<Unsigned_key>(first.key));
+                    double pointMinSlope = (y - epsilon - first.intercept) / dx;
+                    double pointMaxSlope = (y + epsilon - first.intercept) / dx;
+                    bool isFirstSlope = minSlope == -std::numeric_limits<double>::infinity();
+                    
+                    if (isFirstSlope || (pointMinSlope <= maxSlope && pointMaxSlope >= minSlope)) {
+                        minSlope = isFirstSlope ? pointMinSlope : std::max(minSlope, pointMinSlope);
+                        maxSlope = isFirstSlope ? pointMaxSlope : std::min(maxSlope, pointMaxSlope);
+                        return;
+                    }
+                    finish();
+                }
+                
+                first.key = key;
+                first.intercept = y;
+                hasSegment = true;
+                minSlope = -std::numeric_limits<double>::infinity();
+                maxSlope = std::numeric_limits<double>::infinity();
+            }
+            
+            void finish() {
+                if (!hasSegment)
+                    return;
+                
+                // Keys between the points must not be predicted before the previous ones: the slope is never
+                // negative, 0 is in the range whenever the middle is below it
+                bool isSinglePoint = minSlope == -std::numeric_limits<double>::infinity();
+                first.slope = isSinglePoint ? 0.0 : std::max(0.0, (minSlope + maxSlope) / 2);
+                segments.push_back(first);
+                hasSegment = false;
+            }
+        
+        private:
+            std::vector<Segment>& segments;
+            double epsilon;
+            bool hasSegment;
+            Segment first;
+            double minSlope;
+            double maxSlope;
+        };
+        
+        std::vector<Key> keys;
+        std::vector<Segment> segments;   // the levels one after another, from the one over the keys up to the root
+        std::vector<size_type> levelOffsets; // first segment of every level, then the segments count
+        
+        size_type getLevelsCount() const noexcept {
+            return levelOffsets.empty() ? 0 : levelOffsets.size() - 1;
+        }
+        
+        void build() {
+            segments.clear();
+            levelOffsets.assign(1, 0);
+            if (keys.empty())
+                return;
+            
+            // The keys, each at the position of its first occurrence
+            Segments_fitter keysFitter(segments, static_cast<double>(Epsilon));
+            for (size_type i = 0; i < keys.size(); ++i) {
+                if (i == 0 || keys[i - 1] != keys[i])
+                    keysFitter.add(keys[i], i);
+            }
+            keysFitter.finish();
+            levelOffsets.push_back(segments.size());
+            
+            // The first keys of the level's segments, at their indices in the level
+            while (levelOffsets.back() - levelOffsets[levelOffsets.size() - 2] > 1) {
+                size_type levelBegin = levelOffsets[levelOffsets.size() - 2];
+                size_type levelEnd = levelOffsets.back();
+                
+                Segments_fitter levelFitter(segments, static_cast<double>(RecursiveEpsilon));
+                for (size_type i = levelBegin; i < levelEnd; ++i) {
+                    levelFitter.add(segments[i].key, i - levelBegin); // the new segments don't move the level's ones
+                }
+                levelFitter.finish();
+                levelOffsets.push_back(segments.size());
+            }
+            
+            segments.shrink_to_fit();
+            levelOffsets.shrink_to_fit();
+        }
+        
+        //
+        // First position whose key isn't 'before' the key: the prediction of the segment of every level
+        // gives the window of the segment in the level below, the last level's one the window in the keys
+        //
+        template<typename Before>
+        size_type getPosition(const Key& key, Before before) const {
+            if (keys.empty())
+                return 0;
+            
+            size_type segmentIdx = levelOffsets[getLevelsCount() - 1]; // the root segment
+            
+            for (size_type level = getLevelsCount() - 1; level > 0; --level) {
+                size_type lowerBegin = levelOffsets[level - 1];
+                size_type lowerCount = levelOffsets[level] - lowerBegin;
+                size_type predicted = predict(segmentIdx, levelOffsets[level + 1], lowerCount, key);
+                
+                // The last segment of the level below starting not after the key
+                size_type nextIdx = searchAround([this, lowerBegin](size_type i) -> const Key& { return segments[lowerBegin + i].key; },
+                                                 lowerCount, predicted, RecursiveEpsilon,
+                                                 [&key](const Key& segmentKey) { return !(key < segmentKey); });
+                segmentIdx = lowerBegin + (nextIdx > 0 ? nextIdx - 1 : 0);
+            }
+            
+            size_type predicted = predict(segmentIdx, levelOffsets[1], keys.size(), key);
+            return searchAround([this](size_type i) -> const Key& { return keys[i]; }, keys.size(), predicted, Epsilon, before);
+        }
+        
+        // Position of the key by the segment, up to the position of the next segment's first key
+        size_type predict(size_type segmentIdx, size_type levelEnd, size_type count, const Key& key) const {
+            const Segment& segment = segments[segmentIdx];
+            double dx = segment.key < key ? static_cast<double>(static_cast<Unsigned_key>(key) - static_cast<Unsigned_key>(segment.key)) : 0.0;
+            double prediction = segment.intercept + segment.slope * dx;
+            double nextIntercept = segmentIdx + 1 < levelEnd ? segments[segmentIdx + 1].intercept : static_cast<double>(count);
+            
+            return static_cast<size_type>(std::min(prediction, nextIntercept));
+        }
+        
+        //
+        // First position in [0, count) whose key isn't 'before', count if there is none
+        // The predicted position is expected within 'epsilon' of it, the window is searched first
+        //
+        template<typename GetKey, typename Before>
+        static size_type searchAround(GetKey getKey, size_type count, size_type predicted, size_type epsilon, Before before) {
+            size_type low = predicted > epsilon + 1 ? predicted - epsilon - 1 : 0;
+            size_type high = std::min(count, predicted + epsilon + 2);
+            size_type position = searchWindow(getKey, low, high, before);
+            
+            if (position == low && low > 0 && !before(getKey(low - 1))) {
+                // Exponential search down: the key at 'high' isn't 'before'
+                high = low - 1;
+                size_type step = 1;
+                while (high >= step && !before(getKey(high - step))) {
+                    high -= step;
+                    step *= 2;
+                }
+                return searchWindow(getKey, high >= step ? high - step + 1 : 0, high, before);
+            }
+            
+            if (position == high && high < count) {
+                // Exponential search up: the key before 'low' is 'before'
+                low = high;
+                size_type step = 1;
+                while (low + step < count && before(getKey(low + step - 1))) {
+                    low += step;
+                    step *= 2;
+                }
+                return searchWindow(getKey, low, low + step < count ? low + step - 1 : count, before);
+            }
+            
+            return position;
+        }
+        
+        // Binary search without branches on the comparisons: the first position in [first, last) whose key isn't 'before'
+        template<typename GetKey, typename Before>
+        static size_type searchWindow(GetKey getKey, size_type first, size_type last, Before before) {
+            size_type length = last - first;
+            if (length == 0)
+                return first;
+            
+            while (length > 1) {
+                size_type half = length / 2;
+                first = before(getKey(first + half)) ? first + half : first;
+                length -= half;
+            }
+            return first + (before(getKey(first)) ? 1 : 0);
+        }
+        
+        // The segments are sorted by their keys level by level, the last level is the root's one,
+        // the predictions stay within the level below
+        bool isConsistent() const {
+            if (!std::is_sorted(keys.begin(), keys.end()))
+                return false;
+            if (keys.empty())
+                return segments.empty() && levelOffsets.size() == 1 && levelOffsets[0] == 0;
+            if (levelOffsets.size() < 2 || levelOffsets.front() != 0 || levelOffsets.back() != segments.size() ||
+                levelOffsets.back() - levelOffsets[levelOffsets.size() - 2] != 1)
+                return false;
+            
+            for (size_type level = 0; level + 1 < levelOffsets.size(); ++level) {
+                if (levelOffsets[level] >= levelOffsets[level + 1])
+                    return false;
+                double lowerCount = static_cast<double>(level == 0 ? keys.size() : levelOffsets[level] - levelOffsets[level - 1]);
+                for (size_type i = levelOffsets[level]; i < levelOffsets[level + 1]; ++i) {
+                    const Segment& segment = segments[i];
+                    if (i > levelOffsets[level] && !(segments[i - 1].key < segment.key))
+                        return false;
+                    if (!std::isfinite(segment.slope) || segment.slope < 0 ||
+                        !(segment.intercept >= 0 && segment.intercept <= lowerCount))
+                        return false;
+                }
+            }
+            return true;
+        }
+        
+        template<typename T>
+        static void writeValue(std::ofstream& file, const T& value) {
+            file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+        
+        template<typename T>
+        static void readValue(std::ifstream& file, T& value) {
+            file.read(reinterpret_cast<char*>(&value), sizeof(T));
+        }
+    };
+
+} // namespace lab
+
+#endif // AlgoAndData_data_learned_index_h
@@ -0,0 +1,339 @@
+//
+//  lock_free_hash_set.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_lock_free_hash_set_h
+#define AlgoAndData_data_lock_free_hash_set_h
+
+#include "hash_map.h"
+
+#include <atomic>
+#include <limits>
+#include <functional>
+#include <type_traits>
+#include <algorithm>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // Lock-free open addressing hash set for integer keys, linear probing
+    //
+    // Insert & contains only (no erase). Slots are claimed with CAS on the key word,
+    // probing and load factor follow lab::probing_policy (same as lab::hash_map).
+    //
+    // Resize is cooperative: the thread exceeding the load factor links a bigger table to the old one,
+    // then every thread touching the old table migrates chunks of slots before doing its own operation.
+    // Migrated slots are marked, so nothing is inserted into them anymore:
+    //  - Empty slot -> Sealed (the probe chain ends here, continue in the next table)
+    //  - Key slot -> Moved (the key is in the next table already, continue probing)
+    //
+    // Old tables are freed by the destructor only: a concurrent reader may still probe them.
+    //
+    template<typename Key, typename Hash = std::hash<Key>>
+    class lock_free_hash_set {
+    private:
+        static_assert(std::is_integral<Key>::value, "Key type must be an integral type");
+        
+        // Three top values of Key are slot markers, such keys are kept aside in flags
+        static const Key EmptyKey = std::numeric_limits<Key>::max();
+        static const Key SealedKey = EmptyKey - 1;
+        static const Key MovedKey = EmptyKey - 2;
+        static const int ReservedKeysCount = 3;
+        
+        static const std::size_t MigrationChunk = 1024;
+        static const std::size_t MinCapacity = 16;
+        
+        struct Table {
+            std::size_t capacity;
+            std::atomic<Key>* slots;
+            std::atomic<std::size_t> elementsCount;
+            
+            std::atomic<Table*> next;
+            Table* older;
+            
+            std::atomic<std::size_t> migrateCursor; // first slot of the next chunk to migrate
+            std::atomic<std::size_t> migratedCount; // slots migrated
+            
+            Table(std::size_t capacity, Table* older)
+                : capacity(capacity), slots(new std::atomic<Key>[capacity]), elementsCount(0),
+                  next(nullptr), older(older), migrateCursor(0), migratedCount(0)
+            {
+                for (std::size_t i = 0; i < capacity; ++i) {
+                    slots[i].store(EmptyKey, std::memory_order_relaxed);
+                }
+            }
+            
+            ~Table() {
+                delete[] slots;
+            }
+        };
+    
+    public:
+        using key_type = Key;
+        using value_type = Key;
+        using size_type = std::size_t;
+        
+        explicit lock_free_hash_set(size_type capacity = MinCapacity, const Hash& hash = Hash())
+            : hash(hash)
+        {
+            Table* table = new Table(capacity < MinCapacity ? MinCapacity : capacity, nullptr);
+            current.store(table);
+            
+            for (int i = 0; i < ReservedKeysCount; ++i) {
+                reservedKeys[i].store(false);
+            }
+        }
+        
+        lock_free_hash_set(const lock_free_hash_set&) = delete;
+        lock_free_hash_set& operator=(const lock_free_hash_set&) = delete;
+        
+        ~lock_free_hash_set() {
+            Table* table = current.load();
+            
+            // Newest table first, then all the older ones
+            while (Table* next = table->next.load())
+                table = next;
+            
+            while (table) {
+                Table* older = table->older;
+                delete table;
+                table = older;
+            }
+        }
+        
+        // Returns true if the key was absent and has been inserted by this call
+        bool insert(key_type key) {
+            if (isReservedKey(key))
+                return !reservedKeys[EmptyKey - key].exchange(true);
+            
+            return insertImpl(current.load(), key);
+        }
+        
+        bool contains(key_type key) const {
+            if (isReservedKey(key))
+                return reservedKeys[EmptyKey - key].load();
+            
+            Table* table = current.load();
+            std::size_t homeIdx = 0;
+            
+            while (table) {
+                homeIdx = getHomeIndex(table, key);
+                std::size_t index = homeIdx;
+                
+                do {
+                    Key slotKey = table->slots[index].load(std::memory_order_acquire);
+                    
+                    if (slotKey == key)
+                        return true;
+                    if (slotKey == EmptyKey || slotKey == SealedKey)
+                        break; // End of the probe chain
+                    
+                    index = probing_policy::next_index(index, table->capacity);
+                } while (index != homeIdx);
+                
+                // The key may be in the next table already (migrated or inserted there directly)
+                table = table->next.load();
+            }
+            
+            return false;
+        }
+        
+        size_type count(key_type key) const {
+            return contains(key) ? 1 : 0;
+        }
+        
+        // Exact when no insertion or migration is in progress
+        size_type size() const {
+            Table* table = current.load();
+            while (Table* next = table->next.load())
+                table = next;
+            
+            size_type elementsCount = table->elementsCount.load();
+            for (int i = 0; i < ReservedKeysCount; ++i) {
+                if (reservedKeys[i].load())
+                    ++elementsCount;
+            }
+            return elementsCount;
+        }
+        
+        bool empty() const {
+            return size() == 0;
+        }
+        
+        size_type capacity() const {
+            return current.load()->capacity;
+        }
+        
+        float max_load_factor() const {
+            return probing_policy::max_load_factor();
+        }
+    
+    private:
+        std::atomic<Table*> current;
+        std::atomic<bool> reservedKeys[ReservedKeysCount];
+        Hash hash;
+        
+        static bool isReservedKey(key_type key) noexcept {
+            return key == EmptyKey || key == SealedKey || key == MovedKey;
+        }
+        
+        std::size_t getHomeIndex(const Table* table, key_type key) const {
+            return probing_policy::home_index(hash(key), table->capacity);
+        }
+        
+        bool insertImpl(Table* table, key_type key) {
+            while (true) {
+                Table* next = table->next.load();
+                
+                if (next) {
+                    // Resize in progress: help, then seal our probe chain in the old table,
+                    // so nobody puts the key there after we've looked for it
+                    helpMigrate(table, next);
+                    
+                    if (sealProbeChain(table, key))
+                        return false; // Found in the old table
+                    
+                    table = next;
+                    continue;
+                }
+                
+                std::size_t homeIdx = getHomeIndex(table, key);
+                std::size_t index = homeIdx;
+                bool restart = false;
+                
+                do {
+                    Key slotKey = table->slots[index].load(std::memory_order_acquire);
+                    
+                    if (slotKey == key)
+                        return false;
+                    
+                    if (slotKey == EmptyKey) {
+                        if (table->slots[index].compare_exchange_strong(slotKey, key, std::memory_order_acq_rel)) {
+                            std::size_t elementsCount = table->elementsCount.fetch_add(1) + 1;
+                            
+                            if (elementsCount >= probing_policy::max_load_factor() * table->capacity)
+                                startResize(table);
+                            return true;
+                        }
+                        
+                        // Lost the slot: it's either taken by some key (maybe ours) or sealed by a migration
+                        if (slotKey == key)
+                            return false;
+                        if (slotKey == SealedKey || slotKey == MovedKey) {
+                            restart = true;
+                            break;
+                        }
+                    } else if (slotKey == SealedKey || slotKey == MovedKey) {
+                        // Migration reached the table: a moved slot may have held our key,
+                        // the restart looks for it in the next table
+                        restart = true;
+                        break;
+                    }
+                    
+                    index = probing_policy::next_index(index, table->capacity);
+                } while (index != homeIdx);
+                
+                if (!restart) {
+                    // No empty slots at all (insertions raced past the load factor check)
+                    startResize(table);
+                }
+            }
+        }
+        
+        //
+        // Walks the key's probe chain in the table being migrated
+        // Returns true if the key is found, otherwise seals the chain end (if it's still empty)
+        //
+        bool sealProbeChain(Table* table, key_type key) {
+            std::size_t homeIdx = getHomeIndex(table, key);
+            std::size_t index = homeIdx;
+            
+            do {
+                Key slotKey = table->slots[index].load(std::memory_order_acquire);
+                
+                while (slotKey == EmptyKey) {
+                    if (table->slots[index].compare_exchange_strong(slotKey, SealedKey, std::memory_order_acq_rel))
+                        return false;
+                }
+                
+                if (slotKey == key)
+                    return true;
+                if (slotKey == SealedKey)
+                    return false;
+                
+                // Moved or some other key, the chain continues
+                index = probing_policy::next_index(index, table->capacity);
+            } while (index != homeIdx);
+            
+            return false;
+        }
+        
+        void startResize(Table* table) {
+            if (table->next.load() == nullptr) {
+                std::size_t newCapacity = table->capacity * probing_policy::growth_factor();
+                Table* newTable = new Table(newCapacity, table);
+                Table* expected = nullptr;
+                
+                if (!table->next.compare_exchange_strong(expected, newTable)) {
+                    // Some other thread has started the resize
+                    newTable->older = nullptr;
+                    delete newTable;
+                }
+            }
+            
+            helpMigrate(table, table->next.load());
+        }
+        
+        void helpMigrate(Table* table, Table* next) {
+            while (true) {
+                std::size_t chunkStart = table->migrateCursor.fetch_add(MigrationChunk);
+                if (chunkStart >= table->capacity)
+                    break;
+                
+                std::size_t chunkEnd = std::min(chunkStart + MigrationChunk, table->capacity);
+                for (std::size_t i = chunkStart; i < chunkEnd; ++i) {
+                    migrateSlot(table, next, i);
+                }
+                
+                std::size_t migratedCount = table->migratedCount.fetch_add(chunkEnd - chunkStart) + (chunkEnd - chunkStart);
+                if (migratedCount == table->capacity)
+                    advanceCurrent();
+            }
+        }
+        
+        // New operations start from the first table which isn't fully migrated
+        void advanceCurrent() {
+            Table* table = current.load();
+            Table* next = nullptr;
+            
+            while ((next = table->next.load()) != nullptr && table->migratedCount.load() == table->capacity) {
+                if (current.compare_exchange_strong(table, next))
+                    table = next;
+            }
+        }
+        
+        // The slot's chunk is owned by the calling thread, inserters may only seal the empty slot
+        void migrateSlot(Table* table, Table* next, std::size_t index) {
+            Key slotKey = table->slots[index].load(std::memory_order_acquire);
+            
+            while (slotKey == EmptyKey) {
+                if (table->slots[index].compare_exchange_strong(slotKey, SealedKey, std::memory_order_acq_rel))
+                    return;
+            }
+            
+            if (slotKey == SealedKey || slotKey == MovedKey)
+                return;
+            
+            // Copy first, then mark: a reader seeing Moved must find the key in the next table
+            insertImpl(next, slotKey);
+            table->slots[index].store(MovedKey, std::memory_order_release);
+        }
+    };
+
+} // namespace lab
+
+#endif // AlgoAndData_data_lock_free_hash_set_h
@@ -0,0 +1,301 @@
+//
+//  mapped_hash_map.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_mapped_hash_map_h
+#define AlgoAndData_data_mapped_hash_map_h
+
+#include "hash_map.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+#include <stdexcept>
+#include <iterator>
+#include <string>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // Read-only view of a hash_map snapshot (hash_map::save), the file is mmap'ed as is
+    //
+    // open() only validates the header: there's no deserialization, pages of the control bytes
+    // and slots are faulted in by the lookups which touch them.
+    // Hash and KeyEqual must match the ones of the saved map.
+    //
+    template<
+        typename Key,
+        typename T,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>
+    >
+    class mapped_hash_map {
+    public:
+        using key_type = Key;
+        using mapped_type = T;
+        using value_type = hash_map_snapshot_slot<Key, T>;
+        using size_type = std::size_t;
+        
+        class const_iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = typename mapped_hash_map::value_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const value_type*;
+            using reference = const value_type&;
+            
+            const_iterator() noexcept : map(nullptr), index(0) {}
+            
+            reference operator*() const noexcept {
+                return map->slots[index];
+            }
+            pointer operator->() const noexcept {
+                return map->slots + index;
+            }
+            
+            const_iterator& operator++() noexcept {
+                index = map->nextFull(index + 1);
+                return *this;
+            }
+            const_iterator operator++(int) noexcept {
+                const_iterator tmp(*this);
+                ++*this;
+                return tmp;
+            }
+            
+            bool operator==(const const_iterator& other) const noexcept {
+                return index == other.index;
+            }
+            bool operator!=(const const_iterator& other) const noexcept {
+                return index != other.index;
+            }
+        
+        private:
+            friend class mapped_hash_map;
+            
+            const_iterator(const mapped_hash_map* map, size_type index) noexcept : map(map), index(index) {}
+            
+            const mapped_hash_map* map;
+            size_type index;
+        };
+        
+        //
+        // Maps the snapshot file at 'path'
+        // Throws std::system_error if the file can't be mapped, std::runtime_error if it isn't a snapshot
+        // of this map type
+        //
+        static mapped_hash_map open(const std::string& path, const Hash& hash = Hash(), const KeyEqual& equal = KeyEqual()) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::system_error(errno, std::system_category(), "mapped_hash_map: can't open " + path);
+            
+            struct stat fileStat;
+            if (::fstat(fd, &fileStat) != 0) {
+                int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::system_category(), "mapped_hash_map: can't stat " + path);
+            }
+            
+            size_type fileSize = static_cast<size_type>(fileStat.st_size);
+            void* address = fileSize > 0 ? ::mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            int error = errno;
+            ::close(fd); // the mapping stays valid
+            
+            if (address == MAP_FAILED) {
+                if (fileSize == 0)
+                    throw std::runtime_error("mapped_hash_map: empty file " + path);
+                throw std::system_error(error, std::system_category(), "mapped_hash_map: can't map " + path);
+            }
+            
+            mapped_hash_map map(address, fileSize, hash, equal);
+            map.validate(path);
+            return map;
+        }
+        
+        mapped_hash_map(const mapped_hash_map&) = delete;
+        mapped_hash_map& operator=(const mapped_hash_map&) = delete;
+        
+        mapped_hash_map(mapped_hash_map&& other) noexcept
+            : address(other.address), mappedSize(other.mappedSize), header(other.header),
+              controls(other.controls), slots(other.slots), capacity(other.capacity),
+              hash(std::move(other.hash)), keyEqual(std::move(other.keyEqual))
+        {
+            other.detach();
+        }
+        
+        mapped_hash_map& operator=(mapped_hash_map&& other) noexcept {
+            if (this != &other) {
+                unmap();
+                
+                address = other.address;
+                mappedSize = other.mappedSize;
+                header = other.header;
+                controls = other.controls;
+                slots = other.slots;
+                capacity = other.capacity;
+                hash = std::move(other.hash);
+                keyEqual = std::move(other.keyEqual);
+                
+                other.detach();
+            }
+            return *this;
+        }
+        
+        ~mapped_hash_map() {
+            unmap();
+        }
+        
+        // Lookup
+        
+        const_iterator find(const key_type& key) const {
+            return const_iterator(this, getIndex(key));
+        }
+        
+        size_type count(const key_type& key) const {
+            return getIndex(key) != capacity ? 1 : 0;
+        }
+        
+        bool contains(const key_type& key) const {
+            return getIndex(key) != capacity;
+        }
+        
+        // Throws std::out_of_range if the key isn't found
+        const mapped_type& at(const key_type& key) const {
+            size_type index = getIndex(key);
+            if (index == capacity)
+                throw std::out_of_range("mapped_hash_map::at: key not found");
+            
+            return slots[index].second;
+        }
+        
+        // Capacity
+        
+        bool empty() const noexcept {
+            return size() == 0;
+        }
+        
+        size_type size() const noexcept {
+            return header != nullptr ? static_cast<size_type>(header->elementsCount) : 0;
+        }
+        
+        size_type bucket_count() const noexcept {
+            return capacity;
+        }
+        
+        // Iterators
+        
+        const_iterator begin() const noexcept {
+            return const_iterator(this, nextFull(0));
+        }
+        
+        const_iterator end() const noexcept {
+            return const_iterator(this, capacity);
+        }
+        
+        const_iterator cbegin() const noexcept {
+            return begin();
+        }
+        
+        const_iterator cend() const noexcept {
+            return end();
+        }
+    
+    private:
+        mapped_hash_map(void* address, size_type mappedSize, const Hash& hash, const KeyEqual& equal)
+            : address(address), mappedSize(mappedSize),
+              header(static_cast<const hash_map_snapshot_header*>(address)),
+              controls(nullptr), slots(nullptr), capacity(0),
+              hash(hash), keyEqual(equal) {}
+        
+        void unmap() noexcept {
+            if (address != nullptr)
+                ::munmap(address, mappedSize);
+            address = nullptr;
+        }
+        
+        // Leaves a moved-from map empty: no mapping, no buckets
+        void detach() noexcept {
+            address = nullptr;
+            mappedSize = 0;
+            header = nullptr;
+            controls = nullptr;
+            slots = nullptr;
+            capacity = 0;
+        }
+        
+        void validate(const std::string& path) {
+            if (mappedSize < sizeof(hash_map_snapshot_header) ||
+                std::memcmp(header->magic, hash_map_snapshot_header::signature(), sizeof(header->magic)) != 0)
+                throw std::runtime_error("mapped_hash_map: not a hash_map snapshot " + path);
+            
+            if (header->version != hash_map_snapshot_header::CurrentVersion ||
+                header->slotSize != sizeof(value_type) ||
+                header->keySize != sizeof(Key) ||
+                header->mappedSize != sizeof(T))
+                throw std::runtime_error("mapped_hash_map: snapshot of another map type " + path);
+            
+            if (header->capacity > mappedSize ||
+                header->slotsOffset % hash_map_snapshot_header::SnapshotAlignment != 0 ||
+                header->slotsOffset < sizeof(hash_map_snapshot_header) + header->capacity ||
+                header->slotsOffset + header->capacity * sizeof(value_type) > mappedSize)
+                throw std::runtime_error("mapped_hash_map: truncated snapshot " + path);
+            
+            const char* base = static_cast<const char*>(address);
+            capacity = static_cast<size_type>(header->capacity);
+            controls = reinterpret_cast<const bucket_control*>(base + sizeof(hash_map_snapshot_header));
+            slots = reinterpret_cast<const value_type*>(base + header->slotsOffset);
+        }
+        
+        // Same probing as hash_map; returns the slot index or 'capacity' if the key isn't found
+        size_type getIndex(const key_type& key) const {
+            if (capacity == 0)
+                return capacity;
+            
+            size_type homeIdx = probing_policy::home_index(hash(key), capacity);
+            size_type index = homeIdx;
+            
+            do {
+                bucket_control control = controls[index];
+                
+                if (control == bucket_control::Empty)
+                    break;
+                if (control == bucket_control::Full && keyEqual(slots[index].first, key))
+                    return index;
+                
+                index = probing_policy::next_index(index, capacity);
+            } while (index != homeIdx);
+            
+            return capacity;
+        }
+        
+        size_type nextFull(size_type index) const noexcept {
+            while (index < capacity && controls[index] != bucket_control::Full)
+                ++index;
+            return index;
+        }
+        
+        void* address;
+        size_type mappedSize;
+        const hash_map_snapshot_header* header;
+        const bucket_control* controls;
+        const value_type* slots;
+        size_type capacity;
+        
+        Hash hash;
+        KeyEqual keyEqual;
+    };
+
+} // namespace lab
+
+#endif // AlgoAndData_data_mapped_hash_map_h
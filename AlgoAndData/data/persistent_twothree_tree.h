@@ -0,0 +1,663 @@
+//
+//  persistent_twothree_tree.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_persistent_twothree_tree_h
+#define AlgoAndData_data_persistent_twothree_tree_h
+
+#include <atomic>
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <cstddef>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // Persistent 2-3 Tree (path copying)
+    //
+    // Nodes are shared between the tree and its snapshots and are reference counted. A write copies only
+    // the nodes on its root-to-leaf path (and the siblings a merge changes) that are still shared,
+    // the nodes referenced by the tree alone are changed in place: without snapshots it is a plain 2-3 tree.
+    //
+    // Snapshots are immutable, taking one is O(1). A snapshot may be read, copied and destroyed
+    // in another thread while the tree keeps changing: its nodes are never changed again, reference counts
+    // are atomic. The tree itself has a single writer.
+    //
+    // Search: O(log N)
+    // Insert: O(log N), allocates O(log N) nodes if the path is shared
+    // Delete: O(log N), same
+    // Snapshot: O(1)
+    // Space: O(n) for the tree plus O(log N) per write for every live snapshot
+    //
+    // Nodes are not taken from pool_allocator: its memory pool isn't thread-safe and the last owner
+    // of a node (the tree or any snapshot) frees it.
+    //
+    
+    namespace persistent_detail {
+        
+        template<typename Key, typename Compare>
+        class Tree_view;
+        
+        // Key must be default constructible: a node holds the room for two keys
+        template<typename Key>
+        struct Node {
+            std::atomic<int> refsCount;
+            int valuesCount;
+            bool leaf;
+            Key values[2];
+            Node* childs[3];
+            
+            explicit Node(bool leaf) : refsCount(1), valuesCount(0), leaf(leaf), childs{} {}
+            
+            // Copy sharing the children
+            Node(const Node& other) : refsCount(1), valuesCount(other.valuesCount), leaf(other.leaf), childs{} {
+                for (int i = 0; i < valuesCount; ++i) {
+                    values[i] = other.values[i];
+                }
+                if (!leaf) {
+                    for (int i = 0; i <= valuesCount; ++i) {
+                        childs[i] = other.childs[i];
+                        addRef(childs[i]);
+                    }
+                }
+            }
+            
+            Node& operator=(const Node&) = delete;
+            
+            // The only owner may change the node in place: nobody else can get a reference to it
+            bool isShared() const noexcept {
+                return refsCount.load(std::memory_order_acquire) != 1;
+            }
+            
+            static void addRef(Node* node) noexcept {
+                if (node)
+                    node->refsCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            
+            // The subtree is freed down to the nodes shared with someone else
+            static void release(Node* node) {
+                if (node && node->refsCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    if (!node->leaf) {
+                        for (int i = 0; i <= node->valuesCount; ++i) {
+                            release(node->childs[i]);
+                        }
+                    }
+                    delete node;
+                }
+            }
+        };
+        
+        //
+        // In-order iterator: a node doesn't know its parent, so the iterator keeps the path from the root
+        // Valid while the tree version it was taken from is alive: a snapshot, or the tree until the next write
+        //
+        template<typename Key>
+        class Const_iterator {
+        public:
+            using value_type = Key;
+            using difference_type = std::ptrdiff_t;
+            using iterator_category = std::forward_iterator_tag;
+            
+            using pointer = const Key*;
+            using reference = const Key&;
+            
+            using Node_type = Node<Key>;
+            
+            static const int MaxHeight = 48; // ~2^47 values
+            
+            Const_iterator() noexcept : depth(0) {}
+            
+            const Key& operator*() const {
+                assert(depth > 0);
+                const Path_entry& entry = path[depth - 1];
+                return entry.node->values[entry.idx];
+            }
+            
+            const Key* operator->() const {
+                return &**this;
+            }
+            
+            Const_iterator& operator++() {
+                assert(depth > 0);
+                Path_entry& entry = path[depth - 1];
+                if (!entry.node->leaf) {
+                    // The leftmost value of the right subtree
+                    entry.idx++;
+                    pushLeftmost(entry.node->childs[entry.idx]);
+                    return *this;
+                }
+                
+                if (++entry.idx < entry.node->valuesCount)
+                    return *this;
+                
+                popExhausted();
+                return *this;
+            }
+            
+            Const_iterator operator++(int) {
+                Const_iterator tmp(*this);
+                ++*this;
+                return tmp;
+            }
+            
+            bool operator==(const Const_iterator& other) const noexcept {
+                if (depth == 0 || other.depth == 0)
+                    return depth == other.depth;
+                return path[depth - 1].node == other.path[other.depth - 1].node && path[depth - 1].idx == other.path[other.depth - 1].idx;
+            }
+            
+            bool operator!=(const Const_iterator& other) const noexcept {
+                return !(*this == other);
+            }
+        
+        private:
+            template<typename K, typename C> friend class Tree_view;
+            
+            // For the ancestors idx is the child descended to, for the last node it is the current value
+            struct Path_entry {
+                const Node_type* node;
+                int idx;
+            };
+            
+            Path_entry path[MaxHeight];
+            int depth;
+            
+            static Const_iterator begin(const Node_type* root) {
+                Const_iterator it;
+                if (root)
+                    it.pushLeftmost(root);
+                return it;
+            }
+            
+            // First value not less than the key (greater than the key if 'upper')
+            template<typename Compare>
+            static Const_iterator bound(const Node_type* root, const Key& key, const Compare& compare, bool upper) {
+                Const_iterator it;
+                const Node_type* node = root;
+                
+                while (node) {
+                    int idx = 0;
+                    for (int i = 0; i < node->valuesCount; ++i) {
+                        idx += (upper ? !compare(key, node->values[i]) : compare(node->values[i], key)) ? 1 : 0;
+                    }
+                    
+                    assert(it.depth < MaxHeight);
+                    it.path[it.depth++] = Path_entry { node, idx };
+                    if (!upper && idx < node->valuesCount && !compare(key, node->values[idx]))
+                        return it;
+                    if (node->leaf)
+                        break;
+                    node = node->childs[idx];
+                }
+                
+                if (it.depth > 0 && it.path[it.depth - 1].idx >= it.path[it.depth - 1].node->valuesCount)
+                    it.popExhausted();
+                return it;
+            }
+            
+            void pushLeftmost(const Node_type* node) {
+                while (true) {
+                    assert(depth < MaxHeight);
+                    path[depth++] = Path_entry { node, 0 };
+                    if (node->leaf)
+                        break;
+                    node = node->childs[0];
+                }
+            }
+            
+            // The last node has no values left: up to the first ancestor with a value after the child taken
+            void popExhausted() {
+                do {
+                    --depth;
+                } while (depth > 0 && path[depth - 1].idx >= path[depth - 1].node->valuesCount);
+            }
+        };
+        
+        //
+        // Read-only part shared by the tree and its snapshots
+        //
+        template<typename Key, typename Compare>
+        class Tree_view {
+        public:
+            using key_type = Key;
+            using value_type = Key;
+            using key_compare = Compare;
+            using size_type = std::size_t;
+            using const_reference = const value_type&;
+            using const_iterator = Const_iterator<Key>;
+            using iterator = const_iterator;
+            
+            // Iterators
+            
+            const_iterator begin() const {
+                return const_iterator::begin(root);
+            }
+            
+            const_iterator end() const noexcept {
+                return const_iterator();
+            }
+            
+            // Lookup
+            
+            const_iterator find(const key_type& key) const {
+                const_iterator it = lower_bound(key);
+                return it != end() && !compare(key, *it) ? it : end();
+            }
+            
+            bool contains(const key_type& key) const {
+                const Node_type* node = root;
+                while (node) {
+                    int idx = getChildIdx(node, key);
+                    if (idx < node->valuesCount && !compare(key, node->values[idx]))
+                        return true;
+                    node = node->leaf ? nullptr : node->childs[idx];
+                }
+                return false;
+            }
+            
+            const_iterator lower_bound(const key_type& key) const {
+                return const_iterator::bound(root, key, compare, false);
+            }
+            
+            const_iterator upper_bound(const key_type& key) const {
+                return const_iterator::bound(root, key, compare, true);
+            }
+            
+            // Calls 'visit' for the values in [low, high), in order
+            template<typename Visitor>
+            void range(const key_type& low, const key_type& high, Visitor visit) const {
+                for (const_iterator it = lower_bound(low); it != end() && compare(*it, high); ++it) {
+                    visit(*it);
+                }
+            }
+            
+            // Capacity
+            
+            bool empty() const noexcept {
+                return elementsCount == 0;
+            }
+            
+            size_type size() const noexcept {
+                return elementsCount;
+            }
+        
+        protected:
+            using Node_type = Node<Key>;
+            
+            Node_type* root;
+            size_type elementsCount;
+            Compare compare;
+            
+            Tree_view(Node_type* root, size_type elementsCount, const Compare& compare)
+                : root(root), elementsCount(elementsCount), compare(compare) {}
+            
+            // The number of values less than the key
+            int getChildIdx(const Node_type* node, const key_type& key) const {
+                int idx = 0;
+                for (int i = 0; i < node->valuesCount; ++i) {
+                    idx += compare(node->values[i], key) ? 1 : 0;
+                }
+                return idx;
+            }
+        };
+    
+    } // namespace persistent_detail
+    
+    template<typename Key, typename Compare = std::less<Key>>
+    class persistent_twothree_tree;
+    
+    //
+    // Immutable point-in-time view of a persistent_twothree_tree
+    //
+    template<typename Key, typename Compare = std::less<Key>>
+    class twothree_tree_snapshot : public persistent_detail::Tree_view<Key, Compare> {
+        using Base = persistent_detail::Tree_view<Key, Compare>;
+        using Node_type = typename Base::Node_type;
+    
+    public:
+        twothree_tree_snapshot() : Base(nullptr, 0, Compare()) {}
+        
+        twothree_tree_snapshot(const twothree_tree_snapshot& other) : Base(other.root, other.elementsCount, other.compare) {
+            Node_type::addRef(this->root);
+        }
+        
+        twothree_tree_snapshot(twothree_tree_snapshot&& other) noexcept : Base(other.root, other.elementsCount, other.compare) {
+            other.root = nullptr;
+            other.elementsCount = 0;
+        }
+        
+        twothree_tree_snapshot& operator=(twothree_tree_snapshot other) noexcept {
+            std::swap(this->root, other.root);
+            std::swap(this->elementsCount, other.elementsCount);
+            std::swap(this->compare, other.compare);
+            return *this;
+        }
+        
+        ~twothree_tree_snapshot() {
+            Node_type::release(this->root);
+        }
+    
+    private:
+        friend class persistent_twothree_tree<Key, Compare>;
+        
+        twothree_tree_snapshot(Node_type* root, std::size_t elementsCount, const Compare& compare) : Base(root, elementsCount, compare) {
+            Node_type::addRef(root);
+        }
+    };
+    
+    template<typename Key, typename Compare>
+    class persistent_twothree_tree : public persistent_detail::Tree_view<Key, Compare> {
+        using Base = persistent_detail::Tree_view<Key, Compare>;
+        using Node_type = typename Base::Node_type;
+    
+    public:
+        using typename Base::key_type;
+        using typename Base::value_type;
+        using typename Base::size_type;
+        using typename Base::const_iterator;
+        using snapshot_type = twothree_tree_snapshot<Key, Compare>;
+        
+        explicit persistent_twothree_tree(const Compare& compare = Compare()) : Base(nullptr, 0, compare) {}
+        
+        // O(1), the copies share the nodes until they are changed
+        persistent_twothree_tree(const persistent_twothree_tree& other) : Base(other.root, other.elementsCount, other.compare) {
+            Node_type::addRef(this->root);
+        }
+        
+        persistent_twothree_tree(persistent_twothree_tree&& other) noexcept : Base(other.root, other.elementsCount, other.compare) {
+            other.root = nullptr;
+            other.elementsCount = 0;
+        }
+        
+        persistent_twothree_tree& operator=(persistent_twothree_tree other) noexcept {
+            std::swap(this->root, other.root);
+            std::swap(this->elementsCount, other.elementsCount);
+            std::swap(this->compare, other.compare);
+            return *this;
+        }
+        
+        ~persistent_twothree_tree() {
+            Node_type::release(this->root);
+        }
+        
+        // O(1): the current version of the tree, the next writes copy the paths they change
+        snapshot_type snapshot() const {
+            return snapshot_type(this->root, this->elementsCount, this->compare);
+        }
+        
+        // Modifiers
+        
+        // Returns true if the key was absent and has been inserted
+        bool insert(const key_type& key) {
+            if (this->root == nullptr) {
+                this->root = new Node_type(true);
+                this->root->values[0] = key;
+                this->root->valuesCount = 1;
+                this->elementsCount = 1;
+                return true;
+            }
+            
+            Path_entry path[MaxHeight];
+            int depth = 0;
+            for (Node_type* node = this->root; ; node = node->childs[path[depth - 1].idx]) {
+                int idx = this->getChildIdx(node, key);
+                if (idx < node->valuesCount && !this->compare(key, node->values[idx]))
+                    return false;
+                
+                assert(depth < MaxHeight);
+                path[depth++] = Path_entry { node, idx };
+                if (node->leaf)
+                    break;
+            }
+            
+            makePathOwned(path, depth);
+            
+            // Splits go up to the first node with a free slot
+            key_type carryValue = key;
+            Node_type* carryChild = nullptr; // right neighbour of the carried value, for the internal nodes
+            for (int level = depth - 1; level >= 0; --level) {
+                Node_type* node = path[level].node;
+                int pos = path[level].idx;
+                
+                if (node->valuesCount < 2) {
+                    for (int i = node->valuesCount; i > pos; --i) {
+                        node->values[i] = node->values[i - 1];
+                        node->childs[i + 1] = node->childs[i];
+                    }
+                    node->values[pos] = carryValue;
+                    node->childs[pos + 1] = carryChild;
+                    node->valuesCount++;
+                    ++this->elementsCount;
+                    return true;
+                }
+                
+                // In-order values and children with the carried ones inserted
+                key_type values[3];
+                Node_type* childs[4];
+                for (int i = 0, j = 0; i <= 2; ++i) {
+                    if (i == pos)
+                        values[j++] = carryValue;
+                    if (i < 2)
+                        values[j++] = node->values[i];
+                }
+                for (int i = 0, j = 0; i <= 2; ++i) {
+                    childs[j++] = node->childs[i];
+                    if (i == pos)
+                        childs[j++] = carryChild;
+                }
+                
+                // 4-node: the node keeps the left part, the right part goes to a new node, the middle value goes up
+                Node_type* right = new Node_type(node->leaf);
+                right->values[0] = values[2];
+                right->valuesCount = 1;
+                if (!node->leaf) {
+                    right->childs[0] = childs[2];
+                    right->childs[1] = childs[3];
+                }
+                
+                node->values[0] = values[0];
+                node->valuesCount = 1;
+                node->childs[0] = childs[0];
+                node->childs[1] = childs[1];
+                node->childs[2] = nullptr;
+                
+                carryValue = values[1];
+                carryChild = right;
+            }
+            
+            // The root is split
+            Node_type* newRoot = new Node_type(false);
+            newRoot->values[0] = carryValue;
+            newRoot->valuesCount = 1;
+            newRoot->childs[0] = this->root;
+            newRoot->childs[1] = carryChild;
+            this->root = newRoot;
+            ++this->elementsCount;
+            return true;
+        }
+        
+        // Returns: Number of elements removed.
+        size_type erase(const key_type& key) {
+            Path_entry path[MaxHeight];
+            int depth = 0;
+            int keyLevel = -1;
+            int keyIdx = 0;
+            
+            for (Node_type* node = this->root; node; node = node->leaf ? nullptr : node->childs[path[depth - 1].idx]) {
+                int idx = this->getChildIdx(node, key);
+                assert(depth < MaxHeight);
+                path[depth++] = Path_entry { node, idx };
+                
+                if (idx < node->valuesCount && !this->compare(key, node->values[idx])) {
+                    keyLevel = depth - 1;
+                    keyIdx = idx;
+                    break;
+                }
+            }
+            if (keyLevel < 0)
+                return 0;
+            
+            // An internal value is replaced with its in-order successor, the leftmost value of the right subtree
+            if (!path[keyLevel].node->leaf) {
+                path[keyLevel].idx = keyIdx + 1;
+                for (Node_type* node = path[keyLevel].node->childs[keyIdx + 1]; ; node = node->childs[0]) {
+                    assert(depth < MaxHeight);
+                    path[depth++] = Path_entry { node, 0 };
+                    if (node->leaf)
+                        break;
+                }
+            }
+            
+            makePathOwned(path, depth);
+            
+            Node_type* leaf = path[depth - 1].node;
+            int removedIdx = keyIdx;
+            if (keyLevel != depth - 1) {
+                path[keyLevel].node->values[keyIdx] = leaf->values[0];
+                removedIdx = 0;
+            }
+            
+            for (int i = removedIdx; i + 1 < leaf->valuesCount; ++i) {
+                leaf->values[i] = leaf->values[i + 1];
+            }
+            leaf->values[--leaf->valuesCount] = key_type();
+            --this->elementsCount;
+            
+            if (leaf->valuesCount == 0)
+                fixHole(path, depth);
+            return 1;
+        }
+        
+        void clear() {
+            Node_type::release(this->root);
+            this->root = nullptr;
+            this->elementsCount = 0;
+        }
+    
+    private:
+        static const int MaxHeight = const_iterator::MaxHeight;
+        
+        struct Path_entry {
+            Node_type* node;
+            int idx; // child descended to (value position for the last node)
+        };
+        
+        // Only the tree may change the node (and nothing shares its ancestors), or the node is replaced with a copy
+        Node_type* ownChild(Node_type* parent, int childIdx) {
+            Node_type* child = parent->childs[childIdx];
+            if (!child->isShared())
+                return child;
+            
+            Node_type* copy = new Node_type(*child);
+            parent->childs[childIdx] = copy;
+            Node_type::release(child);
+            return copy;
+        }
+        
+        // Path copying: top-down, a node is owned once its parent is
+        void makePathOwned(Path_entry* path, int depth) {
+            if (this->root->isShared()) {
+                Node_type* copy = new Node_type(*this->root);
+                Node_type::release(this->root);
+                this->root = copy;
+            }
+            path[0].node = this->root;
+            
+            for (int level = 1; level < depth; ++level) {
+                path[level].node = ownChild(path[level - 1].node, path[level - 1].idx);
+            }
+        }
+        
+        //
+        // The leaf at the end of the path has no values: a sibling with two values lends one through the parent,
+        // a sibling with one value is merged with the hole and the parent loses a value (and may become the hole).
+        // The siblings are copied if they are shared.
+        //
+        void fixHole(Path_entry* path, int depth) {
+            Node_type* hole = path[depth - 1].node;
+            Node_type* holeChild = nullptr;
+            
+            for (int level = depth - 1; ; --level) {
+                if (level == 0) {
+                    // The hole is the root: the tree is empty, or its only child is the new root
+                    this->root = holeChild;
+                    delete hole;
+                    return;
+                }
+                
+                Node_type* parent = path[level - 1].node;
+                int holeIdx = path[level - 1].idx;
+                int siblingIdx = holeIdx == 0 ? 1 : holeIdx - 1;
+                int separatorIdx = std::min(holeIdx, siblingIdx);
+                Node_type* sibling = ownChild(parent, siblingIdx);
+                
+                // In-order values and children of the sibling and the hole, with the separator between them
+                key_type values[3];
+                Node_type* childs[4];
+                int valuesCount = 0, childsCount = 0;
+                if (holeIdx < siblingIdx) {
+                    values[valuesCount++] = parent->values[separatorIdx];
+                    childs[childsCount++] = holeChild;
+                }
+                for (int i = 0; i < sibling->valuesCount; ++i) {
+                    values[valuesCount++] = sibling->values[i];
+                }
+                for (int i = 0; i <= sibling->valuesCount; ++i) {
+                    childs[childsCount++] = sibling->childs[i];
+                }
+                if (holeIdx > siblingIdx) {
+                    values[valuesCount++] = parent->values[separatorIdx];
+                    childs[childsCount++] = holeChild;
+                }
+                
+                if (valuesCount == 3) {
+                    // The sibling lends a value through the parent
+                    Node_type* left = holeIdx < siblingIdx ? hole : sibling;
+                    Node_type* right = holeIdx < siblingIdx ? sibling : hole;
+                    storeValues(left, values, childs, 1);
+                    storeValues(right, values + 2, childs + 2, 1);
+                    parent->values[separatorIdx] = values[1];
+                    return;
+                }
+                
+                // Merged into the sibling: the hole is removed, its only child (if any) moved to the sibling
+                storeValues(sibling, values, childs, 2);
+                delete hole;
+                
+                for (int i = separatorIdx; i + 1 < parent->valuesCount; ++i) {
+                    parent->values[i] = parent->values[i + 1];
+                }
+                for (int i = holeIdx; i < parent->valuesCount; ++i) {
+                    parent->childs[i] = parent->childs[i + 1];
+                }
+                parent->childs[parent->valuesCount] = nullptr;
+                parent->values[--parent->valuesCount] = key_type();
+                
+                if (parent->valuesCount > 0)
+                    return;
+                
+                hole = parent;
+                holeChild = sibling;
+            }
+        }
+        
+        static void storeValues(Node_type* node, const key_type* values, Node_type* const* childs, int valuesCount) {
+            for (int i = 0; i < 2; ++i) {
+                node->values[i] = i < valuesCount ? values[i] : key_type();
+            }
+            for (int i = 0; i < 3; ++i) {
+                node->childs[i] = !node->leaf && i <= valuesCount ? childs[i] : nullptr;
+            }
+            node->valuesCount = valuesCount;
+        }
+    };
+
+} // namespace lab
+
+#endif // AlgoAndData_data_persistent_twothree_tree_h
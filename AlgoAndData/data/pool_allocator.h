@@ -0,0 +1,261 @@
+//
+//  pool_allocator.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_pool_allocator_h
+#define AlgoAndData_data_pool_allocator_h
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // Memory pool: size classes with free lists, carved from large slabs
+    //
+    // Blocks up to MaxBlockSize bytes are rounded up to a multiple of Alignment; a freed block goes
+    // to the free list of its class and is reused by the next allocation of that class.
+    // New blocks are bump allocated from the current slab, so a node-based container makes
+    // one malloc call per slab instead of one per node.
+    // Larger requests (e.g. hash table arrays) are passed to operator new as is.
+    //
+    // release() frees all the slabs at once, O(slabs): every small block becomes invalid.
+    // Not thread-safe.
+    //
+    class memory_pool {
+    public:
+        static const std::size_t Alignment = 16;
+        static const std::size_t MaxBlockSize = 512;
+        static const std::size_t SlabSize = 64 * 1024;
+        
+        memory_pool() noexcept : slabs(nullptr), slabCursor(nullptr), slabEnd(nullptr), slabsCount(0) {
+            resetFreeLists();
+        }
+        
+        memory_pool(const memory_pool&) = delete;
+        memory_pool& operator=(const memory_pool&) = delete;
+        
+        ~memory_pool() {
+            release();
+        }
+        
+        void* allocate(std::size_t bytes) {
+            if (bytes > MaxBlockSize)
+                return ::operator new(bytes);
+            
+            std::size_t classIdx = getClassIdx(bytes);
+            FreeBlock* block = freeLists[classIdx];
+            
+            if (block != nullptr) {
+                freeLists[classIdx] = block->next;
+                return block;
+            }
+            
+            std::size_t blockSize = (classIdx + 1) * Alignment;
+            if (static_cast<std::size_t>(slabEnd - slabCursor) < blockSize)
+                allocateSlab();
+            
+            void* address = slabCursor;
+            slabCursor += blockSize;
+            return address;
+        }
+        
+        void deallocate(void* address, std::size_t bytes) noexcept {
+            if (address == nullptr)
+                return;
+            
+            if (bytes > MaxBlockSize) {
+                ::operator delete(address);
+                return;
+            }
+            
+            std::size_t classIdx = getClassIdx(bytes);
+            FreeBlock* block = static_cast<FreeBlock*>(address);
+            block->next = freeLists[classIdx];
+            freeLists[classIdx] = block;
+        }
+        
+        // Frees all the slabs, blocks larger than MaxBlockSize are left to their owners
+        void release() noexcept {
+            while (slabs != nullptr) {
+                Slab* next = slabs->next;
+                ::operator delete(static_cast<void*>(slabs));
+                slabs = next;
+            }
+            
+            slabCursor = nullptr;
+            slabEnd = nullptr;
+            slabsCount = 0;
+            resetFreeLists();
+        }
+        
+        std::size_t slabs_count() const noexcept {
+            return slabsCount;
+        }
+    
+    private:
+        static const std::size_t ClassesCount = MaxBlockSize / Alignment;
+        
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+        
+        // Slab header, blocks start right after it
+        struct Slab {
+            Slab* next;
+        };
+        static const std::size_t SlabHeaderSize = (sizeof(Slab) + Alignment - 1) / Alignment * Alignment;
+        
+        FreeBlock* freeLists[ClassesCount];
+        Slab* slabs;
+        char* slabCursor;
+        char* slabEnd;
+        std::size_t slabsCount;
+        
+        static std::size_t getClassIdx(std::size_t bytes) noexcept {
+            return bytes == 0 ? 0 : (bytes - 1) / Alignment;
+        }
+        
+        void resetFreeLists() noexcept {
+            for (std::size_t i = 0; i < ClassesCount; ++i) {
+                freeLists[i] = nullptr;
+            }
+        }
+        
+        // The rest of the current slab is abandoned (less than MaxBlockSize bytes)
+        void allocateSlab() {
+            char* memory = static_cast<char*>(::operator new(SlabSize));
+            
+            Slab* slab = reinterpret_cast<Slab*>(memory);
+            slab->next = slabs;
+            slabs = slab;
+            ++slabsCount;
+            
+            slabCursor = memory + SlabHeaderSize;
+            slabEnd = memory + SlabSize;
+        }
+    };
+    
+    //
+    // Allocator on top of a memory_pool
+    //
+    // A default constructed allocator creates its own pool, copies and rebound copies share it.
+    // Containers get a new pool when they are copy constructed (select_on_container_copy_construction),
+    // so containers never share a pool unless they were given the same allocator explicitly.
+    // A moved-from allocator has no pool (moves don't allocate): it creates one on its first allocation.
+    //
+    template<typename T>
+    class pool_allocator {
+    public:
+        using value_type = T;
+        using pointer = T*;
+        using const_pointer = const T*;
+        using reference = T&;
+        using const_reference = const T&;
+        using size_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+        
+        using propagate_on_container_copy_assignment = std::false_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+        
+        template<typename U>
+        struct rebind {
+            using other = pool_allocator<U>;
+        };
+        
+        pool_allocator() : pool(std::make_shared<memory_pool>()) {}
+        
+        pool_allocator(const pool_allocator& other) noexcept = default;
+        pool_allocator(pool_allocator&& other) noexcept = default;
+        
+        template<typename U>
+        pool_allocator(const pool_allocator<U>& other) noexcept : pool(other.pool) {}
+        
+        pool_allocator& operator=(const pool_allocator& other) noexcept = default;
+        pool_allocator& operator=(pool_allocator&& other) noexcept = default;
+        
+        T* allocate(size_type n) {
+            static_assert(alignof(T) <= memory_pool::Alignment, "Type is overaligned for the pool");
+            if (!pool)
+                pool = std::make_shared<memory_pool>();
+            return static_cast<T*>(pool->allocate(n * sizeof(T)));
+        }
+        
+        // Nothing is allocated without a pool, only null is given back then
+        void deallocate(T* address, size_type n) noexcept {
+            if (address != nullptr)
+                pool->deallocate(address, n * sizeof(T));
+        }
+        
+        template<typename U, typename... Args>
+        void construct(U* address, Args&&... args) {
+            ::new (static_cast<void*>(address)) U(std::forward<Args>(args)...);
+        }
+        
+        template<typename U>
+        void destroy(U* address) {
+            address->~U();
+        }
+        
+        pool_allocator select_on_container_copy_construction() const {
+            return pool_allocator();
+        }
+        
+        // Frees all the pool's slabs, see memory_pool::release
+        void release() noexcept {
+            if (pool)
+                pool->release();
+        }
+        
+        memory_pool& resource() const noexcept {
+            assert(pool);
+            return *pool;
+        }
+        
+        // Number of allocators using the pool, this one included (0 without a pool)
+        long pool_use_count() const noexcept {
+            return pool.use_count();
+        }
+        
+        // Other allocators use the pool too (copies, rebound copies): releasing it would free their blocks
+        bool is_pool_shared() const noexcept {
+            return pool_use_count() > 1;
+        }
+        
+        template<typename U>
+        bool operator==(const pool_allocator<U>& other) const noexcept {
+            return pool == other.pool;
+        }
+        
+        template<typename U>
+        bool operator!=(const pool_allocator<U>& other) const noexcept {
+            return pool != other.pool;
+        }
+    
+    private:
+        template<typename U>
+        friend class pool_allocator;
+        
+        std::shared_ptr<memory_pool> pool;
+    };
+    
+    //
+    // Allocator can free everything it has allocated at once (has 'release()')
+    //
+    template<typename Alloc, typename = void>
+    struct is_releasable_allocator : std::false_type {};
+    
+    template<typename Alloc>
+    struct is_releasable_allocator<Alloc, decltype(std::declval<Alloc&>().release())> : std::true_type {};
+
+} // namespace lab
+
+#endif // AlgoAndData_data_pool_allocator_h
@@ -0,0 +1,357 @@
+//
+//  static_search_tree.h
+//  AlgoAndData
+//
+//  Copyright (c) 2014 Vladimir Shishov. All rights reserved.
+//
+
+#ifndef AlgoAndData_data_static_search_tree_h
+#define AlgoAndData_data_static_search_tree_h
+
+#include "hash_map.h"
+#include "../sort/heap_sort.h"
+#include "../sort/intro_sort.h"
+
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <cassert>
+
+namespace lab {
+    
+    //
+    // Layouts of the implicit complete binary search tree of static_search_tree
+    //
+    // Nodes are numbered in BFS order: the root is 1, the children of node i are 2i and 2i + 1. A layout maps
+    // the node numbers to positions in the array and descends from the root: no child pointers are stored.
+    // 'descend' returns the node number below the leaves the search ends at: number - 2^height is the count
+    // of the nodes passed on the left, the search never branches on the comparison result.
+    //
+    
+    //
+    // Eytzinger (BFS) layout: the node i is at position i, position 0 is unused
+    // The 2^k descendants of a node k levels down are adjacent: each step prefetches the cache line
+    // of the great-great-grandchildren (for 4-byte keys), the next 4 levels are in cache when they are reached.
+    //
+    struct eytzinger_layout {
+        static const std::size_t CacheLineBytes = 64;
+        
+        void prepare(int height) noexcept {
+            (void)height;
+        }
+        
+        std::size_t storage_size(int height) const noexcept {
+            return std::size_t(1) << height;
+        }
+        
+        std::size_t position(std::size_t node, int depth, const std::size_t* positions) const noexcept {
+            (void)depth;
+            (void)positions;
+            return node;
+        }
+        
+        template<typename Key, typename GoesRight>
+        std::size_t descend(const Key* nodes, int height, GoesRight goesRight) const {
+            const std::size_t prefetchFanout = getPrefetchFanout(sizeof(Key), 1);
+            std::size_t node = 1;
+            
+            for (int depth = 0; depth < height; ++depth) {
+                // The address may lie past the array near the leaves, the prefetch doesn't fault
+                prefetch_read(reinterpret_cast<const void*>(reinterpret_cast<std::uintptr_t>(nodes) + node * prefetchFanout * sizeof(Key)));
+                node = 2 * node + goesRight(nodes[node]);
+            }
+            return node;
+        }
+    
+    private:
+        // Nodes per cache line rounded down to a power of two: the descendants that many times lower
+        static constexpr std::size_t getPrefetchFanout(std::size_t keySize, std::size_t fanout) noexcept {
+            return fanout * 2 * keySize <= CacheLineBytes ? getPrefetchFanout(keySize, fanout * 2) : fanout;
+        }
+    };
+    
+    //
+    // van Emde Boas layout: the tree of height h is cut in the middle, the top tree of h/2 levels is laid out
+    // first, then its 2^(h/2) bottom trees one after another, each of them recursively the same way.
+    // A search touches O(log_B N) cache lines for any line size B (cache-oblivious), no prefetching is needed.
+    //
+    // All the bottom trees cut at the same depth have the same shape: the position of a node at depth d is
+    // the position of its ancestor at topDepth[d] (where the cut was made) + topSize[d] + the bottom tree
+    // index (low bits of the node number) * bottomSize[d]. A search keeps the positions of its path.
+    //
+    struct van_emde_boas_layout {
+        static const int MaxHeight = 64;
+        
+        van_emde_boas_layout() {
+            std::fill(topDepth, topDepth + MaxHeight + 1, 0);
+            std::fill(topSize, topSize + MaxHeight + 1, 0);
+            std::fill(bottomSize, bottomSize + MaxHeight + 1, 0);
+        }
+        
+        void prepare(int height) noexcept {
+            assert(height <= MaxHeight);
+            std::fill(topDepth, topDepth + MaxHeight + 1, 0);
+            std::fill(topSize, topSize + MaxHeight + 1, 0);
+            std::fill(bottomSize, bottomSize + MaxHeight + 1, 0);
+            prepareCuts(0, height);
+        }
+        
+        std::size_t storage_size(int height) const noexcept {
+            return (std::size_t(1) << height) - 1;
+        }
+        
+        // 'positions' holds the positions of the nodes numbered below 'node'
+        std::size_t position(std::size_t node, int depth, const std::size_t* positions) const noexcept {
+            if (depth == 0)
+                return 0;
+            std::size_t ancestor = node >> (depth - topDepth[depth]);
+            return positions[ancestor] + topSize[depth] + (node & topSize[depth]) * bottomSize[depth];
+        }
+        
+        template<typename Key, typename GoesRight>
+        std::size_t descend(const Key* nodes, int height, GoesRight goesRight) const {
+            std::size_t pathPositions[MaxHeight + 1];
+            pathPositions[0] = 0;
+            std::size_t node = 1;
+            
+            // The tables are zero at depth 'height': the position computed past the leaves is never read
+            for (int depth = 0; depth < height; ++depth) {
+                node = 2 * node + goesRight(nodes[pathPositions[depth]]);
+                pathPositions[depth + 1] = pathPositions[topDepth[depth + 1]] + topSize[depth + 1]
+                    + (node & topSize[depth + 1]) * bottomSize[depth + 1];
+            }
+            return node;
+        }
+    
+    private:
+        int topDepth[MaxHeight + 1];
+        std::size_t topSize[MaxHeight + 1];
+        std::size_t bottomSize[MaxHeight + 1];
+        
+        // Every depth but the root's is cut exactly once
+        void prepareCuts(int rootDepth, int height) noexcept {
+            if (height <= 1)
+                return;
+            
+            int topHeight = height / 2;
+            int cutDepth = rootDepth + topHeight;
+            topDepth[cutDepth] = rootDepth;
+            topSize[cutDepth] = (std::size_t(1) << topHeight) - 1;
+            bottomSize[cutDepth] = (std::size_t(1) << (height - topHeight)) - 1;
+            
+            prepareCuts(rootDepth, topHeight);
+            prepareCuts(cutDepth, height - topHeight);
+        }
+    };
+    
+    //
+    // Immutable sorted set for read-mostly lookup tables: built once, probed many times
+    //
+    // The keys are copied into an implicit complete search tree laid out by Layout (eytzinger_layout or
+    // van_emde_boas_layout): a probe is a fixed number of branch-free steps over one array instead of
+    // chasing the node pointers of twothree_tree. The tree is padded to 2^h - 1 nodes with the greatest key.
+    // The sorted keys are kept as well, lower_bound returns an iterator into them:
+    // lower_bound(key) - begin() is the rank of the key, the index of its mapped value in a parallel array.
+    //
+    // Build: O(n) for sorted input, O(n log n) otherwise
+    // Search: O(log N), ceil(log2(N + 1)) comparisons for any key
+    // Space: O(n), the sorted keys + up to twice as many tree nodes
+    //
+    template<typename Key, typename Compare = std::less<Key>, typename Layout = eytzinger_layout>
+    class static_search_tree {
+    public:
+        using key_type = Key;
+        using value_type = Key;
+        using key_compare = Compare;
+        using size_type = std::size_t;
+        using const_iterator = typename std::vector<Key>::const_iterator;
+        using iterator = const_iterator;
+        
+        static_search_tree() : height(0), nodesOffset(0) {}
+        
+        // Unsorted input is sorted with lab::intro_sort first, duplicates are dropped
+        template< class InputIt >
+        static_search_tree(InputIt first, InputIt last, const Compare& compare = Compare()) :
+            values(first, last), height(0), nodesOffset(0), compare(compare) {
+            if (!std::is_sorted(values.begin(), values.end(), this->compare))
+                intro_sort(values.begin(), values.end(), this->compare);
+            
+            values.erase(std::unique(values.begin(), values.end(), [this](const Key& x, const Key& y) {
+                return !this->compare(x, y) && !this->compare(y, x);
+            }), values.end());
+            values.shrink_to_fit();
+            
+            build();
+        }
+        
+        // Copies rebuild the tree: the copied nodes wouldn't keep the cache line alignment
+        static_search_tree(const static_search_tree& other) :
+            values(other.values), height(0), nodesOffset(0), compare(other.compare) {
+            build();
+        }
+        
+        // The moved-from tree is left empty: a search on it doesn't read the taken nodes
+        static_search_tree(static_search_tree&& other) :
+            values(std::move(other.values)), nodes(std::move(other.nodes)), height(other.height),
+            nodesOffset(other.nodesOffset), compare(std::move(other.compare)), layout(std::move(other.layout)) {
+            other.height = 0;
+            other.nodesOffset = 0;
+        }
+        
+        static_search_tree& operator=(const static_search_tree& other) {
+            if (this != &other) {
+                static_search_tree copy(other);
+                *this = std::move(copy);
+            }
+            return *this;
+        }
+        
+        static_search_tree& operator=(static_search_tree&& other) {
+            if (this != &other) {
+                values = std::move(other.values);
+                nodes = std::move(other.nodes);
+                height = other.height;
+                nodesOffset = other.nodesOffset;
+                compare = std::move(other.compare);
+                layout = std::move(other.layout);
+                other.values.clear();
+                other.nodes.clear();
+                other.height = 0;
+                other.nodesOffset = 0;
+            }
+            return *this;
+        }
+        
+        // Lookup, same results as twothree_tree
+        
+        // First element not less than the key
+        const_iterator lower_bound(const Key& key) const {
+            return atRank(getLessCount(key));
+        }
+        
+        // First element greater than the key
+        const_iterator upper_bound(const Key& key) const {
+            return atRank(getNotGreaterCount(key));
+        }
+        
+        const_iterator find(const Key& key) const {
+            const_iterator pos = lower_bound(key);
+            if (pos != end() && compare(key, *pos))
+                return end();
+            return pos;
+        }
+        
+        size_type count(const Key& key) const {
+            return find(key) != end() ? 1 : 0;
+        }
+        
+        // Number of elements less than the key
+        size_type rank(const Key& key) const {
+            return std::min(getLessCount(key), values.size());
+        }
+        
+        // Iterators, in the key order
+        
+        const_iterator begin() const noexcept {
+            return values.begin();
+        }
+        const_iterator end() const noexcept {
+            return values.end();
+        }
+        
+        // Capacity
+        
+        bool empty() const noexcept {
+            return values.empty();
+        }
+        
+        size_type size() const noexcept {
+            return values.size();
+        }
+        
+        // Bytes of the sorted keys and of the tree nodes
+        size_type memory_usage() const noexcept {
+            return (values.capacity() + nodes.capacity()) * sizeof(Key);
+        }
+    
+    private:
+        std::vector<Key> values;
+        std::vector<Key> nodes; // the tree starts at nodesOffset: Eytzinger blocks are aligned with the cache lines
+        int height;
+        size_type nodesOffset;
+        Compare compare;
+        Layout layout;
+        
+        void build() {
+            while ((size_type(1) << height) - 1 < values.size())
+                ++height;
+            if (height == 0)
+                return;
+            
+            layout.prepare(height);
+            size_type storageSize = layout.storage_size(height);
+            size_type alignmentSlack = eytzinger_layout::CacheLineBytes / sizeof(Key);
+            nodes.assign(storageSize + alignmentSlack, values.back());
+            for (nodesOffset = 0; nodesOffset < alignmentSlack; ++nodesOffset) {
+                if (reinterpret_cast<std::uintptr_t>(nodes.data() + nodesOffset) % eytzinger_layout::CacheLineBytes == 0)
+                    break;
+            }
+            if (nodesOffset == alignmentSlack)
+                nodesOffset = 0; // the key size doesn't divide the line, no alignment helps
+            
+            // Node numbers in BFS order: the in-order rank of the node numbered 'node' at 'depth' is
+            // (2 * (node - 2^depth) + 1) * 2^(height - 1 - depth) - 1, the ranks past the keys are padding
+            std::vector<size_type> positions(size_type(1) << height);
+            Key* tree = nodes.data() + nodesOffset;
+            int depth = 0;
+            
+            for (size_type node = 1; node < positions.size(); ++node) {
+                if (node == size_type(2) << depth)
+                    ++depth;
+                
+                positions[node] = layout.position(node, depth, positions.data());
+                size_type rank = ((2 * (node - (size_type(1) << depth)) + 1) << (height - 1 - depth)) - 1;
+                if (rank < values.size())
+                    tree[positions[node]] = values[rank];
+            }
+        }
+        
+        // Number of keys less than the key, the padding counted if the key is greater than all of them
+        size_type getLessCount(const Key& key) const {
+            if (height == 0)
+                return 0;
+            
+            const Compare& less = compare;
+            size_type node = layout.descend(nodes.data() + nodesOffset, height, [&less, &key](const Key& nodeKey) {
+                return less(nodeKey, key);
+            });
+            return node - (size_type(1) << height);
+        }
+        
+        size_type getNotGreaterCount(const Key& key) const {
+            if (height == 0)
+                return 0;
+            
+            const Compare& less = compare;
+            size_type node = layout.descend(nodes.data() + nodesOffset, height, [&less, &key](const Key& nodeKey) {
+                return !less(key, nodeKey);
+            });
+            return node - (size_type(1) << height);
+        }
+        
+        const_iterator atRank(size_type rank) const {
+            return rank < values.size() ? values.begin() + rank : values.end();
+        }
+    };
+    
+    template<typename Key, typename Compare = std::less<Key>>
+    using eytzinger_search_tree = static_search_tree<Key, Compare, eytzinger_layout>;
+    
+    template<typename Key, typename Compare = std::less<Key>>
+    using veb_search_tree = static_search_tree<Key, Compare, van_emde_boas_layout>;
+
+} // namespace lab
+
+#endif // AlgoAndData_data_static_search_tree_h
@@ -9,8 +9,23 @@
 #ifndef AlgoAndData_data_twothree_tree_h
 #define AlgoAndData_data_twothree_tree_h
 
+#include "pool_allocator.h"
+#include "../sort/heap_sort.h"
+#include "../sort/intro_sort.h"
+
 #include <utility>
 #include <memory>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include <stdexcept>
+#include <limits>
+#include <type_traits>
+#include <future>
+#include <mutex>
+#include <thread>
 #include <cassert>
 
 namespace lab {
@@ -21,23 +36,102 @@ namespace lab {
     // Search: O(log N)
     // Insert: O(log N)
     // Delete: O(log N)
+    // Rank / select: O(log N), nodes keep their subtree sizes
     // Space: O(n)
     //
     
-    template<typename Value, typename Compare = std::less<Value>>
-    class Node {
+    //
+    // Tree shape, every field is maintained on insertions and erasures: taking stats is O(1)
+    //
+    struct twothree_tree_stats {
+        std::size_t size;
+        std::size_t node_count;
+        int height;                 // levels, 0 for an empty tree
+        float fill_factor;          // share of the nodes' value slots (two per node) in use, 0.5 .. 1
+        std::size_t memory_usage;   // bytes, see twothree_tree::memory_usage
+    };
+    
+    //
+    // Mapped values of the node's keys (twothree_tree_map), kept in their own array:
+    // searches read the keys only, the mapped values are touched when an element is accessed or moved
+    //
+    // Values move between nodes as entries: the key with its mapped value, or just the key for the set
+    //
+    template<typename Key, typename Mapped, int Count>
+    class Node_payload {
+    public:
+        using entry_type = std::pair<Key, Mapped>;
+        
+        Mapped& getMapped(int valueIdx) {
+            assert(valueIdx >= 0 && valueIdx < Count);
+            return mappedArr[valueIdx];
+        }
+        const Mapped& getMapped(int valueIdx) const {
+            assert(valueIdx >= 0 && valueIdx < Count);
+            return mappedArr[valueIdx];
+        }
+    
+    protected:
+        static const Key& getEntryKey(const entry_type& entry) noexcept {
+            return entry.first;
+        }
+        
+        void moveMapped(int toIdx, int fromIdx) {
+            mappedArr[toIdx] = std::move(mappedArr[fromIdx]);
+        }
+        
+        // Keeps the mapped value, returns the key to store
+        Key&& storeMapped(int valueIdx, entry_type& entry) {
+            mappedArr[valueIdx] = std::move(entry.second);
+            return std::move(entry.first);
+        }
+        
+        entry_type loadEntry(Key&& key, int valueIdx) {
+            return entry_type(std::move(key), std::move(mappedArr[valueIdx]));
+        }
+    
+    private:
+        Mapped mappedArr[Count];
+    };
+    
+    template<typename Key, int Count>
+    class Node_payload<Key, void, Count> {
+    public:
+        using entry_type = Key;
+    
+    protected:
+        static const Key& getEntryKey(const entry_type& entry) noexcept {
+            return entry;
+        }
+        
+        void moveMapped(int, int) noexcept {}
+        
+        Key&& storeMapped(int, entry_type& entry) noexcept {
+            return std::move(entry);
+        }
+        
+        entry_type loadEntry(Key&& key, int) {
+            return entry_type(std::move(key));
+        }
+    };
+    
+    template<typename Value, typename Compare = std::less<Value>, typename Mapped = void>
+    class Node : public Node_payload<Value, Mapped, 3> {
     private:
-        using Node_type = Node<Value, Compare>;
+        using Node_type = Node<Value, Compare, Mapped>;
+        using Payload_type = Node_payload<Value, Mapped, 3>;
         
     public:
         using value_type = Value;
+        using typename Payload_type::entry_type;
+        using Payload_type::getEntryKey;
     
-        Node() : parent(nullptr), childsCount(0), valuesCount(0) {
+        Node() : parent(nullptr), childsCount(0), valuesCount(0), subtreeSize(0), subtreeNodesCount(1), idxInParent(-1) {
             resetChilds();
         }
         
-        Node(const value_type& value) : parent(nullptr), childsCount(0) {
-            valuesArr[0] = value;
+        Node(entry_type entry) : parent(nullptr), childsCount(0), subtreeSize(1), subtreeNodesCount(1), idxInParent(-1) {
+            valuesArr[0] = this->storeMapped(0, entry);
             valuesCount = 1;
             resetChilds();
         }
@@ -48,6 +142,12 @@ namespace lab {
             return parent;
         }
         
+        // Index of the node in its parent's children, kept up to date by the children modifiers
+        int getIdxInParent() const noexcept {
+            assert(parent == nullptr || parent->childsArr[idxInParent] == this);
+            return idxInParent;
+        }
+        
         bool isConsistent() const {
             assert(valuesCount <= MaxValuesCount);
             return valuesCount < MaxValuesCount;
@@ -67,18 +167,38 @@ namespace lab {
         }
         
         int getValueIdx(const value_type& value) const {
-            if (valuesCount == 0)
-                return -1;
-            
-            if (compare(value, valuesArr[0]) || compare(valuesArr[valuesCount-1], value))
-                return -1;
-            
+            bool found = false;
+            int idx = searchValue(value, found);
+            return found ? idx : -1;
+        }
+        
+        //
+        // Number of values less than (not greater than, for the upper bound) the value
+        // Counts over the whole node instead of stopping at the first greater value: no data dependent branches
+        //
+        int getLowerBoundIdx(const value_type& value) const {
+            int idx = 0;
             for (int i = 0; i < valuesCount; ++i) {
-                if (isEquivalent(value, valuesArr[i]))
-                    return i;
+                idx += compare(valuesArr[i], value) ? 1 : 0;
             }
-            
-            return -1;
+            return idx;
+        }
+        int getUpperBoundIdx(const value_type& value) const {
+            int idx = 0;
+            for (int i = 0; i < valuesCount; ++i) {
+                idx += compare(value, valuesArr[i]) ? 0 : 1;
+            }
+            return idx;
+        }
+        
+        //
+        // Single pass in-node search
+        // Returns index of the equivalent value if 'found' is set, otherwise index of the child to descend to
+        //
+        int searchValue(const value_type& value, bool& found) const {
+            int idx = getLowerBoundIdx(value);
+            found = idx < valuesCount && !compare(value, valuesArr[idx]);
+            return idx;
         }
         
         bool containsValue(const value_type& value) const {
@@ -139,6 +259,39 @@ namespace lab {
             return valuesCount == 2;
         }
         
+        // Values count of the subtree
+        std::size_t getSubtreeSize() const noexcept {
+            return subtreeSize;
+        }
+        
+        std::size_t getChildSubtreeSize(int childIdx) const noexcept {
+            Node_type* child = getChild(childIdx);
+            return child != nullptr ? child->subtreeSize : 0;
+        }
+        
+        // Nodes count of the subtree, the node included
+        std::size_t getSubtreeNodesCount() const noexcept {
+            return subtreeNodesCount;
+        }
+        
+        // Recomputes the subtree size and nodes count from the children, after values or children were moved
+        void updateSubtreeSize() noexcept {
+            subtreeSize = valuesCount;
+            subtreeNodesCount = 1;
+            for (int i = 0; i < childsCount; ++i) {
+                subtreeSize += childsArr[i]->subtreeSize;
+                subtreeNodesCount += childsArr[i]->subtreeNodesCount;
+            }
+        }
+        
+        // Adds 'delta' to the subtree sizes ('nodesDelta' to the nodes counts) of all the node's ancestors
+        void updateAncestorsSubtreeSize(std::ptrdiff_t delta, std::ptrdiff_t nodesDelta = 0) noexcept {
+            for (Node_type* ancestor = parent; ancestor != nullptr; ancestor = ancestor->parent) {
+                ancestor->subtreeSize += delta;
+                ancestor->subtreeNodesCount += nodesDelta;
+            }
+        }
+        
         /// Modifiers
         
         // Move complex operation to the tree?
@@ -149,48 +302,52 @@ namespace lab {
         // Determines index of the value to insert in the node, shifts existing values to the right
         // Returns index of the inserted value in the node
         //
-        int insertValue(const value_type& value) {
+        int insertValue(entry_type entry) {
             assert(valuesCount < MaxValuesCount);
             arrSize_t newValueIdx = 0;
             
             if (valuesCount > 0) {
-                newValueIdx = chooseChildIdx(value);
+                newValueIdx = chooseChildIdx(this->getEntryKey(entry));
                 assert(newValueIdx != -1);
                 // Shifting values to insert the new value
                 for (int i = valuesCount; i > newValueIdx; --i) {
                     valuesArr[i] = std::move(valuesArr[i-1]);
+                    this->moveMapped(i, i-1);
                 }
             }
             
-            valuesArr[newValueIdx] = value;
+            valuesArr[newValueIdx] = this->storeMapped(newValueIdx, entry);
             ++valuesCount;
+            ++subtreeSize;
             return newValueIdx;
         }
         
         // remove+insert optimization
-        value_type replaceValue(const value_type& newValue, int atIndex) {
+        entry_type replaceValue(entry_type newEntry, int atIndex) {
             assert(atIndex >= 0 && atIndex < valuesCount);
             
-            value_type lastValue = valuesArr[atIndex];
-            valuesArr[atIndex] = newValue;
-            return lastValue;
+            entry_type lastEntry = takeEntry(atIndex);
+            valuesArr[atIndex] = this->storeMapped(atIndex, newEntry);
+            return lastEntry;
         }
         
         //
         // Removes values from 2-/3-nodes with shifting remaining values to the left
         // Returns removed value
         //
-        value_type removeValueAtIdx(int valueIdx) {
+        entry_type removeValueAtIdx(int valueIdx) {
             assert(valuesCount > 0 && valuesCount < MaxValuesCount); // from 2-/3-nodes only
             assert(valueIdx == 0 || valueIdx == 1);
 
-            value_type removedValue = valuesArr[valueIdx];
+            entry_type removedEntry = takeEntry(valueIdx);
             
             for (int i = valueIdx; i < valuesCount-1; ++i) {
                 valuesArr[i] = std::move(valuesArr[i+1]);
+                this->moveMapped(i, i+1);
             }
             --valuesCount;
-            return removedValue;
+            --subtreeSize;
+            return removedEntry;
         }
         
         //
@@ -203,10 +360,12 @@ namespace lab {
             // Shifting childs to insert the new child
             for (int i = childsCount; i > atIndex; --i) {
                 childsArr[i] = childsArr[i-1];
+                childsArr[i]->idxInParent = i;
             }
             
             childsArr[atIndex] = child;
             child->parent = this;
+            child->idxInParent = atIndex;
             ++childsCount;
         }
         
@@ -215,10 +374,9 @@ namespace lab {
         // Returns pointer to the removed child
         //
         void removeChild(Node_type* child, bool withShift = true) {
-            assert(child != nullptr);
+            assert(child != nullptr && child->parent == this);
             
-            int childIdx = getChildIdx(child);
-            removeChild(childIdx, withShift);
+            removeChild(child->idxInParent, withShift);
         }
         Node_type* removeChild(int childIdx, bool withShift = true) {
             assert(childIdx >= 0 && childIdx < MaxValuesCount);
@@ -233,6 +391,7 @@ namespace lab {
             if (withShift) {
                 for (int i = childIdx; i < childsCount; ++i) {
                     childsArr[i] = childsArr[i+1];
+                    childsArr[i]->idxInParent = i;
                 }
                 childsArr[childsCount] = nullptr;
             }
@@ -246,39 +405,72 @@ namespace lab {
                 return;
             
             // left child
-            newLeftChild->insertValue(valuesArr[0]);
+            newLeftChild->insertValue(takeEntry(0));
             if (childsCount >= 1)
                 newLeftChild->insertChild(childsArr[0], 0);
             if (childsCount >= 2)
                 newLeftChild->insertChild(childsArr[1], 1);
             
             // right child
-            newRightChild->insertValue(valuesArr[2]);
+            newRightChild->insertValue(takeEntry(2));
             if (childsCount >= 3)
                 newRightChild->insertChild(childsArr[2], 0);
             if (childsCount == 4)
                 newRightChild->insertChild(childsArr[3], 1);
             
             valuesArr[0] = std::move(valuesArr[1]);
+            this->moveMapped(0, 1);
             valuesCount = 1;
             resetChilds();
             insertChild(newLeftChild, 0);
             insertChild(newRightChild, 1);
+            
+            // The node's subtree holds the same values and the two new nodes
+            newLeftChild->updateSubtreeSize();
+            newRightChild->updateSubtreeSize();
+            subtreeNodesCount += 2;
         }
         
+        //
         // Comlpex operation, purpose: insertion fix
-        void mergeWithChild(Node* child) {
+        // Returns index of the child's value in the node
+        //
+        int mergeWithChild(Node* child) {
             assert(child->valuesCount == 1); // Only for 2-nodes
             assert(child->childsCount == 2); // with two childs
 
-            int childIdx = chooseChildIdx(child->valuesArr[0]);
+            int childIdx = child->getIdxInParent();
             assert(childsArr[childIdx] == child);
             
-            insertValue(child->valuesArr[0]);
+            int valueIdx = insertValue(child->takeEntry(0));
+            assert(valueIdx == childIdx);
             setChildAt(child->childsArr[0], childIdx); // remove+insert optimization
             insertChild(child->childsArr[1], childIdx+1);
+            updateSubtreeSize(); // same values as before, the child's ones are here now
 
             child->reset();
+            return valueIdx;
+        }
+        
+        //
+        // Moves the values out and unlinks the children, the node is left empty (join / split)
+        // 'childs' gets valuesCount+1 pointers, null for a leaf. Returns the values count
+        //
+        int releaseContents(entry_type* entries, Node_type** childs) {
+            int count = valuesCount;
+            for (int i = 0; i < count; ++i) {
+                entries[i] = takeEntry(i);
+            }
+            for (int i = 0; i <= count; ++i) {
+                childs[i] = childsArr[i];
+                if (childs[i] != nullptr) {
+                    childs[i]->parent = nullptr;
+                    childs[i]->idxInParent = -1;
+                }
+            }
+            
+            reset();
+            return count;
         }
         
     private:
@@ -293,23 +485,19 @@ namespace lab {
         arrSize_t childsCount;
         
         Node_type* parent;
+        std::size_t subtreeSize;
+        std::size_t subtreeNodesCount;
+        arrSize_t idxInParent;
         
-        bool isEquivalent(const value_type& v1, const value_type& v2) const {
-            return !compare(v1, v2) && !compare(v2, v1);
+        // Moves the value out, the slot is left to be overwritten or dropped
+        entry_type takeEntry(int valueIdx) {
+            return this->loadEntry(std::move(valuesArr[valueIdx]), valueIdx);
         }
         
         arrSize_t chooseChildIdx(const value_type& value) const {
-            for (int i = 0; i < valuesCount; ++i) {
-                if (compare(value, valuesArr[i]))
-                    return i;
-
-                if (i > 0 && compare(valuesArr[i-1], value) && compare(value, valuesArr[i])) // redundant?
-                    return i;
-                
-                if (i == valuesCount-1)
-                    return i+1;
-            }
-            return -1;
+            if (valuesCount == 0)
+                return -1;
+            return getLowerBoundIdx(value);
         }
         
         void setChildAt(Node* child, int childIdx) noexcept {
@@ -318,10 +506,13 @@ namespace lab {
             
             childsArr[childIdx] = child;
             child->parent = this;
+            child->idxInParent = childIdx;
         }
         
         void reset() noexcept {
             valuesCount = 0;
+            subtreeSize = 0;
+            subtreeNodesCount = 1;
             parent = nullptr;
             resetChilds();
         }
@@ -394,7 +585,7 @@ namespace lab {
                             break;
                         }
                         
-                        int idxInParent = parent->getChildIdx(current);
+                        int idxInParent = current->getIdxInParent();
                         assert(idxInParent >= 0 && idxInParent <= 2);
                         valueIdx = idxInParent;
                         current = parent;
@@ -506,14 +697,18 @@ namespace lab {
     };
     ///// Iterators
     
+    //
+    // 'Mapped' is the payload stored with every key, void for the set (see twothree_tree_map)
+    //
     template<
         typename Key,
         typename Compare = std::less<Key>,
-        typename Allocator = std::allocator< Key >
+        typename Allocator = pool_allocator< Key >,
+        typename Mapped = void
     >
     class twothree_tree {
-    private:
-        using Node_type = Node<Key, Compare>;
+    protected:
+        using Node_type = Node<Key, Compare, Mapped>;
         using Node_allocator_type = typename Allocator::template rebind<Node_type>::other;
         
     public:
@@ -526,56 +721,241 @@ namespace lab {
         
         // .ctors
         
-        twothree_tree() : rootNode(nullptr) {
+        twothree_tree() : rootNode(nullptr), height(0), nodeAllocatorLock(nullptr), fingerNode(nullptr) {
             
         }
+        
+        // Trees given the same pool_allocator share its pool: they can exchange nodes (join, split, set operations)
+        explicit twothree_tree(const Allocator& allocator) :
+            rootNode(nullptr), nodeAllocator(allocator), height(0), nodeAllocatorLock(nullptr), fingerNode(nullptr) {
+                
+        }
+        
+        // Bulk load, see bulk_load
+        template< class InputIt >
+        twothree_tree(InputIt first, InputIt last, float fill_factor = 1.0f) :
+            rootNode(nullptr), height(0), nodeAllocatorLock(nullptr), fingerNode(nullptr) {
+            bulk_load(first, last, fill_factor);
+        }
+        
+        // The moved-from tree is left empty, its moved-from pool_allocator creates a new pool on the first allocation
+        twothree_tree(twothree_tree&& other) :
+            rootNode(other.rootNode), nodeAllocator(std::move(other.nodeAllocator)), compare(other.compare),
+            height(other.height), nodeAllocatorLock(nullptr), fingerNode(other.fingerNode) {
+            other.rootNode = nullptr;
+            other.fingerNode = nullptr;
+            other.height = 0;
+        }
+        
+        twothree_tree& operator=(twothree_tree&& other) {
+            if (this != &other) {
+                clear();
+                swap(other);
+            }
+            return *this;
+        }
+        
         ~twothree_tree() {
             clear();
         }
         
+        void swap(twothree_tree& other) noexcept {
+            std::swap(rootNode, other.rootNode);
+            std::swap(nodeAllocator, other.nodeAllocator);
+            std::swap(compare, other.compare);
+            std::swap(height, other.height);
+            std::swap(fingerNode, other.fingerNode);
+        }
+        
+        Allocator get_allocator() const {
+            return Allocator(nodeAllocator);
+        }
+        
         // Lookup
         
         iterator find(const value_type& value) {
-            Node_type* node = findNode(value);
-            
-            if (!node)
-                return iterator{nullptr, 0};
+            int valueIdx = -1;
+            Node_type* node = findNode(value, valueIdx);
             
-            int valueIdx = node->getValueIdx(value);
-            if (valueIdx == -1)
+            if (!node || valueIdx == -1)
                 return iterator{nullptr, 0};
             
             return iterator{node, valueIdx};
         }
         const_iterator find(const value_type& value) const {
-            Node_type* node = findNode(value);
+            int valueIdx = -1;
+            Node_type* node = findNode(value, valueIdx);
             
-            if (!node)
+            if (!node || valueIdx == -1)
                 return const_iterator{nullptr, 0};
             
-            int valueIdx = node->getValueIdx(value);
-            if (valueIdx == -1)
+            return const_iterator{node, valueIdx};
+        }
+        
+        //
+        // Finger search: the search starts from the hint and climbs only as far as the value's place needs,
+        // O(log d) for a value d positions away from the hint instead of O(log N) from the root
+        // end() stands for the position of the last insert
+        //
+        iterator find(const_iterator hint, const value_type& value) {
+            int valueIdx = -1;
+            Node_type* node = findNode(getFingerStart(hint.current, value), value, valueIdx);
+            
+            if (!node || valueIdx == -1)
+                return iterator{nullptr, 0};
+            
+            return iterator{node, valueIdx};
+        }
+        const_iterator find(const_iterator hint, const value_type& value) const {
+            int valueIdx = -1;
+            Node_type* node = findNode(getFingerStart(hint.current, value), value, valueIdx);
+            
+            if (!node || valueIdx == -1)
                 return const_iterator{nullptr, 0};
             
             return const_iterator{node, valueIdx};
         }
         
+        // First element not less than the value
+        iterator lower_bound(const value_type& value) {
+            std::pair<Node_type*, int> position = boundImpl(value, false);
+            return iterator(position.first, position.second);
+        }
+        const_iterator lower_bound(const value_type& value) const {
+            std::pair<Node_type*, int> position = boundImpl(value, false);
+            return const_iterator(position.first, position.second);
+        }
+        
+        // First element greater than the value
+        iterator upper_bound(const value_type& value) {
+            std::pair<Node_type*, int> position = boundImpl(value, true);
+            return iterator(position.first, position.second);
+        }
+        const_iterator upper_bound(const value_type& value) const {
+            std::pair<Node_type*, int> position = boundImpl(value, true);
+            return const_iterator(position.first, position.second);
+        }
+        
+        std::pair<iterator, iterator> equal_range(const value_type& value) {
+            return std::make_pair(lower_bound(value), upper_bound(value));
+        }
+        std::pair<const_iterator, const_iterator> equal_range(const value_type& value) const {
+            return std::make_pair(lower_bound(value), upper_bound(value));
+        }
+        
+        //
+        // Calls 'visit' for every element in [low, high), in order
+        // One descent to 'low', then the in-order walk: O(log N + K) for K visited elements
+        //
+        template<typename Visitor>
+        void range(const value_type& low, const value_type& high, Visitor visit) const {
+            for (const_iterator pos = lower_bound(low); pos != end() && compare(*pos, high); ++pos) {
+                visit(*pos);
+            }
+        }
+        
+        // Order statistics
+        
+        // Number of elements less than the value
+        size_type rank(const value_type& value) const {
+            size_type result = 0;
+            Node_type* node = rootNode;
+            
+            while (node) {
+                int valueIdx = 0;
+                for (; valueIdx < node->getValuesCount(); ++valueIdx) {
+                    if (!compare(node->getValue(valueIdx), value))
+                        break;
+                    result += node->getChildSubtreeSize(valueIdx) + 1;
+                }
+                
+                if (valueIdx < node->getValuesCount() && !compare(value, node->getValue(valueIdx))) {
+                    // Found: the smaller values are in the subtree to the left
+                    return result + node->getChildSubtreeSize(valueIdx);
+                }
+                node = node->getChild(valueIdx);
+            }
+            
+            return result;
+        }
+        
+        // Element with 'index' elements less than it (0-based), end() if the index is out of range
+        iterator select(size_type index) {
+            std::pair<Node_type*, int> position = selectImpl(index);
+            return iterator(position.first, position.second);
+        }
+        const_iterator select(size_type index) const {
+            std::pair<Node_type*, int> position = selectImpl(index);
+            return const_iterator(position.first, position.second);
+        }
+        
+        // Number of elements in [low, high)
+        size_type count_range(const value_type& low, const value_type& high) const {
+            if (!compare(low, high))
+                return 0;
+            return rank(high) - rank(low);
+        }
+        
         // Modifiers
         
         std::pair<iterator,bool> insert(const value_type& value) {
-            return insertImpl(value);
+            return insertImpl(value, value);
+        }
+        
+        //
+        // Hinted insert: the value's place is searched from the hint (see find with a hint), end() stands for
+        // the position of the last insert. Returns the position of the value, the hint for the next one:
+        // the search for the next value of a sorted stream is O(1), the splits are amortized O(1) as well.
+        // The subtree sizes of the ancestors (order statistics) are still updated up to the root.
+        //
+        iterator insert(const_iterator hint, const value_type& value) {
+            return insertFromImpl(getFingerStart(hint.current, value), value, value).first;
         }
         
         template< class InputIt >
         void insert(InputIt first, InputIt last) {
             for (; first != last; ++first) {
-                insertImpl(*first);
+                insertImpl(*first, *first);
             }
         }
         
         void insert(std::initializer_list<value_type> ilist) {
             insert(ilist.begin(), ilist.end());
         }
+        
+        //
+        // Replaces the contents with the values of [first, last), O(n) for sorted input
+        //
+        // The tree is built bottom-up: no searches, no splits. Unsorted input is sorted with lab::intro_sort first,
+        // duplicates are dropped.
+        // 'fill_factor' is the share of the node capacity (two values) to use, from 0.5 (2-nodes only,
+        // room for the following inserts) to 1.0 (3-nodes wherever possible, the lowest tree).
+        //
+        template< class InputIt >
+        void bulk_load(InputIt first, InputIt last, float fill_factor = 1.0f) {
+            std::vector<value_type> values(first, last);
+            fill_factor = std::min(1.0f, std::max(0.5f, fill_factor));
+            
+            if (!std::is_sorted(values.begin(), values.end(), compare))
+                intro_sort(values.begin(), values.end(), compare);
+            
+            values.erase(std::unique(values.begin(), values.end(), [this](const value_type& x, const value_type& y) {
+                return !compare(x, y) && !compare(y, x);
+            }), values.end());
+            
+            clear();
+            if (values.empty())
+                return;
+            
+            try {
+                int bulkLoadHeight = getBulkLoadHeight(values.size(), fill_factor);
+                buildSubtree(values.data(), values.size(), bulkLoadHeight, fill_factor, nullptr, 0);
+                height = bulkLoadHeight + 1;
+            } catch(...) {
+                clear(); // the partially built tree is linked to the root
+                throw;
+            }
+        }
 
         // TODO Return on Iterator following the last removed element
         void erase(const_iterator pos) {
@@ -595,39 +975,85 @@ namespace lab {
             return 1;
         }
         
+        //
+        // O(n) without recursion or a stack, O(slabs) for trivially destructible values and a releasable allocator:
+        // unless the tree was given an allocator shared with another tree (or the tree was split), its pool_allocator's
+        // pool holds this tree's nodes only, so the nodes aren't freed one by one, the pool drops all its slabs at once.
+        // Nodes aren't even visited if their destructor is trivial. Nodes larger than memory_pool::MaxBlockSize
+        // aren't in the slabs, they are always freed one by one.
+        //
         void clear() noexcept {
-            // Depth-first post-order tree traversal
-            Node_type* curNode = rootNode;
+            clearImpl(is_releasable_allocator<Node_allocator_type>{});
+            height = 0;
+            fingerNode = nullptr;
+        }
+        
+        // Same as clear: the tree's node pool is released as a whole whenever it can be
+        void release_all() noexcept {
+            clear();
+        }
+        
+        //
+        // Join and split: the trees exchange whole subtrees, O(log N)
+        //
+        // Nodes move between trees with equal allocators only: trees given the same pool_allocator (sharing its pool),
+        // or a stateless allocator. The tree split off gets the same allocator. The elements of a tree
+        // with another allocator are moved to new nodes first, O(M).
+        // Trees sharing a pool must not be changed concurrently: the pool isn't thread-safe.
+        //
+        
+        // Appends the separator and the elements of 'right': all the elements here < separator < all of 'right'
+        // 'right' is left empty
+        void join(const value_type& separator, twothree_tree& right) {
+            assert(empty() || compare(getLastValue(), separator));
+            assert(right.empty() || compare(separator, *right.begin()));
             
-            while (curNode) {
-                // Checking node's children from left to right
-                if (curNode->getChildrenCount() > 0) {
-                    Node_type* child = nullptr;
-                    
-                    for (int i = 0; i < 4; ++i) {
-                        if ((child = curNode->getChild(i)) != nullptr)
-                            break;
-                    }
-                    
-                    if (child != nullptr) {
-                        curNode = child;
-                        continue;
-                    }
-                }
-                
-                // The node is a leaf node, deleting it
-                Node_type* parent = curNode->getParent();
-                
-                if (parent == nullptr) {
-                    assert(curNode == rootNode); // Only root doesn't have a parent
-                } else {
-                    parent->removeChild(curNode, false);
-                }
-                deallocateNode(curNode);
-                curNode = parent;
-            }
+            Subtree rightPart = takeNodes(right);
+            setSubtree(joinSubtrees(takeSubtree(), separator, rightPart));
+        }
+        
+        // Appends the elements of 'right', all greater than the elements here; 'right' is left empty
+        void join(twothree_tree& right) {
+            assert(empty() || right.empty() || compare(getLastValue(), *right.begin()));
             
-            rootNode = nullptr;
+            Subtree rightPart = takeNodes(right);
+            setSubtree(concatSubtrees(takeSubtree(), rightPart));
+        }
+        
+        // Moves the elements not less than the key to the returned tree, the smaller ones stay
+        twothree_tree split(const value_type& key) {
+            twothree_tree right(get_allocator());
+            Subtree leftPart, rightPart;
+            bool found = false;
+            typename Node_type::entry_type foundEntry;
+            
+            splitSubtree(takeSubtree(), key, leftPart, found, foundEntry, rightPart);
+            if (found)
+                rightPart = joinSubtrees(Subtree(), std::move(foundEntry), rightPart);
+            
+            setSubtree(leftPart);
+            right.setSubtree(rightPart);
+            return right;
+        }
+        
+        //
+        // Set operations: the result is left in the tree, 'other' is left empty (its nodes are reused or freed)
+        //
+        // Splits and joins (see join): O(M log(N/M + 1)) for the smaller size M, instead of M searches
+        // and insertions into the larger tree. Both halves of the recursion run in parallel down to
+        // log2(threadsCount) levels, node allocations are serialized then.
+        //
+        void set_union(twothree_tree& other, unsigned threadsCount = std::thread::hardware_concurrency()) {
+            runSetOperation(other, threadsCount, &twothree_tree::unionSubtrees);
+        }
+        
+        void set_intersection(twothree_tree& other, unsigned threadsCount = std::thread::hardware_concurrency()) {
+            runSetOperation(other, threadsCount, &twothree_tree::intersectSubtrees);
+        }
+        
+        // Removes the elements of 'other'
+        void set_difference(twothree_tree& other, unsigned threadsCount = std::thread::hardware_concurrency()) {
+            runSetOperation(other, threadsCount, &twothree_tree::subtractSubtrees);
         }
         
         // Capacity
@@ -635,7 +1061,26 @@ namespace lab {
         bool empty() const noexcept {
             return rootNode == nullptr;
         }
-        //...
+        
+        size_type size() const noexcept {
+            return rootNode != nullptr ? rootNode->getSubtreeSize() : 0;
+        }
+        
+        // Bytes taken by the nodes (allocator's overhead excluded)
+        size_type memory_usage() const noexcept {
+            return getNodesCount() * sizeof(Node_type);
+        }
+        
+        // O(1)
+        twothree_tree_stats stats() const noexcept {
+            twothree_tree_stats result;
+            result.size = size();
+            result.node_count = getNodesCount();
+            result.height = height;
+            result.fill_factor = result.node_count > 0 ? static_cast<float>(result.size) / (2 * result.node_count) : 0.0f;
+            result.memory_usage = memory_usage();
+            return result;
+        }
         
         // Iterators
         
@@ -702,12 +1147,32 @@ namespace lab {
             return proxy.value(valueIdx);
         }
         
-    private:
+    protected:
+        // Detached subtree: the root has no parent, 'height' is in levels (0 for no subtree)
+        struct Subtree {
+            Node_type* root;
+            int height;
+            
+            Subtree() : root(nullptr), height(0) {}
+            Subtree(Node_type* root, int height) : root(root), height(height) {}
+        };
+        
+        // Set operations split the work between threads only for subtrees this large
+        static const size_type ParallelGrain = 1 << 12;
+        
         Node_type* rootNode;
         Node_allocator_type nodeAllocator;
+        Compare compare;
+        int height;
+        std::mutex* nodeAllocatorLock; // set while a set operation runs on several threads
+        Node_type* fingerNode; // position of the last insert, the hinted operations start from it; reset by any other change
         
         template<typename... Args>
         Node_type* allocateNode(Args&&... args) {
+            std::unique_lock<std::mutex> lock;
+            if (nodeAllocatorLock != nullptr)
+                lock = std::unique_lock<std::mutex>(*nodeAllocatorLock);
+            
             Node_type* node = nodeAllocator.allocate(1);
             
             try {
@@ -721,66 +1186,592 @@ namespace lab {
         }
         
         void deallocateNode(Node_type* node) {
+            std::unique_lock<std::mutex> lock;
+            if (nodeAllocatorLock != nullptr)
+                lock = std::unique_lock<std::mutex>(*nodeAllocatorLock);
+            
             nodeAllocator.destroy(node);
             nodeAllocator.deallocate(node, 1);
         }
         
-        Node_type* getFirstNode() const {
-            if (rootNode == nullptr)
-                return nullptr;
+        //
+        // Next node of the depth-first post-order traversal: the leftmost leaf of the next sibling's subtree,
+        // or the parent once all its children are visited. Reads only the node's links and its parent's
+        //
+        static Node_type* getNextPostOrder(Node_type* node) noexcept {
+            Node_type* parent = node->getParent();
+            int nextChildIdx = node->getIdxInParent() + 1;
             
-            return rootNode->getLeftmostChild();
+            if (parent != nullptr && nextChildIdx < parent->getChildrenCount())
+                return parent->getChild(nextChildIdx)->getLeftmostChild();
+            return parent;
         }
         
-        // Returns node, containing search value, or insertion proposal node
-        Node_type* findNode(const value_type& value) const {
-            if (!rootNode)
-                return nullptr;
-            
-            Node_type* curNode = rootNode;
+        //
+        // Destroys all the nodes of the subtree (root has no parent), frees them too if 'deallocate' is set
+        // Post-order traversal over the parent links: a node is disposed right after its last child,
+        // the links of the not yet disposed nodes are left untouched, so every step is O(1)
+        //
+        void disposeNodes(Node_type* root, bool deallocate) noexcept {
+            Node_type* curNode = root != nullptr ? root->getLeftmostChild() : nullptr;
             
-            while (true) {
-                if (curNode->containsValue(value))
-                    break;
+            while (curNode) {
+                Node_type* nextNode = getNextPostOrder(curNode);
                 
-                Node_type* child = curNode->chooseChild(value);
-                if (!child)
-                    break;
+                if (deallocate)
+                    deallocateNode(curNode);
+                else
+                    nodeAllocator.destroy(curNode);
                 
-                curNode = child;
+                curNode = nextNode;
+            }
+        }
+        
+        void clearImpl(std::true_type) noexcept {
+            // Other trees' nodes are in the pool too, or the nodes are larger than the pool's blocks:
+            // release() frees only the slabs, such nodes are freed one by one
+            if (nodeAllocator.is_pool_shared() || sizeof(Node_type) > memory_pool::MaxBlockSize) {
+                clearImpl(std::false_type{});
+                return;
             }
             
-            return curNode;
+            if (!std::is_trivially_destructible<Node_type>::value)
+                disposeNodes(rootNode, false);
+            
+            rootNode = nullptr;
+            nodeAllocator.release();
         }
         
-        std::pair<iterator,bool> insertImpl(const value_type& value) {
-            // Returns a pair consisting of an iterator to the inserted element (or to the element that prevented the insertion) and a bool denoting whether the insertion took place.
-            if (!rootNode) {
-                rootNode = allocateNode(value);
-                return std::make_pair(iterator{rootNode, 0}, true);
-            } else {
-                Node_type* node = findNode(value);
+        void clearImpl(std::false_type) noexcept {
+            disposeNodes(rootNode, true);
+            rootNode = nullptr;
+        }
+        
+        // Every node keeps the nodes count of its subtree: split and join leave the counts exact
+        size_type getNodesCount() const noexcept {
+            return rootNode != nullptr ? rootNode->getSubtreeNodesCount() : 0;
+        }
+        
+        Node_type* getFirstNode() const {
+            if (rootNode == nullptr)
+                return nullptr;
+            
+            return rootNode->getLeftmostChild();
+        }
+        
+        //
+        // Position of the first element not less than (greater than, if 'upper' is set) the value, or the end
+        // The answer is either in the child subtree the search goes down to or the value right after that child
+        //
+        std::pair<Node_type*, int> boundImpl(const value_type& value, bool upper) const {
+            std::pair<Node_type*, int> candidate(nullptr, 0);
+            Node_type* node = rootNode;
+            
+            while (node) {
+                int valueIdx = upper ? node->getUpperBoundIdx(value) : node->getLowerBoundIdx(value);
+                
+                if (valueIdx < node->getValuesCount()) {
+                    candidate = std::make_pair(node, valueIdx);
+                    
+                    if (!upper && !compare(value, node->getValue(valueIdx)))
+                        break; // equal value, nothing smaller qualifies
+                }
+                node = node->getChild(valueIdx);
+            }
+            
+            return candidate;
+        }
+        
+        std::pair<Node_type*, int> selectImpl(size_type index) const {
+            if (index >= size())
+                return std::make_pair(nullptr, 0);
+            
+            Node_type* node = rootNode;
+            while (true) {
+                int childIdx = 0;
+                for (; childIdx <= node->getValuesCount(); ++childIdx) {
+                    size_type childSize = node->getChildSubtreeSize(childIdx);
+                    if (index < childSize)
+                        break; // in this child's subtree
+                    
+                    index -= childSize;
+                    if (index == 0)
+                        return std::make_pair(node, childIdx);
+                    --index;
+                }
+                
+                assert(childIdx <= node->getValuesCount());
+                node = node->getChild(childIdx);
+            }
+        }
+        
+        /// Bulk load
+        
+        // Values count range of a subtree of the height (leaves are of height 0): all 2-nodes ... all 3-nodes
+        static size_type getMinSubtreeSize(int height) noexcept {
+            return (size_type(2) << height) - 1;
+        }
+        static size_type getMaxSubtreeSize(int height) noexcept {
+            double maxSize = std::pow(3.0, height + 1) - 1;
+            return maxSize < static_cast<double>(std::numeric_limits<size_type>::max()) ? static_cast<size_type>(maxSize) : std::numeric_limits<size_type>::max();
+        }
+        
+        // Subtree size of the height with every node filled to 'fill_factor'
+        static double getTargetSubtreeSize(int height, float fillFactor) noexcept {
+            return std::pow(1.0 + 2.0 * fillFactor, height + 1) - 1;
+        }
+        
+        // The lowest height reaching the fill factor, unless there are too few values for it
+        static int getBulkLoadHeight(size_type count, float fillFactor) noexcept {
+            int height = 0;
+            while (count > getMaxSubtreeSize(height))
+                ++height;
+            
+            while (count > getTargetSubtreeSize(height, fillFactor) && getMinSubtreeSize(height + 1) <= count)
+                ++height;
+            return height;
+        }
+        
+        //
+        // Builds a subtree of exactly 'height' from 'count' sorted values and links it to the parent (the root if none)
+        // Values are spread evenly between the children, the separators are the values between the children ranges.
+        //
+        void buildSubtree(const value_type* values, size_type count, int height, float fillFactor, Node_type* parent, int childIdx) {
+            assert(count >= getMinSubtreeSize(height) && count <= getMaxSubtreeSize(height));
+            
+            Node_type* node = height == 0 ? allocateNode(values[0]) : allocateNode();
+            if (parent != nullptr)
+                parent->insertChild(node, childIdx);
+            else
+                rootNode = node;
+            
+            if (height == 0) {
+                if (count == 2)
+                    node->insertValue(values[1]);
+                return;
+            }
+            
+            // 2 or 3 children: the one whose subtree sizes are closer to the target, if both fit
+            size_type minChild = getMinSubtreeSize(height - 1);
+            size_type maxChild = getMaxSubtreeSize(height - 1);
+            double target = getTargetSubtreeSize(height - 1, fillFactor);
+            
+            bool twoFit = count - 1 >= 2 * minChild && count / 2 <= maxChild;
+            bool threeFit = count - 2 >= 3 * minChild && count / 3 <= maxChild;
+            size_type childsCount = 3;
+            if (twoFit && (!threeFit || std::abs((count - 1) / 2.0 - target) <= std::abs((count - 2) / 3.0 - target)))
+                childsCount = 2;
+            
+            size_type childValuesCount = count - (childsCount - 1);
+            size_type offset = 0;
+            for (size_type i = 0; i < childsCount; ++i) {
+                size_type childCount = childValuesCount / childsCount + (i < childValuesCount % childsCount ? 1 : 0);
+                buildSubtree(values + offset, childCount, height - 1, fillFactor, node, static_cast<int>(i));
+                
+                if (i + 1 < childsCount)
+                    node->insertValue(values[offset + childCount]); // separator
+                offset += childCount + 1;
+            }
+            node->updateSubtreeSize();
+        }
+        
+        /// Join and split
+        
+        using entry_type = typename Node_type::entry_type;
+        
+        Subtree takeSubtree() noexcept {
+            Subtree subtree(rootNode, height);
+            rootNode = nullptr;
+            height = 0;
+            fingerNode = nullptr;
+            return subtree;
+        }
+        
+        void setSubtree(Subtree subtree) noexcept {
+            rootNode = subtree.root;
+            height = subtree.height;
+            fingerNode = nullptr;
+        }
+        
+        // The nodes of 'other' become this tree's nodes, they are rebuilt with this tree's allocator if they can't be shared
+        Subtree takeNodes(twothree_tree& other) {
+            if (nodeAllocator != other.nodeAllocator) {
+                twothree_tree adopted(get_allocator());
+                adopted.bulk_load(std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()));
+                other.clear();
+                if (nodeAllocator != adopted.nodeAllocator)
+                    nodeAllocator = adopted.nodeAllocator; // no pool to copy (moved from): this tree has no nodes
+                return takeNodes(adopted);
+            }
+            
+            return other.takeSubtree();
+        }
+        
+        // The greatest value, the tree is not empty
+        const value_type& getLastValue() const {
+            Node_type* node = rootNode;
+            while (!node->isLeafNode()) {
+                node = node->getChild(node->getChildrenCount() - 1);
+            }
+            return node->getValue(node->getValuesCount() - 1);
+        }
+        
+        //
+        // Joins two subtrees with the separator between them: left < separator < right
+        // The lower subtree becomes the last (first) child of the node at its level + 1 on the right (left) spine
+        // of the higher one, the node is fixed as after an insertion. O(height difference + 1)
+        //
+        Subtree joinSubtrees(Subtree left, entry_type separator, Subtree right) {
+            if (left.height == right.height) {
+                Node_type* node = allocateNode(std::move(separator));
+                if (left.root != nullptr) {
+                    node->insertChild(left.root, 0);
+                    node->insertChild(right.root, 1);
+                    node->updateSubtreeSize();
+                }
+                return Subtree(node, left.height + 1);
+            }
+            
+            bool leftHigher = left.height > right.height;
+            Subtree higher = leftHigher ? left : right;
+            Subtree lower = leftHigher ? right : left;
+            
+            Node_type* node = higher.root;
+            for (int level = higher.height; level > lower.height + 1; --level) {
+                node = node->getChild(leftHigher ? node->getChildrenCount() - 1 : 0);
+            }
+            
+            std::size_t oldSize = node->getSubtreeSize();
+            std::size_t oldNodesCount = node->getSubtreeNodesCount();
+            int valueIdx = node->insertValue(std::move(separator));
+            if (lower.root != nullptr)
+                node->insertChild(lower.root, leftHigher ? valueIdx + 1 : 0);
+            node->updateSubtreeSize();
+            node->updateAncestorsSubtreeSize(static_cast<std::ptrdiff_t>(node->getSubtreeSize() - oldSize),
+                                             static_cast<std::ptrdiff_t>(node->getSubtreeNodesCount() - oldNodesCount));
+            
+            bool rootSplit = false;
+            fixNodeInsert(node, valueIdx, rootSplit);
+            return Subtree(higher.root, higher.height + (rootSplit ? 1 : 0));
+        }
+        
+        // Joins two subtrees without a separator: the smallest value of the right one is taken out for it
+        Subtree concatSubtrees(Subtree left, Subtree right) {
+            if (right.root == nullptr)
+                return left;
+            if (left.root == nullptr)
+                return right;
+            
+            key_type minKey = right.root->getLeftmostChild()->getValue(0);
+            Subtree empty, rest;
+            bool found = false;
+            entry_type separator;
+            splitSubtree(right, minKey, empty, found, separator, rest);
+            assert(found && empty.root == nullptr);
+            
+            return joinSubtrees(left, std::move(separator), rest);
+        }
+        
+        //
+        // Splits the subtree into the values less than the key and the greater ones, the equivalent value is taken out
+        // The root is dismantled, the parts on both sides of the child the key belongs to are joined
+        // to the parts of that child's split, nearest first: the joins' costs telescope to O(height)
+        //
+        void splitSubtree(Subtree tree, const key_type& key, Subtree& left, bool& found, entry_type& foundEntry, Subtree& right) {
+            if (tree.root == nullptr) {
+                left = right = Subtree();
+                found = false;
+                return;
+            }
+            
+            bool isFound = false;
+            int idx = tree.root->searchValue(key, isFound);
+            
+            entry_type entries[2];
+            Node_type* childs[3];
+            int count = tree.root->releaseContents(entries, childs);
+            deallocateNode(tree.root);
+            int childHeight = tree.height - 1;
+            
+            if (isFound) {
+                found = true;
+                foundEntry = std::move(entries[idx]);
+                left = Subtree(childs[idx], childHeight);
+                right = Subtree(childs[idx + 1], childHeight);
+            } else {
+                splitSubtree(Subtree(childs[idx], childHeight), key, left, found, foundEntry, right);
+            }
+            
+            for (int i = idx - 1; i >= 0; --i) {
+                left = joinSubtrees(Subtree(childs[i], childHeight), std::move(entries[i]), left);
+            }
+            for (int i = isFound ? idx + 1 : idx; i < count; ++i) {
+                right = joinSubtrees(right, std::move(entries[i]), Subtree(childs[i + 1], childHeight));
+            }
+        }
+        
+        // Takes the root apart: left < key < right
+        void exposeSubtree(Subtree tree, Subtree& left, entry_type& key, Subtree& right) {
+            entry_type entries[2];
+            Node_type* childs[3];
+            int count = tree.root->releaseContents(entries, childs);
+            deallocateNode(tree.root);
+            int childHeight = tree.height - 1;
+            
+            left = Subtree(childs[0], childHeight);
+            key = std::move(entries[0]);
+            right = Subtree(childs[1], childHeight);
+            if (count == 2)
+                right = joinSubtrees(right, std::move(entries[1]), Subtree(childs[2], childHeight));
+        }
+        
+        void disposeSubtree(Subtree tree) noexcept {
+            disposeNodes(tree.root, true);
+        }
+        
+        static size_type getSubtreeSize(Subtree tree) noexcept {
+            return tree.root != nullptr ? tree.root->getSubtreeSize() : 0;
+        }
+        
+        /// Set operations
+        
+        template<typename Operation>
+        void runSetOperation(twothree_tree& other, unsigned threadsCount, Operation operation) {
+            Subtree otherPart = takeNodes(other);
+            
+            int parallelDepth = 0;
+            while ((1u << parallelDepth) < threadsCount) {
+                ++parallelDepth;
+            }
+            
+            std::mutex allocatorLock;
+            if (parallelDepth > 0)
+                nodeAllocatorLock = &allocatorLock;
+            
+            try {
+                setSubtree((this->*operation)(takeSubtree(), otherPart, parallelDepth));
+            } catch(...) {
+                nodeAllocatorLock = nullptr;
+                throw;
+            }
+            nodeAllocatorLock = nullptr;
+        }
+        
+        // Runs both halves of a set operation, the first one on another thread if 'parallel' is set
+        template<typename First, typename Second>
+        static void runHalves(bool parallel, First first, Second second) {
+            if (!parallel) {
+                first();
+                second();
+                return;
+            }
+            
+            std::future<void> firstDone = std::async(std::launch::async, first);
+            try {
+                second();
+            } catch(...) {
+                firstDone.wait();
+                throw;
+            }
+            firstDone.get();
+        }
+        
+        static bool isParallel(int parallelDepth, Subtree a, Subtree b) noexcept {
+            return parallelDepth > 0 && getSubtreeSize(a) + getSubtreeSize(b) >= ParallelGrain;
+        }
+        
+        // The root value of 'a' splits 'b', the halves are united recursively and joined with that value
+        Subtree unionSubtrees(Subtree a, Subtree b, int parallelDepth) {
+            if (a.root == nullptr)
+                return b;
+            if (b.root == nullptr)
+                return a;
+            
+            bool parallel = isParallel(parallelDepth, a, b);
+            Subtree aLeft, aRight, bLeft, bRight, left, right;
+            entry_type key, duplicate;
+            bool found = false;
+            exposeSubtree(a, aLeft, key, aRight);
+            splitSubtree(b, Node_type::getEntryKey(key), bLeft, found, duplicate, bRight);
+            
+            runHalves(parallel,
+                      [&]() { left = unionSubtrees(aLeft, bLeft, parallelDepth - 1); },
+                      [&]() { right = unionSubtrees(aRight, bRight, parallelDepth - 1); });
+            return joinSubtrees(left, std::move(key), right);
+        }
+        
+        // Same recursion, the root value of 'a' is kept only if 'b' has it too
+        Subtree intersectSubtrees(Subtree a, Subtree b, int parallelDepth) {
+            if (a.root == nullptr || b.root == nullptr) {
+                disposeSubtree(a);
+                disposeSubtree(b);
+                return Subtree();
+            }
+            
+            bool parallel = isParallel(parallelDepth, a, b);
+            Subtree aLeft, aRight, bLeft, bRight, left, right;
+            entry_type key, duplicate;
+            bool found = false;
+            exposeSubtree(a, aLeft, key, aRight);
+            splitSubtree(b, Node_type::getEntryKey(key), bLeft, found, duplicate, bRight);
+            
+            runHalves(parallel,
+                      [&]() { left = intersectSubtrees(aLeft, bLeft, parallelDepth - 1); },
+                      [&]() { right = intersectSubtrees(aRight, bRight, parallelDepth - 1); });
+            return found ? joinSubtrees(left, std::move(key), right) : concatSubtrees(left, right);
+        }
+        
+        // The root value of 'b' splits 'a' (and is dropped from it), the halves are subtracted recursively
+        Subtree subtractSubtrees(Subtree a, Subtree b, int parallelDepth) {
+            if (a.root == nullptr || b.root == nullptr) {
+                disposeSubtree(b);
+                return a;
+            }
+            
+            bool parallel = isParallel(parallelDepth, a, b);
+            Subtree aLeft, aRight, bLeft, bRight, left, right;
+            entry_type key, removed;
+            bool found = false;
+            exposeSubtree(b, bLeft, key, bRight);
+            splitSubtree(a, Node_type::getEntryKey(key), aLeft, found, removed, aRight);
+            
+            runHalves(parallel,
+                      [&]() { left = subtractSubtrees(aLeft, bLeft, parallelDepth - 1); },
+                      [&]() { right = subtractSubtrees(aRight, bRight, parallelDepth - 1); });
+            return concatSubtrees(left, right);
+        }
+        
+        //
+        // Returns node, containing search value, or insertion proposal node
+        // 'valueIdx' is set to the index of the value in the node, -1 if there is no such value
+        // The search starts from 'startNode', its subtree must hold the value's place (see getFingerStart)
+        //
+        Node_type* findNode(const value_type& value, int& valueIdx) const {
+            return findNode(rootNode, value, valueIdx);
+        }
+        Node_type* findNode(Node_type* startNode, const value_type& value, int& valueIdx) const {
+            valueIdx = -1;
+            if (!startNode)
+                return nullptr;
+            
+            Node_type* curNode = startNode;
+            
+            while (true) {
+                bool found = false;
+                int idx = curNode->searchValue(value, found);
+                if (found) {
+                    valueIdx = idx;
+                    break;
+                }
+                
+                if (curNode->isLeafNode())
+                    break;
+                
+                curNode = curNode->getChild(idx);
+            }
+            
+            return curNode;
+        }
+        
+        //
+        // Finger search: the lowest ancestor of 'node' (or the node itself) whose subtree holds the value's place
+        // A null 'node' stands for the position of the last insert, the root is used if there is none
+        // A subtree's range is bounded by the nearest separators to its left and to its right among the ancestors,
+        // the climb stops as soon as both are found on the right sides of the value. For a value d positions away from
+        // the node the climb is O(log d) on average: O(1) for the next value of a sorted stream.
+        //
+        Node_type* getFingerStart(Node_type* node, const value_type& value) const {
+            if (!node)
+                node = fingerNode;
+            if (!node)
+                return rootNode;
+            
+            Node_type* start = node;
+            bool lowBoundNeeded = true;
+            bool highBoundNeeded = true;
+            
+            while ((lowBoundNeeded || highBoundNeeded) && node->getParent()) {
+                Node_type* parent = node->getParent();
+                int idx = node->getIdxInParent();
+                
+                if (lowBoundNeeded && idx > 0) {
+                    if (compare(parent->getValue(idx - 1), value)) {
+                        lowBoundNeeded = false;
+                    } else {
+                        // The value isn't above the separator, which is below the parent's high bound
+                        start = parent;
+                        highBoundNeeded = false;
+                    }
+                }
+                if (highBoundNeeded && idx < parent->getValuesCount()) {
+                    if (compare(value, parent->getValue(idx))) {
+                        highBoundNeeded = false;
+                    } else {
+                        start = parent;
+                        lowBoundNeeded = false;
+                    }
+                }
+                node = parent;
+            }
+            
+            return start;
+        }
+        
+        //
+        // Inserts the entry constructed from 'args' unless there is a value equivalent to the key
+        // The entry is constructed only if the insertion takes place
+        //
+        template<typename... Args>
+        std::pair<iterator,bool> insertImpl(const key_type& key, Args&&... args) {
+            return insertFromImpl(rootNode, key, std::forward<Args>(args)...);
+        }
+        
+        // Same, the search starts from 'startNode' (see findNode)
+        template<typename... Args>
+        std::pair<iterator,bool> insertFromImpl(Node_type* startNode, const key_type& key, Args&&... args) {
+            // Returns a pair consisting of an iterator to the inserted element (or to the element that prevented the insertion) and a bool denoting whether the insertion took place.
+            using entry_type = typename Node_type::entry_type;
+            
+            if (!rootNode) {
+                rootNode = allocateNode(entry_type(std::forward<Args>(args)...));
+                height = 1;
+                fingerNode = rootNode;
+                return std::make_pair(iterator{rootNode, 0}, true);
+            } else {
+                int valueIdx = -1;
+                Node_type* node = findNode(startNode, key, valueIdx);
                 
                 // node is always non null here, at least we have root node
-                int valueIdx = node->getValueIdx(value);
-                if (valueIdx != -1)
+                if (valueIdx != -1) {
+                    fingerNode = node;
                     return std::make_pair(iterator{node, valueIdx}, false);
+                }
                 
-                node->insertValue(value);
-                node = fixNodeInsert(node, value);
+                // 'key' may be moved from from now on
+                valueIdx = node->insertValue(entry_type(std::forward<Args>(args)...));
+                node->updateAncestorsSubtreeSize(1);
+                bool rootSplit = false;
+                std::pair<Node_type*, int> position = fixNodeInsert(node, valueIdx, rootSplit);
+                if (rootSplit)
+                    ++height;
                 
-                assert(node && node->containsValue(value));
-                valueIdx = node->getValueIdx(value);
-                return std::make_pair(iterator{node, valueIdx}, true);
+                fingerNode = position.first;
+                return std::make_pair(iterator{position.first, position.second}, true);
             }
         }
         
-        // After all fixes retuns node that contains new inserted value
-        Node_type* fixNodeInsert(Node_type* node, const value_type& value) {
+        //
+        // After all fixes retuns node and index of the new inserted value
+        // The value is tracked by its position: the left and the right values of a 4-node go to the new children,
+        // the middle one goes up with the node
+        // 'rootSplit' is set if the subtree got higher: its root node stays the root
+        //
+        std::pair<Node_type*, int> fixNodeInsert(Node_type* node, int valueIdx, bool& rootSplit) {
             if (node->isConsistent())
-                return node;
+                return std::make_pair(node, valueIdx);
             
             Node_type* valueNode = nullptr;
+            std::ptrdiff_t mergedSplits = 0; // each one adds a node to the subtrees above the merging parent
             
             do {
                 // We have a 4-node here, split it and propagate higher
@@ -796,33 +1787,43 @@ namespace lab {
                     node->splitIf4Node(newLeftChild, newRightChild);
                     assert(node->isConsistent()); // Check if splitted down to 2-node
 
-                    if (!valueNode && newLeftChild->containsValue(value))
-                        valueNode = newLeftChild;
-                    if (!valueNode && newRightChild->containsValue(value))
-                        valueNode = newRightChild;
+                    if (!valueNode && valueIdx != 1) {
+                        valueNode = valueIdx == 0 ? newLeftChild : newRightChild;
+                        valueIdx = 0;
+                    } else if (!valueNode) {
+                        valueIdx = 0; // the middle value
+                    }
                     
                     if (node->getParent()) {
                         Node_type* parent = node->getParent();
-                        parent->mergeWithChild(node);
+                        int mergedIdx = parent->mergeWithChild(node);
                         deallocateNode(node); // Can be reused
+                        ++mergedSplits;
                         
+                        if (!valueNode)
+                            valueIdx = mergedIdx;
                         node = parent;
+                    } else {
+                        rootSplit = true;
                     }
                 } catch(...) {
                     if (newLeftChild && !newLeftChild->getParent())
                         deallocateNode(newLeftChild);
                     if (newRightChild && !newRightChild->getParent())
                         deallocateNode(newRightChild);
+                    node->updateAncestorsSubtreeSize(0, mergedSplits);
                     throw;
                 }
             } while (!node->isConsistent());
             
+            node->updateAncestorsSubtreeSize(0, mergedSplits);
+            
             if (!valueNode)
                 valueNode = node;
             
             assert(valueNode != nullptr);
-            assert(valueNode->containsValue(value));
-            return valueNode;
+            assert(valueIdx >= 0 && valueIdx < valueNode->getValuesCount());
+            return std::make_pair(valueNode, valueIdx);
         }
         
         int eraseImpl(const_iterator pos) {
@@ -832,6 +1833,8 @@ namespace lab {
             if (node == nullptr)
                 return 0;
             
+            fingerNode = nullptr; // nodes may be merged and freed
+            
             // Downward phase, cases:
             // 1. Del from non-terminal 3-node: replace the value from its in-order predecessor
             // 2. Del from non-terminal 2-node: replace the value from its in-order predecessor
@@ -840,6 +1843,7 @@ namespace lab {
             if (node->isLeafNode()) {
                 // Leaf node
                 node->removeValueAtIdx(valueIdx);
+                node->updateAncestorsSubtreeSize(-1);
             } else if (node->isTwoNode() || node->isThreeNode()) {
                 // Internal 2-node or 3-node
                 const_iterator nextPos = pos; // in-order successor
@@ -853,6 +1857,7 @@ namespace lab {
                 assert(leafNode->getValuesCount() > 0);
 
                 node->replaceValue(leafNode->removeValueAtIdx(leafValueIdx), valueIdx);
+                leafNode->updateAncestorsSubtreeSize(-1);
                 node = leafNode;
             } else {
                 assert(false);
@@ -862,6 +1867,7 @@ namespace lab {
                 // root node removed
                 deallocateNode(rootNode);
                 rootNode = nullptr;
+                height = 0;
             } else if (node->isLeafNode() && node->getValuesCount() == 1) {
                 // former 3-node, the tree is in consistent state now
             } else {
@@ -880,10 +1886,12 @@ namespace lab {
             //      Move the parent to the hole node's place (left or right), rearrange children
             // 3. 3-node as a parent, 2-node as a sibling: two subcases...
             // 4. 3-node as a parent, 3-node as a sibling: two subcases...
+            // The parents are recounted, the nodes freed below the last one are subtracted from its ancestors
+            std::ptrdiff_t freedNodes = 0;
             while (holeNode) {
                 Node_type* parent = holeNode->getParent();
                 assert(parent != nullptr);
-                int idxInParent = parent->getChildIdx(holeNode);
+                int idxInParent = holeNode->getIdxInParent();
                 assert(idxInParent != -1);
                 
                 if (parent->isTwoNode()) {
@@ -902,11 +1910,15 @@ namespace lab {
                             sibling->insertChild(holeChild, idxInParent == 0 ? 0 : 2);
                         
                         deallocateNode(parent->removeChild(idxInParent));
+                        ++freedNodes;
+                        sibling->updateSubtreeSize();
+                        parent->updateSubtreeSize();
                         
                         if (parent == rootNode) { // eliminate hole at the root of the tree (tree height decrement)
                             assert(parent->getChildrenCount() == 1);
                             rootNode = parent->removeChild(0);
                             deallocateNode(parent);
+                            --height;
                             holeNode = nullptr;
                         } else {
                             holeNode = parent;
@@ -922,6 +1934,11 @@ namespace lab {
                         if (siblingChild != nullptr)
                             holeNode->insertChild(siblingChild, siblingIdx);
                         
+                        holeNode->updateSubtreeSize();
+                        sibling->updateSubtreeSize();
+                        parent->updateSubtreeSize();
+                        if (freedNodes > 0)
+                            parent->updateAncestorsSubtreeSize(0, -freedNodes);
                         holeNode = nullptr;
                     } else {
                         assert(false);
@@ -952,6 +1969,8 @@ namespace lab {
                             sibling->insertChild(holeChild, rotateLeft ? 0 : 2);
                         
                         deallocateNode(parent->removeChild(idxInParent));
+                        ++freedNodes;
+                        sibling->updateSubtreeSize();
                     } else if (sibling->isThreeNode()) { // Case 4
                         // removeValue from:Sibling atIndex:(0|1) -> replaceValue to:Parent atIndex:(0|1) -> insertValue to:Hole
                         // removeChild from:Sibling atIndex:(0|2) -> insertChild to:Hole atIndex:(1|0)
@@ -963,9 +1982,15 @@ namespace lab {
                         Node_type* siblingChild = sibling->removeChild(rotateLeft ? 0 : 2);
                         if (siblingChild != nullptr)
                             holeNode->insertChild(siblingChild, rotateLeft ? 1 : 0);
+                        
+                        holeNode->updateSubtreeSize();
+                        sibling->updateSubtreeSize();
                     } else {
                         assert(false);
                     }
+                    parent->updateSubtreeSize();
+                    if (freedNodes > 0)
+                        parent->updateAncestorsSubtreeSize(0, -freedNodes);
                     holeNode = nullptr;
                 } else {
                     assert(false);
@@ -973,6 +1998,338 @@ namespace lab {
             }
         }
     };
+    
+    ///// Map iterators
+    /// Keys and mapped values are stored apart, so the elements are accessed through a pair of references
+    template<typename Reference>
+    struct Node_map_arrow_proxy
+    {
+        Reference reference;
+        
+        Reference* operator->() {
+            return std::addressof(reference);
+        }
+    };
+    
+    template<typename Key, typename T, typename node_type>
+    struct Node_map_iterator : public Node_iterator_base<Key, node_type>
+    {
+    private:
+        using base_type = Node_iterator_base<Key, node_type>;
+    
+    public:
+        using value_type = std::pair<const Key, T>;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+        
+        using reference = std::pair<const Key&, T&>;
+        using pointer = Node_map_arrow_proxy<reference>;
+        
+        Node_map_iterator(node_type* curNode, int valueIdx) :
+            base_type(curNode, valueIdx) {}
+        
+        reference
+        operator*() const {
+            return reference(this->current->getValue(this->valueIdx), this->current->getMapped(this->valueIdx));
+        }
+        
+        pointer
+        operator->() const {
+            return pointer{**this};
+        }
+        
+        Node_map_iterator&
+        operator++() {
+            this->incr();
+            return *this;
+        }
+        
+        Node_map_iterator
+        operator++(int) {
+            Node_map_iterator tmp(*this);
+            this->incr();
+            return tmp;
+        }
+    };
+    
+    template<typename Key, typename T, typename node_type>
+    struct Node_map_const_iterator : public Node_iterator_base<Key, node_type>
+    {
+    private:
+        using base_type = Node_iterator_base<Key, node_type>;
+    
+    public:
+        using value_type = std::pair<const Key, T>;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+        
+        using reference = std::pair<const Key&, const T&>;
+        using pointer = Node_map_arrow_proxy<reference>;
+        
+        Node_map_const_iterator(node_type* curNode, int valueIdx) :
+            base_type(curNode, valueIdx) {}
+        
+        Node_map_const_iterator(const Node_map_iterator<Key, T, node_type>& other) :
+            base_type(other.current, other.valueIdx)
+        {}
+        
+        reference
+        operator*() const {
+            return reference(this->current->getValue(this->valueIdx), this->current->getMapped(this->valueIdx));
+        }
+        
+        pointer
+        operator->() const {
+            return pointer{**this};
+        }
+        
+        Node_map_const_iterator&
+        operator++() {
+            this->incr();
+            return *this;
+        }
+        
+        Node_map_const_iterator
+        operator++(int) {
+            Node_map_const_iterator tmp(*this);
+            this->incr();
+            return tmp;
+        }
+    };
+    ///// Map iterators
+    
+    //
+    // 2-3 Tree map
+    //
+    // Same balancing as twothree_tree, the mapped values are kept in the nodes next to the keys:
+    // one search per access, and the searches only read the keys' array.
+    // Dereferencing an iterator gives a pair of references: std::pair<const Key&, T&>.
+    // The mapped type has to be default constructible (nodes are allocated with all their slots).
+    //
+    template<
+        typename Key,
+        typename T,
+        typename Compare = std::less<Key>,
+        typename Allocator = pool_allocator< std::pair<const Key, T> >
+    >
+    class twothree_tree_map : private twothree_tree<Key, Compare, Allocator, T> {
+    private:
+        using base_type = twothree_tree<Key, Compare, Allocator, T>;
+        using typename base_type::Node_type;
+        using base_iterator = typename base_type::iterator;
+        using base_const_iterator = typename base_type::const_iterator;
+    
+    public:
+        using key_type = Key;
+        using mapped_type = T;
+        using value_type = std::pair<const Key, T>;
+        using size_type = std::size_t;
+        
+        using iterator = Node_map_iterator<Key, T, Node_type>;
+        using const_iterator = Node_map_const_iterator<Key, T, Node_type>;
+        
+        twothree_tree_map() {}
+        
+        twothree_tree_map(std::initializer_list<value_type> ilist) {
+            insert(ilist);
+        }
+        
+        // Lookup
+        
+        T& operator[](const key_type& key) {
+            return try_emplace(key).first->second;
+        }
+        
+        T& operator[](key_type&& key) {
+            return try_emplace(std::move(key)).first->second;
+        }
+        
+        // Throws std::out_of_range if the key isn't found
+        T& at(const key_type& key) {
+            iterator pos = find(key);
+            if (pos == end())
+                throw std::out_of_range("twothree_tree_map::at: key not found");
+            return pos->second;
+        }
+        const T& at(const key_type& key) const {
+            const_iterator pos = find(key);
+            if (pos == end())
+                throw std::out_of_range("twothree_tree_map::at: key not found");
+            return pos->second;
+        }
+        
+        iterator find(const key_type& key) {
+            return toIterator(base_type::find(key));
+        }
+        const_iterator find(const key_type& key) const {
+            return toIterator(base_type::find(key));
+        }
+        
+        size_type count(const key_type& key) const {
+            return find(key) != end() ? 1 : 0;
+        }
+        
+        iterator lower_bound(const key_type& key) {
+            return toIterator(base_type::lower_bound(key));
+        }
+        const_iterator lower_bound(const key_type& key) const {
+            return toIterator(base_type::lower_bound(key));
+        }
+        
+        iterator upper_bound(const key_type& key) {
+            return toIterator(base_type::upper_bound(key));
+        }
+        const_iterator upper_bound(const key_type& key) const {
+            return toIterator(base_type::upper_bound(key));
+        }
+        
+        std::pair<iterator, iterator> equal_range(const key_type& key) {
+            return std::make_pair(lower_bound(key), upper_bound(key));
+        }
+        std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const {
+            return std::make_pair(lower_bound(key), upper_bound(key));
+        }
+        
+        using base_type::rank;
+        using base_type::count_range;
+        
+        // Modifiers
+        
+        std::pair<iterator,bool> insert(const value_type& value) {
+            return toIterator(this->insertImpl(value.first, value));
+        }
+        
+        // The mapped value is moved into the node, the key is copied (it is const in the value)
+        std::pair<iterator,bool> insert(value_type&& value) {
+            return toIterator(this->insertImpl(value.first, std::move(value)));
+        }
+        
+        // Hinted inserts, see twothree_tree::insert with a hint
+        iterator insert(const_iterator hint, const value_type& value) {
+            return toIterator(this->insertFromImpl(this->getFingerStart(hint.current, value.first), value.first, value).first);
+        }
+        iterator insert(const_iterator hint, value_type&& value) {
+            return toIterator(this->insertFromImpl(this->getFingerStart(hint.current, value.first), value.first, std::move(value)).first);
+        }
+        
+        template< class InputIt >
+        void insert(InputIt first, InputIt last) {
+            for (; first != last; ++first) {
+                insert(*first);
+            }
+        }
+        
+        void insert(std::initializer_list<value_type> ilist) {
+            insert(ilist.begin(), ilist.end());
+        }
+        
+        // The value is constructed first to get its key, use try_emplace to construct it only if the key is absent
+        template<typename... Args>
+        std::pair<iterator,bool> emplace(Args&&... args) {
+            value_type value(std::forward<Args>(args)...);
+            return toIterator(this->insertImpl(value.first, std::move(value)));
+        }
+        
+        template<typename... Args>
+        std::pair<iterator,bool> try_emplace(const key_type& key, Args&&... args) {
+            return toIterator(this->insertImpl(key, std::piecewise_construct,
+                                               std::forward_as_tuple(key),
+                                               std::forward_as_tuple(std::forward<Args>(args)...)));
+        }
+        
+        template<typename... Args>
+        std::pair<iterator,bool> try_emplace(key_type&& key, Args&&... args) {
+            return toIterator(this->insertImpl(key, std::piecewise_construct,
+                                               std::forward_as_tuple(std::move(key)),
+                                               std::forward_as_tuple(std::forward<Args>(args)...)));
+        }
+        
+        template<typename... Args>
+        iterator try_emplace(const_iterator hint, const key_type& key, Args&&... args) {
+            return toIterator(this->insertFromImpl(this->getFingerStart(hint.current, key), key, std::piecewise_construct,
+                                                   std::forward_as_tuple(key),
+                                                   std::forward_as_tuple(std::forward<Args>(args)...)).first);
+        }
+        
+        template<typename... Args>
+        iterator try_emplace(const_iterator hint, key_type&& key, Args&&... args) {
+            return toIterator(this->insertFromImpl(this->getFingerStart(hint.current, key), key, std::piecewise_construct,
+                                                   std::forward_as_tuple(std::move(key)),
+                                                   std::forward_as_tuple(std::forward<Args>(args)...)).first);
+        }
+        
+        template<typename M>
+        std::pair<iterator,bool> insert_or_assign(const key_type& key, M&& obj) {
+            std::pair<iterator,bool> result = try_emplace(key, std::forward<M>(obj));
+            if (!result.second)
+                result.first->second = std::forward<M>(obj);
+            return result;
+        }
+        
+        template<typename M>
+        std::pair<iterator,bool> insert_or_assign(key_type&& key, M&& obj) {
+            std::pair<iterator,bool> result = try_emplace(std::move(key), std::forward<M>(obj));
+            if (!result.second)
+                result.first->second = std::forward<M>(obj);
+            return result;
+        }
+        
+        void erase(const_iterator pos) {
+            this->eraseImpl(base_const_iterator(pos.current, pos.valueIdx));
+        }
+        
+        // Returns: Number of elements removed.
+        size_type erase(const key_type& key) {
+            return base_type::erase(key);
+        }
+        
+        using base_type::clear;
+        using base_type::release_all;
+        
+        // Capacity
+        
+        using base_type::empty;
+        using base_type::size;
+        using base_type::memory_usage;
+        using base_type::stats;
+        
+        // Iterators
+        
+        iterator begin() noexcept {
+            return toIterator(base_type::begin());
+        }
+        
+        const_iterator begin() const noexcept {
+            return toIterator(base_type::begin());
+        }
+        
+        iterator end() noexcept {
+            return iterator(nullptr, 0);
+        }
+        
+        const_iterator end() const noexcept {
+            return const_iterator(nullptr, 0);
+        }
+        
+        const_iterator cbegin() const noexcept {
+            return begin();
+        }
+        
+        const_iterator cend() const noexcept {
+            return end();
+        }
+    
+    private:
+        static iterator toIterator(const base_iterator& pos) noexcept {
+            return iterator(pos.current, pos.valueIdx);
+        }
+        static const_iterator toIterator(const base_const_iterator& pos) noexcept {
+            return const_iterator(pos.current, pos.valueIdx);
+        }
+        static std::pair<iterator,bool> toIterator(const std::pair<base_iterator,bool>& result) noexcept {
+            return std::make_pair(toIterator(result.first), result.second);
+        }
+    };
 
 } // namespace lab
 
@@ -9,13 +9,26 @@
 
 #include "sort/sort.h"
 #include "data/hash_map.h"
+#include "data/concurrent_hash_map.h"
+#include "data/lock_free_hash_set.h"
+#include "data/mapped_hash_map.h"
+#include "data/cuckoo_hash_map.h"
+#include "data/filter.h"
+#include "data/btree.h"
 #include "data/twothree_tree.h"
+#include "data/concurrent_twothree_tree.h"
+#include "data/persistent_twothree_tree.h"
+#include "data/static_search_tree.h"
+#include "data/learned_index.h"
 
 #include <iostream>
 #include <vector>
 #include <list>
+#include <set>
+#include <map>
 #include <array>
 #include <algorithm>
+#include <numeric>
 #include <iterator>
 #include <functional>
 #include <initializer_list>
@@ -25,6 +38,11 @@
 #include <future>
 #include <string>
 #include <utility>
+#include <limits>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
 
 
 struct Data {
@@ -524,383 +542,3176 @@ void testHashMap() {
     assert(testMap.count("44") == 1);
     
     testMap.erase(++testMap.cbegin());
+    
+    // Emplacement
+    
+    auto emplaceRes1 = testMap.try_emplace("1000", 1000, 1000);
+    auto emplaceRes2 = testMap.try_emplace("1000", 1, 1);
+    assert(emplaceRes1.second == true);
+    assert(emplaceRes2.second == false);
+    assert(emplaceRes2.first->second == Data(1000, 1000));
+    
+    auto assignRes1 = testMap.insert_or_assign("1001", Data { 1, 1 });
+    auto assignRes2 = testMap.insert_or_assign("1001", Data { 1001, 1001 });
+    assert(assignRes1.second == true);
+    assert(assignRes2.second == false);
+    assert(testMap["1001"] == Data(1001, 1001));
+    
+    auto emplaceRes3 = testMap.emplace("1002", Data { 1002, 1002 });
+    assert(emplaceRes3.second == true);
+    assert(emplaceRes3.first->second == Data(1002, 1002));
+    
+    // Heterogeneous lookup
+    
+    using StringMap = lab::hash_map<std::string, int, lab::string_hash, lab::string_equal>;
+    StringMap strMap;
+    std::string movedKey = "moved";
+    std::unique_ptr<int> movedValue { new int(5) };
+    
+    strMap["first"] = 1;
+    strMap[std::move(movedKey)] = 2;
+    
+    for (int i = 0; i < 100; ++i) {
+        strMap.try_emplace(std::to_string(i), i);
+    }
+    
+    assert(strMap.find("first") != strMap.end());
+    assert(strMap.find("moved")->second == 2);
+    assert(strMap.count("42") == 1);
+    assert(strMap.count("absent") == 0);
+    assert(strMap.erase("42") == 1);
+    assert(strMap.count(std::string("42")) == 0);
+    
+    lab::hash_map<int, std::unique_ptr<int>> ptrMap;
+    ptrMap.try_emplace(1, std::move(movedValue));
+    for (int i = 2; i < 100; ++i) {
+        ptrMap.try_emplace(i, new int(i));
+    }
+    assert(*ptrMap.find(1)->second == 5);
+    assert(*ptrMap.find(99)->second == 99);
+    
+    // Non default constructible values, copies
+    
+    struct NoDefault {
+        explicit NoDefault(int value) : values(value, value) {}
+        std::vector<int> values;
+    };
+    
+    lab::hash_map<int, NoDefault> noDefaultMap;
+    for (int i = 0; i < 100; ++i) {
+        noDefaultMap.try_emplace(i, i);
+    }
+    for (int i = 0; i < 100; i += 3) {
+        noDefaultMap.erase(i);
+    }
+    for (int i = 0; i < 100; i += 6) {
+        noDefaultMap.try_emplace(i, i);
+    }
+    
+    lab::hash_map<int, NoDefault> noDefaultCopy { noDefaultMap };
+    assert(noDefaultCopy.size() == noDefaultMap.size());
+    
+    for (auto& pair : noDefaultCopy) {
+        assert(pair.second.values.size() == static_cast<size_t>(pair.first));
+        assert(noDefaultMap.find(pair.first) != noDefaultMap.end());
+    }
+    assert(noDefaultCopy.count(3) == 0);
+    assert(noDefaultCopy.count(6) == 1);
+    
+    // Batched lookup
+    
+    std::vector<int> batchKeys;
+    for (int i = 0; i < 150; ++i) {
+        batchKeys.push_back(i);
+    }
+    
+    std::vector<lab::hash_map<int, NoDefault>::const_iterator> batchFound;
+    std::vector<bool> batchContains;
+    noDefaultMap.find_batch(batchKeys.begin(), batchKeys.end(), std::back_inserter(batchFound));
+    noDefaultMap.contains_batch(batchKeys.begin(), batchKeys.end(), std::back_inserter(batchContains));
+    assert(batchFound.size() == batchKeys.size());
+    
+    const auto& constNoDefaultMap = noDefaultMap;
+    for (size_t i = 0; i < batchKeys.size(); ++i) {
+        assert(batchFound[i] == constNoDefaultMap.find(batchKeys[i]));
+        assert(batchContains[i] == (noDefaultMap.count(batchKeys[i]) == 1));
+    }
+    
+    // Sparse tables, clear & shrink
+    
+    using IntMap = lab::hash_map<int, int>;
+    IntMap sparseMap;
+    for (int i = 0; i < 10000; ++i) {
+        sparseMap[i] = i;
+    }
+    for (int i = 0; i < 10000; ++i) {
+        if (i % 100 != 99)
+            sparseMap.erase(i);
+    }
+    assert(sparseMap.size() == 100);
+    assert(sparseMap.begin()->first % 100 == 99);
+    assert(std::distance(sparseMap.begin(), sparseMap.end()) == 100);
+    
+    // begin() follows erasures and insertions in front of it
+    sparseMap.erase(sparseMap.begin());
+    assert(std::distance(sparseMap.cbegin(), sparseMap.cend()) == 99);
+    sparseMap[0] = 0;
+    assert(sparseMap.begin()->first == 0);
+    sparseMap.erase(0);
+    
+    IntMap frontMap;
+    for (int i = 0; i < 1000; ++i) {
+        frontMap[i] = i;
+    }
+    while (!frontMap.empty()) {
+        frontMap.erase(frontMap.begin());
+        assert(static_cast<size_t>(std::distance(frontMap.begin(), frontMap.end())) == frontMap.size());
+    }
+    
+    // begin() doesn't write to a const map: concurrent readers need no locking
+    const IntMap& sharedMap = sparseMap;
+    std::vector<long long> sums(4, 0);
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < sums.size(); ++t) {
+        readers.push_back(std::thread([&sharedMap, &sums, t]() {
+            for (int pass = 0; pass < 100; ++pass) {
+                for (IntMap::const_iterator it = sharedMap.begin(); it != sharedMap.end(); ++it) {
+                    sums[t] += it->second;
+                }
+            }
+        }));
+    }
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    for (size_t t = 1; t < sums.size(); ++t) {
+        assert(sums[t] == sums[0]);
+    }
+    
+    IntMap::size_type bucketCount = sparseMap.bucket_count();
+    sparseMap.shrink_to_fit();
+    assert(sparseMap.bucket_count() < bucketCount);
+    assert(sparseMap.size() == 99);
+    for (int i = 199; i < 10000; i += 100) {
+        assert(sparseMap.count(i) == 1);
+    }
+    
+    bucketCount = sparseMap.bucket_count();
+    assert(!sparseMap.empty());
+    sparseMap.clear();
+    assert(sparseMap.empty() && sparseMap.size() == 0);
+    assert(sparseMap.bucket_count() == bucketCount);
+    assert(sparseMap.begin() == sparseMap.end());
+    
+    sparseMap[5] = 5;
+    assert(sparseMap.size() == 1 && sparseMap.begin()->second == 5);
+    
+    // Moved-from map is empty and usable
+    IntMap movedMap { std::move(sparseMap) };
+    assert(sparseMap.empty() && sparseMap.count(5) == 0 && sparseMap.find(5) == sparseMap.end());
+    sparseMap[6] = 6;
+    assert(sparseMap.size() == 1 && movedMap.size() == 1);
+    
+    // Stats: std::hash<int> is the identity, keys 0, 10, 20 share home bucket 0 of the 10 buckets table
+    auto histogramTotal = [](const lab::hash_map_stats& stats) {
+        return std::accumulate(stats.probe_lengths.counts, stats.probe_lengths.counts + lab::probe_length_histogram::BucketsCount, size_t(0));
+    };
+    
+    IntMap statsMap;
+    assert(statsMap.bucket_count() == 10);
+    statsMap[0] = 0;
+    statsMap[10] = 10;
+    statsMap[20] = 20;
+    lab::hash_map_stats stats = statsMap.stats();
+    assert(stats.size == 3 && stats.capacity == 10 && stats.tombstones == 0);
+    assert(stats.probe_lengths.counts[0] == 1 && stats.probe_lengths.counts[1] == 1 && stats.probe_lengths.counts[2] == 1);
+    assert(stats.load_factor == 0.3f && stats.memory_usage == statsMap.memory_usage());
+    
+    statsMap.erase(0);
+    assert(statsMap.stats().tombstones == 1 && statsMap.stats().probe_lengths.counts[0] == 0);
+    statsMap.find(20); // moved to the tombstone in its home bucket
+    stats = statsMap.stats();
+    assert(stats.tombstones == 1 && stats.probe_lengths.counts[0] == 1 && stats.probe_lengths.counts[2] == 0);
+    statsMap[30] = 30; // takes the tombstone left by 20
+    stats = statsMap.stats();
+    assert(stats.tombstones == 0 && stats.probe_lengths.counts[2] == 1 && histogramTotal(stats) == 3);
+    
+    // Counters match the size through random modifications, rehashes and clear
+    std::vector<int> statsKeys = generateRandomInput(20000, 5000);
+    for (size_t i = 0; i < statsKeys.size(); ++i) {
+        if (i % 3 == 2)
+            statsMap.erase(statsKeys[i]);
+        else if (i % 3 == 1)
+            statsMap.find(statsKeys[i]);
+        else
+            statsMap[statsKeys[i]] = statsKeys[i];
+        assert(histogramTotal(statsMap.stats()) == statsMap.size());
+    }
+    IntMap statsCopy { statsMap };
+    assert(statsCopy.stats().tombstones == statsMap.stats().tombstones && histogramTotal(statsCopy.stats()) == statsCopy.size());
+    statsMap.shrink_to_fit();
+    assert(statsMap.stats().tombstones == 0 && histogramTotal(statsMap.stats()) == statsMap.size());
+    statsMap.clear();
+    stats = statsMap.stats();
+    assert(stats.size == 0 && stats.tombstones == 0 && histogramTotal(stats) == 0 && stats.load_factor == 0.0f);
+}
+
+void runHashMapBatchBenchmark() {
+    using IntMap = lab::hash_map<int, int>;
+    
+    std::vector<int> inputVecSizes { 10000, 100000, 1000000, 10000000, 30000000 };
+    
+    std::cout << "size\tcount\tcontains_batch\tfind\tfind_batch" << std::endl;
+    
+    for (int inputSize : inputVecSizes) {
+        IntMap testMap;
+        for (int i = 0; i < inputSize; ++i) {
+            testMap.try_emplace(i * 7, i);
+        }
+        
+        const IntMap& constMap = testMap;
+        std::vector<int> probeKeys = generateRandomInput(4000000, inputSize * 7);
+        std::vector<char> contained(probeKeys.size());
+        std::vector<IntMap::const_iterator> found(probeKeys.size(), constMap.end());
+        
+        auto countDuration = runWithTimer([&]() {
+            for (size_t i = 0; i < probeKeys.size(); ++i) {
+                contained[i] = constMap.count(probeKeys[i]) == 1;
+            }
+        });
+        auto containsDuration = runWithTimer([&]() {
+            constMap.contains_batch(probeKeys.begin(), probeKeys.end(), contained.begin());
+        });
+        auto findDuration = runWithTimer([&]() {
+            for (size_t i = 0; i < probeKeys.size(); ++i) {
+                found[i] = constMap.find(probeKeys[i]);
+            }
+        });
+        auto findBatchDuration = runWithTimer([&]() {
+            constMap.find_batch(probeKeys.begin(), probeKeys.end(), found.begin());
+        });
+        
+        std::cout << inputSize << "\t" << countDuration.count() << "\t" << containsDuration.count()
+                  << "\t" << findDuration.count() << "\t" << findBatchDuration.count() << std::endl;
+    }
+}
+
+void runHashMapIterationBenchmark() {
+    using IntMap = lab::hash_map<int, int>;
+    
+    std::vector<int> inputSizes { 100000, 1000000, 10000000 };
+    
+    std::cout << "size\tbuckets\tbytes/bucket\titeration\titeration (1% left)" << std::endl;
+    
+    for (int inputSize : inputSizes) {
+        IntMap testMap;
+        for (int i = 0; i < inputSize; ++i) {
+            testMap[i] = i;
+        }
+        
+        long long sum = 0;
+        auto iterationDuration = runWithTimer([&]() {
+            for (const auto& pair : testMap) {
+                sum += pair.second;
+            }
+        });
+        
+        for (int i = 0; i < inputSize; ++i) {
+            if (i % 100 != 0)
+                testMap.erase(i);
+        }
+        auto sparseIterationDuration = runWithTimer([&]() {
+            for (const auto& pair : testMap) {
+                sum += pair.second;
+            }
+        });
+        
+        std::cout << inputSize << "\t" << testMap.bucket_count()
+                  << "\t" << (double)testMap.memory_usage() / testMap.bucket_count()
+                  << "\t" << iterationDuration.count() << "\t" << sparseIterationDuration.count() << std::endl;
+        assert(sum > 0);
+    }
+}
+
+void testMappedHashMap() {
+    using IntMap = lab::hash_map<int, double>;
+    using MappedMap = lab::mapped_hash_map<int, double>;
+    const std::string snapshotPath = "hash_map_snapshot.bin";
+    
+    std::vector<int> randomIntVec = generateRandomInput(100000, 1000000);
+    
+    IntMap testMap;
+    for (int value : randomIntVec) {
+        testMap[value] = value * 0.5;
+    }
+    // Tombstones are kept in the snapshot
+    for (int i = 0; i < 100; ++i) {
+        testMap.erase(randomIntVec[i]);
+    }
+    testMap.save(snapshotPath);
+    
+    {
+        MappedMap mappedMap = MappedMap::open(snapshotPath);
+        assert(mappedMap.size() == testMap.size());
+        assert((size_t)std::distance(mappedMap.begin(), mappedMap.end()) == testMap.size());
+        
+        for (int value : randomIntVec) {
+            auto iter = testMap.find(value);
+            auto mappedIter = mappedMap.find(value);
+            
+            if (iter == testMap.end()) {
+                assert(mappedIter == mappedMap.end());
+                assert(mappedMap.count(value) == 0);
+            } else {
+                assert(mappedIter != mappedMap.end());
+                assert(mappedIter->first == value && mappedIter->second == iter->second);
+                assert(mappedMap.at(value) == value * 0.5);
+            }
+        }
+        assert(!mappedMap.contains(-1));
+        
+        bool thrown = false;
+        try {
+            mappedMap.at(-1);
+        } catch (const std::out_of_range&) {
+            thrown = true;
+        }
+        assert(thrown);
+        
+        // Mapping belongs to the moved-to map
+        MappedMap otherMap = std::move(mappedMap);
+        assert(otherMap.contains(randomIntVec.back()));
+        
+        // Moved-from map is empty
+        assert(mappedMap.empty() && mappedMap.bucket_count() == 0);
+        assert(mappedMap.begin() == mappedMap.end());
+        assert(mappedMap.find(randomIntVec.back()) == mappedMap.end());
+        assert(!mappedMap.contains(randomIntVec.back()));
+        
+        MappedMap assignedMap = MappedMap::open(snapshotPath);
+        assignedMap = std::move(otherMap);
+        assert(assignedMap.size() == testMap.size());
+        assert(otherMap.empty() && otherMap.begin() == otherMap.end());
+        assert(otherMap.count(randomIntVec.back()) == 0);
+    }
+    
+    // A snapshot of another type isn't accepted
+    {
+        bool thrown = false;
+        try {
+            lab::mapped_hash_map<int, int>::open(snapshotPath);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    
+    // Empty map
+    {
+        IntMap emptyMap;
+        emptyMap.save(snapshotPath);
+        
+        MappedMap mappedMap = MappedMap::open(snapshotPath);
+        assert(mappedMap.empty());
+        assert(mappedMap.begin() == mappedMap.end());
+        assert(mappedMap.find(1) == mappedMap.end());
+    }
+    
+    std::remove(snapshotPath.c_str());
+}
+
+void runMappedHashMapBenchmark() {
+    using IntMap = lab::hash_map<int, int>;
+    using MappedMap = lab::mapped_hash_map<int, int>;
+    const std::string snapshotPath = "hash_map_snapshot.bin";
+    
+    std::vector<int> inputSizes { 1000000, 10000000, 30000000 };
+    
+    std::cout << "size\trebuild\tsave\topen\tfirst lookups (mapped)\tlookups (rebuilt)" << std::endl;
+    
+    for (int inputSize : inputSizes) {
+        std::vector<int> keys = generateRandomInput(inputSize, std::numeric_limits<int>::max());
+        std::vector<int> probeKeys = generateRandomInput(1000000, inputSize);
+        for (int& key : probeKeys) {
+            key = keys[key % inputSize];
+        }
+        
+        IntMap testMap;
+        auto rebuildDuration = runWithTimer([&]() {
+            for (int key : keys) {
+                testMap[key] = key;
+            }
+        });
+        
+        auto saveDuration = runWithTimer([&]() {
+            testMap.save(snapshotPath);
+        });
+        
+        long long mapSum = 0;
+        auto lookupDuration = runWithTimer([&]() {
+            for (int key : probeKeys) {
+                mapSum += testMap.find(key)->second;
+            }
+        });
+        
+        long long mappedSum = 0;
+        MappedMap mappedMap = MappedMap::open(snapshotPath);
+        auto openDuration = runWithTimer([&]() {
+            MappedMap openedMap = MappedMap::open(snapshotPath);
+            mappedMap = std::move(openedMap);
+        });
+        auto mappedLookupDuration = runWithTimer([&]() {
+            for (int key : probeKeys) {
+                mappedSum += mappedMap.find(key)->second;
+            }
+        });
+        assert(mapSum == mappedSum);
+        
+        std::cout << inputSize << "\t" << rebuildDuration.count() << "\t" << saveDuration.count()
+                  << "\t" << openDuration.count() << "\t" << mappedLookupDuration.count()
+                  << "\t" << lookupDuration.count() << std::endl;
+    }
+    
+    std::remove(snapshotPath.c_str());
+}
+
+void testConcurrentHashMap() {
+    using IntMap = lab::concurrent_hash_map<int, int>;
+    IntMap testMap;
+    
+    const int ThreadsCount = 8;
+    const int KeysPerThread = 20000;
+    std::vector<std::thread> threads;
+    
+    // Writers on disjoint key ranges, readers on everything
+    for (int t = 0; t < ThreadsCount; ++t) {
+        threads.emplace_back([&testMap, t, KeysPerThread]() {
+            for (int i = t * KeysPerThread; i < (t+1) * KeysPerThread; ++i) {
+                bool inserted = testMap.try_emplace(i, i * 2);
+                assert(inserted);
+            }
+            for (int i = t * KeysPerThread; i < (t+1) * KeysPerThread; i += 2) {
+                assert(testMap.erase(i) == 1);
+            }
+        });
+        threads.emplace_back([&testMap, ThreadsCount, KeysPerThread]() {
+            for (int i = 0; i < ThreadsCount * KeysPerThread; ++i) {
+                int value = 0;
+                if (testMap.find(i, value))
+                    assert(value == i * 2);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    assert(testMap.size() == ThreadsCount * KeysPerThread / 2);
+    
+    for (int i = 0; i < ThreadsCount * KeysPerThread; ++i) {
+        assert(testMap.contains(i) == (i % 2 == 1));
+    }
+    
+    testMap.update(1, [](int& value) { value = -1; });
+    assert(testMap.visit(1, [](const IntMap::value_type& pair) { assert(pair.second == -1); }));
+    assert(!testMap.insert_or_assign(1, 5));
+    assert(testMap.insert_or_assign(0, 5));
+    
+    testMap.clear();
+    assert(testMap.empty());
+}
+
+void runConcurrentHashMapBenchmark() {
+    using IntMap = lab::concurrent_hash_map<int, int>;
+    
+    const int KeysRange = 1 << 20;
+    const int OpsPerThread = 1000000;
+    std::vector<int> threadCounts { 1, 2, 4, 8, 16 };
+    std::vector<int> readPercents { 90, 50 };
+    
+    for (int readPercent : readPercents) {
+        std::cout << "--- " << readPercent << "% reads, " << 100 - readPercent << "% writes ---" << std::endl;
+        std::cout << "threads\tMops/s" << std::endl;
+        
+        for (int threadsCount : threadCounts) {
+            IntMap testMap;
+            for (int i = 0; i < KeysRange; i += 2) {
+                testMap.try_emplace(i, i);
+            }
+            
+            std::vector<std::vector<int>> threadKeys;
+            for (int t = 0; t < threadsCount; ++t) {
+                threadKeys.push_back(generateRandomInput(OpsPerThread, KeysRange));
+            }
+            
+            auto duration = runWithTimer([&]() {
+                std::vector<std::thread> threads;
+                
+                for (int t = 0; t < threadsCount; ++t) {
+                    threads.emplace_back([&testMap, &threadKeys, t, readPercent]() {
+                        int value = 0;
+                        int opIdx = 0;
+                        
+                        for (int key : threadKeys[t]) {
+                            if (opIdx++ % 100 < readPercent) {
+                                testMap.find(key, value);
+                            } else if (key % 2 == 0) {
+                                testMap.erase(key);
+                            } else {
+                                testMap.insert_or_assign(key, key);
+                            }
+                        }
+                    });
+                }
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+            });
+            
+            double mops = threadsCount * (double)OpsPerThread / duration.count() / 1000.0;
+            std::cout << threadsCount << "\t" << mops << std::endl;
+        }
+    }
+}
+
+void testLockFreeHashSet() {
+    using IntSet = lab::lock_free_hash_set<int>;
+    IntSet testSet;
+    
+    const int ThreadsCount = 8;
+    const int KeysPerThread = 50000;
+    const int KeysRange = ThreadsCount * KeysPerThread / 2;
+    std::vector<std::future<int>> results;
+    
+    // Overlapping ranges: every key is inserted by two threads, but only one of them succeeds.
+    // Starting from the minimal capacity, so inserts race with several migrations
+    for (int t = 0; t < ThreadsCount; ++t) {
+        results.push_back(std::async(std::launch::async, [&testSet, t, KeysPerThread, KeysRange]() {
+            int insertedCount = 0;
+            int rangeStart = (t * KeysPerThread / 2) % KeysRange;
+            
+            for (int i = 0; i < KeysPerThread; ++i) {
+                int key = (rangeStart + i) % KeysRange;
+                if (testSet.insert(key))
+                    ++insertedCount;
+                assert(testSet.contains(key));
+            }
+            return insertedCount;
+        }));
+    }
+    
+    int insertedCount = 0;
+    for (auto& result : results) {
+        insertedCount += result.get();
+    }
+    
+    assert(insertedCount == KeysRange);
+    assert(testSet.size() == KeysRange);
+    for (int i = 0; i < KeysRange; ++i) {
+        assert(testSet.contains(i));
+    }
+    assert(!testSet.contains(-1));
+    assert(!testSet.contains(KeysRange));
+    
+    // Keys equal to the slot markers
+    const int MaxKey = std::numeric_limits<int>::max();
+    assert(!testSet.contains(MaxKey));
+    assert(testSet.insert(MaxKey));
+    assert(!testSet.insert(MaxKey));
+    assert(testSet.insert(MaxKey - 2));
+    assert(testSet.contains(MaxKey) && testSet.contains(MaxKey - 2) && !testSet.contains(MaxKey - 1));
+    assert(testSet.size() == KeysRange + 2);
+}
+
+void runLockFreeHashSetBenchmark() {
+    using IntSet = lab::lock_free_hash_set<int>;
+    using IntMap = lab::concurrent_hash_map<int, int>;
+    
+    const int KeysPerThread = 1000000;
+    std::vector<int> threadCounts { 1, 2, 4, 8, 16, 32 };
+    
+    std::cout << "threads\tlock-free Mops/s\tsharded Mops/s" << std::endl;
+    
+    for (int threadsCount : threadCounts) {
+        std::vector<std::vector<int>> threadKeys;
+        for (int t = 0; t < threadsCount; ++t) {
+            threadKeys.push_back(generateRandomInput(KeysPerThread, std::numeric_limits<int>::max() - 3));
+        }
+        
+        IntSet testSet;
+        IntMap testMap;
+        
+        auto runThreads = [&](std::function<void(int)> insertFunc) {
+            return runWithTimer([&]() {
+                std::vector<std::thread> threads;
+                
+                for (int t = 0; t < threadsCount; ++t) {
+                    threads.emplace_back([&threadKeys, &insertFunc, t]() {
+                        for (int key : threadKeys[t]) {
+                            insertFunc(key);
+                        }
+                    });
+                }
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+            });
+        };
+        
+        auto setDuration = runThreads([&testSet](int key) { testSet.insert(key); });
+        auto mapDuration = runThreads([&testMap](int key) { testMap.try_emplace(key, key); });
+        
+        double totalOps = threadsCount * (double)KeysPerThread;
+        std::cout << threadsCount << "\t" << totalOps / setDuration.count() / 1000.0
+                  << "\t" << totalOps / mapDuration.count() / 1000.0 << std::endl;
+    }
+}
+
+void testCuckooHashMap() {
+    using IntMap = lab::cuckoo_hash_map<int, int>;
+    using StringMap = lab::cuckoo_hash_map<std::string, std::string>;
+    
+    IntMap testMap;
+    assert(testMap.empty());
+    assert(testMap.find(1) == testMap.end());
+    assert(testMap.begin() == testMap.end());
+    
+    const int KeysCount = 100000;
+    std::vector<int> keys = generateRandomInput(KeysCount, std::numeric_limits<int>::max());
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(1));
+    
+    for (int key : keys) {
+        assert(testMap.try_emplace(key, key / 2).second);
+    }
+    assert(testMap.size() == keys.size());
+    for (int key : keys) {
+        auto iter = testMap.find(key);
+        assert(iter != testMap.end() && iter->first == key && iter->second == key / 2);
+        assert(!testMap.try_emplace(key, 0).second);
+    }
+    assert(std::distance(testMap.begin(), testMap.end()) == keys.size());
+    
+    // Every other key erased, then inserted back with new values
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        assert(testMap.erase(keys[i]) == 1);
+        assert(testMap.erase(keys[i]) == 0);
+    }
+    assert(testMap.size() == keys.size() / 2);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        assert(testMap.contains(keys[i]) == (i % 2 == 1));
+    }
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        assert(testMap.insert_or_assign(keys[i], -1).second);
+        assert(!testMap.insert_or_assign(keys[i], -2).second);
+        assert(testMap[keys[i]] == -2);
+    }
+    assert(testMap.size() == keys.size());
+    
+    // Reserved table is filled far beyond the open addressing load factors without growing
+    IntMap denseMap;
+    denseMap.reserve(KeysCount);
+    size_t bucketCount = denseMap.bucket_count();
+    for (int i = 0; denseMap.size() < 0.9f * bucketCount; ++i) {
+        denseMap[i * 7] = i;
+    }
+    assert(denseMap.bucket_count() == bucketCount);
+    assert(denseMap.load_factor() >= 0.9f);
+    for (int i = 0; i < (int)denseMap.size(); ++i) {
+        assert(denseMap.find(i * 7)->second == i);
+        assert(!denseMap.contains(i * 7 + 1));
+    }
+    
+    // Erase by iterator
+    int erasedCount = 0;
+    for (auto iter = denseMap.begin(); iter != denseMap.end(); ) {
+        if (iter->second % 3 == 0) {
+            iter = denseMap.erase(iter);
+            ++erasedCount;
+        } else {
+            ++iter;
+        }
+    }
+    assert(std::distance(denseMap.cbegin(), denseMap.cend()) == denseMap.size());
+    for (const auto& pair : denseMap) {
+        assert(pair.second % 3 != 0);
+    }
+    
+    // Copy, move, clear
+    StringMap stringMap;
+    for (int i = 0; i < 1000; ++i) {
+        stringMap.try_emplace(std::to_string(i), std::to_string(i * i));
+    }
+    StringMap copiedMap(stringMap);
+    stringMap.clear();
+    assert(stringMap.empty() && stringMap.begin() == stringMap.end());
+    assert(copiedMap.size() == 1000 && copiedMap["999"] == "998001");
+    
+    StringMap movedMap(std::move(copiedMap));
+    assert(movedMap.size() == 1000 && copiedMap.empty());
+    assert(copiedMap.find("1") == copiedMap.end());
+    copiedMap["1"] = "1";
+    assert(copiedMap.size() == 1 && movedMap["1"] == "1");
+    
+    stringMap = movedMap;
+    assert(stringMap.size() == 1000 && stringMap["10"] == "100");
+}
+
+void runCuckooHashMapBenchmark() {
+    using CuckooMap = lab::cuckoo_hash_map<int, int>;
+    using IntMap = lab::hash_map<int, int>;
+    using clock = std::chrono::steady_clock;
+    
+    const int ProbesCount = 1000000;
+    std::vector<int> inputSizes { 100000, 1000000, 10000000 };
+    
+    // Per lookup latency percentiles, ns
+    auto measure = [](const std::vector<int>& probeKeys, std::function<bool(int)> lookup) {
+        std::vector<double> latencies(probeKeys.size());
+        int foundCount = 0;
+        
+        for (size_t i = 0; i < probeKeys.size(); ++i) {
+            auto start = clock::now();
+            foundCount += lookup(probeKeys[i]) ? 1 : 0;
+            latencies[i] = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        }
+        
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double p) { return latencies[(size_t)(p * (latencies.size() - 1))]; };
+        
+        std::cout << "\t" << percentile(0.5) << "\t" << percentile(0.99) << "\t" << percentile(0.999);
+        return foundCount;
+    };
+    
+    std::cout << "size\tmap\tload\thits p50\tp99\tp99.9\tmisses p50\tp99\tp99.9" << std::endl;
+    
+    for (int inputSize : inputSizes) {
+        CuckooMap cuckooMap;
+        IntMap testMap;
+        for (int i = 0; i < inputSize; ++i) {
+            cuckooMap[i * 7] = i;
+            testMap[i * 7] = i;
+        }
+        
+        std::vector<int> hitKeys = generateRandomInput(ProbesCount, inputSize - 1);
+        for (int& key : hitKeys) {
+            key *= 7;
+        }
+        std::vector<int> missKeys(hitKeys);
+        for (int& key : missKeys) {
+            key += 1;
+        }
+        
+        std::cout << inputSize << "\tcuckoo\t" << cuckooMap.load_factor();
+        measure(hitKeys, [&cuckooMap](int key) { return cuckooMap.contains(key); });
+        measure(missKeys, [&cuckooMap](int key) { return cuckooMap.contains(key); });
+        std::cout << std::endl;
+        
+        std::cout << inputSize << "\thash_map\t" << (float)testMap.size() / testMap.bucket_count();
+        measure(hitKeys, [&testMap](int key) { return testMap.count(key) == 1; });
+        measure(missKeys, [&testMap](int key) { return testMap.count(key) == 1; });
+        std::cout << std::endl;
+    }
+}
+
+void testFilters() {
+    const int KeysCount = 100000;
+    std::vector<int> keys;
+    for (int i = 0; i < KeysCount; ++i) {
+        keys.push_back(i * 2);
+    }
+    std::vector<int> missingKeys;
+    for (int i = 0; i < KeysCount; ++i) {
+        missingKeys.push_back(i * 2 + 1);
+    }
+    
+    auto countFalsePositives = [&missingKeys](std::function<bool(int)> contains) {
+        int falsePositives = 0;
+        for (int key : missingKeys) {
+            falsePositives += contains(key) ? 1 : 0;
+        }
+        return falsePositives;
+    };
+    
+    // Blocked Bloom
+    lab::blocked_bloom_filter<int> bloomFilter(KeysCount, 10.0);
+    assert(!bloomFilter.contains(0));
+    bloomFilter.insert(keys.begin(), keys.end());
+    assert(bloomFilter.size() == KeysCount);
+    assert(bloomFilter.bits_per_key() >= 10.0 && bloomFilter.bits_per_key() < 10.1);
+    
+    for (int key : keys) {
+        assert(bloomFilter.contains(key));
+    }
+    int bloomFalsePositives = countFalsePositives([&bloomFilter](int key) { return bloomFilter.contains(key); });
+    assert(bloomFalsePositives < KeysCount / 50); // ~1% expected
+    
+    std::vector<char> batchResult(missingKeys.size());
+    bloomFilter.contains_batch(missingKeys.begin(), missingKeys.end(), batchResult.begin());
+    assert(std::count(batchResult.begin(), batchResult.end(), 1) == bloomFalsePositives);
+    for (size_t i = 0; i < missingKeys.size(); ++i) {
+        assert((batchResult[i] == 1) == bloomFilter.contains(missingKeys[i]));
+    }
+    
+    // Copies are laid out again at their own cache line offset: no false negatives, same answers
+    // Small filters come from the heap's 16-byte aligned chunks, the spacers shift the copies' offsets
+    lab::blocked_bloom_filter<int> smallFilter(1000);
+    smallFilter.insert(keys.begin(), keys.begin() + 1000);
+    std::vector<std::vector<std::uint64_t>> spacers;
+    std::vector<lab::blocked_bloom_filter<int>> copiedFilters;
+    copiedFilters.reserve(8);
+    lab::blocked_bloom_filter<int> assignedFilter(10);
+    for (size_t spacerWords = 1; spacerWords <= 8; ++spacerWords) {
+        spacers.push_back(std::vector<std::uint64_t>(spacerWords));
+        copiedFilters.push_back(smallFilter);
+        const lab::blocked_bloom_filter<int>& copiedFilter = copiedFilters.back();
+        assignedFilter = smallFilter;
+        for (int i = 0; i < 1000; ++i) {
+            assert(copiedFilter.contains(keys[i]) && assignedFilter.contains(keys[i]));
+        }
+        for (int key : missingKeys) {
+            assert(copiedFilter.contains(key) == smallFilter.contains(key));
+        }
+        assert(assignedFilter.size() == 1000);
+    }
+    lab::blocked_bloom_filter<int> movedFilter(std::move(assignedFilter));
+    assert(movedFilter.contains(keys[0]) && movedFilter.size() == 1000);
+    
+    bloomFilter.clear();
+    assert(bloomFilter.size() == 0 && !bloomFilter.contains(keys[0]));
+    
+    // Xor, duplicate keys are ignored
+    std::vector<int> duplicatedKeys(keys);
+    duplicatedKeys.insert(duplicatedKeys.end(), keys.begin(), keys.begin() + 1000);
+    lab::xor_filter<int> xorFilter(duplicatedKeys.begin(), duplicatedKeys.end());
+    assert(xorFilter.size() == KeysCount);
+    assert(xorFilter.bits_per_key() < 10.0);
+    
+    for (int key : keys) {
+        assert(xorFilter.contains(key));
+    }
+    int xorFalsePositives = countFalsePositives([&xorFilter](int key) { return xorFilter.contains(key); });
+    assert(xorFalsePositives < KeysCount / 128); // 1/256 expected
+    
+    xorFilter.contains_batch(keys.begin(), keys.end(), batchResult.begin());
+    assert(std::count(batchResult.begin(), batchResult.end(), 1) == KeysCount);
+    
+    lab::xor_filter<std::string, std::hash<std::string>, std::uint16_t> stringFilter { "one", "two", "three" };
+    assert(stringFilter.contains("one") && stringFilter.contains("two") && stringFilter.contains("three"));
+    assert(!stringFilter.contains("four"));
+    
+    lab::xor_filter<int> emptyFilter(keys.begin(), keys.begin());
+    assert(emptyFilter.size() == 0);
+}
+
+void runFilterBenchmark() {
+    const int KeysCount = 10000000;
+    std::vector<int> keys;
+    std::vector<int> missingKeys;
+    for (int i = 0; i < KeysCount; ++i) {
+        keys.push_back(i * 2);
+        missingKeys.push_back(i * 2 + 1);
+    }
+    std::shuffle(missingKeys.begin(), missingKeys.end(), std::mt19937(1));
+    std::vector<char> batchResult(missingKeys.size());
+    
+    auto report = [&](const char* name, double bitsPerKey, std::function<bool(int)> contains,
+                      std::function<void()> containsBatch) {
+        int falsePositives = 0;
+        auto containsDuration = runWithTimer([&]() {
+            for (int key : missingKeys) {
+                falsePositives += contains(key) ? 1 : 0;
+            }
+        });
+        auto batchDuration = runWithTimer(containsBatch);
+        
+        std::cout << name << "\t" << bitsPerKey << "\t" << 100.0 * falsePositives / missingKeys.size()
+                  << "\t" << containsDuration.count() << "\t" << batchDuration.count() << std::endl;
+    };
+    
+    std::cout << "filter\tbits/key\tFPR %\tcontains\tcontains_batch" << std::endl;
+    
+    std::vector<double> bloomBitsPerKey { 6.0, 8.0, 10.0, 12.0, 16.0, 20.0 };
+    for (double bitsPerKey : bloomBitsPerKey) {
+        lab::blocked_bloom_filter<int> bloomFilter(KeysCount, bitsPerKey);
+        bloomFilter.insert(keys.begin(), keys.end());
+        
+        report("bloom", bloomFilter.bits_per_key(),
+               [&bloomFilter](int key) { return bloomFilter.contains(key); },
+               [&]() { bloomFilter.contains_batch(missingKeys.begin(), missingKeys.end(), batchResult.begin()); });
+    }
+    
+    lab::xor_filter<int> xorFilter(keys.begin(), keys.end());
+    report("xor8", xorFilter.bits_per_key(),
+           [&xorFilter](int key) { return xorFilter.contains(key); },
+           [&]() { xorFilter.contains_batch(missingKeys.begin(), missingKeys.end(), batchResult.begin()); });
+    
+    lab::xor_filter<int, std::hash<int>, std::uint16_t> xor16Filter(keys.begin(), keys.end());
+    report("xor16", xor16Filter.bits_per_key(),
+           [&xor16Filter](int key) { return xor16Filter.contains(key); },
+           [&]() { xor16Filter.contains_batch(missingKeys.begin(), missingKeys.end(), batchResult.begin()); });
+}
+
+template<typename Tree>
+void assertSameElements(const Tree& tree, const std::set<int>& expected) {
+    assert(tree.size() == expected.size());
+    assert(std::equal(expected.begin(), expected.end(), tree.begin()));
+    assert(std::distance(tree.begin(), tree.end()) == expected.size());
+}
+
+void testBtree() {
+    // Small nodes: deep trees with many splits and merges
+    using SmallSet = lab::btree_set<int, std::less<int>, lab::pool_allocator<int>, 64>;
+    using IntSet = lab::btree_set<int>;
+    
+    SmallSet testSet;
+    std::set<int> expectedSet;
+    assert(testSet.empty() && testSet.begin() == testSet.end());
+    assert(testSet.find(1) == testSet.end() && testSet.lower_bound(1) == testSet.end());
+    assert(testSet.erase(1) == 0);
+    
+    auto generator = createIntUniformGenerator(20000);
+    for (int i = 0; i < 100000; ++i) {
+        int value = generator();
+        
+        if (i % 3 == 2) {
+            assert(testSet.erase(value) == expectedSet.erase(value));
+        } else {
+            auto result = testSet.insert(value);
+            assert(*result.first == value);
+            assert(result.second == expectedSet.insert(value).second);
+        }
+    }
+    assertSameElements(testSet, expectedSet);
+    
+    for (int value = -1; value <= 20001; ++value) {
+        assert(testSet.contains(value) == (expectedSet.count(value) == 1));
+        
+        auto lowerBound = testSet.lower_bound(value);
+        auto expectedLowerBound = expectedSet.lower_bound(value);
+        assert(lowerBound == testSet.end() ? expectedLowerBound == expectedSet.end() : *lowerBound == *expectedLowerBound);
+        
+        auto upperBound = testSet.upper_bound(value);
+        auto expectedUpperBound = expectedSet.upper_bound(value);
+        assert(upperBound == testSet.end() ? expectedUpperBound == expectedSet.end() : *upperBound == *expectedUpperBound);
+    }
+    
+    // Erase everything through iterators, in the ascending and in a random order
+    SmallSet copiedSet(testSet);
+    assertSameElements(copiedSet, expectedSet);
+    while (!testSet.empty()) {
+        testSet.erase(testSet.begin());
+    }
+    assert(testSet.size() == 0 && testSet.begin() == testSet.end());
+    
+    std::vector<int> values(expectedSet.begin(), expectedSet.end());
+    std::shuffle(values.begin(), values.end(), std::mt19937(1));
+    for (int value : values) {
+        copiedSet.erase(copiedSet.find(value));
+    }
+    assert(copiedSet.empty());
+    
+    // Sequential inserts, the default node size
+    IntSet sequentialSet { 3, 2, 1 };
+    sequentialSet.insert(sequentialSet.begin(), sequentialSet.end()); // no-op
+    for (int i = 4; i <= 100000; ++i) {
+        sequentialSet.insert(i);
+    }
+    int expectedValue = 1;
+    for (int value : sequentialSet) {
+        assert(value == expectedValue++);
+    }
+    assert(IntSet::leaf_capacity > 32 && IntSet::internal_capacity > 16);
+    
+    IntSet movedSet(std::move(sequentialSet));
+    assert(sequentialSet.empty() && movedSet.size() == 100000);
+    movedSet.release_all();
+    assert(movedSet.empty() && movedSet.size() == 0);
+    movedSet.insert(5);
+    assert(*movedSet.begin() == 5);
+    
+    // The moved-from set has a pool of its own, release_all of either set keeps the other one intact
+    for (int i = 0; i < 1000; ++i) {
+        sequentialSet.insert(i);
+    }
+    IntSet targetSet(std::move(sequentialSet));
+    sequentialSet.insert(1);
+    targetSet.release_all();
+    assert(targetSet.empty() && sequentialSet.size() == 1 && *sequentialSet.begin() == 1);
+    sequentialSet.release_all(); // a leaf only: the internal allocator has no pool yet
+    for (int i = 0; i < 10000; ++i) {
+        sequentialSet.insert(i);
+    }
+    assert(sequentialSet.size() == 10000 && *sequentialSet.begin() == 0);
+    sequentialSet.release_all();
+    assert(sequentialSet.empty());
+    
+    // Sets sharing a pool: release_all falls back to clear()
+    lab::pool_allocator<int> sharedAllocator;
+    IntSet firstShared(std::less<int>(), sharedAllocator), secondShared(std::less<int>(), sharedAllocator);
+    for (int i = 0; i < 10000; ++i) {
+        firstShared.insert(i);
+        secondShared.insert(-i);
+    }
+    firstShared.release_all();
+    assert(firstShared.empty() && secondShared.size() == 10000);
+    expectedValue = -9999;
+    for (int value : secondShared) {
+        assert(value == expectedValue++);
+    }
+    
+    // Nodes larger than the pool's blocks are freed one by one
+    using LargeNodeSet = lab::btree_set<int, std::less<int>, lab::pool_allocator<int>, 2048>;
+    LargeNodeSet largeNodeSet;
+    for (int i = 0; i < 100000; ++i) {
+        largeNodeSet.insert(i);
+    }
+    largeNodeSet.release_all();
+    assert(largeNodeSet.empty());
+    
+    // Map with non-trivial values
+    using StringMap = lab::btree_map<std::string, std::string, std::less<std::string>, lab::pool_allocator<std::pair<const std::string, std::string>>, 128>;
+    StringMap stringMap;
+    for (int i = 0; i < 5000; ++i) {
+        assert(stringMap.try_emplace(std::to_string(i), std::to_string(i * i)).second);
+    }
+    assert(!stringMap.try_emplace("7", "0").second && stringMap.at("7") == "49");
+    assert(!stringMap.insert_or_assign("7", "seven").second && stringMap["7"] == "seven");
+    stringMap["new"] += "value";
+    assert(stringMap.size() == 5001 && stringMap.at("new") == "value");
+    
+    bool thrown = false;
+    try {
+        stringMap.at("absent");
+    } catch(const std::out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown);
+    
+    for (int i = 0; i < 5000; i += 2) {
+        assert(stringMap.erase(std::to_string(i)) == 1);
+    }
+    std::string previousKey;
+    for (const auto& pair : stringMap) {
+        assert(previousKey < pair.first);
+        previousKey = pair.first;
+    }
+    
+    StringMap copiedMap;
+    copiedMap = stringMap;
+    stringMap.clear();
+    assert(stringMap.empty() && copiedMap.size() == 2501);
+    StringMap::const_iterator pos = copiedMap.find("4999");
+    assert(pos != copiedMap.cend() && pos->second == "24990001");
+}
+
+void runBtreeBenchmark() {
+    using IntTree = lab::twothree_tree<int>;
+    using IntBtree = lab::btree_set<int>;
+    using IntBtree512 = lab::btree_set<int, std::less<int>, lab::pool_allocator<int>, 512>;
+    
+    std::vector<int> inputSizes { 100000, 1000000, 10000000 };
+    
+    std::cout << "size\tcontainer\tinsert\tfind\titerate" << std::endl;
+    
+    for (int inputSize : inputSizes) {
+        std::vector<int> values = generateRandomInput(inputSize, std::numeric_limits<int>::max());
+        std::vector<int> probes = generateRandomInput(1000000, inputSize - 1);
+        for (int& probe : probes) {
+            probe = values[probe];
+        }
+        
+        auto measure = [&](const char* name, std::function<void(int)> insert, std::function<bool(int)> contains,
+                           std::function<long long()> iterate) {
+            auto insertDuration = runWithTimer([&]() {
+                for (int value : values) {
+                    insert(value);
+                }
+            });
+            int foundCount = 0;
+            auto findDuration = runWithTimer([&]() {
+                for (int probe : probes) {
+                    foundCount += contains(probe) ? 1 : 0;
+                }
+            });
+            long long sum = 0;
+            auto iterateDuration = runWithTimer([&]() { sum = iterate(); });
+            
+            assert(foundCount == probes.size() && sum != 0);
+            std::cout << inputSize << "\t" << name << "\t" << insertDuration.count() << "\t"
+                      << findDuration.count() << "\t" << iterateDuration.count() << std::endl;
+        };
+        
+        IntTree tree;
+        measure("twothree_tree", [&tree](int value) { tree.insert(value); },
+                [&tree](int value) { return tree.find(value) != tree.end(); },
+                [&tree]() { long long sum = 0; for (int value : tree) sum += value; return sum; });
+        
+        IntBtree btree;
+        measure("btree_set<256>", [&btree](int value) { btree.insert(value); },
+                [&btree](int value) { return btree.contains(value); },
+                [&btree]() { long long sum = 0; for (int value : btree) sum += value; return sum; });
+        
+        IntBtree512 btree512;
+        measure("btree_set<512>", [&btree512](int value) { btree512.insert(value); },
+                [&btree512](int value) { return btree512.contains(value); },
+                [&btree512]() { long long sum = 0; for (int value : btree512) sum += value; return sum; });
+    }
+}
+
+//
+
+template<typename T, typename K, typename U>
+void assertSortedUniques(const lab::twothree_tree<T, K, U>& tree, int count) {
+    std::vector<T> elemsVec { tree.cbegin(), tree.cend() };
+    
+    assert(elemsVec.size() == count);
+    assert(std::is_sorted(elemsVec.cbegin(), elemsVec.cend()));
+    assert(std::adjacent_find(elemsVec.cbegin(), elemsVec.cend()) == elemsVec.cend());
+}
+
+template<typename T>
+void assertNodeValueEqual(const std::pair<T, bool> nodeValue, T value) {
+    assert(nodeValue == std::make_pair(value, true));
+}
+
+template<typename T>
+void assertNodeValueEmpty(const std::pair<T, bool> nodeValue) {
+    assert(nodeValue.second == false);
+}
+
+// Nodes of the subtree, counted by walking it
+template<typename NodeProxy>
+size_t countSubtreeNodes(const NodeProxy& node) {
+    if (!node.exists())
+        return 0;
+    return 1 + countSubtreeNodes(node.child(0)) + countSubtreeNodes(node.child(1)) + countSubtreeNodes(node.child(2));
+}
+
+template<typename T, typename K, typename U>
+size_t countTreeNodes(const lab::twothree_tree<T, K, U>& tree) {
+    if (tree.empty())
+        return 0;
+    return 1 + countSubtreeNodes(tree.child(0)) + countSubtreeNodes(tree.child(1)) + countSubtreeNodes(tree.child(2));
+}
+
+void testTwoThreeTree() {
+    using DataTree = lab::twothree_tree<int>;
+    
+    // Insertion tests
+    // # oneElement
+    {
+        DataTree testTree;
+        testTree.insert(10);
+        assert(testTree.value(0) == std::make_pair(10, true));
+        assert(testTree.value(1).second == false);
+        assert(testTree.child(0).exists() == false);
+        assert(testTree.child(1).exists() == false);
+    }
+    
+    // # twoElements
+    {
+        // 10 15
+        DataTree testTree;
+        testTree.insert(10);
+        testTree.insert(15);
+        assert(testTree.value(0) == std::make_pair(10, true));
+        assert(testTree.value(1) == std::make_pair(15, true));
+        assert(testTree.child(0).exists() == false);
+        assert(testTree.child(1).exists() == false);
+        assertSortedUniques(testTree, 2);
+    }
+    
+    // # twoLevelsSimple
+    {
+        //       10
+        // 4  8     15  20
+        DataTree testTree;
+        testTree.insert({ 10, 15, 4, 20, 8 });
+        assert(testTree.value(0) == std::make_pair(10, true));
+        assert(testTree.value(1).second == false);
+        assert(testTree.child(0).value(0) == std::make_pair(4, true));
+        assert(testTree.child(0).value(1) == std::make_pair(8, true));
+        assert(testTree.child(1).value(0) == std::make_pair(15, true));
+        assert(testTree.child(1).value(1) == std::make_pair(20, true));
+        assert(testTree.child(2).exists() == false);
+        assertSortedUniques(testTree, 5);
+    }
+
+    // # twoLevelsFilled
+    {
+        //       10 20
+        //    /    |    \
+        // 4  7  15 17   23 25
+        DataTree testTree;
+        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25 });
+        assert(testTree.value(0) == std::make_pair(10, true));
+        assert(testTree.value(1) == std::make_pair(20, true));
+        assert(testTree.child(0).value(0) == std::make_pair(4, true));
+        assert(testTree.child(0).value(1) == std::make_pair(7, true));
+        assert(testTree.child(1).value(0) == std::make_pair(15, true));
+        assert(testTree.child(1).value(1) == std::make_pair(17, true));
+        assert(testTree.child(2).value(0) == std::make_pair(23, true));
+        assert(testTree.child(2).value(1) == std::make_pair(25, true));
+        assertSortedUniques(testTree, 8);
+    }
+    
+    // # threeLevelsSingle
+    {
+        //       4
+        //    2      6
+        // 1    3  5    7
+        DataTree testTree;
+        testTree.insert({ 4, 3, 6, 7, 5, 2, 1 });
+        assert(testTree.value(0) == std::make_pair(4, true));
+        assert(testTree.child(0).value(0) == std::make_pair(2, true));
+        assert(testTree.child(0).child(0).value(0) == std::make_pair(1, true));
+        assert(testTree.child(0).child(1).value(0) == std::make_pair(3, true));
+        assert(testTree.child(1).value(0) == std::make_pair(6, true));
+        assert(testTree.child(1).child(0).value(0) == std::make_pair(5, true));
+        assert(testTree.child(1).child(1).value(0) == std::make_pair(7, true));
+        assertSortedUniques(testTree, 7);
+    }
+    
+    // # twoLevelsFilledInsertLeft
+    {
+        //            10
+        //        /        \
+        //      4            20
+        //   /    \       /      \
+        //  2      7    15 17    23 25
+        DataTree testTree;
+        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25 });
+        testTree.insert(2);
+        assert(testTree.value(0) == std::make_pair(10, true));
+        assert(testTree.value(1).second == false);
+        assert(testTree.child(0).value(0) == std::make_pair(4, true));
+        assert(testTree.child(0).value(1).second == false);
+        assert(testTree.child(0).child(0).value(0) == std::make_pair(2, true));
+        assert(testTree.child(0).child(1).value(0) == std::make_pair(7, true));
+        
+        assert(testTree.child(1).value(0) == std::make_pair(20, true));
+        assert(testTree.child(1).value(1).second == false);
+        assert(testTree.child(1).child(0).value(0) == std::make_pair(15, true));
+        assert(testTree.child(1).child(0).value(1) == std::make_pair(17, true));
+        assert(testTree.child(1).child(1).value(0) == std::make_pair(23, true));
+        assert(testTree.child(1).child(1).value(1) == std::make_pair(25, true));
+        assertSortedUniques(testTree, 9);
+    }
+    
+    // # twoLevelsFilledInsertMiddle
+    {
+        //           16
+        //        /      \
+        //      10          20
+        //    /    \      /    \
+        // 4  7     15   17   23 25
+        DataTree testTree;
+        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25 });
+        testTree.insert(16);
+        assertNodeValueEqual(testTree.value(0), 16);
+        assertNodeValueEmpty(testTree.value(1));
+        assertNodeValueEqual(testTree.child(0).value(0), 10);
+        assertNodeValueEqual(testTree.child(0).child(0).value(0), 4);
+        assertNodeValueEqual(testTree.child(0).child(0).value(1), 7);
+        assertNodeValueEqual(testTree.child(0).child(1).value(0), 15);
+        
+        assertNodeValueEqual(testTree.child(1).value(0), 20);
+        assertNodeValueEqual(testTree.child(1).child(0).value(0), 17);
+        assertNodeValueEqual(testTree.child(1).child(1).value(0), 23);
+        assertNodeValueEqual(testTree.child(1).child(1).value(1), 25);
+        assertSortedUniques(testTree, 9);
+    }
+    
+    // # twoLevelsFilledInsertRight
+    {
+        //             20
+        //          /      \
+        //       10          25
+        //    /     \      /    \
+        // 4  7   15 17   23     27
+        DataTree testTree;
+        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25 });
+        testTree.insert(27);
+        assertNodeValueEqual(testTree.value(0), 20);
+        assertNodeValueEmpty(testTree.value(1));
+        assertNodeValueEqual(testTree.child(0).value(0), 10);
+        assertNodeValueEqual(testTree.child(0).child(0).value(0), 4);
+        assertNodeValueEqual(testTree.child(0).child(0).value(1), 7);
+        assertNodeValueEqual(testTree.child(0).child(1).value(0), 15);
+        assertNodeValueEqual(testTree.child(0).child(1).value(1), 17);
+        
+        assertNodeValueEqual(testTree.child(1).value(0), 25);
+        assertNodeValueEqual(testTree.child(1).child(0).value(0), 23);
+        assertNodeValueEqual(testTree.child(1).child(1).value(0), 27);
+        assertSortedUniques(testTree, 9);
+    }
+    
+    // # eraseTest1 - removing last value from tree
+    {
+        DataTree testTree;
+        testTree.insert(16);
+        testTree.erase(16);
+        assert(testTree.empty());
+    }
+    
+    // # eraseTest2 - removing last but one value from tree
+    {
+        DataTree testTree;
+        testTree.insert({ 16, 17 });
+        testTree.erase(16);
+        assertNodeValueEqual(testTree.value(0), 17);
+        assertNodeValueEmpty(testTree.value(1));
+        assertSortedUniques(testTree, 1);
+    }
+    
+    // # eraseTest3 - case 1, simple
+    {
+        //    5
+        //  3   7
+        DataTree testTree;
+        testTree.insert({ 3, 5, 7 });
+        testTree.erase(7);
+        assertNodeValueEqual(testTree.value(0), 3);
+        assertNodeValueEqual(testTree.value(1), 5);
+        assertSortedUniques(testTree, 2);
+    }
+    
+    // # eraseTest4 - case 1b+1a
+    {
+        //       4
+        //    2      6
+        // 1    3  5    7
+        
+        //        4 6
+        //      /  |  \
+        //   1 2   5    7
+        DataTree testTree;
+        testTree.insert({ 4, 3, 6, 7, 5, 2, 1 });
+        testTree.erase(3);
+        assertNodeValueEqual(testTree.value(0), 4);
+        assertNodeValueEqual(testTree.value(1), 6);
+        assertNodeValueEqual(testTree.child(0).value(0), 1);
+        assertNodeValueEqual(testTree.child(0).value(1), 2);
+        assertNodeValueEqual(testTree.child(1).value(0), 5);
+        assertNodeValueEqual(testTree.child(2).value(0), 7);
+        assertSortedUniques(testTree, 6);
+    }
+    
+    // # eraseTest5 - case 2, simple
+    {
+        //     5
+        //  3    7 9
+        DataTree testTree;
+        testTree.insert({ 3, 5, 7, 9 });
+        testTree.erase(3);
+        assertNodeValueEqual(testTree.value(0), 7);
+        assertNodeValueEmpty(testTree.value(1));
+        assertNodeValueEqual(testTree.child(0).value(0), 5);
+        assertNodeValueEqual(testTree.child(1).value(0), 9);
+        assertSortedUniques(testTree, 3);
+    }
+    
+    // # eraseTest6 - case 2a
+    {
+        //         4
+        //    2        6,9
+        // 1    3   5   7  11
+        
+        //         6
+        //     4         9
+        // 1,2   5     7   11
+        DataTree testTree;
+        testTree.insert({ 4, 3, 6, 7, 5, 2, 1, 9, 11 });
+        testTree.erase(3);
+        assertNodeValueEqual(testTree.value(0), 6);
+        assertNodeValueEqual(testTree.child(0).value(0), 4);
+        assertNodeValueEqual(testTree.child(0).child(0).value(0), 1);
+        assertNodeValueEqual(testTree.child(0).child(0).value(1), 2);
+        assertNodeValueEqual(testTree.child(0).child(1).value(0), 5);
+        assertNodeValueEqual(testTree.child(1).value(0), 9);
+        assertNodeValueEqual(testTree.child(1).child(0).value(0), 7);
+        assertNodeValueEqual(testTree.child(1).child(1).value(0), 11);
+        assertSortedUniques(testTree, 8);
+    }
+
+    // # eraseTest7 - case 3, erase from left
+    {
+        //              16,24
+        //    8           21          29
+        // 1     12    20    22     28   30
+        DataTree testTree;
+        testTree.insert({ 16, 12, 24, 28, 20, 8, 1 });
+        testTree.insert({ 21, 29, 22, 30 });
+        //               24
+        //       16,21          29
+        //   1,8   20  22     28   30
+        testTree.erase(12);
+        assertNodeValueEqual(testTree.value(0), 24);
+        assertNodeValueEmpty(testTree.value(1));
+        assertNodeValueEqual(testTree.child(0).value(0), 16);
+        assertNodeValueEqual(testTree.child(0).value(1), 21);
+        assertNodeValueEqual(testTree.child(0).child(0).value(0), 1);
+        assertNodeValueEqual(testTree.child(0).child(0).value(1), 8);
+        assertSortedUniques(testTree, 10);
+    }
+    
+    // # eraseTest8 - case 3, erase from middle
+    {
+        //              16,24
+        //    8           21          29
+        // 1     12    20    22     28   30
+        DataTree testTree;
+        testTree.insert({ 16, 12, 24, 28, 20, 8, 1 });
+        testTree.insert({ 21, 29, 22, 30 });
+        //                24
+        //     8,16              29
+        // 1    12  20,21     28    30
+        testTree.erase(22);
+        assertNodeValueEqual(testTree.value(0), 24);
+        assertNodeValueEmpty(testTree.value(1));
+        assertNodeValueEqual(testTree.child(0).value(0), 8);
+        assertNodeValueEqual(testTree.child(0).value(1), 16);
+        assertNodeValueEqual(testTree.child(0).child(2).value(0), 20);
+        assertNodeValueEqual(testTree.child(0).child(2).value(1), 21);
+        assertSortedUniques(testTree, 10);
+    }
+    
+    // # eraseTest9 - case 3, erase from right
+    {
+        //              16,24
+        //    8           21          29
+        // 1     12    20    22     28   30
+        DataTree testTree;
+        testTree.insert({ 16, 12, 24, 28, 20, 8, 1 });
+        testTree.insert({ 21, 29, 22, 30 });
+        //           16
+        //    8               21,24
+        // 1     12       20   22   29,30
+        testTree.erase(28);
+        assertNodeValueEqual(testTree.value(0), 16);
+        assertNodeValueEmpty(testTree.value(1));
+        assertNodeValueEqual(testTree.child(1).value(0), 21);
+        assertNodeValueEqual(testTree.child(1).value(1), 24);
+        assertNodeValueEqual(testTree.child(1).child(0).value(0), 20);
+        assertNodeValueEqual(testTree.child(1).child(1).value(0), 22);
+        assertNodeValueEqual(testTree.child(1).child(2).value(0), 29);
+        assertNodeValueEqual(testTree.child(1).child(2).value(1), 30);
+        assertSortedUniques(testTree, 10);
+    }
+    
+    
+    // ______X______
+    
+    // # eraseTest3 - ??
+    {
+        //              16
+        //         /         \
+        //      10            20 24
+        //    /    \       /    |     \
+        // 4  7     15   17   22 23   25 27
+        
+        //              17
+        //         /         \
+        //      10            20 24
+        //    /    \       /    |     \
+        // 4  7     10    _   22 23   25 27
+        DataTree testTree;
+        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25, 16, 24, 22, 27 });
+        testTree.erase(16);
+        assertSortedUniques(testTree, 11);
+    }
+    
+    // Bulk load
+    // # fullNodes
+    {
+        //      3     6
+        // 1 2   4 5    7 8
+        DataTree testTree;
+        testTree.insert({ 8, 7, 6, 5, 4, 3, 2, 1 });
+        testTree.bulk_load(testTree.begin(), testTree.end());
+        assert(testTree.value(0) == std::make_pair(3, true));
+        assert(testTree.value(1) == std::make_pair(6, true));
+        assertNodeValueEqual(testTree.child(0).value(1), 2);
+        assertNodeValueEqual(testTree.child(1).value(1), 5);
+        assertNodeValueEqual(testTree.child(2).value(1), 8);
+        assert(testTree.child(0).child(0).exists() == false);
+        assertSortedUniques(testTree, 8);
+    }
+    
+    // # halfFilledNodes, unsorted input with duplicates
+    {
+        //       4
+        //   2       6
+        // 1   3   5   7
+        std::vector<int> values { 7, 1, 5, 3, 2, 6, 4, 1, 7 };
+        DataTree testTree(values.begin(), values.end(), 0.5f);
+        assert(testTree.value(0) == std::make_pair(4, true));
+        assertNodeValueEmpty(testTree.value(1));
+        assertNodeValueEqual(testTree.child(0).value(0), 2);
+        assertNodeValueEqual(testTree.child(1).child(1).value(0), 7);
+        assertNodeValueEmpty(testTree.child(1).child(1).value(1));
+        assertSortedUniques(testTree, 7);
+    }
+    
+    // # anySize, then regular inserts and erasures
+    for (int count = 0; count < 300; ++count) {
+        for (float fillFactor : { 0.5f, 0.75f, 1.0f }) {
+            std::vector<int> values(count);
+            std::iota(values.begin(), values.end(), 0);
+            std::shuffle(values.begin(), values.end(), std::mt19937(count));
+            
+            DataTree testTree(values.begin(), values.end(), fillFactor);
+            assertSortedUniques(testTree, count);
+            for (int value = 0; value < count; ++value) {
+                assert(*testTree.find(value) == value);
+            }
+            
+            testTree.insert({ -1, count, count / 2 });
+            assertSortedUniques(testTree, count + 2);
+            testTree.erase(-1);
+            testTree.erase(count);
+            assertSortedUniques(testTree, count);
+        }
+    }
+    
+    // Order statistics: rank / select / count_range after inserts, erasures and bulk load
+    {
+        DataTree testTree;
+        std::set<int> expectedSet;
+        auto generator = createIntUniformGenerator(3000);
+        
+        auto assertOrderStatistics = [](const DataTree& tree, const std::set<int>& expected) {
+            std::vector<int> expectedVec(expected.begin(), expected.end());
+            assert(tree.size() == expectedVec.size());
+            
+            for (size_t i = 0; i < expectedVec.size(); ++i) {
+                assert(*tree.select(i) == expectedVec[i]);
+                assert(tree.rank(expectedVec[i]) == i);
+                assert(tree.rank(expectedVec[i] + 1) == i + 1);
+            }
+            assert(tree.select(expectedVec.size()) == tree.end());
+            
+            for (int low = -1; low < 3002; low += 7) {
+                int high = low + 100;
+                size_t expectedCount = std::distance(expected.lower_bound(low), expected.lower_bound(high));
+                assert(tree.count_range(low, high) == expectedCount);
+                assert(tree.rank(low) == static_cast<size_t>(std::distance(expected.begin(), expected.lower_bound(low))));
+            }
+            assert(tree.count_range(10, 10) == 0 && tree.count_range(20, 10) == 0);
+        };
+        
+        for (int i = 0; i < 6000; ++i) {
+            int value = generator();
+            if (i % 3 == 2) {
+                testTree.erase(value);
+                expectedSet.erase(value);
+            } else {
+                testTree.insert(value);
+                expectedSet.insert(value);
+            }
+        }
+        assertOrderStatistics(testTree, expectedSet);
+        
+        while (!expectedSet.empty()) {
+            int value = *testTree.select(expectedSet.size() / 2);
+            testTree.erase(value);
+            expectedSet.erase(value);
+        }
+        assert(testTree.size() == 0 && testTree.rank(5) == 0 && testTree.select(0) == testTree.end());
+        
+        std::vector<int> values = generateRandomInput(2000, 3000);
+        testTree.bulk_load(values.begin(), values.end(), 0.75f);
+        expectedSet.insert(values.begin(), values.end());
+        assertOrderStatistics(testTree, expectedSet);
+    }
+    
+    // In-node search with a non-default comparator and non-arithmetic keys
+    {
+        lab::twothree_tree<int, std::greater<int>> descendingTree;
+        std::set<int, std::greater<int>> expectedDescending;
+        lab::twothree_tree<std::string> stringTree;
+        std::set<std::string> expectedStrings;
+        for (int value : generateRandomInput(3000, 1000)) {
+            assert(descendingTree.insert(value).second == expectedDescending.insert(value).second);
+            assert(stringTree.insert(std::to_string(value)).second == expectedStrings.insert(std::to_string(value)).second);
+        }
+        for (int value = -1; value <= 1001; ++value) {
+            assert((descendingTree.find(value) != descendingTree.end()) == (expectedDescending.count(value) == 1));
+            assert((stringTree.find(std::to_string(value)) != stringTree.end()) == (expectedStrings.count(std::to_string(value)) == 1));
+        }
+        assert(std::equal(expectedDescending.begin(), expectedDescending.end(), descendingTree.begin()));
+        assert(std::equal(expectedStrings.begin(), expectedStrings.end(), stringTree.begin()));
+    }
+    
+    // Stats: node count & height are kept up to date
+    {
+        DataTree testTree;
+        assert(testTree.stats().node_count == 0 && testTree.stats().height == 0 && testTree.memory_usage() == 0);
+        testTree.insert({ 1, 2, 3 }); // root split: [2], [1], [3]
+        lab::twothree_tree_stats stats = testTree.stats();
+        assert(stats.size == 3 && stats.node_count == 3 && stats.height == 2 && stats.fill_factor == 0.5f);
+        assert(stats.memory_usage == testTree.memory_usage() && stats.memory_usage > 0);
+        
+        std::vector<int> perfectVec(15);
+        std::iota(perfectVec.begin(), perfectVec.end(), 0);
+        testTree.bulk_load(perfectVec.begin(), perfectVec.end(), 0.5f); // 2-nodes only
+        stats = testTree.stats();
+        assert(stats.node_count == 15 && stats.height == 4);
+        
+        std::vector<int> values = generateRandomInput(5000, 2000);
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (i % 3 == 2)
+                testTree.erase(values[i]);
+            else
+                testTree.insert(values[i]);
+            
+            stats = testTree.stats();
+            int height = testTree.empty() ? 0 : 1;
+            for (DataTree::node_proxy node = testTree.child(0); node.exists(); node = node.child(0)) {
+                ++height;
+            }
+            assert(stats.height == height);
+            assert(stats.node_count * 2 >= stats.size && stats.node_count <= stats.size);
+            if (i % 100 == 0)
+                assert(stats.node_count == countTreeNodes(testTree));
+        }
+        testTree.clear();
+        assert(testTree.stats().node_count == 0 && testTree.stats().height == 0);
+    }
+    
+    // Bounds and range scans
+    {
+        DataTree testTree;
+        std::set<int> expectedSet;
+        std::vector<int> values = generateRandomInput(5000, 10000);
+        for (int value : values) {
+            testTree.insert(value * 2); // odd values are absent
+            expectedSet.insert(value * 2);
+        }
+        for (size_t i = 0; i < values.size(); i += 4) {
+            testTree.erase(values[i] * 2);
+            expectedSet.erase(values[i] * 2);
+        }
+        
+        for (int value = -2; value <= 20002; ++value) {
+            auto lowerBound = testTree.lower_bound(value);
+            auto expectedLowerBound = expectedSet.lower_bound(value);
+            assert(lowerBound == testTree.end() ? expectedLowerBound == expectedSet.end() : *lowerBound == *expectedLowerBound);
+            
+            auto upperBound = testTree.upper_bound(value);
+            auto expectedUpperBound = expectedSet.upper_bound(value);
+            assert(upperBound == testTree.end() ? expectedUpperBound == expectedSet.end() : *upperBound == *expectedUpperBound);
+            
+            auto equalRange = testTree.equal_range(value);
+            assert(static_cast<size_t>(std::distance(equalRange.first, equalRange.second)) == expectedSet.count(value));
+        }
+        
+        for (int low = -10; low < 20010; low += 97) {
+            std::vector<int> visited;
+            testTree.range(low, low + 500, [&visited](int value) { visited.push_back(value); });
+            assert(std::equal(visited.begin(), visited.end(), expectedSet.lower_bound(low)));
+            assert(visited.size() == static_cast<size_t>(std::distance(expectedSet.lower_bound(low), expectedSet.lower_bound(low + 500))));
+        }
+        
+        const DataTree& constTree = testTree;
+        assert(constTree.lower_bound(20001) == constTree.end());
+        assert(*constTree.upper_bound(-1) == *expectedSet.begin());
+        assert(std::equal(expectedSet.begin(), expectedSet.end(), constTree.begin()));
+    }
+    
+    // Join, split and set operations
+    {
+        auto assertTreeEqual = [](const DataTree& tree, const std::set<int>& expected) {
+            assert(tree.size() == expected.size());
+            assert(std::equal(expected.begin(), expected.end(), tree.begin()));
+            
+            lab::twothree_tree_stats stats = tree.stats();
+            int height = tree.empty() ? 0 : 1;
+            for (DataTree::node_proxy node = tree.child(0); node.exists(); node = node.child(0)) {
+                ++height;
+            }
+            assert(stats.height == height);
+            assert(stats.node_count * 2 >= stats.size && stats.node_count <= stats.size);
+            assert(stats.node_count == countTreeNodes(tree));
+        };
+        
+        // Split at every kind of key, then join back, with and without a separator
+        lab::pool_allocator<int> sharedAllocator;
+        for (int size : { 0, 1, 2, 3, 10, 100, 1000 }) {
+            std::vector<int> values(size);
+            std::iota(values.begin(), values.end(), 0);
+            std::transform(values.begin(), values.end(), values.begin(), [](int value) { return value * 2; });
+            
+            for (int key = -1; key <= size * 2 + 1; key += std::max(1, size / 10)) {
+                DataTree testTree(sharedAllocator);
+                testTree.insert(values.begin(), values.end());
+                
+                DataTree rightTree = testTree.split(key);
+                std::set<int> expectedLeft(values.begin(), std::lower_bound(values.begin(), values.end(), key));
+                std::set<int> expectedRight(std::lower_bound(values.begin(), values.end(), key), values.end());
+                assertTreeEqual(testTree, expectedLeft);
+                assertTreeEqual(rightTree, expectedRight);
+                
+                if (key % 2 != 0) {
+                    testTree.join(key, rightTree);
+                    expectedLeft.insert(key);
+                } else {
+                    testTree.join(rightTree);
+                }
+                expectedLeft.insert(expectedRight.begin(), expectedRight.end());
+                assertTreeEqual(testTree, expectedLeft);
+                assert(rightTree.empty());
+                
+                rightTree.insert(size * 4);
+                testTree.insert(-5);
+                assert(rightTree.size() == 1 && testTree.find(-5) != testTree.end());
+            }
+        }
+        
+        // Trees of different heights and allocators
+        {
+            DataTree leftTree, rightTree;
+            std::set<int> expected;
+            for (int i = 0; i < 5000; ++i) {
+                leftTree.insert(i);
+                expected.insert(i);
+            }
+            for (int i = 10000; i < 10003; ++i) {
+                rightTree.insert(i);
+                expected.insert(i);
+            }
+            leftTree.join(rightTree);
+            assertTreeEqual(leftTree, expected);
+            
+            DataTree smallTree;
+            smallTree.insert(-10);
+            expected.insert(-10);
+            expected.insert(-5);
+            smallTree.join(-5, leftTree);
+            assertTreeEqual(smallTree, expected);
+            assert(leftTree.empty() && leftTree.stats().node_count == 0);
+        }
+        
+        // Set operations against std::set_*, sequential and on several threads
+        for (unsigned threadsCount : { 1u, 4u }) {
+            for (int round = 0; round < 20; ++round) {
+                int firstSize = generateRandomInt(20000);
+                int secondSize = round % 4 == 0 ? generateRandomInt(50) : generateRandomInt(20000);
+                std::vector<int> firstValues = generateRandomInput(firstSize, 30000);
+                std::vector<int> secondValues = generateRandomInput(secondSize, 30000);
+                std::set<int> firstSet(firstValues.begin(), firstValues.end());
+                std::set<int> secondSet(secondValues.begin(), secondValues.end());
+                
+                std::set<int> expectedUnion, expectedIntersection, expectedDifference;
+                std::set_union(firstSet.begin(), firstSet.end(), secondSet.begin(), secondSet.end(), std::inserter(expectedUnion, expectedUnion.end()));
+                std::set_intersection(firstSet.begin(), firstSet.end(), secondSet.begin(), secondSet.end(), std::inserter(expectedIntersection, expectedIntersection.end()));
+                std::set_difference(firstSet.begin(), firstSet.end(), secondSet.begin(), secondSet.end(), std::inserter(expectedDifference, expectedDifference.end()));
+                
+                DataTree unionTree(firstValues.begin(), firstValues.end()), unionOther(secondValues.begin(), secondValues.end());
+                unionTree.set_union(unionOther, threadsCount);
+                assertTreeEqual(unionTree, expectedUnion);
+                assert(unionOther.empty());
+                
+                DataTree intersectionTree(firstValues.begin(), firstValues.end()), intersectionOther(secondValues.begin(), secondValues.end());
+                intersectionTree.set_intersection(intersectionOther, threadsCount);
+                assertTreeEqual(intersectionTree, expectedIntersection);
+                
+                DataTree differenceTree(firstValues.begin(), firstValues.end()), differenceOther(secondValues.begin(), secondValues.end());
+                differenceTree.set_difference(differenceOther, threadsCount);
+                assertTreeEqual(differenceTree, expectedDifference);
+                
+                unionTree.set_difference(intersectionTree, threadsCount);
+                differenceTree.set_union(intersectionTree, threadsCount);
+                assert(intersectionTree.empty());
+            }
+        }
+    }
+    
+    // Hinted insert and finger search
+    {
+        DataTree testTree;
+        std::set<int> expectedSet;
+        
+        // Nearly sorted stream: each value is inserted next to the previous one
+        DataTree::iterator hint = testTree.end();
+        for (int i = 0; i < 20000; ++i) {
+            int value = i * 4 + generateRandomInt(12);
+            hint = testTree.insert(hint, value);
+            expectedSet.insert(value);
+            assert(*hint == value);
+        }
+        assert(testTree.size() == expectedSet.size());
+        assert(std::equal(expectedSet.begin(), expectedSet.end(), testTree.begin()));
+        
+        // Any hint gives the same result, end() stands for the last insert
+        std::vector<int> randomValues = generateRandomInput(5000, 100000);
+        for (size_t i = 0; i < randomValues.size(); ++i) {
+            DataTree::iterator randomHint = testTree.find(*expectedSet.begin());
+            if (i % 3 == 1)
+                randomHint = testTree.end();
+            else if (i % 3 == 2)
+                randomHint = testTree.lower_bound(randomValues[randomValues.size() - 1 - i]);
+            
+            DataTree::iterator pos = testTree.insert(randomHint, randomValues[i]);
+            assert(*pos == randomValues[i]);
+            expectedSet.insert(randomValues[i]);
+            
+            if (i % 100 == 0) {
+                // The last insert position is forgotten by erase
+                int valueToErase = randomValues[i / 2];
+                assert(testTree.erase(valueToErase) == expectedSet.erase(valueToErase));
+            }
+        }
+        assert(testTree.size() == expectedSet.size());
+        assert(std::equal(expectedSet.begin(), expectedSet.end(), testTree.begin()));
+        for (DataTree::size_type i = 0; i < testTree.size(); i += 97) {
+            assert(testTree.rank(*testTree.select(i)) == i);
+        }
+        
+        // Finger search from every element to the next ones and back
+        const DataTree& constTree = testTree;
+        for (DataTree::const_iterator pos = constTree.begin(); pos != constTree.end(); ++pos) {
+            int value = *pos;
+            assert(constTree.find(pos, value) == pos);
+            assert((constTree.find(pos, value + 1) != constTree.end()) == (expectedSet.count(value + 1) == 1));
+            assert((constTree.find(pos, value - 3) != constTree.end()) == (expectedSet.count(value - 3) == 1));
+            assert(constTree.find(pos, value + 1000) == constTree.find(value + 1000));
+        }
+        
+        // Descending stream, then the values above it
+        DataTree descendingTree;
+        for (int i = 5000; i > 0; --i) {
+            descendingTree.insert(descendingTree.end(), i);
+        }
+        std::vector<int> rangeValues(expectedSet.begin(), expectedSet.end());
+        descendingTree.insert(rangeValues.begin(), rangeValues.end());
+        for (int i = 1; i <= 5000; ++i) {
+            expectedSet.insert(i);
+        }
+        assert(descendingTree.size() == expectedSet.size());
+        assert(std::equal(expectedSet.begin(), expectedSet.end(), descendingTree.begin()));
+        
+        DataTree rightPart = descendingTree.split(40000);
+        descendingTree.insert(descendingTree.end(), 39999);
+        rightPart.insert(rightPart.end(), 40001);
+        assert(descendingTree.find(39999) != descendingTree.end() && rightPart.find(40001) != rightPart.end());
+    }
+    
+    // #3 Random insertions and erasures
+    while (true) {
+        DataTree testTree;
+        std::vector<int> randomIntVec = generateRandomInput(30, 30); // 1000000
+        int uniquesInserted = 0;
+        
+        for (auto& value : randomIntVec) {
+            auto result = testTree.insert(value);
+            
+            if (result.second)
+                ++uniquesInserted;
+        }
+        assertSortedUniques(testTree, uniquesInserted);
+        
+        int valueToErase = randomIntVec.at(generateRandomInt(static_cast<int>(randomIntVec.size()-1)));
+        testTree.erase(valueToErase);
+        assertSortedUniques(testTree, uniquesInserted-1);
+    }
+}
+
+void testTwoThreeTreeMap() {
+    using IntMap = lab::twothree_tree_map<int, std::string>;
+    
+    // Random insertions and erasures against std::map
+    IntMap testMap;
+    std::map<int, std::string> expectedMap;
+    std::vector<int> keys = generateRandomInput(20000, 5000);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        int key = keys[i];
+        switch (i % 5) {
+            case 0:
+                testMap[key] = std::to_string(i);
+                expectedMap[key] = std::to_string(i);
+                break;
+            case 1:
+                assert(testMap.try_emplace(key, 3, 'x').second == expectedMap.emplace(key, std::string(3, 'x')).second);
+                break;
+            case 2:
+                assert(testMap.insert_or_assign(key, std::to_string(key)).second == (expectedMap.count(key) == 0));
+                expectedMap[key] = std::to_string(key);
+                break;
+            case 3:
+                assert(testMap.emplace(key, "emplaced").second == expectedMap.emplace(key, "emplaced").second);
+                break;
+            default:
+                assert(testMap.erase(key) == expectedMap.erase(key));
+                break;
+        }
+    }
+    
+    assert(testMap.size() == expectedMap.size());
+    assert(std::equal(expectedMap.begin(), expectedMap.end(), testMap.begin(),
+                      [](const std::pair<const int, std::string>& expected, IntMap::const_iterator::reference actual) {
+                          return expected.first == actual.first && expected.second == actual.second;
+                      }));
+    for (int key = -1; key <= 5001; ++key) {
+        auto expectedPos = expectedMap.find(key);
+        if (expectedPos == expectedMap.end()) {
+            assert(testMap.find(key) == testMap.end() && testMap.count(key) == 0);
+            continue;
+        }
+        assert(testMap.at(key) == expectedPos->second);
+        auto lowerBound = testMap.lower_bound(key);
+        assert(lowerBound != testMap.end() && lowerBound->first == key);
+    }
+    
+    // Mapped values are modified in place and moved between the nodes
+    for (auto pos = testMap.begin(); pos != testMap.end(); ++pos) {
+        pos->second += "!";
+    }
+    const IntMap& constMap = testMap;
+    for (auto element : constMap) {
+        assert(element.second == expectedMap[element.first] + "!");
+    }
+    bool exceptionThrown = false;
+    try {
+        constMap.at(-1);
+    } catch (const std::out_of_range&) {
+        exceptionThrown = true;
+    }
+    assert(exceptionThrown);
+    
+    // Hinted inserts
+    IntMap hintedMap;
+    IntMap::iterator hint = hintedMap.end();
+    for (int key = 0; key < 3000; ++key) {
+        hint = key % 2 ? hintedMap.try_emplace(hint, key, 2, 'y') : hintedMap.insert(hint, std::make_pair(key, std::to_string(key)));
+        assert(hint->first == key);
+    }
+    hintedMap.insert(expectedMap.begin(), expectedMap.end());
+    assert(hintedMap.size() == 3000 + static_cast<size_t>(std::distance(expectedMap.lower_bound(3000), expectedMap.end())));
+    for (int key = 0; key < 3000; ++key) {
+        assert(hintedMap.at(key) == (key % 2 ? std::string(2, 'y') : std::to_string(key)));
+    }
+    
+    // Move-only mapped values
+    lab::twothree_tree_map<std::string, std::unique_ptr<int>> ptrMap;
+    for (int i = 0; i < 1000; ++i) {
+        ptrMap.try_emplace(std::to_string(i), new int(i));
+        ptrMap.insert(std::make_pair(std::to_string(i + 1000), std::unique_ptr<int>(new int(i + 1000))));
+    }
+    for (int i = 0; i < 2000; i += 2) {
+        assert(ptrMap.erase(std::to_string(i)) == 1);
+    }
+    assert(ptrMap.size() == 1000);
+    for (int i = 1; i < 2000; i += 2) {
+        assert(*ptrMap.at(std::to_string(i)) == i);
+    }
+    std::string movedKey = "1";
+    assert(!ptrMap.insert_or_assign(std::move(movedKey), std::unique_ptr<int>(new int(-1))).second);
+    assert(*ptrMap.at("1") == -1);
+    movedKey = "new";
+    assert(ptrMap.insert_or_assign(std::move(movedKey), std::unique_ptr<int>(new int(-2))).second);
+    assert(ptrMap.size() == 1001 && *ptrMap.at("new") == -2);
+    ptrMap.clear();
+    
+    // Move-only keys are moved in
+    lab::twothree_tree_map<std::unique_ptr<int>, int> ownerMap;
+    for (int i = 0; i < 100; ++i) {
+        assert(ownerMap.insert_or_assign(std::unique_ptr<int>(new int(i)), i).second);
+    }
+    assert(ownerMap.size() == 100);
+    for (const auto& element : ownerMap) {
+        assert(*element.first == element.second);
+    }
+    assert(ptrMap.empty() && ptrMap.begin() == ptrMap.end());
+}
+
+void testPoolAllocator() {
+    // Pool: freed blocks are reused by the same size class
+    {
+        lab::memory_pool pool;
+        void* first = pool.allocate(40);
+        void* second = pool.allocate(48);
+        assert(first != second);
+        assert(pool.slabs_count() == 1);
+        
+        pool.deallocate(first, 40);
+        assert(pool.allocate(33) == first);
+        
+        // Large blocks bypass the slabs
+        void* large = pool.allocate(lab::memory_pool::MaxBlockSize + 1);
+        pool.deallocate(large, lab::memory_pool::MaxBlockSize + 1);
+        assert(pool.slabs_count() == 1);
+        
+        pool.release();
+        assert(pool.slabs_count() == 0);
+    }
+    
+    // Copies share the pool, rebound copies too; container copies don't
+    {
+        lab::pool_allocator<int> alloc;
+        lab::pool_allocator<double> reboundAlloc { alloc };
+        assert(alloc == reboundAlloc);
+        assert(alloc != alloc.select_on_container_copy_construction());
+        
+        // Moves take the pool, the moved-from allocator gets a new one when it allocates
+        lab::pool_allocator<int> movedAlloc(std::move(alloc));
+        assert(alloc.pool_use_count() == 0 && movedAlloc == reboundAlloc);
+        alloc.release();
+        int* address = alloc.allocate(1);
+        assert(alloc.pool_use_count() == 1 && alloc != movedAlloc);
+        alloc.deallocate(address, 1);
+        alloc = movedAlloc;
+        assert(alloc == reboundAlloc);
+        
+        std::vector<int, lab::pool_allocator<int>> pooledVec(alloc);
+        for (int i = 0; i < 1000; ++i) {
+            pooledVec.push_back(i);
+        }
+        assert(pooledVec.size() == 1000 && pooledVec.back() == 999);
+    }
+    
+    // release_all: containers are empty and usable afterwards
+    {
+        using DataTree = lab::twothree_tree<int>;
+        DataTree testTree;
+        std::vector<int> randomIntVec = generateRandomInput(10000, 100000);
+        
+        testTree.insert(randomIntVec.begin(), randomIntVec.end());
+        testTree.release_all();
+        assert(testTree.empty());
+        
+        testTree.insert(randomIntVec.begin(), randomIntVec.end());
+        std::sort(randomIntVec.begin(), randomIntVec.end());
+        int uniquesCount = static_cast<int>(std::unique(randomIntVec.begin(), randomIntVec.end()) - randomIntVec.begin());
+        assertSortedUniques(testTree, uniquesCount);
+        
+        // std::allocator falls back to clear
+        lab::twothree_tree<int, std::less<int>, std::allocator<int>> stdTree;
+        stdTree.insert({ 3, 1, 2 });
+        stdTree.release_all();
+        assert(stdTree.empty());
+        
+        // clear: nodes are freed one by one (std::allocator) or destroyed before the pool is released (strings)
+        stdTree.insert(randomIntVec.begin(), randomIntVec.end());
+        stdTree.clear();
+        assert(stdTree.empty() && stdTree.begin() == stdTree.end());
+        stdTree.insert(randomIntVec.begin(), randomIntVec.end());
+        assertSortedUniques(stdTree, uniquesCount);
+        
+        lab::twothree_tree<std::string> stringTree;
+        for (int value : randomIntVec) {
+            stringTree.insert(std::to_string(value) + " is long enough to be allocated");
+        }
+        stringTree.clear();
+        assert(stringTree.empty() && stringTree.size() == 0);
+        stringTree.insert("reused");
+        assert(*stringTree.begin() == "reused");
+        
+        // Nodes larger than the pool's blocks are freed one by one
+        using LargeValue = std::array<int, 128>;
+        lab::twothree_tree<LargeValue> largeTree;
+        for (int i = 0; i < 1000; ++i) {
+            LargeValue value;
+            value.fill(i);
+            largeTree.insert(value);
+        }
+        largeTree.release_all();
+        assert(largeTree.empty());
+        largeTree.insert(LargeValue());
+        assert(largeTree.size() == 1);
+        
+        // A moved-from tree takes a new pool when it allocates, joins rebuild the nodes from other pools in it
+        DataTree movedTree(std::move(testTree));
+        assert(testTree.empty() && movedTree.size() == static_cast<size_t>(uniquesCount));
+        DataTree otherTree;
+        otherTree.insert({ 1, 2, 3 });
+        testTree.join(otherTree);
+        assert(testTree.size() == 3 && otherTree.empty());
+        testTree.insert(4);
+        testTree.release_all();
+        assert(testTree.empty() && movedTree.size() == static_cast<size_t>(uniquesCount));
+        DataTree emptyMoved(std::move(testTree));
+        testTree.insert(5);
+        assert(testTree.size() == 1 && *testTree.begin() == 5 && emptyMoved.empty());
+    }
+    {
+        using StringMap = lab::hash_map<int, std::string>;
+        StringMap testMap;
+        for (int i = 0; i < 1000; ++i) {
+            testMap[i] = std::to_string(i) + " is long enough to be allocated";
+        }
+        
+        StringMap copyMap { testMap };
+        testMap.release_all();
+        assert(testMap.size() == 0 && testMap.begin() == testMap.end());
+        assert(copyMap.size() == 1000 && copyMap[999] == "999 is long enough to be allocated");
+        
+        testMap[1] = "one";
+        assert(testMap.size() == 1 && testMap[1] == "one");
+        
+        // A shared pool isn't released: the other map's buckets are in it
+        using IntMap = lab::hash_map<int, int>;
+        lab::pool_allocator<std::pair<const int, int>> sharedAllocator;
+        IntMap firstMap(10, std::hash<int>(), std::equal_to<int>(), sharedAllocator);
+        IntMap secondMap(10, std::hash<int>(), std::equal_to<int>(), sharedAllocator);
+        for (int i = 0; i < 1000; ++i) {
+            firstMap[i] = i;
+            secondMap[i] = -i;
+        }
+        firstMap.release_all();
+        assert(firstMap.empty() && secondMap.size() == 1000 && secondMap.find(500)->second == -500);
+        
+        // Neither is the pool of a moved-to map: the moved-from one gets a pool of its own
+        IntMap movedMap(std::move(secondMap));
+        secondMap[5] = 5;
+        secondMap.release_all();
+        assert(movedMap.size() == 1000 && movedMap.find(500)->second == -500);
+    }
 }
 
-//
-
-template<typename T, typename K, typename U>
-void assertSortedUniques(const lab::twothree_tree<T, K, U>& tree, int count) {
-    std::vector<T> elemsVec { tree.cbegin(), tree.cend() };
+void testConcurrentTwoThreeTree() {
+    using IntTree = lab::concurrent_twothree_tree<int>;
     
-    assert(elemsVec.size() == count);
-    assert(std::is_sorted(elemsVec.cbegin(), elemsVec.cend()));
-    assert(std::adjacent_find(elemsVec.cbegin(), elemsVec.cend()) == elemsVec.cend());
+    // Single thread, against std::set
+    {
+        IntTree testTree;
+        std::set<int> expected;
+        assert(testTree.empty());
+        assert(!testTree.lower_bound(0).second);
+        assert(!testTree.erase(0));
+        
+        std::vector<int> input = generateRandomInput(20000, 5000);
+        for (size_t i = 0; i < input.size(); ++i) {
+            int key = input[i];
+            if (i % 3 == 2) {
+                assert(testTree.erase(key) == expected.erase(key));
+            } else {
+                assert(testTree.insert(key) == expected.insert(key).second);
+            }
+            assert(testTree.size() == expected.size());
+        }
+        
+        for (int key = -1; key <= 5001; ++key) {
+            assert(testTree.contains(key) == (expected.count(key) == 1));
+            
+            auto lower = expected.lower_bound(key);
+            auto treeLower = testTree.lower_bound(key);
+            assert(treeLower.second == (lower != expected.end()));
+            assert(!treeLower.second || treeLower.first == *lower);
+            
+            auto upper = expected.upper_bound(key);
+            auto treeUpper = testTree.upper_bound(key);
+            assert(treeUpper.second == (upper != expected.end()));
+            assert(!treeUpper.second || treeUpper.first == *upper);
+        }
+        
+        std::vector<int> scanned;
+        testTree.range(1000, 2000, [&scanned](int key) { scanned.push_back(key); });
+        assert(std::equal(scanned.begin(), scanned.end(), expected.lower_bound(1000)));
+        assert(scanned.size() == (size_t)std::distance(expected.lower_bound(1000), expected.lower_bound(2000)));
+        
+        for (int key : std::vector<int>(expected.begin(), expected.end())) {
+            assert(testTree.erase(key) == 1);
+        }
+        assert(testTree.empty());
+        assert(!testTree.contains(input[0]));
+    }
+    
+    // Writers on disjoint key ranges, readers on everything
+    {
+        IntTree testTree;
+        
+        const int ThreadsCount = 8;
+        const int KeysPerThread = 20000;
+        const int StableKeysCount = 100;
+        std::vector<std::thread> threads;
+        
+        // Keys below zero are never changed: readers must see them all the time
+        for (int i = -StableKeysCount; i < 0; ++i) {
+            testTree.insert(i);
+        }
+        
+        for (int t = 0; t < ThreadsCount; ++t) {
+            threads.emplace_back([&testTree, t, KeysPerThread]() {
+                for (int i = t * KeysPerThread; i < (t+1) * KeysPerThread; ++i) {
+                    bool inserted = testTree.insert(i);
+                    assert(inserted);
+                }
+                for (int i = t * KeysPerThread; i < (t+1) * KeysPerThread; i += 2) {
+                    assert(testTree.erase(i) == 1);
+                }
+            });
+            threads.emplace_back([&testTree, ThreadsCount, KeysPerThread, StableKeysCount]() {
+                for (int i = 0; i < ThreadsCount * KeysPerThread; ++i) {
+                    int stableKey = -1 - i % StableKeysCount;
+                    assert(testTree.contains(stableKey));
+                    
+                    auto lower = testTree.lower_bound(i);
+                    assert(!lower.second || lower.first >= i);
+                    auto upper = testTree.upper_bound(stableKey);
+                    assert(upper.second && upper.first > stableKey);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        
+        assert(testTree.size() == ThreadsCount * KeysPerThread / 2 + StableKeysCount);
+        
+        for (int i = 0; i < ThreadsCount * KeysPerThread; ++i) {
+            assert(testTree.contains(i) == (i % 2 == 1));
+        }
+        
+        int previous = -StableKeysCount - 1;
+        size_t scannedCount = 0;
+        testTree.range(-StableKeysCount, ThreadsCount * KeysPerThread, [&previous, &scannedCount](int key) {
+            assert(key > previous);
+            previous = key;
+            ++scannedCount;
+        });
+        assert(scannedCount == testTree.size());
+    }
 }
 
-template<typename T>
-void assertNodeValueEqual(const std::pair<T, bool> nodeValue, T value) {
-    assert(nodeValue == std::make_pair(value, true));
+void testPersistentTwoThreeTree() {
+    using IntTree = lab::persistent_twothree_tree<int>;
+    
+    // Against std::set, every snapshot keeps the contents it was taken with
+    {
+        IntTree testTree;
+        std::set<int> expected;
+        std::vector<std::pair<IntTree::snapshot_type, std::set<int>>> snapshots;
+        assert(testTree.empty() && testTree.begin() == testTree.end());
+        assert(testTree.erase(0) == 0);
+        
+        std::vector<int> input = generateRandomInput(20000, 3000);
+        for (size_t i = 0; i < input.size(); ++i) {
+            int key = input[i];
+            if (i % 3 == 2) {
+                assert(testTree.erase(key) == expected.erase(key));
+            } else {
+                assert(testTree.insert(key) == expected.insert(key).second);
+            }
+            assert(testTree.size() == expected.size());
+            
+            if (i % 1000 == 0)
+                snapshots.emplace_back(testTree.snapshot(), expected);
+        }
+        
+        assert(std::equal(testTree.begin(), testTree.end(), expected.begin()));
+        for (int key = -1; key <= 3001; ++key) {
+            assert(testTree.contains(key) == (expected.count(key) == 1));
+            assert((testTree.find(key) != testTree.end()) == (expected.count(key) == 1));
+            
+            auto lower = expected.lower_bound(key);
+            auto treeLower = testTree.lower_bound(key);
+            assert((treeLower == testTree.end()) == (lower == expected.end()));
+            assert(treeLower == testTree.end() || *treeLower == *lower);
+            
+            auto upper = expected.upper_bound(key);
+            auto treeUpper = testTree.upper_bound(key);
+            assert((treeUpper == testTree.end()) == (upper == expected.end()));
+            assert(treeUpper == testTree.end() || *treeUpper == *upper);
+        }
+        
+        std::vector<int> scanned;
+        testTree.range(1000, 2000, [&scanned](int key) { scanned.push_back(key); });
+        assert(scanned == std::vector<int>(expected.lower_bound(1000), expected.lower_bound(2000)));
+        
+        for (auto& snapshot : snapshots) {
+            assert(snapshot.first.size() == snapshot.second.size());
+            assert(std::equal(snapshot.first.begin(), snapshot.first.end(), snapshot.second.begin()));
+        }
+        
+        // Emptying the tree doesn't touch the snapshots, releasing them frees the shared nodes
+        auto lastSnapshot = testTree.snapshot();
+        for (int key : expected) {
+            assert(testTree.erase(key) == 1);
+        }
+        assert(testTree.empty() && testTree.begin() == testTree.end());
+        assert(lastSnapshot.size() == expected.size());
+        assert(std::equal(lastSnapshot.begin(), lastSnapshot.end(), expected.begin()));
+        snapshots.clear();
+    }
+    
+    // Copies are O(1) and independent
+    {
+        lab::persistent_twothree_tree<std::string> testTree;
+        for (int i = 0; i < 1000; ++i) {
+            testTree.insert(std::to_string(i));
+        }
+        
+        auto copyTree = testTree;
+        copyTree.erase("500");
+        copyTree.insert("abc");
+        testTree.clear();
+        testTree.insert("xyz");
+        
+        assert(copyTree.size() == 1000 && copyTree.contains("abc") && !copyTree.contains("500"));
+        assert(testTree.size() == 1 && *testTree.begin() == "xyz");
+        
+        auto snapshot = copyTree.snapshot();
+        copyTree = std::move(testTree);
+        assert(snapshot.size() == 1000 && snapshot.contains("999"));
+        assert(copyTree.size() == 1 && copyTree.contains("xyz"));
+    }
+    
+    // A snapshot is scanned in another thread while the tree keeps changing
+    {
+        IntTree testTree;
+        const int KeysCount = 100000;
+        for (int i = 0; i < KeysCount; ++i) {
+            testTree.insert(i);
+        }
+        
+        auto snapshot = testTree.snapshot();
+        std::thread reader([snapshot, KeysCount]() {
+            for (int round = 0; round < 5; ++round) {
+                int expectedKey = 0;
+                for (int key : snapshot) {
+                    assert(key == expectedKey);
+                    ++expectedKey;
+                }
+                assert(expectedKey == KeysCount);
+            }
+        });
+        
+        for (int i = 0; i < KeysCount; i += 2) {
+            testTree.erase(i);
+            testTree.insert(KeysCount + i);
+        }
+        reader.join();
+        
+        assert(testTree.size() == KeysCount);
+        assert(*testTree.begin() == 1);
+        assert(snapshot.size() == KeysCount && *snapshot.begin() == 0);
+    }
 }
 
-template<typename T>
-void assertNodeValueEmpty(const std::pair<T, bool> nodeValue) {
-    assert(nodeValue.second == false);
+template<typename SearchTree, typename Key, typename Compare>
+void assertSameSearches(const SearchTree& tree, const std::set<Key, Compare>& expectedSet, const std::vector<Key>& queries) {
+    assert(tree.size() == expectedSet.size());
+    assert(std::equal(expectedSet.begin(), expectedSet.end(), tree.begin()));
+    
+    // The expected ranks come from a sorted vector: std::distance over the set's iterators is O(n)
+    std::vector<Key> sortedKeys(expectedSet.begin(), expectedSet.end());
+    Compare compare = expectedSet.key_comp();
+    
+    for (const Key& query : queries) {
+        auto lowerBound = tree.lower_bound(query);
+        auto expectedLowerBound = std::lower_bound(sortedKeys.begin(), sortedKeys.end(), query, compare);
+        assert(lowerBound - tree.begin() == expectedLowerBound - sortedKeys.begin());
+        assert(tree.upper_bound(query) - tree.begin() == std::upper_bound(sortedKeys.begin(), sortedKeys.end(), query, compare) - sortedKeys.begin());
+        assert(tree.rank(query) == static_cast<size_t>(lowerBound - tree.begin()));
+        
+        auto pos = tree.find(query);
+        if (expectedLowerBound != sortedKeys.end() && !compare(query, *expectedLowerBound)) {
+            assert(pos == lowerBound && !(*pos < query) && !(query < *pos));
+        } else {
+            assert(pos == tree.end() && tree.count(query) == 0);
+        }
+    }
 }
 
-void testTwoThreeTree() {
-    using DataTree = lab::twothree_tree<int>;
+void testStaticSearchTree() {
+    using EytzingerTree = lab::static_search_tree<int>;
+    using VebTree = lab::static_search_tree<int, std::less<int>, lab::van_emde_boas_layout>;
     
-    // Insertion tests
-    // # oneElement
-    {
-        DataTree testTree;
-        testTree.insert(10);
-        assert(testTree.value(0) == std::make_pair(10, true));
-        assert(testTree.value(1).second == false);
-        assert(testTree.child(0).exists() == false);
-        assert(testTree.child(1).exists() == false);
+    // Every size up to a few complete trees, then random ones: the padding and the layouts' cuts differ
+    std::vector<int> sizes;
+    for (int size = 0; size <= 70; ++size) {
+        sizes.push_back(size);
     }
+    sizes.insert(sizes.end(), { 127, 128, 255, 1000, 4095, 4096, 65537 });
     
-    // # twoElements
-    {
-        // 10 15
-        DataTree testTree;
-        testTree.insert(10);
-        testTree.insert(15);
-        assert(testTree.value(0) == std::make_pair(10, true));
-        assert(testTree.value(1) == std::make_pair(15, true));
-        assert(testTree.child(0).exists() == false);
-        assert(testTree.child(1).exists() == false);
-        assertSortedUniques(testTree, 2);
+    for (int size : sizes) {
+        std::vector<int> input = generateRandomInput(size, size * 3);
+        std::set<int> expectedSet(input.begin(), input.end());
+        
+        std::vector<int> queries;
+        for (int query = -2; query <= size * 3 + 2; query += size > 4096 ? 7 : 1) {
+            queries.push_back(query);
+        }
+        
+        EytzingerTree eytzingerTree(input.begin(), input.end());
+        VebTree vebTree(expectedSet.begin(), expectedSet.end());
+        assertSameSearches(eytzingerTree, expectedSet, queries);
+        assertSameSearches(vebTree, expectedSet, queries);
+        
+        // Copies rebuild the tree, moves take it
+        EytzingerTree eytzingerCopy(eytzingerTree);
+        VebTree vebCopy;
+        vebCopy = vebTree;
+        assertSameSearches(eytzingerCopy, expectedSet, queries);
+        assertSameSearches(vebCopy, expectedSet, queries);
+        VebTree vebMoved(std::move(vebCopy));
+        assertSameSearches(vebMoved, expectedSet, queries);
+        EytzingerTree eytzingerMoved;
+        eytzingerMoved = std::move(eytzingerCopy);
+        assertSameSearches(eytzingerMoved, expectedSet, queries);
+        
+        // Moved-from trees are empty and searchable
+        for (int query : { -1, 0, size }) {
+            assert(vebCopy.lower_bound(query) == vebCopy.end() && vebCopy.rank(query) == 0 && vebCopy.count(query) == 0);
+            assert(eytzingerCopy.upper_bound(query) == eytzingerCopy.end() && eytzingerCopy.find(query) == eytzingerCopy.end());
+        }
+        assert(vebCopy.empty() && eytzingerCopy.empty());
     }
     
-    // # twoLevelsSimple
+    // Custom order and keys larger than a cache line's share
     {
-        //       10
-        // 4  8     15  20
-        DataTree testTree;
-        testTree.insert({ 10, 15, 4, 20, 8 });
-        assert(testTree.value(0) == std::make_pair(10, true));
-        assert(testTree.value(1).second == false);
-        assert(testTree.child(0).value(0) == std::make_pair(4, true));
-        assert(testTree.child(0).value(1) == std::make_pair(8, true));
-        assert(testTree.child(1).value(0) == std::make_pair(15, true));
-        assert(testTree.child(1).value(1) == std::make_pair(20, true));
-        assert(testTree.child(2).exists() == false);
-        assertSortedUniques(testTree, 5);
+        std::vector<std::string> input;
+        for (int i = 0; i < 3000; i += 3) {
+            input.push_back(std::to_string(i));
+        }
+        std::set<std::string, std::greater<std::string>> expectedSet(input.begin(), input.end());
+        std::vector<std::string> queries;
+        for (int i = -1; i < 3002; ++i) {
+            queries.push_back(std::to_string(i));
+        }
+        
+        lab::static_search_tree<std::string, std::greater<std::string>> eytzingerTree(input.begin(), input.end());
+        lab::static_search_tree<std::string, std::greater<std::string>, lab::van_emde_boas_layout> vebTree(input.begin(), input.end());
+        assertSameSearches(eytzingerTree, expectedSet, queries);
+        assertSameSearches(vebTree, expectedSet, queries);
     }
+}
 
-    // # twoLevelsFilled
-    {
-        //       10 20
-        //    /    |    \
-        // 4  7  15 17   23 25
-        DataTree testTree;
-        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25 });
-        assert(testTree.value(0) == std::make_pair(10, true));
-        assert(testTree.value(1) == std::make_pair(20, true));
-        assert(testTree.child(0).value(0) == std::make_pair(4, true));
-        assert(testTree.child(0).value(1) == std::make_pair(7, true));
-        assert(testTree.child(1).value(0) == std::make_pair(15, true));
-        assert(testTree.child(1).value(1) == std::make_pair(17, true));
-        assert(testTree.child(2).value(0) == std::make_pair(23, true));
-        assert(testTree.child(2).value(1) == std::make_pair(25, true));
-        assertSortedUniques(testTree, 8);
+template<typename Index, typename Key>
+void assertSameBounds(const Index& index, const std::vector<Key>& sortedKeys, const std::vector<Key>& queries) {
+    assert(index.size() == sortedKeys.size());
+    assert(std::equal(sortedKeys.begin(), sortedKeys.end(), index.begin()));
+    
+    for (const Key& query : queries) {
+        auto lowerBound = index.lower_bound(query);
+        auto upperBound = index.upper_bound(query);
+        assert(lowerBound - index.begin() == std::lower_bound(sortedKeys.begin(), sortedKeys.end(), query) - sortedKeys.begin());
+        assert(upperBound - index.begin() == std::upper_bound(sortedKeys.begin(), sortedKeys.end(), query) - sortedKeys.begin());
+        assert(index.count(query) == static_cast<size_t>(upperBound - lowerBound));
+        assert(index.find(query) == (lowerBound != upperBound ? lowerBound : index.end()));
     }
+}
+
+void testLearnedIndex() {
+    using IntIndex = lab::learned_index<int>;
     
-    // # threeLevelsSingle
-    {
-        //       4
-        //    2      6
-        // 1    3  5    7
-        DataTree testTree;
-        testTree.insert({ 4, 3, 6, 7, 5, 2, 1 });
-        assert(testTree.value(0) == std::make_pair(4, true));
-        assert(testTree.child(0).value(0) == std::make_pair(2, true));
-        assert(testTree.child(0).child(0).value(0) == std::make_pair(1, true));
-        assert(testTree.child(0).child(1).value(0) == std::make_pair(3, true));
-        assert(testTree.child(1).value(0) == std::make_pair(6, true));
-        assert(testTree.child(1).child(0).value(0) == std::make_pair(5, true));
-        assert(testTree.child(1).child(1).value(0) == std::make_pair(7, true));
-        assertSortedUniques(testTree, 7);
+    // Uniform, clustered and duplicate-heavy keys: smooth and rough position functions
+    std::vector<int> sizes { 0, 1, 2, 3, 10, 100, 1000, 100000 };
+    for (int size : sizes) {
+        std::vector<std::vector<int>> inputs;
+        inputs.push_back(generateRandomInput(size, std::numeric_limits<int>::max()));
+        inputs.push_back(generateRandomInput(size, size / 4 + 1)); // runs of equal keys
+        
+        std::vector<int> clustered(size);
+        for (int i = 0; i < size; ++i) {
+            clustered[i] = (i % 7 == 0 ? -1 : 1) * static_cast<int>(std::min(1e9, std::pow(1.0001, i) * 1000)) + generateRandomInt(50);
+        }
+        inputs.push_back(clustered);
+        
+        for (std::vector<int>& input : inputs) {
+            std::vector<int> queries;
+            for (int i = 0; i < std::min(size, 20000); ++i) {
+                queries.push_back(input[i]);
+                queries.push_back(input[i] + 1);
+                queries.push_back(input[i] - 1);
+            }
+            queries.insert(queries.end(), { std::numeric_limits<int>::min(), std::numeric_limits<int>::max(), 0, -1 });
+            
+            IntIndex index(input.begin(), input.end());
+            std::sort(input.begin(), input.end());
+            assertSameBounds(index, input, queries);
+            assert(index.segments_count() <= input.size());
+            
+            lab::learned_index<int, 4> smallErrorIndex(input.begin(), input.end());
+            assertSameBounds(smallErrorIndex, input, queries);
+        }
     }
     
-    // # twoLevelsFilledInsertLeft
+    // Sorted by the radix sort, and the position function of a single run of equal keys
     {
-        //            10
-        //        /        \
-        //      4            20
-        //   /    \       /      \
-        //  2      7    15 17    23 25
-        DataTree testTree;
-        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25 });
-        testTree.insert(2);
-        assert(testTree.value(0) == std::make_pair(10, true));
-        assert(testTree.value(1).second == false);
-        assert(testTree.child(0).value(0) == std::make_pair(4, true));
-        assert(testTree.child(0).value(1).second == false);
-        assert(testTree.child(0).child(0).value(0) == std::make_pair(2, true));
-        assert(testTree.child(0).child(1).value(0) == std::make_pair(7, true));
+        std::vector<int> input = generateRandomInput(50000, 1000000);
+        lab::radix_sort(input.begin(), input.end());
+        input.insert(input.begin() + 20000, 1000, input[20000]);
         
-        assert(testTree.child(1).value(0) == std::make_pair(20, true));
-        assert(testTree.child(1).value(1).second == false);
-        assert(testTree.child(1).child(0).value(0) == std::make_pair(15, true));
-        assert(testTree.child(1).child(0).value(1) == std::make_pair(17, true));
-        assert(testTree.child(1).child(1).value(0) == std::make_pair(23, true));
-        assert(testTree.child(1).child(1).value(1) == std::make_pair(25, true));
-        assertSortedUniques(testTree, 9);
+        std::vector<int> queries(input.begin(), input.begin() + 30000);
+        for (int i = -5; i < 1000005; i += 101) {
+            queries.push_back(i);
+        }
+        IntIndex index(input.begin(), input.end());
+        assertSameBounds(index, input, queries);
+        assert(index.segments_count() < input.size() / 100);
+        assert(index.memory_usage() > index.index_memory_usage());
     }
     
-    // # twoLevelsFilledInsertMiddle
+    // 64-bit keys over the whole range: the differences don't fit a double exactly
     {
-        //           16
-        //        /      \
-        //      10          20
-        //    /    \      /    \
-        // 4  7     15   17   23 25
-        DataTree testTree;
-        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25 });
-        testTree.insert(16);
-        assertNodeValueEqual(testTree.value(0), 16);
-        assertNodeValueEmpty(testTree.value(1));
-        assertNodeValueEqual(testTree.child(0).value(0), 10);
-        assertNodeValueEqual(testTree.child(0).child(0).value(0), 4);
-        assertNodeValueEqual(testTree.child(0).child(0).value(1), 7);
-        assertNodeValueEqual(testTree.child(0).child(1).value(0), 15);
+        std::mt19937_64 generator(1);
+        std::vector<long long> input(100000);
+        for (long long& key : input) {
+            key = static_cast<long long>(generator());
+        }
+        std::vector<unsigned long long> unsignedInput(input.begin(), input.end());
         
-        assertNodeValueEqual(testTree.child(1).value(0), 20);
-        assertNodeValueEqual(testTree.child(1).child(0).value(0), 17);
-        assertNodeValueEqual(testTree.child(1).child(1).value(0), 23);
-        assertNodeValueEqual(testTree.child(1).child(1).value(1), 25);
-        assertSortedUniques(testTree, 9);
+        lab::learned_index<long long> index(input.begin(), input.end());
+        lab::learned_index<unsigned long long, 16> unsignedIndex(unsignedInput.begin(), unsignedInput.end());
+        std::sort(input.begin(), input.end());
+        std::sort(unsignedInput.begin(), unsignedInput.end());
+        
+        std::vector<long long> queries(input.begin(), input.begin() + 1000);
+        std::vector<unsigned long long> unsignedQueries(unsignedInput.begin(), unsignedInput.begin() + 1000);
+        for (int i = 0; i < 1000; ++i) {
+            queries.push_back(static_cast<long long>(generator()));
+            unsignedQueries.push_back(generator());
+        }
+        assertSameBounds(index, input, queries);
+        assertSameBounds(unsignedIndex, unsignedInput, unsignedQueries);
     }
     
-    // # twoLevelsFilledInsertRight
+    // Save and load
     {
-        //             20
-        //          /      \
-        //       10          25
-        //    /     \      /    \
-        // 4  7   15 17   23     27
-        DataTree testTree;
-        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25 });
-        testTree.insert(27);
-        assertNodeValueEqual(testTree.value(0), 20);
-        assertNodeValueEmpty(testTree.value(1));
-        assertNodeValueEqual(testTree.child(0).value(0), 10);
-        assertNodeValueEqual(testTree.child(0).child(0).value(0), 4);
-        assertNodeValueEqual(testTree.child(0).child(0).value(1), 7);
-        assertNodeValueEqual(testTree.child(0).child(1).value(0), 15);
-        assertNodeValueEqual(testTree.child(0).child(1).value(1), 17);
+        const std::string indexPath = "learned_index.bin";
+        std::vector<int> input = generateRandomInput(100000, 10000000);
+        IntIndex index(input.begin(), input.end());
+        index.save(indexPath);
+        
+        IntIndex loadedIndex = IntIndex::load(indexPath);
+        std::sort(input.begin(), input.end());
+        assertSameBounds(loadedIndex, input, std::vector<int>(input.begin(), input.begin() + 10000));
+        assert(loadedIndex.segments_count() == index.segments_count());
+        
+        // Another index type isn't accepted
+        bool thrown = false;
+        try {
+            lab::learned_index<int, 16>::load(indexPath);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+        
+        // Neither is a truncated file
+        {
+            std::ifstream file(indexPath, std::ios::binary);
+            std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            std::ofstream truncatedFile(indexPath, std::ios::binary | std::ios::trunc);
+            truncatedFile.write(contents.data(), contents.size() - 1);
+        }
+        thrown = false;
+        try {
+            IntIndex::load(indexPath);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+        
+        IntIndex emptyIndex;
+        emptyIndex.save(indexPath);
+        IntIndex loadedEmptyIndex = IntIndex::load(indexPath);
+        assert(loadedEmptyIndex.empty() && loadedEmptyIndex.find(1) == loadedEmptyIndex.end());
+        
+        std::remove(indexPath.c_str());
+    }
+}
+
+void runTwoThreeTreeMapBenchmark() {
+    using IntTree = lab::twothree_tree<int>;
+    using IntHashMap = lab::hash_map<int, long long>;
+    using IntTreeMap = lab::twothree_tree_map<int, long long>;
+    
+    std::vector<int> inputSizes { 100000, 1000000, 10000000 };
+    
+    std::cout << "size\tcontainer\tinsert\tlookup" << std::endl;
+    
+    for (int inputSize : inputSizes) {
+        std::vector<int> keys = generateRandomInput(inputSize, std::numeric_limits<int>::max());
+        std::vector<int> probes = generateRandomInput(1000000, inputSize - 1);
+        for (int& probe : probes) {
+            probe = keys[probe];
+        }
         
-        assertNodeValueEqual(testTree.child(1).value(0), 25);
-        assertNodeValueEqual(testTree.child(1).child(0).value(0), 23);
-        assertNodeValueEqual(testTree.child(1).child(1).value(0), 27);
-        assertSortedUniques(testTree, 9);
+        // Ordered keys with the payloads in a parallel hash map: two lookups
+        {
+            IntTree tree;
+            IntHashMap payloads;
+            auto insertDuration = runWithTimer([&]() {
+                for (int key : keys) {
+                    if (tree.insert(key).second)
+                        payloads[key] = key;
+                }
+            });
+            long long sum = 0;
+            auto lookupDuration = runWithTimer([&]() {
+                for (int probe : probes) {
+                    if (tree.find(probe) != tree.end())
+                        sum += payloads.find(probe)->second;
+                }
+            });
+            assert(sum != 0);
+            std::cout << inputSize << "\ttwothree_tree + hash_map\t" << insertDuration.count() << "\t" << lookupDuration.count() << std::endl;
+        }
+        
+        {
+            IntTreeMap treeMap;
+            auto insertDuration = runWithTimer([&]() {
+                for (int key : keys) {
+                    treeMap.try_emplace(key, key);
+                }
+            });
+            long long sum = 0;
+            auto lookupDuration = runWithTimer([&]() {
+                for (int probe : probes) {
+                    auto pos = treeMap.find(probe);
+                    if (pos != treeMap.end())
+                        sum += pos->second;
+                }
+            });
+            assert(sum != 0);
+            std::cout << inputSize << "\ttwothree_tree_map\t" << insertDuration.count() << "\t" << lookupDuration.count() << std::endl;
+        }
     }
+}
+
+void runPoolAllocatorBenchmark() {
+    using PoolTree = lab::twothree_tree<int>;
+    using StdTree = lab::twothree_tree<int, std::less<int>, std::allocator<int>>;
     
-    // # eraseTest1 - removing last value from tree
-    {
-        DataTree testTree;
-        testTree.insert(16);
-        testTree.erase(16);
-        assert(testTree.empty());
-    }
+    std::vector<int> inputSizes { 100000, 1000000, 10000000 };
     
-    // # eraseTest2 - removing last but one value from tree
-    {
-        DataTree testTree;
-        testTree.insert({ 16, 17 });
-        testTree.erase(16);
-        assertNodeValueEqual(testTree.value(0), 17);
-        assertNodeValueEmpty(testTree.value(1));
-        assertSortedUniques(testTree, 1);
-    }
+    std::cout << "size\tinsert (std)\tinsert (pool)\tclear (std)\tclear (pool)\trelease_all (pool)" << std::endl;
     
-    // # eraseTest3 - case 1, simple
-    {
-        //    5
-        //  3   7
-        DataTree testTree;
-        testTree.insert({ 3, 5, 7 });
-        testTree.erase(7);
-        assertNodeValueEqual(testTree.value(0), 3);
-        assertNodeValueEqual(testTree.value(1), 5);
-        assertSortedUniques(testTree, 2);
+    for (int inputSize : inputSizes) {
+        std::vector<int> inputVec = generateRandomInput(inputSize, std::numeric_limits<int>::max());
+        
+        StdTree stdTree;
+        auto stdInsertDuration = runWithTimer([&]() {
+            stdTree.insert(inputVec.begin(), inputVec.end());
+        });
+        auto stdClearDuration = runWithTimer([&]() {
+            stdTree.clear();
+        });
+        
+        PoolTree poolTree;
+        auto poolInsertDuration = runWithTimer([&]() {
+            poolTree.insert(inputVec.begin(), inputVec.end());
+        });
+        auto poolClearDuration = runWithTimer([&]() {
+            poolTree.clear();
+        });
+        
+        poolTree.insert(inputVec.begin(), inputVec.end());
+        auto poolReleaseDuration = runWithTimer([&]() {
+            poolTree.release_all();
+        });
+        
+        std::cout << inputSize << "\t" << stdInsertDuration.count() << "\t" << poolInsertDuration.count()
+                  << "\t" << stdClearDuration.count() << "\t" << poolClearDuration.count()
+                  << "\t" << poolReleaseDuration.count() << std::endl;
     }
+}
+
+void runTwoThreeTreeBulkLoadBenchmark() {
+    using IntTree = lab::twothree_tree<int>;
     
-    // # eraseTest4 - case 1b+1a
-    {
-        //       4
-        //    2      6
-        // 1    3  5    7
+    std::vector<int> inputSizes { 1000000, 10000000, 30000000 };
+    
+    std::cout << "size\tinsert (sorted)\tbulk_load (sorted)\tbulk_load (random)\tbulk_load 0.5 (sorted)" << std::endl;
+    
+    for (int inputSize : inputSizes) {
+        std::vector<int> sortedVec(inputSize);
+        std::iota(sortedVec.begin(), sortedVec.end(), 0);
+        std::vector<int> randomVec = generateRandomInput(inputSize, std::numeric_limits<int>::max());
         
-        //        4 6
-        //      /  |  \
-        //   1 2   5    7
-        DataTree testTree;
-        testTree.insert({ 4, 3, 6, 7, 5, 2, 1 });
-        testTree.erase(3);
-        assertNodeValueEqual(testTree.value(0), 4);
-        assertNodeValueEqual(testTree.value(1), 6);
-        assertNodeValueEqual(testTree.child(0).value(0), 1);
-        assertNodeValueEqual(testTree.child(0).value(1), 2);
-        assertNodeValueEqual(testTree.child(1).value(0), 5);
-        assertNodeValueEqual(testTree.child(2).value(0), 7);
-        assertSortedUniques(testTree, 6);
+        IntTree testTree;
+        auto insertDuration = runWithTimer([&]() {
+            testTree.insert(sortedVec.begin(), sortedVec.end());
+        });
+        testTree.release_all();
+        
+        auto bulkLoadDuration = runWithTimer([&]() {
+            testTree.bulk_load(sortedVec.begin(), sortedVec.end());
+        });
+        testTree.release_all();
+        
+        auto randomBulkLoadDuration = runWithTimer([&]() {
+            testTree.bulk_load(randomVec.begin(), randomVec.end());
+        });
+        testTree.release_all();
+        
+        auto halfFilledDuration = runWithTimer([&]() {
+            testTree.bulk_load(sortedVec.begin(), sortedVec.end(), 0.5f);
+        });
+        testTree.release_all();
+        
+        std::cout << inputSize << "\t" << insertDuration.count() << "\t" << bulkLoadDuration.count()
+                  << "\t" << randomBulkLoadDuration.count() << "\t" << halfFilledDuration.count() << std::endl;
     }
+}
+
+void runTwoThreeTreeRangeBenchmark() {
+    using IntTree = lab::twothree_tree<int>;
     
-    // # eraseTest5 - case 2, simple
-    {
-        //     5
-        //  3    7 9
-        DataTree testTree;
-        testTree.insert({ 3, 5, 7, 9 });
-        testTree.erase(3);
-        assertNodeValueEqual(testTree.value(0), 7);
-        assertNodeValueEmpty(testTree.value(1));
-        assertNodeValueEqual(testTree.child(0).value(0), 5);
-        assertNodeValueEqual(testTree.child(1).value(0), 9);
-        assertSortedUniques(testTree, 3);
+    const int QueriesCount = 100000;
+    const int WindowSize = 1000;
+    std::vector<int> inputSizes { 1000000, 10000000 };
+    
+    std::cout << "size\titeration\trange scans (" << QueriesCount << " x " << WindowSize << ")" << std::endl;
+    
+    for (int inputSize : inputSizes) {
+        std::vector<int> inputVec(inputSize);
+        std::iota(inputVec.begin(), inputVec.end(), 0);
+        IntTree testTree(inputVec.begin(), inputVec.end(), 0.75f);
+        
+        long long sum = 0;
+        auto iterationDuration = runWithTimer([&]() {
+            for (int value : testTree) {
+                sum += value;
+            }
+        });
+        
+        std::vector<int> windowStarts = generateRandomInput(QueriesCount, inputSize - WindowSize);
+        auto rangeDuration = runWithTimer([&]() {
+            for (int low : windowStarts) {
+                testTree.range(low, low + WindowSize, [&sum](int value) { sum += value; });
+            }
+        });
+        
+        assert(sum != 0);
+        std::cout << inputSize << "\t" << iterationDuration.count() << "\t" << rangeDuration.count() << std::endl;
     }
+}
+
+void runConcurrentTwoThreeTreeBenchmark() {
+    using IntTree = lab::concurrent_twothree_tree<int>;
+    using LockedTree = lab::twothree_tree<int>;
     
-    // # eraseTest6 - case 2a
-    {
-        //         4
-        //    2        6,9
-        // 1    3   5   7  11
+    const int KeysRange = 1 << 20;
+    const int OpsPerThread = 500000;
+    std::vector<int> threadCounts { 1, 2, 4, 8, 16 };
+    std::vector<int> readPercents { 90, 50 };
+    
+    for (int readPercent : readPercents) {
+        std::cout << "--- " << readPercent << "% reads, " << 100 - readPercent << "% writes ---" << std::endl;
+        std::cout << "threads\tconcurrent (Mops/s)\tshared_spin_lock (Mops/s)" << std::endl;
         
-        //         6
-        //     4         9
-        // 1,2   5     7   11
-        DataTree testTree;
-        testTree.insert({ 4, 3, 6, 7, 5, 2, 1, 9, 11 });
-        testTree.erase(3);
-        assertNodeValueEqual(testTree.value(0), 6);
-        assertNodeValueEqual(testTree.child(0).value(0), 4);
-        assertNodeValueEqual(testTree.child(0).child(0).value(0), 1);
-        assertNodeValueEqual(testTree.child(0).child(0).value(1), 2);
-        assertNodeValueEqual(testTree.child(0).child(1).value(0), 5);
-        assertNodeValueEqual(testTree.child(1).value(0), 9);
-        assertNodeValueEqual(testTree.child(1).child(0).value(0), 7);
-        assertNodeValueEqual(testTree.child(1).child(1).value(0), 11);
-        assertSortedUniques(testTree, 8);
+        for (int threadsCount : threadCounts) {
+            std::vector<std::vector<int>> threadKeys;
+            for (int t = 0; t < threadsCount; ++t) {
+                threadKeys.push_back(generateRandomInput(OpsPerThread, KeysRange));
+            }
+            
+            IntTree testTree;
+            for (int i = 0; i < KeysRange; i += 2) {
+                testTree.insert(i);
+            }
+            
+            auto concurrentDuration = runWithTimer([&]() {
+                std::vector<std::thread> threads;
+                
+                for (int t = 0; t < threadsCount; ++t) {
+                    threads.emplace_back([&testTree, &threadKeys, t, readPercent]() {
+                        int opIdx = 0;
+                        
+                        for (int key : threadKeys[t]) {
+                            if (opIdx++ % 100 < readPercent) {
+                                testTree.contains(key);
+                            } else if (key % 2 == 0) {
+                                testTree.erase(key);
+                            } else {
+                                testTree.insert(key);
+                            }
+                        }
+                    });
+                }
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+            });
+            
+            LockedTree lockedTree;
+            lab::shared_spin_lock treeLock;
+            for (int i = 0; i < KeysRange; i += 2) {
+                lockedTree.insert(i);
+            }
+            
+            auto lockedDuration = runWithTimer([&]() {
+                std::vector<std::thread> threads;
+                
+                for (int t = 0; t < threadsCount; ++t) {
+                    threads.emplace_back([&lockedTree, &treeLock, &threadKeys, t, readPercent]() {
+                        int opIdx = 0;
+                        
+                        for (int key : threadKeys[t]) {
+                            if (opIdx++ % 100 < readPercent) {
+                                treeLock.lock_shared();
+                                lockedTree.find(key);
+                                treeLock.unlock_shared();
+                            } else {
+                                treeLock.lock();
+                                if (key % 2 == 0)
+                                    lockedTree.erase(key);
+                                else
+                                    lockedTree.insert(key);
+                                treeLock.unlock();
+                            }
+                        }
+                    });
+                }
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+            });
+            
+            double concurrentMops = threadsCount * (double)OpsPerThread / concurrentDuration.count() / 1000.0;
+            double lockedMops = threadsCount * (double)OpsPerThread / lockedDuration.count() / 1000.0;
+            std::cout << threadsCount << "\t" << concurrentMops << "\t" << lockedMops << std::endl;
+        }
     }
+}
 
-    // # eraseTest7 - case 3, erase from left
-    {
-        //              16,24
-        //    8           21          29
-        // 1     12    20    22     28   30
-        DataTree testTree;
-        testTree.insert({ 16, 12, 24, 28, 20, 8, 1 });
-        testTree.insert({ 21, 29, 22, 30 });
-        //               24
-        //       16,21          29
-        //   1,8   20  22     28   30
-        testTree.erase(12);
-        assertNodeValueEqual(testTree.value(0), 24);
-        assertNodeValueEmpty(testTree.value(1));
-        assertNodeValueEqual(testTree.child(0).value(0), 16);
-        assertNodeValueEqual(testTree.child(0).value(1), 21);
-        assertNodeValueEqual(testTree.child(0).child(0).value(0), 1);
-        assertNodeValueEqual(testTree.child(0).child(0).value(1), 8);
-        assertSortedUniques(testTree, 10);
+void runPersistentTwoThreeTreeBenchmark() {
+    using IntTree = lab::twothree_tree<int>;
+    using PersistentTree = lab::persistent_twothree_tree<int>;
+    
+    const int ReportsCount = 100;
+    const int WritesPerReport = 10000;
+    std::vector<int> inputSizes { 100000, 1000000 };
+    
+    std::cout << "size\tcopy per report\tsnapshot per report\tinserts (no snapshots)\tinserts (live snapshot)" << std::endl;
+    
+    for (int inputSize : inputSizes) {
+        std::vector<int> inputVec = generateRandomInput(inputSize, std::numeric_limits<int>::max());
+        std::vector<int> writes = generateRandomInput(ReportsCount * WritesPerReport, std::numeric_limits<int>::max());
+        long long sum = 0;
+        
+        // Current practice: every report copies the tree
+        IntTree testTree(inputVec.begin(), inputVec.end());
+        auto copyDuration = runWithTimer([&]() {
+            for (int report = 0; report < ReportsCount; ++report) {
+                IntTree reportTree(testTree.begin(), testTree.end());
+                sum += *reportTree.begin();
+                
+                for (int i = report * WritesPerReport; i < (report + 1) * WritesPerReport; ++i) {
+                    testTree.insert(writes[i]);
+                }
+            }
+        });
+        
+        PersistentTree persistentTree;
+        for (int value : inputVec) {
+            persistentTree.insert(value);
+        }
+        auto snapshotDuration = runWithTimer([&]() {
+            for (int report = 0; report < ReportsCount; ++report) {
+                auto snapshot = persistentTree.snapshot();
+                sum += *snapshot.begin();
+                
+                for (int i = report * WritesPerReport; i < (report + 1) * WritesPerReport; ++i) {
+                    persistentTree.insert(writes[i]);
+                }
+            }
+        });
+        
+        // Write cost: nodes changed in place vs path copying under a live snapshot
+        PersistentTree plainTree;
+        auto plainInsertDuration = runWithTimer([&]() {
+            for (int value : inputVec) {
+                plainTree.insert(value);
+            }
+        });
+        
+        PersistentTree snapshottedTree;
+        auto snapshotInsertDuration = runWithTimer([&]() {
+            for (size_t i = 0; i < inputVec.size(); ++i) {
+                auto snapshot = snapshottedTree.snapshot();
+                snapshottedTree.insert(inputVec[i]);
+            }
+        });
+        
+        assert(sum != 0);
+        std::cout << inputSize << "\t" << copyDuration.count() << "\t" << snapshotDuration.count()
+                  << "\t" << plainInsertDuration.count() << "\t" << snapshotInsertDuration.count() << std::endl;
     }
+}
+
+void runTwoThreeTreeSetOperationsBenchmark() {
+    using IntTree = lab::twothree_tree<int>;
     
-    // # eraseTest8 - case 3, erase from middle
-    {
-        //              16,24
-        //    8           21          29
-        // 1     12    20    22     28   30
-        DataTree testTree;
-        testTree.insert({ 16, 12, 24, 28, 20, 8, 1 });
-        testTree.insert({ 21, 29, 22, 30 });
-        //                24
-        //     8,16              29
-        // 1    12  20,21     28    30
-        testTree.erase(22);
-        assertNodeValueEqual(testTree.value(0), 24);
-        assertNodeValueEmpty(testTree.value(1));
-        assertNodeValueEqual(testTree.child(0).value(0), 8);
-        assertNodeValueEqual(testTree.child(0).value(1), 16);
-        assertNodeValueEqual(testTree.child(0).child(2).value(0), 20);
-        assertNodeValueEqual(testTree.child(0).child(2).value(1), 21);
-        assertSortedUniques(testTree, 10);
+    const int LargeSize = 1000000;
+    std::vector<int> smallSizes { 1000, 100000, 1000000 };
+    unsigned threadsCount = std::max(1u, std::thread::hardware_concurrency());
+    
+    std::vector<int> largeInput = generateRandomInput(LargeSize, std::numeric_limits<int>::max());
+    
+    std::cout << "large\tsmall\tinserts\tset_union (1 thread)\tset_union (" << threadsCount << " threads)"
+              << "\tset_difference (1 thread)\tcopy at the key\tsplit" << std::endl;
+    
+    for (int smallSize : smallSizes) {
+        std::vector<int> smallInput = generateRandomInput(smallSize, std::numeric_limits<int>::max());
+        
+        // Current practice: every element of the smaller tree is inserted into the larger one
+        IntTree insertTree(largeInput.begin(), largeInput.end()), insertOther(smallInput.begin(), smallInput.end());
+        auto insertDuration = runWithTimer([&]() {
+            for (int value : insertOther) {
+                insertTree.insert(value);
+            }
+        });
+        
+        IntTree unionTree(largeInput.begin(), largeInput.end()), unionOther(smallInput.begin(), smallInput.end());
+        auto unionDuration = runWithTimer([&]() {
+            unionTree.set_union(unionOther, 1);
+        });
+        assert(unionTree.size() == insertTree.size());
+        
+        IntTree parallelTree(largeInput.begin(), largeInput.end()), parallelOther(smallInput.begin(), smallInput.end());
+        auto parallelDuration = runWithTimer([&]() {
+            parallelTree.set_union(parallelOther, threadsCount);
+        });
+        assert(parallelTree.size() == insertTree.size());
+        
+        IntTree differenceTree(largeInput.begin(), largeInput.end()), differenceOther(smallInput.begin(), smallInput.end());
+        auto differenceDuration = runWithTimer([&]() {
+            differenceTree.set_difference(differenceOther, 1);
+        });
+        
+        // Cutting the merged tree at the median of the smaller input
+        int key = smallInput[smallInput.size() / 2];
+        IntTree copyTree;
+        auto copyDuration = runWithTimer([&]() {
+            for (auto it = insertTree.lower_bound(key); it != insertTree.end(); ++it) {
+                copyTree.insert(*it);
+            }
+        });
+        
+        IntTree splitTree;
+        auto splitDuration = runWithTimer([&]() {
+            splitTree = unionTree.split(key);
+        });
+        assert(splitTree.size() == copyTree.size());
+        
+        std::cout << LargeSize << "\t" << smallSize << "\t" << insertDuration.count() << "\t" << unionDuration.count()
+                  << "\t" << parallelDuration.count() << "\t" << differenceDuration.count()
+                  << "\t" << copyDuration.count() << "\t" << splitDuration.count() << std::endl;
     }
+}
+
+void runTwoThreeTreeHintedInsertBenchmark() {
+    using IntTree = lab::twothree_tree<int>;
     
-    // # eraseTest9 - case 3, erase from right
-    {
-        //              16,24
-        //    8           21          29
-        // 1     12    20    22     28   30
-        DataTree testTree;
-        testTree.insert({ 16, 12, 24, 28, 20, 8, 1 });
-        testTree.insert({ 21, 29, 22, 30 });
-        //           16
-        //    8               21,24
-        // 1     12       20   22   29,30
-        testTree.erase(28);
-        assertNodeValueEqual(testTree.value(0), 16);
-        assertNodeValueEmpty(testTree.value(1));
-        assertNodeValueEqual(testTree.child(1).value(0), 21);
-        assertNodeValueEqual(testTree.child(1).value(1), 24);
-        assertNodeValueEqual(testTree.child(1).child(0).value(0), 20);
-        assertNodeValueEqual(testTree.child(1).child(1).value(0), 22);
-        assertNodeValueEqual(testTree.child(1).child(2).value(0), 29);
-        assertNodeValueEqual(testTree.child(1).child(2).value(1), 30);
-        assertSortedUniques(testTree, 10);
+    std::vector<int> inputSizes { 100000, 1000000, 10000000 };
+    
+    std::cout << "size\tinput\tinsert\tinsert (hint)\tinsert (end() hint)" << std::endl;
+    
+    for (int inputSize : inputSizes) {
+        // Timestamps arriving nearly in order, and the same values shuffled
+        std::vector<int> nearlySorted(inputSize);
+        for (int i = 0; i < inputSize; ++i) {
+            nearlySorted[i] = i * 8 + generateRandomInt(16);
+        }
+        std::vector<int> shuffled(nearlySorted);
+        std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1));
+        
+        for (const std::vector<int>* input : { &nearlySorted, &shuffled }) {
+            IntTree plainTree;
+            auto plainDuration = runWithTimer([&]() {
+                for (int value : *input) {
+                    plainTree.insert(value);
+                }
+            });
+            
+            IntTree hintTree;
+            auto hintDuration = runWithTimer([&]() {
+                IntTree::iterator hint = hintTree.end();
+                for (int value : *input) {
+                    hint = hintTree.insert(hint, value);
+                }
+            });
+            
+            IntTree endHintTree;
+            auto endHintDuration = runWithTimer([&]() {
+                for (int value : *input) {
+                    endHintTree.insert(endHintTree.end(), value);
+                }
+            });
+            
+            assert(hintTree.size() == plainTree.size() && endHintTree.size() == plainTree.size());
+            std::cout << inputSize << "\t" << (input == &nearlySorted ? "nearly sorted" : "shuffled") << "\t" << plainDuration.count()
+                      << "\t" << hintDuration.count() << "\t" << endHintDuration.count() << std::endl;
+        }
     }
+}
+
+void runStaticSearchTreeBenchmark() {
+    using IntTree = lab::twothree_tree<int>;
+    using EytzingerTree = lab::static_search_tree<int>;
+    using VebTree = lab::static_search_tree<int, std::less<int>, lab::van_emde_boas_layout>;
     
+    const int QueriesCount = 10000000;
+    std::vector<int> inputSizes { 1000, 100000, 1000000, 10000000 };
     
-    // ______X______
+    std::cout << "size\tstd::lower_bound\ttwothree_tree::find\teytzinger find\tveb find\t(" << QueriesCount << " queries)" << std::endl;
     
-    // # eraseTest3 - ??
-    {
-        //              16
-        //         /         \
-        //      10            20 24
-        //    /    \       /    |     \
-        // 4  7     15   17   22 23   25 27
+    for (int inputSize : inputSizes) {
+        std::vector<int> sortedInput = generateRandomInput(inputSize, std::numeric_limits<int>::max());
+        lab::intro_sort(sortedInput.begin(), sortedInput.end(), std::less<int>{});
+        sortedInput.erase(std::unique(sortedInput.begin(), sortedInput.end()), sortedInput.end());
         
-        //              17
-        //         /         \
-        //      10            20 24
-        //    /    \       /    |     \
-        // 4  7     10    _   22 23   25 27
-        DataTree testTree;
-        testTree.insert({ 10, 15, 4, 20, 7, 23, 17, 25, 16, 24, 22, 27 });
-        testTree.erase(16);
-        assertSortedUniques(testTree, 11);
+        // Half of the queries are present
+        std::vector<int> queries = generateRandomInput(QueriesCount, std::numeric_limits<int>::max());
+        for (int i = 0; i < QueriesCount; i += 2) {
+            queries[i] = sortedInput[queries[i] % sortedInput.size()];
+        }
+        
+        long long expectedFound = 0, found = 0;
+        auto binarySearchDuration = runWithTimer([&]() {
+            for (int query : queries) {
+                auto pos = std::lower_bound(sortedInput.begin(), sortedInput.end(), query);
+                expectedFound += pos != sortedInput.end() && *pos == query;
+            }
+        });
+        
+        IntTree testTree(sortedInput.begin(), sortedInput.end());
+        found = 0;
+        auto treeDuration = runWithTimer([&]() {
+            for (int query : queries) {
+                found += testTree.find(query) != testTree.end();
+            }
+        });
+        assert(found == expectedFound);
+        
+        EytzingerTree eytzingerTree(sortedInput.begin(), sortedInput.end());
+        found = 0;
+        auto eytzingerDuration = runWithTimer([&]() {
+            for (int query : queries) {
+                found += eytzingerTree.find(query) != eytzingerTree.end();
+            }
+        });
+        assert(found == expectedFound);
+        
+        VebTree vebTree(sortedInput.begin(), sortedInput.end());
+        found = 0;
+        auto vebDuration = runWithTimer([&]() {
+            for (int query : queries) {
+                found += vebTree.find(query) != vebTree.end();
+            }
+        });
+        
+        assert(found == expectedFound);
+        std::cout << inputSize << "\t" << binarySearchDuration.count() << "\t" << treeDuration.count()
+                  << "\t" << eytzingerDuration.count() << "\t" << vebDuration.count() << std::endl;
     }
+}
+
+void runLearnedIndexBenchmark() {
+    using IntTree = lab::twothree_tree<int>;
+    using EytzingerTree = lab::static_search_tree<int>;
+    using VebTree = lab::static_search_tree<int, std::less<int>, lab::van_emde_boas_layout>;
     
-    // #3 Random insertions and erasures
-    while (true) {
-        DataTree testTree;
-        std::vector<int> randomIntVec = generateRandomInput(30, 30); // 1000000
-        int uniquesInserted = 0;
+    const int QueriesCount = 10000000;
+    std::vector<int> inputSizes { 100000, 1000000, 10000000 };
+    
+    for (int inputSize : inputSizes) {
+        // Keys of the radix sort pipeline, half of the queries are present
+        std::vector<int> sortedInput = generateRandomInput(inputSize, std::numeric_limits<int>::max());
+        lab::radix_sort<std::vector<int>::iterator, lab::DefaultKeyAccessor<int>, 1024>(sortedInput.begin(), sortedInput.end());
         
-        for (auto& value : randomIntVec) {
-            auto result = testTree.insert(value);
-            
-            if (result.second)
-                ++uniquesInserted;
+        std::vector<int> queries = generateRandomInput(QueriesCount, std::numeric_limits<int>::max());
+        for (int i = 0; i < QueriesCount; i += 2) {
+            queries[i] = sortedInput[queries[i] % sortedInput.size()];
         }
-        assertSortedUniques(testTree, uniquesInserted);
         
-        int valueToErase = randomIntVec.at(generateRandomInt(static_cast<int>(randomIntVec.size()-1)));
-        testTree.erase(valueToErase);
-        assertSortedUniques(testTree, uniquesInserted-1);
+        std::cout << "--- " << inputSize << " keys, " << QueriesCount << " queries ---" << std::endl;
+        std::cout << "structure\tmemory (bytes)\tindex memory (bytes)\tfind (ms)" << std::endl;
+        
+        long long expectedFound = 0;
+        for (int query : queries) {
+            expectedFound += std::binary_search(sortedInput.begin(), sortedInput.end(), query);
+        }
+        
+        // Every lookup goes through a std::function: the same call overhead for all of them
+        auto measure = [&](const char* name, std::size_t memoryUsage, std::size_t indexMemoryUsage, std::function<bool(int)> find) {
+            long long found = 0;
+            auto duration = runWithTimer([&]() {
+                for (int query : queries) {
+                    found += find(query);
+                }
+            });
+            assert(found == expectedFound);
+            std::cout << name << "\t" << memoryUsage << "\t" << indexMemoryUsage << "\t" << duration.count() << std::endl;
+        };
+        
+        measure("std::lower_bound", sortedInput.size() * sizeof(int), 0, [&sortedInput](int query) {
+            auto pos = std::lower_bound(sortedInput.begin(), sortedInput.end(), query);
+            return pos != sortedInput.end() && *pos == query;
+        });
+        {
+            IntTree testTree(sortedInput.begin(), sortedInput.end());
+            lab::twothree_tree_stats stats = testTree.stats();
+            measure("twothree_tree", stats.memory_usage, stats.memory_usage, [&testTree](int query) { return testTree.find(query) != testTree.end(); });
+        }
+        {
+            EytzingerTree eytzingerTree(sortedInput.begin(), sortedInput.end());
+            measure("eytzinger", eytzingerTree.memory_usage(), eytzingerTree.memory_usage() - eytzingerTree.size() * sizeof(int),
+                    [&eytzingerTree](int query) { return eytzingerTree.find(query) != eytzingerTree.end(); });
+            
+            VebTree vebTree(sortedInput.begin(), sortedInput.end());
+            measure("veb", vebTree.memory_usage(), vebTree.memory_usage() - vebTree.size() * sizeof(int),
+                    [&vebTree](int query) { return vebTree.find(query) != vebTree.end(); });
+        }
+        {
+            lab::learned_index<int, 16> index16(sortedInput.begin(), sortedInput.end());
+            measure("learned_index (eps 16)", index16.memory_usage(), index16.index_memory_usage(),
+                    [&index16](int query) { return index16.find(query) != index16.end(); });
+            
+            lab::learned_index<int, 64> index64(sortedInput.begin(), sortedInput.end());
+            measure("learned_index (eps 64)", index64.memory_usage(), index64.index_memory_usage(),
+                    [&index64](int query) { return index64.find(query) != index64.end(); });
+            
+            lab::learned_index<int, 256> index256(sortedInput.begin(), sortedInput.end());
+            measure("learned_index (eps 256)", index256.memory_usage(), index256.index_memory_usage(),
+                    [&index256](int query) { return index256.find(query) != index256.end(); });
+        }
     }
 }
 
 int main2(int argc, const char * argv[])
 {
 //    testHashMap();
+//    testMappedHashMap();
+//    testConcurrentHashMap();
+//    testLockFreeHashSet();
+//    testCuckooHashMap();
+//    testFilters();
+//    testBtree();
     testTwoThreeTree();
+//    testTwoThreeTreeMap();
+//    testPoolAllocator();
+//    testConcurrentTwoThreeTree();
+//    testPersistentTwoThreeTree();
+//    testStaticSearchTree();
+//    testLearnedIndex();
     return 0;
     
 //	runRadixSortBenchmark();
+//	runHashMapBatchBenchmark();
+//	runMappedHashMapBenchmark();
+//	runHashMapIterationBenchmark();
+//	runConcurrentHashMapBenchmark();
+//	runLockFreeHashSetBenchmark();
+//	runCuckooHashMapBenchmark();
+//	runFilterBenchmark();
+//	runBtreeBenchmark();
+//	runTwoThreeTreeBulkLoadBenchmark();
+//	runTwoThreeTreeRangeBenchmark();
+//	runTwoThreeTreeSetOperationsBenchmark();
+//	runTwoThreeTreeHintedInsertBenchmark();
+//	runConcurrentTwoThreeTreeBenchmark();
+//	runPersistentTwoThreeTreeBenchmark();
+//	runStaticSearchTreeBenchmark();
+//	runLearnedIndexBenchmark();
+//	runTwoThreeTreeMapBenchmark();
+//	runPoolAllocatorBenchmark();
 	
 //	runBenchmark([](int inputSize) { return generateRandomInput(inputSize, inputSize); });
 //	runBenchmark([](int inputSize) { return generateRandomInput(inputSize, (int)(3 + 0.00097f*(inputSize - 10))); });